@@ -0,0 +1,286 @@
+/*
+ * ACPI Table Discovery Implementation
+ */
+
+#include "acpi.h"
+#include "debug.h"
+
+/* Root System Description Pointer */
+struct acpi_rsdp {
+    char signature[8];           /* "RSD PTR " */
+    unsigned char checksum;      /* Covers the first 20 bytes */
+    char oem_id[6];
+    unsigned char revision;      /* 0 = ACPI 1.0, 2 = ACPI 2.0+ */
+    unsigned int rsdt_address;
+    /* ACPI 2.0+ */
+    unsigned int length;
+    unsigned long long xsdt_address;
+    unsigned char extended_checksum;
+    unsigned char reserved[3];
+} __attribute__((packed));
+
+/* MADT header */
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    unsigned int lapic_address;
+    unsigned int flags;
+} __attribute__((packed));
+
+/* MADT entry types */
+#define MADT_LAPIC            0
+#define MADT_IOAPIC           1
+#define MADT_ISO              2
+#define MADT_LAPIC_OVERRIDE   5
+#define MADT_X2APIC           9
+
+#define MADT_LAPIC_ENABLED    0x01
+
+struct madt_entry {
+    unsigned char type;
+    unsigned char length;
+} __attribute__((packed));
+
+struct madt_lapic {
+    struct madt_entry entry;
+    unsigned char processor_id;
+    unsigned char apic_id;
+    unsigned int flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+    struct madt_entry entry;
+    unsigned char id;
+    unsigned char reserved;
+    unsigned int address;
+    unsigned int gsi_base;
+} __attribute__((packed));
+
+struct madt_iso {
+    struct madt_entry entry;
+    unsigned char bus;           /* 0 = ISA */
+    unsigned char source;        /* ISA IRQ */
+    unsigned int gsi;
+    unsigned short flags;
+} __attribute__((packed));
+
+struct madt_lapic_override {
+    struct madt_entry entry;
+    unsigned short reserved;
+    unsigned long long address;
+} __attribute__((packed));
+
+struct madt_x2apic {
+    struct madt_entry entry;
+    unsigned short reserved;
+    unsigned int x2apic_id;
+    unsigned int flags;
+    unsigned int processor_uid;
+} __attribute__((packed));
+
+/* BIOS areas searched for the RSDP */
+#define BDA_EBDA_SEGMENT   0x40E
+#define BIOS_ROM_START     0xE0000
+#define BIOS_ROM_END       0x100000
+
+static struct acpi_rsdp* rsdp = 0;
+static struct acpi_madt_info madt_info;
+static int madt_valid = 0;
+
+/* Sum of all bytes (a valid table sums to 0) */
+static unsigned char acpi_checksum(const void* data, unsigned int length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned char sum = 0;
+
+    for (unsigned int i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static int acpi_signature_matches(const char* a, const char* b, unsigned int length) {
+    for (unsigned int i = 0; i < length; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Scan a physical range on 16-byte boundaries for the RSDP */
+static struct acpi_rsdp* acpi_scan_rsdp(unsigned int start, unsigned int end) {
+    for (unsigned int address = start; address + 20 <= end; address += 16) {
+        struct acpi_rsdp* candidate = (struct acpi_rsdp*)address;
+
+        if (acpi_signature_matches(candidate->signature, "RSD PTR ", 8) &&
+            acpi_checksum(candidate, 20) == 0) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+/* Find a table by signature in the RSDT or XSDT */
+struct acpi_sdt_header* acpi_find_table(const char* signature) {
+    struct acpi_sdt_header* root;
+    unsigned int entry_size;
+    unsigned int count;
+
+    if (rsdp == 0) {
+        return 0;
+    }
+
+    /* Prefer the XSDT if it is reachable with 32-bit addresses */
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 && (rsdp->xsdt_address >> 32) == 0) {
+        root = (struct acpi_sdt_header*)(unsigned int)rsdp->xsdt_address;
+        entry_size = 8;
+    } else {
+        root = (struct acpi_sdt_header*)rsdp->rsdt_address;
+        entry_size = 4;
+    }
+
+    if (acpi_checksum(root, root->length) != 0) {
+        return 0;
+    }
+
+    count = (root->length - sizeof(struct acpi_sdt_header)) / entry_size;
+    for (unsigned int i = 0; i < count; i++) {
+        const unsigned char* entry = (const unsigned char*)(root + 1) + i * entry_size;
+        struct acpi_sdt_header* table;
+
+        /* Tables above 4 GB are not reachable */
+        if (entry_size == 8 && *(const unsigned int*)(entry + 4) != 0) {
+            continue;
+        }
+        table = (struct acpi_sdt_header*)*(const unsigned int*)entry;
+
+        if (acpi_signature_matches(table->signature, signature, 4) &&
+            acpi_checksum(table, table->length) == 0) {
+            return table;
+        }
+    }
+    return 0;
+}
+
+/* Record an ISA interrupt source override */
+static void acpi_parse_iso(const struct madt_iso* iso) {
+    if (iso->bus != 0 || iso->source >= 16) {
+        return;
+    }
+    madt_info.isa_irqs[iso->source].gsi = iso->gsi;
+    madt_info.isa_irqs[iso->source].flags = iso->flags;
+    madt_info.override_count++;
+}
+
+/* Record an enabled CPU */
+static void acpi_add_cpu(unsigned int apic_id, unsigned int flags) {
+    if (!(flags & MADT_LAPIC_ENABLED) || madt_info.cpu_count >= ACPI_MAX_CPUS) {
+        return;
+    }
+    madt_info.cpu_apic_ids[madt_info.cpu_count++] = apic_id;
+}
+
+/* Walk the MADT entries */
+static int acpi_parse_madt(void) {
+    struct acpi_madt* madt = (struct acpi_madt*)acpi_find_table("APIC");
+    const unsigned char* entry;
+    const unsigned char* end;
+
+    if (madt == 0) {
+        return -1;
+    }
+
+    madt_info.lapic_address = madt->lapic_address;
+    madt_info.flags = madt->flags;
+    for (unsigned int irq = 0; irq < 16; irq++) {
+        madt_info.isa_irqs[irq].gsi = irq;
+        madt_info.isa_irqs[irq].flags = 0;  /* Conforms to the bus: ISA is edge, active high */
+    }
+
+    entry = (const unsigned char*)(madt + 1);
+    end = (const unsigned char*)madt + madt->header.length;
+    while (entry + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry* header = (const struct madt_entry*)entry;
+
+        if (header->length < sizeof(struct madt_entry) || entry + header->length > end) {
+            break;
+        }
+
+        switch (header->type) {
+            case MADT_LAPIC: {
+                const struct madt_lapic* lapic = (const struct madt_lapic*)entry;
+                acpi_add_cpu(lapic->apic_id, lapic->flags);
+                break;
+            }
+            case MADT_X2APIC: {
+                const struct madt_x2apic* x2apic = (const struct madt_x2apic*)entry;
+                acpi_add_cpu(x2apic->x2apic_id, x2apic->flags);
+                break;
+            }
+            case MADT_IOAPIC: {
+                const struct madt_ioapic* ioapic = (const struct madt_ioapic*)entry;
+                if (madt_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                    struct acpi_ioapic* out = &madt_info.ioapics[madt_info.ioapic_count++];
+                    out->id = ioapic->id;
+                    out->address = ioapic->address;
+                    out->gsi_base = ioapic->gsi_base;
+                }
+                break;
+            }
+            case MADT_ISO:
+                acpi_parse_iso((const struct madt_iso*)entry);
+                break;
+            case MADT_LAPIC_OVERRIDE: {
+                const struct madt_lapic_override* override = (const struct madt_lapic_override*)entry;
+                if ((override->address >> 32) == 0) {
+                    madt_info.lapic_address = (unsigned int)override->address;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        entry += header->length;
+    }
+
+    return 0;
+}
+
+/* Locate the ACPI tables and parse the MADT */
+int acpi_init(void) {
+    const volatile unsigned short* bda_ebda = (const volatile unsigned short*)BDA_EBDA_SEGMENT;
+    unsigned int ebda;
+
+    /* Hide the constant address from GCC, which treats pointers below 4 KB
+     * as invalid and warns about the dereference */
+    __asm__ ("" : "+r"(bda_ebda));
+    ebda = (unsigned int)*bda_ebda << 4;
+
+    /* The RSDP is in the first KB of the EBDA or in the BIOS ROM area */
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (rsdp == 0) {
+        rsdp = acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    }
+    if (rsdp == 0) {
+        debug_warn("acpi: RSDP not found");
+        return -1;
+    }
+
+    if (acpi_parse_madt() != 0) {
+        debug_warn("acpi: no MADT");
+        return -1;
+    }
+    madt_valid = 1;
+
+    debug_logf(LOG_INFO, "acpi: rev %u, %u CPU(s), %u I/O APIC(s), %u override(s), LAPIC at 0x%08x",
+               rsdp->revision, madt_info.cpu_count, madt_info.ioapic_count,
+               madt_info.override_count, madt_info.lapic_address);
+    return 0;
+}
+
+/* Parsed MADT */
+const struct acpi_madt_info* acpi_get_madt(void) {
+    return madt_valid ? &madt_info : 0;
+}
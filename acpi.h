@@ -0,0 +1,76 @@
+/*
+ * ACPI Table Discovery Header
+ *
+ * Finds the RSDP in the BIOS areas, walks the RSDT (or XSDT) and parses the
+ * MADT ("APIC" table), which lists the local APICs (one per CPU), the I/O
+ * APICs and the ISA interrupt source overrides (e.g. the PIT on IRQ 0 is
+ * usually wired to I/O APIC input 2).
+ *
+ * Tables are read through their physical addresses, which is fine as long
+ * as the low 4 GB are identity mapped.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#define ACPI_MAX_CPUS     16
+#define ACPI_MAX_IOAPICS  4
+
+/* MADT interrupt source override flags (MPS INTI) */
+#define ACPI_MADT_POLARITY_MASK   0x03
+#define ACPI_MADT_POLARITY_LOW    0x03
+#define ACPI_MADT_TRIGGER_MASK    0x0C
+#define ACPI_MADT_TRIGGER_LEVEL   0x0C
+
+/* MADT flags */
+#define ACPI_MADT_PCAT_COMPAT     0x01  /* Dual 8259 present */
+
+/* Common header of every system description table */
+struct acpi_sdt_header {
+    char signature[4];
+    unsigned int length;
+    unsigned char revision;
+    unsigned char checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    unsigned int oem_revision;
+    unsigned int creator_id;
+    unsigned int creator_revision;
+} __attribute__((packed));
+
+/* One I/O APIC */
+struct acpi_ioapic {
+    unsigned int id;
+    unsigned int address;    /* MMIO base */
+    unsigned int gsi_base;   /* First global system interrupt it serves */
+};
+
+/* Routing of one ISA IRQ */
+struct acpi_isa_irq {
+    unsigned int gsi;        /* I/O APIC input */
+    unsigned int flags;      /* ACPI_MADT_POLARITY_* / ACPI_MADT_TRIGGER_* */
+};
+
+/* What the MADT describes */
+struct acpi_madt_info {
+    unsigned int lapic_address;
+    unsigned int flags;                       /* ACPI_MADT_PCAT_COMPAT */
+    unsigned int cpu_count;
+    unsigned int cpu_apic_ids[ACPI_MAX_CPUS]; /* Enabled CPUs, BSP not necessarily first */
+    unsigned int ioapic_count;
+    struct acpi_ioapic ioapics[ACPI_MAX_IOAPICS];
+    struct acpi_isa_irq isa_irqs[16];         /* Identity mapping unless overridden */
+    unsigned int override_count;
+};
+
+/* Locate the ACPI tables and parse the MADT.
+ * Returns 0 on success, -1 if there is no usable MADT. */
+int acpi_init(void);
+
+/* Find a table by signature (0 if absent or acpi_init() failed) */
+struct acpi_sdt_header* acpi_find_table(const char* signature);
+
+/* Parsed MADT (valid after a successful acpi_init()) */
+const struct acpi_madt_info* acpi_get_madt(void);
+
+#endif /* ACPI_H */
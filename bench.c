@@ -0,0 +1,339 @@
+/*
+ * Microbenchmark Framework Implementation
+ *
+ * The core suite below covers the primitives everything else is built on:
+ * interrupt entry/exit, the serial and VGA output paths, the 8259 and the
+ * memory routines. Other modules add their own suites with
+ * bench_register().
+ */
+
+#include "bench.h"
+#include "bench_thresholds.h"
+#include "idt.h"
+#include "pic.h"
+#include "vga.h"
+#include "serial.h"
+#include "string.h"
+#include "ktime.h"
+#include "math64.h"
+#include "kprintf.h"
+#include "cpu.h"
+#include "io.h"
+#include "debug.h"
+
+/* System halt function (defined in boostrap.c) */
+extern void halt(void);
+
+/* ============================================================================
+ * Core Suite
+ * ============================================================================
+ */
+
+/* Interrupt round trip: int $n -> isr stub -> interrupt_dispatch -> iret */
+static void bench_nop_handler(struct trap_frame* frame) {
+    (void)frame;
+}
+
+static void bench_int_roundtrip(void) {
+    __asm__ volatile ("int %0" : : "i"(BENCH_VECTOR) : "memory");
+}
+
+/* Serial: each run queues one comment line (64 bytes) into an empty ring */
+#define BENCH_SERIAL_BYTES 64
+
+static void bench_serial_prepare(void) {
+    serial_flush();
+}
+
+static void bench_serial_putchar(void) {
+    serial_putchar('#');
+    for (unsigned int i = 1; i < BENCH_SERIAL_BYTES - 1; i++) {
+        serial_putchar('.');
+    }
+    serial_putchar('\n');
+}
+
+/* VGA: one full line (shadow update, row copy, cursor), and a clear */
+static const char bench_vga_line[VGA_WIDTH + 1] =
+    "bench: vga_puts throughput ...................................................\n";
+
+static void bench_vga_puts(void) {
+    vga_puts(bench_vga_line);
+}
+
+static void bench_vga_clear(void) {
+    vga_clear();
+}
+
+/* PIC: IRQ 7 (LPT1) is never unmasked, so masking it again changes nothing;
+ * EOI with nothing in service (interrupts are off) is a no-op for the PICs */
+static void bench_pic_mask(void) {
+    pic_disable_irq(7);
+}
+
+static void bench_pic_eoi(void) {
+    pic_send_eoi(8);
+}
+
+/* Memory routines on page-aligned buffers */
+#define BENCH_COPY_SIZE 4096
+
+static unsigned char bench_src[BENCH_COPY_SIZE] __attribute__((aligned(4096)));
+static unsigned char bench_dst[BENCH_COPY_SIZE] __attribute__((aligned(4096)));
+
+static void bench_memcpy_64(void) {
+    memcpy(bench_dst, bench_src, 64);
+}
+
+static void bench_memcpy_4k(void) {
+    memcpy(bench_dst, bench_src, BENCH_COPY_SIZE);
+}
+
+static void bench_memset_64(void) {
+    memset(bench_dst, 0x5A, 64);
+}
+
+static void bench_memset_4k(void) {
+    memset(bench_dst, 0x5A, BENCH_COPY_SIZE);
+}
+
+static const struct bench core_benches[] = {
+    { "int_roundtrip",  bench_int_roundtrip,  0, 0, 0, 0, BENCH_MAX_INT_ROUNDTRIP },
+    { "serial_putchar", bench_serial_putchar, bench_serial_prepare, BENCH_SERIAL_BYTES, 4, 64,
+      BENCH_MAX_SERIAL_PUTCHAR },
+    { "vga_puts",       bench_vga_puts,       0, VGA_WIDTH, 0, 0, BENCH_MAX_VGA_PUTS },
+    { "vga_clear",      bench_vga_clear,      0, VGA_WIDTH * VGA_HEIGHT * 2, 0, 0, BENCH_MAX_VGA_CLEAR },
+    { "pic_mask",       bench_pic_mask,       0, 0, 0, 0, BENCH_MAX_PIC_MASK },
+    { "pic_eoi",        bench_pic_eoi,        0, 0, 0, 0, BENCH_MAX_PIC_EOI },
+    { "memcpy_64",      bench_memcpy_64,      0, 64, 0, 0, BENCH_MAX_MEMCPY_64 },
+    { "memcpy_4k",      bench_memcpy_4k,      0, BENCH_COPY_SIZE, 0, 0, BENCH_MAX_MEMCPY_4K },
+    { "memset_64",      bench_memset_64,      0, 64, 0, 0, BENCH_MAX_MEMSET_64 },
+    { "memset_4k",      bench_memset_4k,      0, BENCH_COPY_SIZE, 0, 0, BENCH_MAX_MEMSET_4K },
+};
+
+/* ============================================================================
+ * Framework
+ * ============================================================================
+ */
+
+struct bench_suite {
+    const struct bench* benches;
+    unsigned int count;
+};
+
+static struct bench_suite suites[BENCH_MAX_SUITES] = {
+    { core_benches, sizeof(core_benches) / sizeof(core_benches[0]) },
+};
+static unsigned int suite_count = 1;
+
+struct bench_sampler_group {
+    const struct bench_sampler* samplers;
+    unsigned int count;
+};
+
+static struct bench_sampler_group sampler_groups[BENCH_MAX_SAMPLERS];
+static unsigned int sampler_group_count = 0;
+
+static unsigned int samples[BENCH_MAX_SAMPLES];
+static unsigned int tsc_overhead = 0;
+
+/* Register a suite */
+int bench_register(const struct bench* benches, unsigned int count) {
+    if (suite_count >= BENCH_MAX_SUITES) {
+        return -1;
+    }
+    suites[suite_count].benches = benches;
+    suites[suite_count].count = count;
+    suite_count++;
+    return 0;
+}
+
+/* Register a group of samplers */
+int bench_register_sampler(const struct bench_sampler* samplers, unsigned int count) {
+    if (sampler_group_count >= BENCH_MAX_SAMPLERS) {
+        return -1;
+    }
+    sampler_groups[sampler_group_count].samplers = samplers;
+    sampler_groups[sampler_group_count].count = count;
+    sampler_group_count++;
+    return 0;
+}
+
+/* Sort samples (insertion sort: the arrays are small) */
+static void bench_sort(unsigned int* values, unsigned int count) {
+    for (unsigned int i = 1; i < count; i++) {
+        unsigned int value = values[i];
+        unsigned int j = i;
+        while (j > 0 && values[j - 1] > value) {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+}
+
+/* Cost of back-to-back RDTSCs: the minimum over a few hundred tries */
+static unsigned int bench_measure_overhead(void) {
+    unsigned int best = ~0u;
+
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned long long start = rdtsc();
+        unsigned long long end = rdtsc();
+        if (end - start < best) {
+            best = (unsigned int)(end - start);
+        }
+    }
+    return best;
+}
+
+/* Sort `count` samples and fill in `result` from them */
+static void bench_summarize(unsigned int count, unsigned int bytes, unsigned int max_median,
+                            struct bench_result* result) {
+    unsigned int khz = ktime_tsc_khz();
+
+    result->samples = count;
+    result->mb_per_sec = 0;
+    if (count == 0) {
+        result->min = 0;
+        result->median = 0;
+        result->p99 = 0;
+        result->passed = 1;
+        return;
+    }
+
+    bench_sort(samples, count);
+    result->min = samples[0];
+    result->median = samples[count / 2];
+    result->p99 = samples[(count * 99) / 100];
+    result->passed = max_median == 0 || result->median <= max_median;
+
+    /* bytes per median run at khz * 1000 cycles per second, in MB/s */
+    if (bytes != 0 && khz != 0 && result->median != 0) {
+        result->mb_per_sec = (unsigned int)div_u64(div_u64((unsigned long long)bytes * khz,
+                                                           result->median), 1000);
+    }
+}
+
+/* Run one benchmark */
+void bench_run(const struct bench* bench, struct bench_result* result) {
+    unsigned int warmup = bench->warmup ? bench->warmup : BENCH_WARMUP;
+    unsigned int count = bench->samples ? bench->samples : BENCH_SAMPLES;
+
+    if (count > BENCH_MAX_SAMPLES) {
+        count = BENCH_MAX_SAMPLES;
+    }
+
+    for (unsigned int i = 0; i < warmup; i++) {
+        if (bench->prepare) {
+            bench->prepare();
+        }
+        bench->run();
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned long long start, end, cycles;
+        unsigned int flags;
+
+        if (bench->prepare) {
+            bench->prepare();
+        }
+
+        flags = irq_save();
+        start = rdtsc();
+        bench->run();
+        end = rdtsc();
+        irq_restore(flags);
+
+        cycles = end - start;
+        cycles = cycles > tsc_overhead ? cycles - tsc_overhead : 0;
+        samples[i] = (cycles >> 32) ? 0xFFFFFFFFu : (unsigned int)cycles;
+    }
+
+    bench_summarize(count, bench->bytes, bench->max_median, result);
+}
+
+/* Run one sampler */
+static void bench_run_sampler(const struct bench_sampler* sampler, struct bench_result* result) {
+    unsigned int count = sampler->samples ? sampler->samples : BENCH_SAMPLES;
+
+    if (count > BENCH_MAX_SAMPLES) {
+        count = BENCH_MAX_SAMPLES;
+    }
+    count = sampler->sample(samples, count);
+    for (unsigned int i = 0; i < count; i++) {
+        samples[i] = samples[i] > tsc_overhead ? samples[i] - tsc_overhead : 0;
+    }
+    bench_summarize(count, 0, sampler->max_median, result);
+}
+
+/* Stream one result line and count it */
+static void bench_report(const char* name, unsigned int max_median, const struct bench_result* result,
+                         unsigned int* passed, unsigned int* failed) {
+    char line[160];
+
+    if (result->passed) {
+        (*passed)++;
+    } else {
+        (*failed)++;
+    }
+    ksnprintf(line, sizeof(line), "bench %s %u %u %u %u %u %u %s\n",
+              name, result->samples, result->min, result->median, result->p99,
+              max_median, result->mb_per_sec, result->passed ? "PASS" : "FAIL");
+    serial_puts(line);
+    serial_flush();
+}
+
+/* Run every registered benchmark and stream the results over serial */
+unsigned int bench_run_all(void) {
+    unsigned int passed = 0;
+    unsigned int failed = 0;
+    char line[160];
+
+    idt_set_handler(BENCH_VECTOR, bench_nop_handler);
+    for (unsigned int i = 0; i < BENCH_COPY_SIZE; i++) {
+        bench_src[i] = (unsigned char)i;
+    }
+    tsc_overhead = bench_measure_overhead();
+
+    serial_flush();
+    ksnprintf(line, sizeof(line), "# bench v1 tsc_khz=%u overhead=%u\n",
+              ktime_tsc_khz(), tsc_overhead);
+    serial_puts(line);
+
+    for (unsigned int s = 0; s < suite_count; s++) {
+        for (unsigned int b = 0; b < suites[s].count; b++) {
+            const struct bench* bench = &suites[s].benches[b];
+            struct bench_result result;
+
+            bench_run(bench, &result);
+            bench_report(bench->name, bench->max_median, &result, &passed, &failed);
+        }
+    }
+
+    for (unsigned int g = 0; g < sampler_group_count; g++) {
+        for (unsigned int b = 0; b < sampler_groups[g].count; b++) {
+            const struct bench_sampler* sampler = &sampler_groups[g].samplers[b];
+            struct bench_result result;
+
+            bench_run_sampler(sampler, &result);
+            bench_report(sampler->name, sampler->max_median, &result, &passed, &failed);
+        }
+    }
+
+    ksnprintf(line, sizeof(line), "# end bench passed=%u failed=%u\n", passed, failed);
+    serial_puts(line);
+    serial_flush();
+
+    idt_set_handler(BENCH_VECTOR, 0);
+    return failed;
+}
+
+/* Leave QEMU through isa-debug-exit */
+void bench_exit(unsigned int failed) {
+    debug_flush_log();
+    serial_flush();
+    outb(BENCH_EXIT_PORT, failed ? BENCH_EXIT_FAIL : BENCH_EXIT_PASS);
+
+    /* Still here: not running under QEMU with the exit device */
+    halt();
+}
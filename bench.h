@@ -0,0 +1,103 @@
+/*
+ * Microbenchmark Framework Header
+ *
+ * A benchmark times one operation: after `warmup` untimed runs it takes
+ * `samples` measurements of a single run each, bracketed by RDTSC, with
+ * interrupts disabled. The cost of the RDTSC pair itself is subtracted.
+ * From the samples we report the minimum, median and 99th percentile in
+ * TSC cycles, and the throughput for operations that move bytes.
+ *
+ * Each benchmark carries a pass limit for its median (bench_thresholds.h);
+ * informational ones (limit 0) always pass.
+ *
+ * Operations the framework cannot bracket from here - a system call made
+ * from ring 3, say - register a sampler instead, which takes its own
+ * RDTSC deltas; they are reported the same way.
+ * bench_run_all() runs every registered suite and streams the results
+ * over serial:
+ *
+ *   # bench v1 tsc_khz=<khz> overhead=<cycles>
+ *   bench <name> <samples> <min> <median> <p99> <limit> <MB/s> PASS|FAIL
+ *   # end bench passed=<n> failed=<n>
+ *
+ * Booting with "bench" on the kernel command line (`make bench`) runs the
+ * suites at the end of boot. It then leaves QEMU through the
+ * isa-debug-exit device with a status that tells pass from fail.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Most samples per benchmark */
+#define BENCH_MAX_SAMPLES  1024
+
+/* Defaults for a zero `warmup` / `samples` */
+#define BENCH_WARMUP       16
+#define BENCH_SAMPLES      256
+
+/* Most suites that can be registered */
+#define BENCH_MAX_SUITES   16
+
+/* Most sampler groups that can be registered */
+#define BENCH_MAX_SAMPLERS 8
+
+/* Vector used for the interrupt round-trip benchmark */
+#define BENCH_VECTOR       0xF2
+
+/* QEMU isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04):
+ * writing v makes QEMU exit with status (v << 1) | 1 */
+#define BENCH_EXIT_PORT    0xF4
+#define BENCH_EXIT_PASS    0     /* QEMU exits with 1 */
+#define BENCH_EXIT_FAIL    1     /* QEMU exits with 3 */
+
+/* One benchmark */
+struct bench {
+    const char* name;
+    void (*run)(void);           /* The timed operation */
+    void (*prepare)(void);       /* Untimed, before every run (optional) */
+    unsigned int bytes;          /* Bytes per run, for MB/s (0 = latency only) */
+    unsigned int warmup;         /* Untimed runs first (0 = BENCH_WARMUP) */
+    unsigned int samples;        /* Timed runs (0 = BENCH_SAMPLES) */
+    unsigned int max_median;     /* Pass limit for the median, cycles (0 = none) */
+};
+
+/* A benchmark that takes its own samples */
+struct bench_sampler {
+    const char* name;
+    /* Store up to `count` RDTSC deltas of one operation each (the RDTSC
+     * overhead is subtracted afterwards); returns how many were taken */
+    unsigned int (*sample)(unsigned int* samples, unsigned int count);
+    unsigned int samples;        /* Samples to ask for (0 = BENCH_SAMPLES) */
+    unsigned int max_median;     /* Pass limit for the median, cycles (0 = none) */
+};
+
+/* Result of one benchmark (cycles) */
+struct bench_result {
+    unsigned int samples;
+    unsigned int min;
+    unsigned int median;
+    unsigned int p99;
+    unsigned int mb_per_sec;     /* From the median (0 if no bytes or no TSC rate) */
+    int passed;
+};
+
+/* Register `count` benchmarks to be run by bench_run_all(). The array
+ * must stay valid. Returns 0, or -1 if the suite table is full. */
+int bench_register(const struct bench* benches, unsigned int count);
+
+/* Register `count` samplers, run after the suites. Returns 0, or -1 if
+ * the table is full. */
+int bench_register_sampler(const struct bench_sampler* samplers, unsigned int count);
+
+/* Run one benchmark */
+void bench_run(const struct bench* bench, struct bench_result* result);
+
+/* Run every registered benchmark and stream the results over serial.
+ * Returns the number of benchmarks that failed. */
+unsigned int bench_run_all(void);
+
+/* Leave QEMU through isa-debug-exit (no effect on real hardware, where
+ * the CPU just halts) */
+void bench_exit(unsigned int failed);
+
+#endif /* BENCH_H */
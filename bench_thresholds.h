@@ -0,0 +1,44 @@
+/*
+ * Benchmark Thresholds
+ *
+ * Pass limits for the benchmarks in bench.c: the median cost of one
+ * operation in TSC cycles. A benchmark whose median is above its limit
+ * fails, and `make bench` then exits non-zero.
+ *
+ * The limits have to hold both under KVM and under plain TCG emulation,
+ * where port I/O and interrupts cost several times more. So they are set
+ * to catch gross regressions (a lost fast path, a byte loop instead of a
+ * string instruction), not small drifts. Compare the medians printed by
+ * `make bench` across commits for those. When a change makes something
+ * legitimately slower, raise the limit here in the same commit.
+ */
+
+#ifndef BENCH_THRESHOLDS_H
+#define BENCH_THRESHOLDS_H
+
+/* int $BENCH_VECTOR through the IDT stub, dispatch and iret */
+#define BENCH_MAX_INT_ROUNDTRIP     60000
+
+/* 64 serial_putchar() calls into an empty TX ring */
+#define BENCH_MAX_SERIAL_PUTCHAR    400000
+
+/* vga_puts() of one 80-column line, and a vga_clear() */
+#define BENCH_MAX_VGA_PUTS          400000
+#define BENCH_MAX_VGA_CLEAR         1000000
+
+/* Mask one 8259 line (read-modify-write of the IMR), EOI to both PICs */
+#define BENCH_MAX_PIC_MASK          40000
+#define BENCH_MAX_PIC_EOI           40000
+
+/* memcpy()/memset() of 64 bytes and of one page */
+#define BENCH_MAX_MEMCPY_64         5000
+#define BENCH_MAX_MEMCPY_4K         200000
+#define BENCH_MAX_MEMSET_64         5000
+#define BENCH_MAX_MEMSET_4K         200000
+
+/* Null system call (getpid) from ring 3 through SYSENTER/SYSEXIT and
+ * through int 0x80/iret */
+#define BENCH_MAX_SYSCALL_SYSENTER  60000
+#define BENCH_MAX_SYSCALL_INT80     60000
+
+#endif /* BENCH_THRESHOLDS_H */
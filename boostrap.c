@@ -10,11 +10,34 @@
 #include "debug.h"
 #include "idt.h"
 #include "pic.h"
-
-/* Multiboot Specification Constants */
-#define MULTIBOOT_HEADER_MAGIC      0x1BADB002
-#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
-#define MULTIBOOT_HEADER_FLAGS      0x00000003  /* Align modules on page boundaries + provide memory map */
+#include "irq.h"
+#include "pit.h"
+#include "ktime.h"
+#include "timer.h"
+#include "math64.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "irqchip.h"
+#include "percpu.h"
+#include "smp.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "slab.h"
+#include "paging.h"
+#include "boottrace.h"
+#include "profile.h"
+#include "bench.h"
+#include "cpufeature.h"
+#include "fpu.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "string.h"
+#include "syscall.h"
+#include "user.h"
+#include "keyboard.h"
+#include "softirq.h"
+#include "console.h"
 
 /* 
  * Multiboot Header Structure
@@ -36,35 +59,6 @@ static const unsigned int multiboot_header[] = {
     -(MULTIBOOT_HEADER_MAGIC + MULTIBOOT_HEADER_FLAGS)  /* Checksum */
 };
 
-/* Multiboot Information Structure
- * 
- * This structure is passed to our kernel by the bootloader.
- * It contains information about memory, boot device, command line, etc.
- */
-struct multiboot_info {
-    unsigned int flags;
-    unsigned int mem_lower;      /* Lower memory (in KB) */
-    unsigned int mem_upper;      /* Upper memory (in KB) */
-    unsigned int boot_device;
-    unsigned int cmdline;        /* Command line string */
-    unsigned int mods_count;
-    unsigned int mods_addr;
-    unsigned int syms[4];        /* Symbol table info */
-    unsigned int mmap_length;    /* Memory map length */
-    unsigned int mmap_addr;      /* Memory map address */
-    unsigned int drives_length;
-    unsigned int drives_addr;
-    unsigned int config_table;
-    unsigned int boot_loader_name;
-    unsigned int apm_table;
-    unsigned int vbe_control_info;
-    unsigned int vbe_mode_info;
-    unsigned short vbe_mode;
-    unsigned short vbe_interface_seg;
-    unsigned short vbe_interface_off;
-    unsigned short vbe_interface_len;
-};
-
 /* Forward declaration */
 void kernel_main(unsigned int magic, struct multiboot_info* mbi);
 
@@ -78,6 +72,9 @@ void kernel_main(unsigned int magic, struct multiboot_info* mbi);
 
 /* Halt the CPU indefinitely */
 void halt(void) {
+    /* Interrupts are about to be disabled for good: flush buffered output */
+    debug_panic_mode();
+    
     /* Output using debug system */
     debug_set_color(VGA_COLOR(COLOR_WHITE, COLOR_RED));
     debug_puts("System halted!\n");
@@ -91,11 +88,12 @@ void halt(void) {
 
 /* Panic - critical error, halt the system */
 void panic(const char* message) {
+    /* Write synchronously so the message survives the halt */
+    debug_panic_mode();
+    
     /* Output using debug system */
     debug_set_color(VGA_COLOR(COLOR_WHITE, COLOR_RED));
-    debug_puts("[PANIC] ");
-    debug_puts(message);
-    debug_puts("\n");
+    kprintf("[PANIC] %s\n", message);
     
     /* Halt the system */
     halt();
@@ -121,30 +119,265 @@ void _start(void) {
     /* Get multiboot info pointer from EBX register */
     __asm__ volatile ("movl %%ebx, %0" : "=r" (mbi));
     
+    /* Stamp the TSC before anything else runs */
+    boottrace_start();
+    
     /* Call our main kernel function */
     kernel_main(magic, mbi);
 }
 
-/* Kernel entry point - called by the bootloader */
-void kernel_main(unsigned int magic, struct multiboot_info* mbi) {
-    /* Initialize debug system (initializes serial port) */
+/* Boot-time check of the timer core: report how late a 5 ms timer fired */
+static struct timer boot_test_timer;
+
+static void boot_test_timer_fn(struct timer* timer, void* data) {
+    unsigned long long late = ktime_get_ns() - timer->expires;
+    
+    (void)data;
+    debug_logf(LOG_INFO, "Timer test: 5 ms timer fired %u us late",
+               (unsigned int)div_u64(late, NSEC_PER_USEC));
+}
+
+/* Boot-time check of bottom halves: a tasklet scheduled by an interrupt
+ * handler runs as soon as the handler returns, with interrupts enabled */
+static struct tasklet boot_test_tasklet;
+static volatile int boot_tasklet_state = 0;   /* 1 = right context, -1 = wrong */
+
+static void boot_test_tasklet_fn(unsigned long data) {
+    boot_tasklet_state = irqs_enabled() && !in_interrupt() && in_softirq() ? (int)data : -1;
+}
+
+static void boot_test_softirq_handler(struct trap_frame* frame) {
+    (void)frame;
+    tasklet_schedule(&boot_test_tasklet);
+}
+
+/* Boot-time check of cross-CPU calls: every online CPU checks in once */
+static void boot_test_smp_fn(void* arg) {
+    __atomic_fetch_or((volatile unsigned int*)arg, 1u << smp_processor_id(), __ATOMIC_RELAXED);
+}
+
+/* Boot-time check of the demand-zero heap: grow it, touch every page and
+ * make sure each one arrived zero-filled through a page fault */
+static void boot_test_kheap(void) {
+    struct paging_stats before, after;
+    unsigned int pages = 4;
+    unsigned int* heap;
+    unsigned int bad = 0;
+
+    heap = kheap_grow(pages * PAGE_SIZE);
+    if (heap == 0) {
+        debug_error("kheap: grow failed");
+        return;
+    }
+    paging_get_stats(&before);
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int* word = heap + i * (PAGE_SIZE / 4);
+        bad += *word != 0;
+        *word = i;
+    }
+    paging_get_stats(&after);
+    debug_logf(LOG_INFO, "kheap: %u pages at %p, %u demand faults, %u not zeroed",
+               pages, heap, after.demand_faults - before.demand_faults, bad);
+}
+
+/* Boot-time check of lazy FPU switching: two contexts with different x87
+ * control words, switched back and forth around a kernel SIMD section.
+ * Each must read back its own value, restored through #NM. */
+static struct fpu boot_fpu_a, boot_fpu_b;
+
+static unsigned short boot_fpu_get_cw(void) {
+    unsigned short cw;
+    __asm__ volatile ("fnstcw %0" : "=m"(cw));
+    return cw;
+}
+
+static void boot_fpu_set_cw(unsigned short cw) {
+    __asm__ volatile ("fldcw %0" : : "m"(cw));
+}
+
+static void boot_test_fpu(void) {
+    struct percpu* cpu = this_cpu();
+    struct fpu* boot_context = cpu->fpu_current;
+    struct fpu_stats before, after;
+    unsigned int bad = 0;
+
+    fpu_get_stats(&before);
+    fpu_context_init(&boot_fpu_a);
+    fpu_context_init(&boot_fpu_b);
+
+    fpu_switch(&boot_fpu_a);
+    boot_fpu_set_cw(0x037F);          /* #NM: fresh registers */
+    fpu_switch(&boot_fpu_b);
+    boot_fpu_set_cw(0x027F);          /* #NM: save A, fresh registers */
+    fpu_switch(&boot_fpu_a);
+    bad += boot_fpu_get_cw() != 0x037F;   /* #NM: save B, restore A */
+    fpu_switch(&boot_fpu_b);
+    fpu_switch(&boot_fpu_a);          /* A still owns the registers */
+    bad += boot_fpu_get_cw() != 0x037F;
+
+    kernel_fpu_begin();               /* Parks A */
+    __asm__ volatile ("fninit");
+    kernel_fpu_end();
+    bad += boot_fpu_get_cw() != 0x037F;   /* #NM: restore A */
+
+    fpu_switch(boot_context);
+    fpu_release(&boot_fpu_a);
+    fpu_release(&boot_fpu_b);
+    fpu_get_stats(&after);
+
+    debug_logf(bad ? LOG_ERROR : LOG_INFO,
+               "fpu: self-test %s: %u #NM, %u saves, %u restores, %u kept registers",
+               bad ? "FAILED" : "ok", after.nm_traps - before.nm_traps,
+               after.saves - before.saves, after.restores - before.restores,
+               after.lazy_hits - before.lazy_hits);
+}
+
+/* Boot-time check of user tasks and system calls. The first task runs
+ * each call from ring 3 and exits with a code naming the first thing
+ * that went wrong (its argument if nothing did); the second reads kernel
+ * memory and must be killed for it. */
+static const char boot_user_hello[] USER_RODATA = "user: hello from ring 3\n";
+static char boot_user_buf[16] USER_BSS;
+
+USER_TEXT static int boot_user_main(unsigned int code) {
+    int pid = user_syscall_int80(SYS_getpid, 0, 0, 0);
+
+    if (user_syscall(SYS_write, 1, (unsigned int)boot_user_hello,
+                     sizeof(boot_user_hello) - 1) != (int)sizeof(boot_user_hello) - 1) {
+        return 1;
+    }
+    if (user_syscall(SYS_getpid, 0, 0, 0) != pid) {
+        return 2;
+    }
+    if (user_syscall(SYS_read, 0, (unsigned int)boot_user_buf, sizeof(boot_user_buf)) < 0) {
+        return 3;
+    }
+    /* A kernel buffer and an unknown call number must both fail */
+    if (user_syscall(SYS_read, 0, (unsigned int)&boot_fpu_a, 4) != -1 ||
+        user_syscall(SYSCALL_MAX - 1, 0, 0, 0) != -1) {
+        return 4;
+    }
+    return (int)code;
+}
+
+USER_TEXT static int boot_user_fault(unsigned int addr) {
+    return (int)*(volatile unsigned int*)addr;
+}
+
+static void boot_test_user(void) {
+    int task, code, fault_code;
+
+    task = user_task_create("user", boot_user_main, 42);
+    code = task < 0 ? -1 : user_task_wait(task);
+    task = user_task_create("user-fault", boot_user_fault, (unsigned int)&boot_fpu_a);
+    fault_code = task < 0 ? 0 : user_task_wait(task);
+
+    debug_logf(code == 42 && fault_code == USER_EXIT_FAULT ? LOG_INFO : LOG_ERROR,
+               "user: self-test %s: exit code %d, faulting task %s",
+               code == 42 && fault_code == USER_EXIT_FAULT ? "ok" : "FAILED", code,
+               fault_code == USER_EXIT_FAULT ? "killed" : "NOT killed");
+}
+
+/* ============================================================================
+ * Boot Stages
+ * ============================================================================
+ *
+ * kernel_main() runs these in table order; boottrace stamps each one so
+ * the boot timeline shows where the time goes. Stages that need more than
+ * a bare init call get a small wrapper below.
+ */
+
+static unsigned int boot_magic;
+static struct multiboot_info* boot_mbi;
+static int boot_apic_ok = 0;
+
+/* Initialize debug system (initializes serial port) */
+static void boot_debug(void) {
     debug_init();
     debug_info("Debug system initialized");
-    
-    /* Initialize Interrupt Descriptor Table */
-    idt_init();
-    
-    /* Initialize Programmable Interrupt Controller */
-    pic_init();
-    debug_info("PIC initialized");
-    
-    /* Verify we were loaded by a Multiboot-compliant bootloader */
-    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+}
+
+/* Verify we were loaded by a Multiboot-compliant bootloader */
+static void boot_check_magic(void) {
+    if (boot_magic != MULTIBOOT_BOOTLOADER_MAGIC) {
         panic("Invalid bootloader magic number!");
     }
     
     debug_info("Multiboot magic verified");
+}
+
+/* Hand the RAM from the Multiboot memory map to the page allocator */
+static void boot_pmm(void) {
+    pmm_init(boot_mbi);
+}
+
+/* Initialize Programmable Interrupt Controller */
+static void boot_pic(void) {
+    pic_init();
+    debug_info("PIC initialized");
+}
+
+/* Start the periodic tick */
+static void boot_tick(void) {
+    pit_init(CONFIG_HZ);
+    __asm__ volatile ("sti");
+}
+
+/* Check the TSC clock against the PIT tick (reported over serial) */
+static void boot_clock_check(void) {
+    ktime_selfcheck(100);
+}
+
+/* Hand the PIT to the timer core: from here on it only fires when a
+ * timer is due */
+static void boot_timers(void) {
+    timer_init();
+    pit_clockevent_init();
+}
+
+/* Budget the softirq runs and check that a tasklet fires on interrupt
+ * exit (borrows the benchmark vector) */
+static void boot_softirq(void) {
+    softirq_init();
     
+    tasklet_init(&boot_test_tasklet, boot_test_tasklet_fn, 1);
+    idt_set_handler(BENCH_VECTOR, boot_test_softirq_handler);
+    __asm__ volatile ("int %0" : : "i"(BENCH_VECTOR) : "memory");
+    idt_set_handler(BENCH_VECTOR, 0);
+    
+    if (boot_tasklet_state == 1) {
+        debug_info("Tasklet ran on interrupt exit with interrupts enabled");
+    } else {
+        debug_logf(LOG_ERROR, "softirq: boot tasklet %s",
+                   boot_tasklet_state == 0 ? "did not run" : "ran in the wrong context");
+    }
+}
+
+/* Move interrupt delivery from the 8259 to the APICs when ACPI
+ * describes them; the local APIC timer then replaces the PIT */
+static void boot_apic(void) {
+    if (acpi_init() == 0 &&
+        lapic_init(acpi_get_madt()->lapic_address) == 0 &&
+        ioapic_init() == 0) {
+        irq_set_chip(&ioapic_chip);
+        lapic_timer_init();
+        boot_apic_ok = 1;
+    } else {
+        debug_info("Using the 8259 PIC");
+    }
+}
+
+/* Start the other CPUs and make sure each one answers an IPI */
+static void boot_smp(void) {
+    if (boot_apic_ok && smp_boot() > 1) {
+        volatile unsigned int seen = 0;
+        smp_call_function_all(boot_test_smp_fn, (void*)&seen);
+        debug_logf(LOG_INFO, "smp: function call ran on CPU mask 0x%x", seen);
+    }
+}
+
+/* Welcome screen with the bootloader information */
+static void boot_screen(void) {
     /* Clear the screen and set up colors */
     debug_clear();
     debug_set_color(VGA_COLOR(COLOR_LIGHT_GREEN, COLOR_BLACK));
@@ -156,51 +389,213 @@ void kernel_main(unsigned int magic, struct multiboot_info* mbi) {
     
     /* Print bootloader information */
     debug_set_color(VGA_COLOR(COLOR_LIGHT_CYAN, COLOR_BLACK));
-    debug_puts("Bootloader Magic: ");
-    debug_puthex(magic);
-    debug_puts("\n");
+    kprintf("Bootloader Magic: 0x%X\n", boot_magic);
     
     /* Print memory information if available */
-    if (mbi->flags & 0x01) {  /* Check if memory info is available */
+    if (boot_mbi->flags & 0x01) {  /* Check if memory info is available */
         debug_set_color(VGA_COLOR(COLOR_YELLOW, COLOR_BLACK));
-        debug_puts("Lower memory: ");
-        debug_putuint(mbi->mem_lower);
-        debug_puts(" KB\n");
-        debug_puts("Upper memory: ");
-        debug_putuint(mbi->mem_upper);
-        debug_puts(" KB\n");
+        kprintf("Lower memory: %u KB\n", boot_mbi->mem_lower);
+        kprintf("Upper memory: %u KB\n", boot_mbi->mem_upper);
         
         debug_info("Memory information retrieved");
     } else {
         debug_warn("Memory information not available");
     }
+}
+
+/* Allocator and paging statistics */
+static void boot_memory_report(void) {
+    pmm_dump_stats();
+    kmem_dump_stats();
+    boot_test_kheap();
+    paging_dump_stats();
+}
+
+/* Lazy FPU switching (#NM handler), checked once */
+static void boot_fpu(void) {
+    fpu_init();
+    if (cpu_has(X86_FEATURE_FPU)) {
+        boot_test_fpu();
+        fpu_dump_stats();
+    }
+}
+
+/* Find "key=value" or a bare "key" in the kernel command line; returns
+ * the value ("" for a bare key), or 0 if the key is absent */
+static const char* boot_cmdline_option(const char* key) {
+    const char* p;
+
+    if (!(boot_mbi->flags & MULTIBOOT_INFO_CMDLINE) || boot_mbi->cmdline == 0) {
+        return 0;
+    }
+    p = (const char*)boot_mbi->cmdline;
+    while (*p != '\0') {
+        unsigned int i = 0;
+        while (key[i] != '\0' && p[i] == key[i]) {
+            i++;
+        }
+        if (key[i] == '\0' && (p == (const char*)boot_mbi->cmdline || p[-1] == ' ')) {
+            if (p[i] == '=') {
+                return p + i + 1;
+            }
+            if (p[i] == ' ' || p[i] == '\0') {
+                return p + i;
+            }
+        }
+        p++;
+    }
+    return 0;
+}
+
+/* Profile the rest of the boot and the idle system when the command line
+ * says "profile=<ms>[,callchain]" (see `make profile`) */
+static void boot_profile(void) {
+    const char* arg = boot_cmdline_option("profile");
+    unsigned int ms = 0;
+    unsigned int flags = 0;
+
+    if (arg == 0) {
+        return;
+    }
+    while (*arg >= '0' && *arg <= '9') {
+        ms = ms * 10 + (unsigned int)(*arg++ - '0');
+    }
+    if (arg[0] == ',' && arg[1] == 'c') {
+        flags |= PROFILE_CALLCHAIN;
+    }
+    if (ms != 0 && profile_start(0, flags) == 0) {
+        profile_stop_after(ms);
+    }
+}
+
+/* Contend for every lock kind from all CPUs; with CONFIG_LOCKSTAT the
+ * counters gathered so far go out over serial */
+static void boot_locks(void) {
+    spinlock_init();
+    if (CONFIG_LOCKSTAT) {
+        lockstat_dump();
+    }
+}
+
+/* Start the scheduler and time a thread ping-pong */
+static void boot_sched(void) {
+    sched_init();
+    sched_pingpong(1000);
+    sched_dump();
+}
+
+/* System calls: the int 0x80 gate, SYSENTER on every CPU, then a ring-3
+ * round trip */
+static void boot_user(void) {
+    if (syscall_init() == 0) {
+        boot_test_user();
+        syscall_dump_stats();
+    }
+}
+
+/* PS/2 keyboard; its characters are what user tasks read from fd 0 */
+static void boot_kbd(void) {
+    if (kbd_init() == 0) {
+        syscall_set_stdin(kbd_read);
+    }
+}
+
+/* Command console on COM1, started last so its prompt follows the boot
+ * output */
+static void boot_console(void) {
+    console_init();
+}
+
+/* Run the microbenchmarks and leave QEMU when the command line says
+ * "bench" (see `make bench`) */
+static void boot_bench(void) {
+    if (boot_cmdline_option("bench") != 0) {
+        unsigned int failed = string_selftest();
+        bench_exit(failed + bench_run_all());
+    }
+}
+
+static const struct boot_stage boot_stages[] = {
+    /* Load our own GDT with the boot CPU's per-CPU segment; everything
+     * below may use this_cpu() */
+    BOOT_STAGE(percpu_init_bsp),
+    BOOT_STAGE(boot_debug),
+    BOOT_STAGE(boot_check_magic),
+    /* CPUID feature mask, FPU/SSE on; then bind memcpy/memset to match */
+    BOOT_STAGE(cpu_features_init),
+    BOOT_STAGE(string_init),
+    BOOT_STAGE(idt_init),
+    /* #NM handler: FPU/SSE state is switched lazily from here on */
+    BOOT_STAGE(boot_fpu),
+    BOOT_STAGE(boot_pmm),
+    BOOT_STAGE(slab_init),
+    /* Identity-map RAM (4 MB pages), protect the kernel text, turn on paging */
+    BOOT_STAGE(paging_init),
+    BOOT_STAGE(boot_pic),
+    /* Install the IRQ dispatcher (drivers register with request_irq) */
+    BOOT_STAGE(irq_init),
+    /* Drain serial output from the COM1 interrupt instead of busy-waiting */
+    BOOT_STAGE(debug_enable_irq_output),
+    /* Calibrate the TSC clocksource */
+    BOOT_STAGE(ktime_init),
+    BOOT_STAGE(boot_tick),
+    BOOT_STAGE(boot_clock_check),
+    BOOT_STAGE(boot_timers),
+    /* Bottom halves: softirqs and tasklets run on interrupt exit */
+    BOOT_STAGE(boot_softirq),
+    BOOT_STAGE(boot_apic),
+    BOOT_STAGE(boot_smp),
+    BOOT_STAGE(boot_locks),
+    /* From here on kernel_main runs as thread "main" */
+    BOOT_STAGE(boot_sched),
+    /* User tasks in ring 3, SYSENTER and int 0x80 system calls */
+    BOOT_STAGE(boot_user),
+    BOOT_STAGE(boot_kbd),
+    BOOT_STAGE(boot_profile),
+    BOOT_STAGE(boot_screen),
+    BOOT_STAGE(boot_memory_report),
+    BOOT_STAGE(boot_console),
+    BOOT_STAGE(boot_bench),
+};
+
+/* Kernel entry point - called by the bootloader */
+void kernel_main(unsigned int magic, struct multiboot_info* mbi) {
+    boot_magic = magic;
+    boot_mbi = mbi;
+    
+    /* Bring the kernel up one stage at a time */
+    boottrace_run(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0]));
     
     debug_set_color(VGA_COLOR(COLOR_WHITE, COLOR_BLACK));
     debug_info("Kernel initialized successfully!\n");
     debug_info("System ready.\n");
     
+    /* Where the boot time went (parsed by `make boot-report`) */
+    boottrace_report();
+    
     /* Test debug logging */
     debug_debug("This is a debug message");
     debug_info("This is an info message");
     debug_warn("This is a warning message");
     debug_error("This is an error message (test)");
     
-    /* Test IDT - trigger a divide by zero exception */
-    debug_info("Testing IDT with divide by zero exception...");
-    debug_puts("About to divide by zero...\n");
+    /* Test IDT - trigger a breakpoint exception */
+    debug_info("Testing IDT with breakpoint exception...");
     
-    // /* This will trigger exception 0 (Division By Zero) */
-    volatile int a = 1;
-    volatile int b = 0;
-    volatile int c = a / b;  /* This should trigger our exception handler */
+    /* This triggers exception 3 (Breakpoint); the handler returns through
+     * the common exit path and execution resumes after the int3 */
+    __asm__ volatile ("int3");
     
-    // /* We should never reach here if exception handling works */
-    debug_puts("ERROR: Should not reach here!\n");
+    debug_info("Resumed after breakpoint exception");
     
-    /* Infinite loop - kernel is running */
-    while (1) {
-        /* For now, we just halt the CPU */
-        __asm__ volatile ("hlt");
-    }
+    /* Test the timer core with a one-shot timer */
+    timer_setup(&boot_test_timer, boot_test_timer_fn, 0);
+    timer_add(&boot_test_timer, ktime_get_ns() + 5 * NSEC_PER_MSEC);
+    
+    /* Kernel is running: thread "main" is done and hands the CPU to the
+     * idle thread, which flushes the log and polls the profiler from now
+     * on. Spinning here at the default priority would starve every
+     * thread below it. */
+    sched_idle_handoff();
 }
 
@@ -0,0 +1,75 @@
+# Boot timeline report
+#
+# Turns the boottrace table from a serial log (see boottrace.c) into a
+# report that can be diffed across commits:
+#
+#   awk -v commit=<rev> -f boot-report.awk boot-serial.log
+#
+# Run by `make boot-report`. POSIX awk, no gawk extensions.
+
+{ sub(/\r$/, "") }
+
+/^# boottrace v1/ {
+    n = 0
+    for (i = 3; i <= NF; i++) {
+        split($i, kv, "=")
+        meta[kv[1]] = kv[2]
+    }
+    next
+}
+
+/^boottrace / {
+    n++
+    name[n] = $2; start[n] = $3; dur[n] = $4; end[n] = $5; cycles[n] = $6
+    next
+}
+
+/^# end boottrace/ {
+    split($4, kv, "=")
+    total = kv[2]
+    done = 1
+}
+
+function ms(us) {
+    return sprintf("%9.3f", us / 1000)
+}
+
+END {
+    if (!done) {
+        print "boot-report: no complete boottrace table in the serial log" > "/dev/stderr"
+        exit 1
+    }
+
+    printf "Boot report  commit %s  tsc %s kHz  %d stages", commit, meta["tsc_khz"], n
+    if (meta["dropped"] > 0) {
+        printf "  (%s dropped)", meta["dropped"]
+    }
+    printf "\n\n"
+
+    printf "%-28s %9s %9s %9s %6s\n", "stage", "start ms", "time ms", "total ms", "%"
+    traced = 0
+    for (i = 1; i <= n; i++) {
+        pct = (total > 0) ? 100 * dur[i] / total : 0
+        printf "%-28s %s %s %s %6.1f\n", name[i], ms(start[i]), ms(dur[i]), ms(end[i]), pct
+        traced += dur[i]
+    }
+    printf "%-28s %9s %s %s\n", "(outside stages)", "", ms(total - traced), ms(total)
+
+    # Slowest stages first (selection sort: the table is short)
+    for (i = 1; i <= n; i++) {
+        rank[i] = i
+    }
+    for (i = 1; i <= n; i++) {
+        best = i
+        for (j = i + 1; j <= n; j++) {
+            if (dur[rank[j]] + 0 > dur[rank[best]] + 0) {
+                best = j
+            }
+        }
+        tmp = rank[i]; rank[i] = rank[best]; rank[best] = tmp
+    }
+    printf "\nSlowest stages:\n"
+    for (i = 1; i <= n && i <= 5; i++) {
+        printf "  %-26s %s ms\n", name[rank[i]], ms(dur[rank[i]])
+    }
+}
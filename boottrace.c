@@ -0,0 +1,134 @@
+/*
+ * Boot-Time Trace Implementation
+ *
+ * Stages are recorded by the boot CPU while kernel_main() runs, so the
+ * table needs no lock; interrupts are only disabled around an append so
+ * a record made from an interrupt handler cannot tear it.
+ */
+
+#include "boottrace.h"
+#include "ktime.h"
+#include "math64.h"
+#include "serial.h"
+#include "kprintf.h"
+#include "cpu.h"
+#include "io.h"
+
+/* One recorded stage */
+struct boottrace_entry {
+    const char* name;
+    unsigned long long start;   /* TSC at stage entry */
+    unsigned long long end;     /* TSC at stage exit */
+};
+
+static unsigned long long boot_tsc = 0;   /* TSC at _start */
+static struct boottrace_entry entries[BOOTTRACE_MAX_STAGES];
+static unsigned int entry_count = 0;
+static unsigned int dropped = 0;
+
+/* Record the TSC at kernel entry (first thing in _start) */
+void boottrace_start(void) {
+    if (CONFIG_BOOTTRACE) {
+        boot_tsc = rdtsc();
+    }
+}
+
+/* Record a stage measured by the caller (TSC stamps) */
+void boottrace_record(const char* name, unsigned long long start, unsigned long long end) {
+    unsigned int flags;
+
+    if (!CONFIG_BOOTTRACE) {
+        return;
+    }
+
+    flags = irq_save();
+    if (entry_count < BOOTTRACE_MAX_STAGES) {
+        struct boottrace_entry* entry = &entries[entry_count++];
+        entry->name = name;
+        entry->start = start;
+        entry->end = end;
+    } else {
+        dropped++;
+    }
+    irq_restore(flags);
+}
+
+/* Run `count` stages in order, stamping the TSC around each */
+void boottrace_run(const struct boot_stage* stages, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned long long start = CONFIG_BOOTTRACE ? rdtsc() : 0;
+
+        stages[i].init();
+
+        if (CONFIG_BOOTTRACE) {
+            boottrace_record(stages[i].name, start, rdtsc());
+        }
+    }
+}
+
+/* Convert a TSC interval to microseconds (0 before calibration) */
+static unsigned int boottrace_us(unsigned long long cycles, unsigned int khz) {
+    if (khz == 0) {
+        return 0;
+    }
+    return (unsigned int)div_u64(cycles * 1000, khz);
+}
+
+/* Print the timeline as a machine-readable table over serial
+ *
+ * Format (times in microseconds since _start, cycles raw):
+ *   # boottrace v1 tsc_khz=<khz> stages=<n> dropped=<n>
+ *   boottrace <name> <start_us> <duration_us> <end_us> <duration_cycles>
+ *   # end boottrace total_us=<end of the last stage>
+ *
+ * Lines are sorted by start time; end_us is the cumulative time at which
+ * the stage finished. Gaps between one stage's end and the next one's
+ * start are time spent outside any stage.
+ */
+void boottrace_report(void) {
+    unsigned int order[BOOTTRACE_MAX_STAGES];
+    unsigned int khz = ktime_tsc_khz();
+    unsigned long long last_end = boot_tsc;
+    unsigned int count;
+    char line[128];
+
+    if (!CONFIG_BOOTTRACE) {
+        serial_puts("# boottrace disabled (built with CONFIG_BOOTTRACE=0)\n");
+        return;
+    }
+
+    /* Insertion sort by start stamp (the table is nearly sorted already) */
+    count = entry_count;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int j = i;
+        while (j > 0 && entries[order[j - 1]].start > entries[i].start) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    ksnprintf(line, sizeof(line), "# boottrace v1 tsc_khz=%u stages=%u dropped=%u\n",
+              khz, count, dropped);
+    serial_puts(line);
+
+    for (unsigned int i = 0; i < count; i++) {
+        const struct boottrace_entry* entry = &entries[order[i]];
+        unsigned long long cycles = entry->end - entry->start;
+
+        ksnprintf(line, sizeof(line), "boottrace %s %u %u %u %llu\n", entry->name,
+                  boottrace_us(entry->start - boot_tsc, khz), boottrace_us(cycles, khz),
+                  boottrace_us(entry->end - boot_tsc, khz), cycles);
+        serial_puts(line);
+        if (entry->end > last_end) {
+            last_end = entry->end;
+        }
+
+        /* The table can be larger than the TX ring: push it out as we go */
+        serial_flush();
+    }
+
+    ksnprintf(line, sizeof(line), "# end boottrace total_us=%u\n",
+              boottrace_us(last_end - boot_tsc, khz));
+    serial_puts(line);
+}
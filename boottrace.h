@@ -0,0 +1,49 @@
+/*
+ * Boot-Time Trace Header
+ *
+ * Measures where boot time goes. _start stamps the TSC before anything
+ * else runs; kernel_main() then runs its initialization as a table of
+ * named stages (struct boot_stage), and boottrace_run() stamps the TSC
+ * around each one. boottrace_report() prints the stages in start order
+ * with their duration and the time since _start, as a machine-readable
+ * table over serial (`make boot-report` turns it into a report).
+ *
+ * Stamps are raw TSC cycles; they are only converted to microseconds
+ * when the report is printed, after ktime_init() has calibrated the TSC.
+ * The cost is two RDTSCs per stage; building with CONFIG_BOOTTRACE=0
+ * keeps the stage table but drops the stamps and the report.
+ */
+
+#ifndef BOOTTRACE_H
+#define BOOTTRACE_H
+
+/* Enabled unless the build says otherwise (make CONFIG_BOOTTRACE=0) */
+#ifndef CONFIG_BOOTTRACE
+#define CONFIG_BOOTTRACE 1
+#endif
+
+/* Most stages recorded per boot (later ones are run but not recorded) */
+#define BOOTTRACE_MAX_STAGES 48
+
+/* One initialization stage */
+struct boot_stage {
+    const char* name;
+    void (*init)(void);
+};
+
+/* Table entry for a stage named after its init function */
+#define BOOT_STAGE(fn)  { #fn, fn }
+
+/* Record the TSC at kernel entry (first thing in _start) */
+void boottrace_start(void);
+
+/* Run `count` stages in order, stamping the TSC around each */
+void boottrace_run(const struct boot_stage* stages, unsigned int count);
+
+/* Record a stage measured by the caller (TSC stamps) */
+void boottrace_record(const char* name, unsigned long long start, unsigned long long end);
+
+/* Print the timeline as a machine-readable table over serial */
+void boottrace_report(void);
+
+#endif /* BOOTTRACE_H */
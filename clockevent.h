@@ -0,0 +1,55 @@
+/*
+ * Clock Event Device Header
+ *
+ * A clock event device is a hardware timer that can raise an interrupt at a
+ * programmed time: the PIT (pit.c) and later the local APIC timer. Drivers
+ * describe the device with a struct clockevent and register it; the timer
+ * core (timer.c) picks the device with the highest rating, installs its
+ * event handler and then only ever asks it for "the next expiry".
+ *
+ * In one-shot mode there is no periodic tick at all: when no timer is
+ * pending the device is left disarmed and the idle loop sleeps until some
+ * other interrupt arrives. Devices that cannot do one-shot (or a kernel
+ * without a calibrated TSC) run in periodic mode and the timer core checks
+ * the wheel on every tick.
+ */
+
+#ifndef CLOCKEVENT_H
+#define CLOCKEVENT_H
+
+/* Device features */
+#define CLOCKEVENT_FEAT_PERIODIC  0x01
+#define CLOCKEVENT_FEAT_ONESHOT   0x02
+
+/* Device modes */
+#define CLOCKEVENT_MODE_SHUTDOWN  0
+#define CLOCKEVENT_MODE_PERIODIC  1
+#define CLOCKEVENT_MODE_ONESHOT   2
+
+struct clockevent {
+    const char* name;
+    unsigned int rating;         /* Higher is preferred */
+    unsigned int features;       /* CLOCKEVENT_FEAT_* */
+    unsigned int min_delta_ns;   /* Shortest programmable delay */
+    unsigned int max_delta_ns;   /* Longest programmable delay */
+
+    /* Driver callbacks (called with interrupts disabled) */
+    void (*set_periodic)(void);
+    void (*set_oneshot)(void);
+    void (*shutdown)(void);
+    void (*set_next_event)(unsigned int delta_ns);  /* One-shot mode only */
+
+    /* Set by the timer core; the driver calls it from its interrupt handler */
+    void (*event_handler)(struct clockevent* dev);
+
+    unsigned int mode;           /* CLOCKEVENT_MODE_*, maintained by the core */
+    unsigned int events;         /* Interrupts delivered, maintained by the driver */
+};
+
+/* Offer a device to the timer core; it is used if it outranks the current one */
+void clockevent_register(struct clockevent* dev);
+
+/* Device currently driving the timer core (0 if none) */
+struct clockevent* clockevent_get_device(void);
+
+#endif /* CLOCKEVENT_H */
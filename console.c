@@ -0,0 +1,426 @@
+/*
+ * Serial Command Console Implementation
+ *
+ * Only the console thread touches the line buffer and the counters, so
+ * neither needs a lock. Commands run in that thread too: they may take
+ * locks and allocate (profile start), but should not block for long,
+ * since the console reads no input meanwhile.
+ */
+
+#include "console.h"
+#include "serial.h"
+#include "sched.h"
+#include "irq.h"
+#include "irqstat.h"
+#include "softirq.h"
+#include "timer.h"
+#include "pmm.h"
+#include "slab.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "profile.h"
+#include "keyboard.h"
+#include "syscall.h"
+#include "ktime.h"
+#include "io.h"
+#include "debug.h"
+
+/* Not below the default priority: a wakeup must get it onto the CPU */
+#define CONSOLE_THREAD_PRIO  SCHED_PRIO_DEFAULT
+
+/* How long the init self-test waits for the thread to take its byte */
+#define CONSOLE_SELFTEST_MS  100
+
+/* Input bytes with a meaning to the line editor */
+#define CHAR_CTRL_C   0x03
+#define CHAR_BS       0x08
+#define CHAR_CTRL_U   0x15
+#define CHAR_ESC      0x1B
+#define CHAR_DEL      0x7F
+
+/* Escape sequence parser state */
+#define ESC_NONE      0
+#define ESC_START     1   /* After ESC */
+#define ESC_CSI       2   /* After ESC [ or ESC O, until the final byte */
+
+struct console_command {
+    const char* name;
+    const char* usage;
+    const char* help;
+    void (*fn)(unsigned int argc, char** argv);
+};
+
+static struct wait_queue console_wait = WAIT_QUEUE_INIT;
+
+static char line[CONSOLE_LINE_MAX + 1];
+static unsigned int line_len = 0;
+static unsigned int esc_state = ESC_NONE;
+static int last_cr = 0;
+
+static struct console_stats stats;
+
+static const char* const level_names[] = { "debug", "info", "warn", "error", "panic" };
+
+/* ============================================================================
+ * Helpers
+ * ============================================================================
+ */
+
+static int console_streq(const char* a, const char* b) {
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Parse a decimal number; returns 0 on success */
+static int console_parse_uint(const char* s, unsigned int* out) {
+    unsigned int value = 0;
+
+    if (*s == '\0') {
+        return -1;
+    }
+    for (; *s != '\0'; s++) {
+        unsigned int digit = (unsigned int)(*s - '0');
+
+        if (*s < '0' || *s > '9' || value > (0xFFFFFFFFu - digit) / 10) {
+            return -1;
+        }
+        value = value * 10 + digit;
+    }
+    *out = value;
+    return 0;
+}
+
+/* ============================================================================
+ * Commands
+ * ============================================================================
+ */
+
+static void cmd_help(unsigned int argc, char** argv);
+
+static void cmd_loglevel(unsigned int argc, char** argv) {
+    unsigned int level;
+
+    if (argc < 2) {
+        level = debug_get_level();
+        kprintf("log level: %s\n", level <= LOG_PANIC ? level_names[level] : "?");
+        return;
+    }
+    for (level = 0; level <= LOG_PANIC; level++) {
+        if (console_streq(argv[1], level_names[level])) {
+            break;
+        }
+    }
+    if (level > LOG_PANIC && (console_parse_uint(argv[1], &level) != 0 || level > LOG_PANIC)) {
+        kprintf("loglevel: expected debug, info, warn, error, panic or 0-4\n");
+        return;
+    }
+    debug_set_level(level);
+    kprintf("log level: %s\n", level_names[level]);
+}
+
+static void cmd_irq(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    irq_dump_stats();
+    softirq_dump_stats();
+}
+
+static void cmd_irqstat(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    irqstat_dump();
+}
+
+static void cmd_mem(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    pmm_dump_stats();
+    kmem_dump_stats();
+    paging_dump_stats();
+}
+
+static void cmd_sched(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    sched_dump();
+    timer_dump_stats();
+}
+
+static void cmd_locks(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    lockstat_dump();
+}
+
+static void cmd_kbd(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    kbd_dump_stats();
+}
+
+static void cmd_syscall(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    syscall_dump_stats();
+}
+
+static void cmd_serial(unsigned int argc, char** argv) {
+    struct serial_stats s;
+    struct console_stats c;
+
+    (void)argc;
+    (void)argv;
+    serial_get_stats(&s);
+    console_get_stats(&c);
+    kprintf("Serial TX: %u bytes queued, %u dropped, ring full %u times, %u irqs, %u FIFO bursts\n",
+            s.bytes_queued, s.bytes_dropped, s.ring_full, s.tx_irqs, s.fifo_bursts);
+    kprintf("Serial RX: %u bytes, %u irqs, %u ring overruns, %u FIFO overruns\n",
+            s.bytes_received, s.rx_irqs, s.rx_overruns, s.rx_fifo_lost);
+    kprintf("Console: %u lines, %u commands, %u unknown, %u chars truncated\n",
+            c.lines, c.commands, c.unknown, c.truncated);
+}
+
+static void cmd_dmesg(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    debug_dmesg();
+}
+
+static void cmd_profile(unsigned int argc, char** argv) {
+    struct profile_stats s;
+
+    if (argc >= 2 && console_streq(argv[1], "start")) {
+        unsigned int hz = 0;
+        unsigned int flags = 0;
+
+        for (unsigned int i = 2; i < argc; i++) {
+            if (console_streq(argv[i], "chain")) {
+                flags |= PROFILE_CALLCHAIN;
+            } else if (console_parse_uint(argv[i], &hz) != 0) {
+                kprintf("profile: bad argument '%s'\n", argv[i]);
+                return;
+            }
+        }
+        if (profile_start(hz, flags) != 0) {
+            kprintf("profile: cannot allocate the sample buffers\n");
+            return;
+        }
+    } else if (argc >= 2 && console_streq(argv[1], "stop")) {
+        profile_stop();
+        profile_dump();
+    } else if (argc >= 2 && !console_streq(argv[1], "status")) {
+        kprintf("usage: profile start [hz] [chain] | stop | status\n");
+        return;
+    }
+
+    profile_get_stats(&s);
+    kprintf("profile: %s, %u Hz%s, %u samples (%u outside), %u chains (%u dropped)\n",
+            s.running ? "running" : "stopped", s.hz,
+            (s.flags & PROFILE_CALLCHAIN) ? " with call chains" : "",
+            s.samples, s.outside, s.chains, s.chain_dropped);
+}
+
+static const struct console_command commands[] = {
+    { "help",     "",                      "list the commands",                         cmd_help },
+    { "loglevel", "[debug|info|warn|...]", "show or set the minimum log level",         cmd_loglevel },
+    { "irq",      "",                      "IRQ and softirq counters",                  cmd_irq },
+    { "irqstat",  "",                      "interrupt latency table",                   cmd_irqstat },
+    { "mem",      "",                      "page allocator, slab and paging counters",  cmd_mem },
+    { "sched",    "",                      "threads and timers",                        cmd_sched },
+    { "locks",    "",                      "lock contention table (CONFIG_LOCKSTAT=1)", cmd_locks },
+    { "kbd",      "",                      "keyboard counters",                         cmd_kbd },
+    { "syscall",  "",                      "system call counters",                      cmd_syscall },
+    { "serial",   "",                      "serial and console counters",               cmd_serial },
+    { "dmesg",    "",                      "log records still in the ring",             cmd_dmesg },
+    { "profile",  "start|stop|status",     "sampling profiler; stop writes it out",     cmd_profile },
+};
+
+#define NR_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static void cmd_help(unsigned int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    for (unsigned int i = 0; i < NR_COMMANDS; i++) {
+        kprintf("  %-8s %-22s %s\n", commands[i].name, commands[i].usage, commands[i].help);
+    }
+}
+
+/* ============================================================================
+ * Line Editor
+ * ============================================================================
+ */
+
+/* Split the line into words and run the command */
+static void console_execute(char* text) {
+    char* argv[CONSOLE_ARGS_MAX];
+    unsigned int argc = 0;
+
+    while (*text != '\0' && argc < CONSOLE_ARGS_MAX) {
+        while (*text == ' ') {
+            *text++ = '\0';
+        }
+        if (*text == '\0') {
+            break;
+        }
+        argv[argc++] = text;
+        while (*text != '\0' && *text != ' ') {
+            text++;
+        }
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    stats.lines++;
+    for (unsigned int i = 0; i < NR_COMMANDS; i++) {
+        if (console_streq(argv[0], commands[i].name)) {
+            stats.commands++;
+            commands[i].fn(argc, argv);
+            return;
+        }
+    }
+    stats.unknown++;
+    kprintf("unknown command '%s' (try help)\n", argv[0]);
+}
+
+/* Erase the last character on the terminal */
+static void console_rubout(void) {
+    line_len--;
+    serial_puts("\b \b");
+}
+
+/* Feed one received byte to the line editor */
+static void console_input(unsigned char c) {
+    int was_cr = last_cr;
+
+    __atomic_store_n(&stats.bytes, stats.bytes + 1, __ATOMIC_RELEASE);
+    last_cr = 0;
+
+    /* Cursor and function keys arrive as escape sequences: skip them */
+    if (esc_state == ESC_START) {
+        esc_state = (c == '[' || c == 'O') ? ESC_CSI : ESC_NONE;
+        return;
+    }
+    if (esc_state == ESC_CSI) {
+        if (c >= 0x40 && c <= 0x7E) {
+            esc_state = ESC_NONE;
+        }
+        return;
+    }
+
+    switch (c) {
+        case '\n':
+            if (was_cr) {
+                return;  /* Second half of CR LF */
+            }
+            /* fall through */
+        case '\r':
+            last_cr = (c == '\r');
+            serial_puts("\n");
+            line[line_len] = '\0';
+            console_execute(line);
+            line_len = 0;
+            serial_puts(CONSOLE_PROMPT);
+            break;
+        case CHAR_BS:
+        case CHAR_DEL:
+            if (line_len > 0) {
+                console_rubout();
+            }
+            break;
+        case CHAR_CTRL_U:
+            while (line_len > 0) {
+                console_rubout();
+            }
+            break;
+        case CHAR_CTRL_C:
+            line_len = 0;
+            serial_puts("^C\n" CONSOLE_PROMPT);
+            break;
+        case CHAR_ESC:
+            esc_state = ESC_START;
+            break;
+        default:
+            if (c < 0x20 || c >= 0x7F) {
+                break;
+            }
+            if (line_len < CONSOLE_LINE_MAX) {
+                line[line_len++] = (char)c;
+                serial_putchar((char)c);
+            } else {
+                stats.truncated++;
+            }
+            break;
+    }
+}
+
+/* ============================================================================
+ * Thread and Initialization
+ * ============================================================================
+ */
+
+/* IRQ 4: new bytes in the RX ring */
+static void console_rx(void) {
+    wait_wake_one(&console_wait);
+}
+
+static void console_thread(void* arg) {
+    unsigned char buf[32];
+
+    (void)arg;
+    for (;;) {
+        unsigned int n;
+
+        wait_event(&console_wait, serial_rx_pending());
+        n = serial_read(buf, sizeof(buf));
+        for (unsigned int i = 0; i < n; i++) {
+            console_input(buf[i]);
+        }
+    }
+}
+
+/* Get a snapshot of the counters */
+void console_get_stats(struct console_stats* out) {
+    unsigned int flags = irq_save();
+
+    *out = stats;
+    irq_restore(flags);
+}
+
+/* Push a Ctrl-U (a no-op on the empty line) through the RX ring and wait
+ * for the console thread to take it. Returns 0 if it arrived. */
+static int console_selftest(void) {
+    static const unsigned char probe = CHAR_CTRL_U;
+    unsigned int before = __atomic_load_n(&stats.bytes, __ATOMIC_ACQUIRE);
+
+    if (serial_rx_inject(&probe, 1) != 1) {
+        return -1;
+    }
+    for (unsigned int ms = 0; ms < CONSOLE_SELFTEST_MS; ms++) {
+        if (__atomic_load_n(&stats.bytes, __ATOMIC_ACQUIRE) != before) {
+            return 0;
+        }
+        thread_sleep(NSEC_PER_MSEC);
+    }
+    return -1;
+}
+
+/* Start the console thread and take serial input */
+int console_init(void) {
+    int bad;
+
+    if (thread_create("console", console_thread, 0, CONSOLE_THREAD_PRIO) == 0) {
+        debug_error("console: cannot start the console thread");
+        return -1;
+    }
+    serial_set_rx_handler(console_rx);
+
+    bad = console_selftest();
+    debug_logf(bad ? LOG_ERROR : LOG_INFO, "console: commands on COM1, type 'help'; input self-test %s",
+               bad ? "FAILED (no byte reached the line editor)" : "ok");
+    serial_puts(CONSOLE_PROMPT);
+    return bad ? -1 : 0;
+}
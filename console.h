@@ -0,0 +1,43 @@
+/*
+ * Serial Command Console Header
+ *
+ * A line-oriented console on COM1 for looking at and tuning the running
+ * kernel without a rebuild: change the log level, dump the interrupt,
+ * memory, scheduler and lock counters, start and stop the profiler.
+ *
+ * The IRQ 4 handler queues received bytes (serial.h) and wakes the
+ * "console" thread, which runs at the default priority. The thread
+ * does the line editing - printable characters, Backspace/Delete, Ctrl-U
+ * (erase line), Ctrl-C (drop line), escape sequences ignored - and runs
+ * a command on Enter. Echo and command output go through the normal TX
+ * ring, which never waits for the UART, so the console cannot hold up
+ * other serial output.
+ *
+ * Type "help" for the list of commands.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#define CONSOLE_LINE_MAX     80      /* Longest command line */
+#define CONSOLE_ARGS_MAX     8       /* Words per command line */
+#define CONSOLE_PROMPT       "> "
+
+/* Counters */
+struct console_stats {
+    unsigned int bytes;              /* Bytes fed to the line editor */
+    unsigned int lines;              /* Lines entered */
+    unsigned int commands;           /* ... that ran a command */
+    unsigned int unknown;            /* ... with an unknown command */
+    unsigned int truncated;          /* Characters dropped at CONSOLE_LINE_MAX */
+};
+
+/* Start the console thread, take serial input and check that a byte
+ * pushed into the RX ring reaches the line editor (after sched_init and
+ * serial_enable_irq). Returns 0 on success. */
+int console_init(void);
+
+/* Get a snapshot of the counters */
+void console_get_stats(struct console_stats* stats);
+
+#endif /* CONSOLE_H */
@@ -0,0 +1,125 @@
+/*
+ * CPU Helper Header
+ *
+ * Inline wrappers for x86 instructions that are not tied to a device:
+ * time stamp counter, CPUID, model-specific registers, control registers,
+ * TLB invalidation and spin-loop hints.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+/* Read the Time Stamp Counter */
+static inline unsigned long long rdtsc(void) {
+    unsigned int lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* Execute CPUID for a leaf (subleaf 0) */
+static inline void cpuid(unsigned int leaf, unsigned int* eax, unsigned int* ebx,
+                         unsigned int* ecx, unsigned int* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(0));
+}
+
+/* CPUID feature bits used by the kernel */
+#define CPUID_1_EDX_FPU          (1u << 0)
+#define CPUID_1_EDX_PSE          (1u << 3)
+#define CPUID_1_EDX_TSC          (1u << 4)
+#define CPUID_1_EDX_MSR          (1u << 5)
+#define CPUID_1_EDX_APIC         (1u << 9)
+#define CPUID_1_EDX_SEP          (1u << 11)  /* SYSENTER/SYSEXIT */
+#define CPUID_1_EDX_PGE          (1u << 13)
+#define CPUID_1_EDX_FXSR         (1u << 24)
+#define CPUID_1_EDX_SSE          (1u << 25)
+#define CPUID_1_EDX_SSE2         (1u << 26)
+#define CPUID_1_ECX_X2APIC       (1u << 21)
+#define CPUID_7_EBX_ERMS         (1u << 9)   /* Fast rep movsb/stosb */
+#define CPUID_80000007_EDX_INVARIANT_TSC (1u << 8)
+
+/* Read a model-specific register */
+static inline unsigned long long rdmsr(unsigned int msr) {
+    unsigned int lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* Write a model-specific register */
+static inline void wrmsr(unsigned int msr, unsigned long long value) {
+    __asm__ volatile ("wrmsr"
+                      :
+                      : "c"(msr), "a"((unsigned int)value), "d"((unsigned int)(value >> 32))
+                      : "memory");
+}
+
+/* Control register bits */
+#define CR0_MP   (1u << 1)   /* WAIT/FWAIT honour CR0.TS */
+#define CR0_EM   (1u << 2)   /* No x87: FPU/SSE instructions trap */
+#define CR0_TS   (1u << 3)   /* Task switched: next FPU/SSE use traps (#NM) */
+#define CR0_NE   (1u << 5)   /* Native x87 error reporting (#MF) */
+#define CR0_WP   (1u << 16)  /* Write-protect read-only pages in ring 0 too */
+#define CR0_PG   (1u << 31)  /* Paging */
+#define CR4_PSE  (1u << 4)   /* 4 MB pages */
+#define CR4_PGE  (1u << 7)   /* Global pages */
+#define CR4_OSFXSR     (1u << 9)   /* FXSAVE/FXRSTOR and SSE instructions */
+#define CR4_OSXMMEXCPT (1u << 10)  /* Unmasked SSE exceptions raise #XM */
+
+static inline unsigned int read_cr0(void) {
+    unsigned int value;
+    __asm__ volatile ("movl %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(unsigned int value) {
+    __asm__ volatile ("movl %0, %%cr0" : : "r"(value) : "memory");
+}
+
+/* Clear CR0.TS: FPU/SSE instructions run without trapping */
+static inline void clts(void) {
+    __asm__ volatile ("clts" : : : "memory");
+}
+
+/* Set CR0.TS: the next FPU/SSE instruction raises #NM */
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline unsigned int read_cr3(void) {
+    unsigned int value;
+    __asm__ volatile ("movl %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+/* Load a page directory; flushes all non-global TLB entries */
+static inline void write_cr3(unsigned int value) {
+    __asm__ volatile ("movl %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline unsigned int read_cr4(void) {
+    unsigned int value;
+    __asm__ volatile ("movl %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(unsigned int value) {
+    __asm__ volatile ("movl %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* Invalidate the TLB entry of one page (global entries included) */
+static inline void invlpg(unsigned int addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* Spin-loop hint (reduces power and pipeline flushes in busy-wait loops) */
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+/* Compiler barrier */
+static inline void barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+#endif /* CPU_H */
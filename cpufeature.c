@@ -0,0 +1,81 @@
+/*
+ * CPU Feature Detection Implementation
+ */
+
+#include "cpufeature.h"
+#include "cpu.h"
+#include "kprintf.h"
+#include "debug.h"
+
+unsigned int cpu_features = 0;
+
+/* Feature names for the boot log, indexed by X86_FEATURE_* */
+static const char* const feature_names[] = {
+    "fpu", "tsc", "pse", "pge", "apic", "fxsr", "sse", "sse2", "erms", "sep",
+};
+
+/* Turn on the FPU and SSE for the calling CPU */
+static void cpu_enable_sse(void) {
+    unsigned int cr0 = read_cr0();
+
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    __asm__ volatile ("fninit");
+}
+
+/* Detect the boot CPU's features and enable the FPU/SSE when present */
+void cpu_features_init(void) {
+    unsigned int max_leaf, eax, ebx, ecx, edx;
+    char line[96];
+    unsigned int len = 0;
+
+    line[0] = '\0';
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    cpu_features = 0;
+    if (edx & CPUID_1_EDX_FPU)  cpu_features |= 1u << X86_FEATURE_FPU;
+    if (edx & CPUID_1_EDX_TSC)  cpu_features |= 1u << X86_FEATURE_TSC;
+    if (edx & CPUID_1_EDX_PSE)  cpu_features |= 1u << X86_FEATURE_PSE;
+    if (edx & CPUID_1_EDX_PGE)  cpu_features |= 1u << X86_FEATURE_PGE;
+    if (edx & CPUID_1_EDX_APIC) cpu_features |= 1u << X86_FEATURE_APIC;
+    if (edx & CPUID_1_EDX_FXSR) cpu_features |= 1u << X86_FEATURE_FXSR;
+    if (edx & CPUID_1_EDX_SSE)  cpu_features |= 1u << X86_FEATURE_SSE;
+    if (edx & CPUID_1_EDX_SSE2) cpu_features |= 1u << X86_FEATURE_SSE2;
+
+    /* The first Pentium Pros (family 6, model and stepping below 3) set
+     * the SEP bit without implementing SYSENTER */
+    if ((edx & CPUID_1_EDX_SEP) &&
+        !(((eax >> 8) & 0xF) == 6 && ((eax >> 4) & 0xF) < 3 && (eax & 0xF) < 3)) {
+        cpu_features |= 1u << X86_FEATURE_SEP;
+    }
+
+    if (max_leaf >= 7) {
+        cpuid(7, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS) cpu_features |= 1u << X86_FEATURE_ERMS;
+    }
+
+    /* SSE needs FXSAVE support before CR4.OSFXSR may be set */
+    if (!cpu_has(X86_FEATURE_FXSR)) {
+        cpu_features &= ~((1u << X86_FEATURE_SSE) | (1u << X86_FEATURE_SSE2));
+    }
+    if (cpu_has(X86_FEATURE_SSE)) {
+        cpu_enable_sse();
+    }
+
+    for (unsigned int i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); i++) {
+        if (cpu_has(i) && len + 8 < sizeof(line)) {
+            len += ksnprintf(line + len, sizeof(line) - len, " %s", feature_names[i]);
+        }
+    }
+    debug_logf(LOG_INFO, "cpu: features%s", line);
+}
+
+/* Enable the FPU/SSE on an application processor */
+void cpu_features_init_ap(void) {
+    if (cpu_has(X86_FEATURE_SSE)) {
+        cpu_enable_sse();
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * CPU Feature Detection Header
+ *
+ * cpu_features_init() reads CPUID once on the boot CPU and records the
+ * features the kernel can pick implementations by (cpu_has()). When the
+ * CPU has SSE it also switches the FPU on: CR0.EM cleared, CR0.MP and
+ * CR0.NE set, CR4.OSFXSR and CR4.OSXMMEXCPT set. Application processors
+ * repeat the control-register part with cpu_features_init_ap().
+ *
+ * The compiler never generates FPU or SSE instructions for the kernel;
+ * code that uses them explicitly (string.c) brackets them with
+ * kernel_fpu_begin/end (fpu.h).
+ */
+
+#ifndef CPUFEATURE_H
+#define CPUFEATURE_H
+
+/* Features (bit numbers in the cpu_features mask) */
+#define X86_FEATURE_FPU    0
+#define X86_FEATURE_TSC    1
+#define X86_FEATURE_PSE    2
+#define X86_FEATURE_PGE    3
+#define X86_FEATURE_APIC   4
+#define X86_FEATURE_FXSR   5
+#define X86_FEATURE_SSE    6
+#define X86_FEATURE_SSE2   7
+#define X86_FEATURE_ERMS   8   /* Enhanced rep movsb/stosb */
+#define X86_FEATURE_SEP    9   /* SYSENTER/SYSEXIT */
+
+extern unsigned int cpu_features;
+
+/* Check for a feature (after cpu_features_init) */
+static inline int cpu_has(unsigned int feature) {
+    return (cpu_features >> feature) & 1;
+}
+
+/* Detect the boot CPU's features and enable the FPU/SSE when present */
+void cpu_features_init(void);
+
+/* Enable the FPU/SSE on an application processor */
+void cpu_features_init_ap(void);
+
+#endif /* CPUFEATURE_H */
@@ -9,10 +9,26 @@
 #include "debug.h"
 #include "vga.h"
 #include "serial.h"
+#include "klog.h"
+#include "idt.h"
+#include "kprintf.h"
+#include "ktime.h"
+#include "math64.h"
+#include "percpu.h"
+#include "softirq.h"
 
 /* Current log level - only messages at or above this level will be shown */
 static unsigned int current_log_level = LOG_DEBUG;
 
+/* Set once the system is going down: all output becomes synchronous */
+static volatile int panic_mode = 0;
+
+/* When set, process-context log records also wait for debug_flush_log() */
+static int log_deferred = 0;
+
+/* Set while someone drains the log ring into the sinks */
+static volatile int log_flushing = 0;
+
 /* ============================================================================
  * Initialization
  * ============================================================================
@@ -20,7 +36,29 @@ static unsigned int current_log_level = LOG_DEBUG;
 
 /* Initialize debug system (initializes serial port) */
 void debug_init(void) {
-    serial_init();
+    serial_init(SERIAL_BAUD_DEFAULT);
+}
+
+/* SOFTIRQ_LOG: write out the records interrupt handlers queued */
+static void debug_log_softirq(void) {
+    if (!log_deferred) {
+        debug_flush_log();
+    }
+}
+
+/* Switch serial output to interrupt-driven transmission (after IDT/PIC
+ * setup); records logged by interrupt handlers are written out from a
+ * softirq from here on */
+void debug_enable_irq_output(void) {
+    serial_enable_irq();
+    open_softirq(SOFTIRQ_LOG, debug_log_softirq);
+}
+
+/* Make all further output synchronous and drain anything still buffered */
+void debug_panic_mode(void) {
+    panic_mode = 1;
+    serial_set_sync(1);
+    debug_flush_log();
 }
 
 /* ============================================================================
@@ -48,14 +86,32 @@ void debug_puts(const char* str) {
 
 /* Print an unsigned integer as decimal */
 void debug_putuint(unsigned int num) {
-    vga_putuint(num);
-    serial_putuint(num);
+    char buffer[12];
+    
+    ksnprintf(buffer, sizeof(buffer), "%u", num);
+    debug_puts(buffer);
 }
 
 /* Print an unsigned integer as hexadecimal */
 void debug_puthex(unsigned int num) {
-    vga_puthex(num);
-    serial_puthex(num);
+    char buffer[12];
+    
+    ksnprintf(buffer, sizeof(buffer), "0x%X", num);
+    debug_puts(buffer);
+}
+
+/* Print a formatted line: formatted once, then handed to every sink */
+int kprintf(const char* format, ...) {
+    char buffer[DEBUG_LINE_MAX];
+    va_list args;
+    int len;
+    
+    va_start(args, format);
+    len = kvsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    
+    debug_puts(buffer);
+    return len;
 }
 
 /* Set the minimum log level */
@@ -63,18 +119,29 @@ void debug_set_level(unsigned int level) {
     current_log_level = level;
 }
 
-/* Internal logging function */
-static void debug_log_internal(unsigned int level, const char* prefix, const char* message) {
-    if (level < current_log_level) {
-        return;
-    }
+/* Get the minimum log level */
+unsigned int debug_get_level(void) {
+    return current_log_level;
+}
+
+/* Prefix printed in front of each log level */
+static const char* const log_prefixes[] = {
+    "DEBUG",
+    "INFO",
+    "WARN",
+    "ERROR",
+    "PANIC"
+};
+
+/* Write one log record to the output sinks */
+static void debug_emit_record(const struct klog_record* record) {
+    unsigned int level = record->level <= LOG_PANIC ? record->level : LOG_PANIC;
+    char line[DEBUG_LINE_MAX];
+    
+    ksnprintf(line, sizeof(line), "[%s] %s\n", log_prefixes[level], record->message);
     
     /* Output to serial port (always) */
-    serial_puts("[");
-    serial_puts(prefix);
-    serial_puts("] ");
-    serial_puts(message);
-    serial_puts("\n");
+    serial_puts(line);
     
     /* Output to VGA (if level is INFO or higher) */
     if (level >= LOG_INFO) {
@@ -91,68 +158,148 @@ static void debug_log_internal(unsigned int level, const char* prefix, const cha
         
         unsigned char old_color = vga_get_color();
         vga_set_color(color);
-        vga_puts("[");
-        vga_puts(prefix);
-        vga_puts("] ");
-        vga_puts(message);
-        vga_puts("\n");
+        vga_puts(line);
         vga_set_color(old_color);
     }
 }
 
-/* Debug logging macros */
-#define debug_log(level, prefix, fmt, ...) do { \
-    char buffer[256]; \
-    debug_sprintf(buffer, fmt, ##__VA_ARGS__); \
-    debug_log_internal(level, prefix, buffer); \
-} while(0)
-
-/* Simple sprintf implementation for debug messages */
-void debug_sprintf(char* buffer, const char* format, ...) {
-    /* For now, we'll implement a simple version */
-    /* This is a placeholder - we'll expand it as needed */
-    unsigned int i = 0;
-    unsigned int j = 0;
-    
-    while (format[i] != '\0' && j < 255) {
-        if (format[i] == '%' && format[i + 1] != '\0') {
-            i++;
-            /* Handle format specifiers - simplified version */
-            if (format[i] == 's') {
-                /* String - we'll need to pass this differently */
-                buffer[j++] = '?';
-            } else if (format[i] == 'd' || format[i] == 'u') {
-                /* Integer - we'll need to pass this differently */
-                buffer[j++] = '?';
-            } else if (format[i] == 'x') {
-                /* Hex - we'll need to pass this differently */
-                buffer[j++] = '?';
-            } else {
-                buffer[j++] = format[i];
-            }
-        } else {
-            buffer[j++] = format[i];
+/* Drain the log ring into the output sinks
+ * 
+ * One flusher at a time, so a softirq or a preempting thread cannot cut
+ * into a line being written: whoever finds the log being flushed leaves
+ * its records to the current flusher (except when going down).
+ */
+void debug_flush_log(void) {
+    struct klog_record record;
+    
+    for (;;) {
+        if (__atomic_exchange_n(&log_flushing, 1, __ATOMIC_ACQUIRE) && !panic_mode) {
+            return;
+        }
+        while (klog_read(&record)) {
+            debug_emit_record(&record);
+        }
+        __atomic_store_n(&log_flushing, 0, __ATOMIC_RELEASE);
+        
+        /* A record that came in after the last read found us busy */
+        if (!klog_pending()) {
+            return;
         }
-        i++;
     }
-    buffer[j] = '\0';
 }
 
-/* Simplified logging functions (without printf-style formatting for now) */
+/* Check whether log records are waiting to be flushed */
+int debug_log_pending(void) {
+    return klog_pending();
+}
+
+/* Defer flushing of process-context log records to the idle loop */
+void debug_set_log_deferred(int deferred) {
+    log_deferred = deferred;
+}
+
+/* Internal logging function
+ * 
+ * The record always goes into the log ring first. It is flushed right
+ * away from process context (unless deferred), but never from inside an
+ * interrupt or exception handler - those records are written out by the
+ * SOFTIRQ_LOG bottom half once the handler has returned, or by the next
+ * flush.
+ * Only the boot CPU drives the output sinks (VGA and serial are not
+ * SMP-safe); records written on other CPUs are flushed by the boot CPU.
+ */
+static void debug_log_internal(unsigned int level, const char* message) {
+    if (level < current_log_level) {
+        return;
+    }
+    
+    klog_write(level, message);
+    
+    if (smp_processor_id() != 0) {
+        return;
+    }
+    
+    if (panic_mode || (!log_deferred && !in_interrupt())) {
+        debug_flush_log();
+    } else if (in_interrupt()) {
+        raise_softirq(SOFTIRQ_LOG);
+    }
+}
+
+/* Print one retained record with its timestamp (dmesg format) */
+static void debug_dmesg_record(const struct klog_record* record) {
+    unsigned int level = record->level <= LOG_PANIC ? record->level : LOG_PANIC;
+    char buffer[DEBUG_LINE_MAX];
+    
+    if (ktime_tsc_khz() != 0) {
+        /* Seconds since the clock was calibrated (earlier records show 0) */
+        unsigned int ns;
+        unsigned int sec = (unsigned int)div_u64_rem(ktime_tsc_to_ns(record->timestamp),
+                                                     NSEC_PER_SEC, &ns);
+        ksnprintf(buffer, sizeof(buffer), "[%5u.%06u] [%s] %s\n",
+                  sec, ns / NSEC_PER_USEC, log_prefixes[level], record->message);
+    } else {
+        ksnprintf(buffer, sizeof(buffer), "[%016llx] [%s] %s\n",
+                  record->timestamp, log_prefixes[level], record->message);
+    }
+    serial_puts(buffer);
+}
+
+/* Dump every record still held in the log ring to serial */
+void debug_dmesg(void) {
+    struct klog_stats stats;
+    char buffer[DEBUG_LINE_MAX];
+    
+    klog_get_stats(&stats);
+    serial_puts(ktime_tsc_khz() != 0 ? "---- dmesg (timestamps are seconds) ----\n"
+                                     : "---- dmesg (timestamps are TSC cycles) ----\n");
+    klog_dump(debug_dmesg_record);
+    ksnprintf(buffer, sizeof(buffer),
+              "---- written %u, flushed %u, overwritten %u, dropped %u ----\n",
+              stats.written, stats.flushed, stats.overwritten, stats.dropped);
+    serial_puts(buffer);
+}
+
+/* Format a log message and queue it at the given level */
+void debug_logf(unsigned int level, const char* format, ...) {
+    char buffer[KLOG_MESSAGE_LEN];
+    va_list args;
+    
+    if (level < current_log_level) {
+        return;
+    }
+    
+    va_start(args, format);
+    kvsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    
+    debug_log_internal(level, buffer);
+}
+
+/* sprintf for debug messages (output is limited to DEBUG_LINE_MAX bytes) */
+void debug_sprintf(char* buffer, const char* format, ...) {
+    va_list args;
+    
+    va_start(args, format);
+    kvsnprintf(buffer, DEBUG_LINE_MAX, format, args);
+    va_end(args);
+}
+
+/* Simplified logging functions (plain messages, see debug_logf for formatting) */
 void debug_debug(const char* message) {
-    debug_log_internal(LOG_DEBUG, "DEBUG", message);
+    debug_log_internal(LOG_DEBUG, message);
 }
 
 void debug_info(const char* message) {
-    debug_log_internal(LOG_INFO, "INFO", message);
+    debug_log_internal(LOG_INFO, message);
 }
 
 void debug_warn(const char* message) {
-    debug_log_internal(LOG_WARN, "WARN", message);
+    debug_log_internal(LOG_WARN, message);
 }
 
 void debug_error(const char* message) {
-    debug_log_internal(LOG_ERROR, "ERROR", message);
+    debug_log_internal(LOG_ERROR, message);
 }
 
 
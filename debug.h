@@ -9,6 +9,11 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
+#include "kprintf.h"
+
+/* Longest line formatted by kprintf()/debug_sprintf() (including the NUL) */
+#define DEBUG_LINE_MAX 256
+
 /* Log levels */
 #define LOG_DEBUG   0
 #define LOG_INFO    1
@@ -45,6 +50,13 @@
 /* Initialize debug system (initializes serial port) */
 void debug_init(void);
 
+/* Switch serial output to interrupt-driven transmission (after IDT/PIC setup) */
+void debug_enable_irq_output(void);
+
+/* Make all further output synchronous and drain anything still buffered
+ * (used by panic/halt, where interrupts will never be serviced again) */
+void debug_panic_mode(void);
+
 /* ============================================================================
  * General Printing Functions
  * ============================================================================
@@ -67,6 +79,10 @@ void debug_putuint(unsigned int num);
 /* Print an unsigned integer as hexadecimal */
 void debug_puthex(unsigned int num);
 
+/* Print a formatted string (see kprintf.h for the supported conversions).
+ * The line is formatted once and the same buffer goes to every sink. */
+int kprintf(const char* format, ...) KPRINTF_FORMAT(1, 2);
+
 /* ============================================================================
  * Debug Logging Functions
  * ============================================================================
@@ -75,14 +91,41 @@ void debug_puthex(unsigned int num);
 /* Set the minimum log level */
 void debug_set_level(unsigned int level);
 
+/* Get the minimum log level */
+unsigned int debug_get_level(void);
+
 /* Simplified logging functions */
 void debug_debug(const char* message);
 void debug_info(const char* message);
 void debug_warn(const char* message);
 void debug_error(const char* message);
 
-/* Simple sprintf implementation for debug messages */
-void debug_sprintf(char* buffer, const char* format, ...);
+/* ============================================================================
+ * Log Ring
+ * ============================================================================
+ * 
+ * Log records are stored in a lock-free ring (klog.h) and written to VGA
+ * and serial when the ring is flushed. Records logged from interrupt or
+ * exception handlers are never flushed in place.
+ */
+
+/* Drain the log ring into the output sinks (idle loop, or on demand) */
+void debug_flush_log(void);
+
+/* Check whether log records are waiting to be flushed */
+int debug_log_pending(void);
+
+/* Defer flushing of process-context log records to the idle loop */
+void debug_set_log_deferred(int deferred);
+
+/* Dump every record still held in the log ring to serial (works after a crash) */
+void debug_dmesg(void);
+
+/* Log a formatted message at the given level (LOG_DEBUG .. LOG_ERROR) */
+void debug_logf(unsigned int level, const char* format, ...) KPRINTF_FORMAT(2, 3);
+
+/* sprintf for debug messages (output is limited to DEBUG_LINE_MAX bytes) */
+void debug_sprintf(char* buffer, const char* format, ...) KPRINTF_FORMAT(2, 3);
 
 #endif /* DEBUG_H */
 
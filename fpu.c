@@ -0,0 +1,267 @@
+/*
+ * Lazy FPU/SSE Context Management Implementation
+ *
+ * The per-CPU ownership fields live in struct percpu; everything here
+ * runs on the calling CPU only, with interrupts off wherever a handler
+ * could otherwise see the fields half-updated.
+ */
+
+#include "fpu.h"
+#include "cpufeature.h"
+#include "percpu.h"
+#include "sched.h"
+#include "idt.h"
+#include "cpu.h"
+#include "io.h"
+#include "kprintf.h"
+#include "debug.h"
+
+/* Per-CPU counters */
+struct fpu_cpu {
+    struct fpu_stats stats;
+} __cacheline_aligned;
+
+static struct fpu_cpu fpu_cpus[NR_CPUS];
+
+/* Context of each CPU's boot thread */
+static struct fpu boot_fpu[NR_CPUS];
+
+static int fpu_present = 0;
+static int fpu_fxsr = 0;
+
+/* ============================================================================
+ * Register State
+ * ============================================================================
+ */
+
+static void fpu_save(struct fpu* fpu) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxsave %0" : "=m"(fpu->state));
+    } else {
+        /* FNSAVE also reinitializes the FPU, which is fine: the
+         * registers are about to be reloaded or handed to the kernel */
+        __asm__ volatile ("fnsave %0" : "=m"(fpu->state));
+    }
+    fpu->used = 1;
+}
+
+static void fpu_restore(const struct fpu* fpu) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxrstor %0" : : "m"(fpu->state));
+    } else {
+        __asm__ volatile ("frstor %0" : : "m"(fpu->state));
+    }
+}
+
+/* Registers as a fresh context expects them */
+static void fpu_fresh(void) {
+    unsigned int mxcsr = FPU_MXCSR_DEFAULT;
+
+    __asm__ volatile ("fninit");
+    if (cpu_has(X86_FEATURE_SSE)) {
+        __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+    }
+}
+
+/* ============================================================================
+ * Device Not Available (#NM)
+ * ============================================================================
+ */
+
+/* The current context touched the FPU with CR0.TS set: give it the
+ * registers, parking the previous owner's state */
+static void fpu_nm_handler(struct trap_frame* frame) {
+    struct percpu* cpu = this_cpu();
+    struct fpu_stats* stats = &fpu_cpus[cpu->cpu].stats;
+    struct fpu* next = cpu->fpu_current;
+
+    stats->nm_traps++;
+    if (!fpu_present || next == 0 || cpu->fpu_kernel) {
+        /* No FPU, or FPU use outside any context: a bug */
+        exception_handler(frame);
+        return;
+    }
+
+    clts();
+    if (cpu->fpu_owner == next) {
+        return;
+    }
+    if (cpu->fpu_owner != 0) {
+        fpu_save(cpu->fpu_owner);
+        stats->saves++;
+    }
+    if (next->used) {
+        fpu_restore(next);
+        stats->restores++;
+    } else {
+        fpu_fresh();
+        stats->inits++;
+    }
+    cpu->fpu_owner = next;
+}
+
+/* ============================================================================
+ * Contexts
+ * ============================================================================
+ */
+
+/* Prepare a new context */
+void fpu_context_init(struct fpu* fpu) {
+    fpu->used = 0;
+}
+
+/* Make `next` the current context */
+void fpu_switch(struct fpu* next) {
+    struct percpu* cpu = this_cpu();
+    struct fpu_stats* stats = &fpu_cpus[cpu->cpu].stats;
+    unsigned int flags;
+
+    if (next == cpu->fpu_current || !fpu_present) {
+        cpu->fpu_current = next;
+        return;
+    }
+
+    flags = irq_save();
+    cpu->fpu_current = next;
+    stats->switches++;
+    if (next != 0 && cpu->fpu_owner == next) {
+        clts();
+        stats->lazy_hits++;
+    } else {
+        stts();
+    }
+    irq_restore(flags);
+}
+
+/* Forget a context that is going away */
+void fpu_release(struct fpu* fpu) {
+    struct percpu* cpu = this_cpu();
+    unsigned int flags = irq_save();
+
+    if (cpu->fpu_owner == fpu) {
+        cpu->fpu_owner = 0;
+    }
+    if (cpu->fpu_current == fpu) {
+        cpu->fpu_current = 0;
+    }
+    irq_restore(flags);
+}
+
+/* ============================================================================
+ * Kernel SIMD Sections
+ * ============================================================================
+ */
+
+/* Check whether kernel_fpu_begin() may be called here */
+int kernel_fpu_usable(void) {
+    return fpu_present && !this_cpu()->fpu_kernel;
+}
+
+/* Take the registers for kernel code */
+void kernel_fpu_begin(void) {
+    struct percpu* cpu = this_cpu();
+    struct fpu_stats* stats = &fpu_cpus[cpu->cpu].stats;
+    unsigned int flags;
+
+    preempt_disable();
+    flags = irq_save();
+    clts();
+    if (cpu->fpu_owner != 0) {
+        fpu_save(cpu->fpu_owner);
+        cpu->fpu_owner = 0;
+        stats->saves++;
+        stats->kernel_saves++;
+    }
+    cpu->fpu_kernel = 1;
+    stats->kernel_sections++;
+    irq_restore(flags);
+}
+
+/* Give the registers back: the current context reloads its state on
+ * its next FPU instruction */
+void kernel_fpu_end(void) {
+    struct percpu* cpu = this_cpu();
+    unsigned int flags = irq_save();
+
+    cpu->fpu_kernel = 0;
+    if (cpu->fpu_current != 0) {
+        stts();
+    }
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================
+ */
+
+/* The calling CPU starts in its boot context, with nothing loaded */
+static void fpu_init_cpu(void) {
+    struct percpu* cpu = this_cpu();
+
+    cpu->fpu_kernel = 0;
+    cpu->fpu_owner = 0;
+    cpu->fpu_current = 0;
+    if (!fpu_present) {
+        return;
+    }
+    fpu_context_init(&boot_fpu[cpu->cpu]);
+    cpu->fpu_current = &boot_fpu[cpu->cpu];
+    stts();
+}
+
+/* Install the #NM handler and set up the boot CPU */
+void fpu_init(void) {
+    fpu_present = cpu_has(X86_FEATURE_FPU);
+    fpu_fxsr = cpu_has(X86_FEATURE_FXSR) && cpu_has(X86_FEATURE_SSE);
+
+    if (fpu_present) {
+        idt_set_handler(VECTOR_NO_COPROCESSOR, fpu_nm_handler);
+    }
+    fpu_init_cpu();
+
+    debug_logf(LOG_INFO, "fpu: %s, lazy switching via #NM",
+               !fpu_present ? "no FPU" : fpu_fxsr ? "fxsave 512 bytes" : "fnsave 108 bytes");
+}
+
+/* Set up an application processor */
+void fpu_init_ap(void) {
+    fpu_init_cpu();
+}
+
+/* ============================================================================
+ * Statistics
+ * ============================================================================
+ */
+
+/* Get a snapshot of the FPU statistics */
+void fpu_get_stats(struct fpu_stats* stats) {
+    *stats = (struct fpu_stats){ 0 };
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct fpu_stats* s = &fpu_cpus[i].stats;
+        stats->switches += s->switches;
+        stats->lazy_hits += s->lazy_hits;
+        stats->nm_traps += s->nm_traps;
+        stats->saves += s->saves;
+        stats->restores += s->restores;
+        stats->inits += s->inits;
+        stats->kernel_sections += s->kernel_sections;
+        stats->kernel_saves += s->kernel_saves;
+    }
+}
+
+/* Print the FPU statistics. An eager scheme would save and restore on
+ * every switch; the difference is the work the lazy one skipped. */
+void fpu_dump_stats(void) {
+    struct fpu_stats s;
+    unsigned int eager;
+
+    fpu_get_stats(&s);
+    eager = 2 * s.switches;
+    kprintf("FPU: %u switches (%u kept their registers), %u #NM, %u saves, %u restores, %u inits\n",
+            s.switches, s.lazy_hits, s.nm_traps, s.saves, s.restores, s.inits);
+    kprintf("  kernel sections %u (%u parked a context), saves+restores avoided %u of %u\n",
+            s.kernel_sections, s.kernel_saves,
+            eager > s.saves + s.restores ? eager - (s.saves + s.restores) : 0, eager);
+}
@@ -0,0 +1,82 @@
+/*
+ * Lazy FPU/SSE Context Management Header
+ *
+ * An FPU context (struct fpu) holds the x87/SSE register state of one
+ * thread of execution: FXSAVE's 512-byte image, or FNSAVE's on CPUs
+ * without FXSR. Each CPU has a current context (its boot context until a
+ * scheduler switches others in) and an owner: the context whose state
+ * is actually in the registers right now.
+ *
+ * Switching contexts never saves or restores anything. fpu_switch() only
+ * sets CR0.TS when the incoming context is not the owner; its first FPU
+ * or SSE instruction then raises #NM, and the handler saves the owner's
+ * state and loads the current context's. A context that never touches
+ * the FPU costs nothing, and one that runs alone keeps its registers.
+ *
+ * Kernel code uses SIMD only between kernel_fpu_begin() and
+ * kernel_fpu_end(), which park the owner's state first and keep the
+ * thread from being preempted (sched.h). Such a section must not block.
+ * It may be interrupted; handlers that want SIMD must check
+ * kernel_fpu_usable() and take an integer path when it is 0 (an
+ * interrupted section, or no FPU at all).
+ *
+ * A context's state lives in the registers of the CPU it last ran on, so
+ * contexts do not migrate between CPUs.
+ */
+
+#ifndef FPU_H
+#define FPU_H
+
+#define FPU_STATE_SIZE   512
+
+/* Default MXCSR: all SIMD exceptions masked, round to nearest */
+#define FPU_MXCSR_DEFAULT 0x1F80
+
+/* Saved register state of one context */
+struct fpu {
+    unsigned char state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+    unsigned int used;           /* `state` is valid (else fresh registers on first use) */
+};
+
+/* FPU statistics, summed over all CPUs */
+struct fpu_stats {
+    unsigned int switches;       /* fpu_switch() to a different context */
+    unsigned int lazy_hits;      /* ... to the owner: registers still valid */
+    unsigned int nm_traps;       /* #NM taken */
+    unsigned int saves;          /* FXSAVE of a context's state */
+    unsigned int restores;       /* FXRSTOR of a context's state */
+    unsigned int inits;          /* First use: fresh registers instead of a restore */
+    unsigned int kernel_sections;/* kernel_fpu_begin/end pairs */
+    unsigned int kernel_saves;   /* ... that had to park a context's state */
+};
+
+/* Install the #NM handler and set up the boot CPU's context (after
+ * idt_init and cpu_features_init) */
+void fpu_init(void);
+
+/* Set up an application processor's context */
+void fpu_init_ap(void);
+
+/* Prepare a new context: fresh registers on its first FPU instruction */
+void fpu_context_init(struct fpu* fpu);
+
+/* Make `next` the calling CPU's current context (lazy: see above) */
+void fpu_switch(struct fpu* next);
+
+/* Forget a context that is going away, without saving its state */
+void fpu_release(struct fpu* fpu);
+
+/* Check whether kernel_fpu_begin() may be called here */
+int kernel_fpu_usable(void);
+
+/* Bracket kernel code that uses FPU/SSE registers */
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+/* Get a snapshot of the FPU statistics */
+void fpu_get_stats(struct fpu_stats* stats);
+
+/* Print the FPU statistics */
+void fpu_dump_stats(void);
+
+#endif /* FPU_H */
@@ -0,0 +1,56 @@
+/*
+ * Global Descriptor Table (GDT) Implementation
+ */
+
+#include "gdt.h"
+#include "percpu.h"
+
+/* Fill one descriptor */
+static void gdt_set_entry(struct gdt_entry* entry, unsigned int base, unsigned int limit,
+                          unsigned char access, unsigned char flags) {
+    entry->limit_low = (unsigned short)(limit & 0xFFFF);
+    entry->base_low = (unsigned short)(base & 0xFFFF);
+    entry->base_mid = (unsigned char)((base >> 16) & 0xFF);
+    entry->access = access;
+    entry->limit_flags = (unsigned char)(((limit >> 16) & 0x0F) | (flags << 4));
+    entry->base_high = (unsigned char)((base >> 24) & 0xFF);
+}
+
+/* Build, load and activate the GDT and TSS of the calling CPU */
+void gdt_init_cpu(struct percpu* cpu) {
+    struct gdt_register gdtr;
+    struct tss* tss = &cpu->tss;
+
+    /* Ring-0 stack: set per thread by the scheduler (sched.c) */
+    *tss = (struct tss){ 0 };
+    tss->ss0 = KERNEL_DS;
+    tss->iomap_base = sizeof(struct tss);
+
+    gdt_set_entry(&cpu->gdt[0], 0, 0, 0, 0);
+    gdt_set_entry(&cpu->gdt[KERNEL_CS / 8], 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAGS_FLAT);
+    gdt_set_entry(&cpu->gdt[KERNEL_DS / 8], 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAGS_FLAT);
+    gdt_set_entry(&cpu->gdt[USER_CS / 8], 0, 0xFFFFF, GDT_ACCESS_USER_CODE, GDT_FLAGS_FLAT);
+    gdt_set_entry(&cpu->gdt[USER_DS / 8], 0, 0xFFFFF, GDT_ACCESS_USER_DATA, GDT_FLAGS_FLAT);
+    gdt_set_entry(&cpu->gdt[GDT_PERCPU_SEL / 8], (unsigned int)cpu, sizeof(struct percpu) - 1,
+                  GDT_ACCESS_DATA, GDT_FLAGS_BYTE);
+    gdt_set_entry(&cpu->gdt[GDT_TSS_SEL / 8], (unsigned int)tss, sizeof(struct tss) - 1,
+                  GDT_ACCESS_TSS, 0);
+
+    gdtr.limit = sizeof(cpu->gdt) - 1;
+    gdtr.base = (unsigned int)cpu->gdt;
+
+    /* Load the table, reload CS with a far jump and the data segments */
+    __asm__ volatile ("lgdt %0\n"
+                      "ljmp %1, $1f\n"
+                      "1:\n"
+                      "movw %w2, %%ds\n"
+                      "movw %w2, %%es\n"
+                      "movw %w2, %%ss\n"
+                      "movw %w3, %%fs\n"
+                      "movw %w4, %%gs\n"
+                      :
+                      : "m"(gdtr), "i"(KERNEL_CS), "r"(KERNEL_DS), "r"(0), "r"(GDT_PERCPU_SEL)
+                      : "memory");
+
+    __asm__ volatile ("ltr %w0" : : "r"(GDT_TSS_SEL));
+}
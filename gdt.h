@@ -0,0 +1,88 @@
+/*
+ * Global Descriptor Table (GDT) Header
+ *
+ * Every CPU gets its own GDT, stored in its per-CPU area (percpu.h). All
+ * of them share the same layout, so selectors are identical on every CPU:
+ *
+ *   0x00  null
+ *   0x08  kernel code (flat 4 GB)
+ *   0x10  kernel data (flat 4 GB)
+ *   0x18  user code (flat 4 GB, ring 3)
+ *   0x20  user data (flat 4 GB, ring 3)
+ *   0x28  per-CPU data: base = this CPU's struct percpu, loaded into GS
+ *   0x30  TSS: this CPU's struct tss
+ *
+ * Only the bases of the per-CPU and TSS descriptors differ, which is how
+ * GS-relative accesses (this_cpu()) find the data of the CPU they run on.
+ *
+ * The order of the first five is fixed by SYSENTER/SYSEXIT (syscall.h):
+ * kernel data must follow kernel code, and user code and data must be
+ * the next two descriptors.
+ *
+ * The TSS is only used for its ring-0 stack (ss0:esp0), which the CPU
+ * switches to when an interrupt or system call leaves ring 3. It has no
+ * I/O permission bitmap, so ring 3 has no port access.
+ */
+
+#ifndef GDT_H
+#define GDT_H
+
+/* Segment selectors */
+#define KERNEL_CS       0x08
+#define KERNEL_DS       0x10
+#define USER_CS         0x1B  /* Descriptor 0x18, RPL 3 */
+#define USER_DS         0x23  /* Descriptor 0x20, RPL 3 */
+#define GDT_PERCPU_SEL  0x28
+#define GDT_TSS_SEL     0x30
+
+/* Number of descriptors */
+#define GDT_ENTRIES     7
+
+/* Access byte: present, ring 0, code/data descriptor */
+#define GDT_ACCESS_CODE  0x9A  /* Execute/read */
+#define GDT_ACCESS_DATA  0x92  /* Read/write */
+#define GDT_ACCESS_USER_CODE  0xFA  /* Execute/read, ring 3 */
+#define GDT_ACCESS_USER_DATA  0xF2  /* Read/write, ring 3 */
+#define GDT_ACCESS_TSS   0x89  /* Available 32-bit TSS */
+
+/* Flags nibble: 4 KB granularity, 32-bit */
+#define GDT_FLAGS_FLAT   0xC
+#define GDT_FLAGS_BYTE   0x4  /* Byte granularity, 32-bit */
+
+/* Segment descriptor (8 bytes) */
+struct gdt_entry {
+    unsigned short limit_low;
+    unsigned short base_low;
+    unsigned char base_mid;
+    unsigned char access;
+    unsigned char limit_flags;   /* Limit bits 16-19, flags in the high nibble */
+    unsigned char base_high;
+} __attribute__((packed));
+
+/* 32-bit task state segment (hardware task switching is not used) */
+struct tss {
+    unsigned int link;
+    unsigned int esp0;           /* Kernel stack for entries from ring 3 */
+    unsigned int ss0;
+    unsigned int esp1, ss1, esp2, ss2;
+    unsigned int cr3, eip, eflags;
+    unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned int es, cs, ss, ds, fs, gs;
+    unsigned int ldt;
+    unsigned short trap;
+    unsigned short iomap_base;   /* Past the limit: no I/O bitmap */
+} __attribute__((packed));
+
+/* GDTR pseudo-descriptor */
+struct gdt_register {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed));
+
+struct percpu;
+
+/* Build the GDT and TSS inside `cpu`, load them and reload every segment
+ * register (GS = GDT_PERCPU_SEL). Must run on the CPU that owns `cpu`. */
+void gdt_init_cpu(struct percpu* cpu);
+
+#endif /* GDT_H */
@@ -6,13 +6,17 @@
 
 #include "idt.h"
 #include "debug.h"
-#include "pic.h"
+#include "irqstat.h"
+#include "cpu.h"
+#include "percpu.h"
+#include "sched.h"
+#include "softirq.h"
+#include "user.h"
 
 /* Forward declaration for halt() */
 extern void halt(void);
 
 /* IDT with 256 entries */
-#define IDT_ENTRIES 256
 static struct idt_entry idt[IDT_ENTRIES];
 static struct idt_register idt_reg;
 
@@ -52,83 +56,103 @@ const char* exception_names[] = {
     "Reserved"
 };
 
-/* Forward declarations for interrupt handler stubs */
-/* These are defined in assembly (we'll create them) */
-extern void isr0(void);   /* Division by zero */
-extern void isr1(void);   /* Debug */
-extern void isr2(void);   /* Non-maskable interrupt */
-extern void isr3(void);   /* Breakpoint */
-extern void isr4(void);   /* Overflow */
-extern void isr5(void);   /* Bound range exceeded */
-extern void isr6(void);   /* Invalid opcode */
-extern void isr7(void);   /* Device not available */
-extern void isr8(void);   /* Double fault */
-extern void isr9(void);   /* Coprocessor segment overrun */
-extern void isr10(void);  /* Invalid TSS */
-extern void isr11(void);  /* Segment not present */
-extern void isr12(void);  /* Stack fault */
-extern void isr13(void);  /* General protection fault */
-extern void isr14(void);  /* Page fault */
-extern void isr15(void);  /* Reserved */
-extern void isr16(void);  /* x87 FPU error */
-extern void isr17(void);  /* Alignment check */
-extern void isr18(void);  /* Machine check */
-extern void isr19(void);  /* SIMD floating point exception */
-/* We'll add more as needed */
-
-/* IRQ handlers (32-47) */
-extern void isr32(void);  /* IRQ 0 - Timer */
-extern void isr33(void);  /* IRQ 1 - Keyboard */
-extern void isr34(void);  /* IRQ 2 - Cascade */
-extern void isr35(void);  /* IRQ 3 - COM2 */
-extern void isr36(void);  /* IRQ 4 - COM1 */
-extern void isr37(void);  /* IRQ 5 - LPT2 */
-extern void isr38(void);  /* IRQ 6 - Floppy */
-extern void isr39(void);  /* IRQ 7 - LPT1 */
-extern void isr40(void);  /* IRQ 8 - RTC */
-extern void isr41(void);  /* IRQ 9 - Free */
-extern void isr42(void);  /* IRQ 10 - Free */
-extern void isr43(void);  /* IRQ 11 - Free */
-extern void isr44(void);  /* IRQ 12 - PS/2 Mouse */
-extern void isr45(void);  /* IRQ 13 - FPU */
-extern void isr46(void);  /* IRQ 14 - Primary ATA */
-extern void isr47(void);  /* IRQ 15 - Secondary ATA */
-
-/* Generic exception handler (called from assembly stubs) */
-void exception_handler(unsigned int interrupt_num) {
-    debug_error("Exception occurred!");
+/* C handler for every vector, filled in by idt_init() */
+static trap_handler_t trap_handlers[IDT_ENTRIES];
+
+/* Check whether the CPU is currently running an interrupt or exception handler
+ * (the nesting depth is per CPU, see struct percpu) */
+int in_interrupt(void) {
+    return this_cpu()->interrupt_nesting != 0;
+}
+
+/* Print the saved register state of a trap frame */
+static void dump_trap_frame(const struct trap_frame* frame) {
+    kprintf("EIP=%08x CS=%04x EFLAGS=%08x ERR=%08x CR2=%08x\n",
+            frame->eip, frame->cs, frame->eflags, frame->error_code, frame->cr2);
+    kprintf("EAX=%08x EBX=%08x ECX=%08x EDX=%08x\n",
+            frame->eax, frame->ebx, frame->ecx, frame->edx);
+    /* pusha saved ESP after the segment registers, vector, error code and
+     * EIP/CS/EFLAGS were pushed: 9 words above the interrupted stack */
+    kprintf("ESI=%08x EDI=%08x EBP=%08x ESP=%08x\n",
+            frame->esi, frame->edi, frame->ebp, frame->esp_dummy + 36);
+}
+
+/* Generic exception handler (default for vectors 0-31) */
+void exception_handler(struct trap_frame* frame) {
+    unsigned int vector = frame->vector;
+    
+    /* Debug and breakpoint traps are harmless: report and resume */
+    if (vector == VECTOR_DEBUG || vector == VECTOR_BREAKPOINT) {
+        debug_logf(LOG_INFO, "Exception: %s (%u) at %08x, resuming",
+                   exception_names[vector], vector, frame->eip);
+        return;
+    }
     
-    if (interrupt_num < 32) {
-        debug_puts("Exception: ");
-        debug_puts(exception_names[interrupt_num]);
-        debug_puts(" (");
-        debug_putuint(interrupt_num);
-        debug_puts(")\n");
-    } else {
-        debug_puts("Interrupt: ");
-        debug_putuint(interrupt_num);
-        debug_puts("\n");
+    /* A user task only kills itself (user.h) */
+    if (user_fault(frame) == 0) {
+        return;
     }
     
-    /* For now, we'll halt on exceptions */
-    /* Later we can add proper error recovery */
+    /* Anything else in the kernel is fatal: switch output to synchronous mode */
+    debug_panic_mode();
+    debug_error("Exception occurred!");
+    kprintf("Exception: %s (%u)\n", exception_names[vector], vector);
+    dump_trap_frame(frame);
+    
+    /* Later we can add proper error recovery by registering a handler
+     * with idt_set_handler() - returning from it resumes the faulting code */
     halt();
 }
 
-/* IRQ handler (called from assembly stubs for IRQs 32-47) */
-void irq_handler(unsigned int interrupt_num) {
-    /* Convert interrupt vector to IRQ number */
-    unsigned char irq = interrupt_num - PIC_IRQ_BASE;
+/* Handler for vectors nobody claimed */
+static void unhandled_interrupt(struct trap_frame* frame) {
+    debug_logf(LOG_WARN, "Unhandled interrupt vector %u", frame->vector);
+}
+
+/* Common C entry point, called by isr_common for every vector */
+void interrupt_dispatch(struct trap_frame* frame) {
+    unsigned int vector = frame->vector & (IDT_ENTRIES - 1);
+    
+#if CONFIG_IRQSTAT
+    unsigned long long handler_start = rdtsc();
+#endif
+    
+    struct percpu* cpu = this_cpu();
+    struct trap_frame* outer_frame = cpu->irq_frame;
     
-    /* For now, just print the IRQ */
-    debug_info("IRQ received: ");
-    debug_putuint(irq);
-    debug_puts("\n");
+    cpu->interrupt_nesting++;
+    cpu->irq_frame = frame;
+    trap_handlers[vector](frame);
+    cpu->irq_frame = outer_frame;
+    cpu->interrupt_nesting--;
     
-    /* Send End of Interrupt to PIC */
-    pic_send_eoi(irq);
+#if CONFIG_IRQSTAT
+    unsigned long long handler_end = rdtsc();
+    frame->handler_exit_tsc = handler_end;
+    irqstat_record(vector, frame->entry_tsc, handler_start, handler_end);
+#endif
     
-    /* Note: We return from interrupt here (handled by assembly stub) */
+    /* Leaving the outermost handler: run the bottom halves it raised,
+     * then another thread if one is due */
+    if (cpu->interrupt_nesting == 0) {
+        int ran = softirq_irq_exit(frame);
+        
+        if (sched_irq_exit(frame) || ran) {
+#if CONFIG_IRQSTAT
+            /* Time the exit from here, not from before the softirqs and
+             * other threads ran */
+            frame->handler_exit_tsc = rdtsc();
+#endif
+        }
+    }
+}
+
+/* Default dispatch target for a vector */
+static trap_handler_t default_handler(unsigned int vector) {
+    if (vector < 32) {
+        return exception_handler;
+    }
+    return unhandled_interrupt;
 }
 
 /* Set an IDT entry */
@@ -146,62 +170,30 @@ void idt_init(void) {
     idt_reg.limit = sizeof(struct idt_entry) * IDT_ENTRIES - 1;
     idt_reg.base = (unsigned int)&idt;
     
-    /* Clear all IDT entries first */
-    unsigned int i;
-    for (i = 0; i < IDT_ENTRIES; i++) {
-        idt_set_entry(i, 0, 0, 0);
-    }
-    
-    /* Set up exception handlers (0-31) */
+    /* Point every gate at its entry stub and install the default handlers */
     /* Flags: 0x8E = Present (bit 7), DPL 00 (bits 6-5), 32-bit interrupt gate (bits 4-0) */
     /* Selector: 0x08 = Kernel code segment (set up by GRUB) */
-    idt_set_entry(0, (unsigned int)isr0, 0x08, 0x8E);
-    idt_set_entry(1, (unsigned int)isr1, 0x08, 0x8E);
-    idt_set_entry(2, (unsigned int)isr2, 0x08, 0x8E);
-    idt_set_entry(3, (unsigned int)isr3, 0x08, 0x8E);
-    idt_set_entry(4, (unsigned int)isr4, 0x08, 0x8E);
-    idt_set_entry(5, (unsigned int)isr5, 0x08, 0x8E);
-    idt_set_entry(6, (unsigned int)isr6, 0x08, 0x8E);
-    idt_set_entry(7, (unsigned int)isr7, 0x08, 0x8E);
-    idt_set_entry(8, (unsigned int)isr8, 0x08, 0x8E);
-    idt_set_entry(9, (unsigned int)isr9, 0x08, 0x8E);
-    idt_set_entry(10, (unsigned int)isr10, 0x08, 0x8E);
-    idt_set_entry(11, (unsigned int)isr11, 0x08, 0x8E);
-    idt_set_entry(12, (unsigned int)isr12, 0x08, 0x8E);
-    idt_set_entry(13, (unsigned int)isr13, 0x08, 0x8E);
-    idt_set_entry(14, (unsigned int)isr14, 0x08, 0x8E);
-    idt_set_entry(15, (unsigned int)isr15, 0x08, 0x8E);
-    idt_set_entry(16, (unsigned int)isr16, 0x08, 0x8E);
-    idt_set_entry(17, (unsigned int)isr17, 0x08, 0x8E);
-    idt_set_entry(18, (unsigned int)isr18, 0x08, 0x8E);
-    idt_set_entry(19, (unsigned int)isr19, 0x08, 0x8E);
-    
-    /* Set up IRQ handlers (32-47) */
-    idt_set_entry(32, (unsigned int)isr32, 0x08, 0x8E);  /* IRQ 0 - Timer */
-    idt_set_entry(33, (unsigned int)isr33, 0x08, 0x8E);  /* IRQ 1 - Keyboard */
-    idt_set_entry(34, (unsigned int)isr34, 0x08, 0x8E);  /* IRQ 2 - Cascade */
-    idt_set_entry(35, (unsigned int)isr35, 0x08, 0x8E);  /* IRQ 3 - COM2 */
-    idt_set_entry(36, (unsigned int)isr36, 0x08, 0x8E);  /* IRQ 4 - COM1 */
-    idt_set_entry(37, (unsigned int)isr37, 0x08, 0x8E);  /* IRQ 5 - LPT2 */
-    idt_set_entry(38, (unsigned int)isr38, 0x08, 0x8E);  /* IRQ 6 - Floppy */
-    idt_set_entry(39, (unsigned int)isr39, 0x08, 0x8E);  /* IRQ 7 - LPT1 */
-    idt_set_entry(40, (unsigned int)isr40, 0x08, 0x8E);  /* IRQ 8 - RTC */
-    idt_set_entry(41, (unsigned int)isr41, 0x08, 0x8E);  /* IRQ 9 - Free */
-    idt_set_entry(42, (unsigned int)isr42, 0x08, 0x8E);  /* IRQ 10 - Free */
-    idt_set_entry(43, (unsigned int)isr43, 0x08, 0x8E);  /* IRQ 11 - Free */
-    idt_set_entry(44, (unsigned int)isr44, 0x08, 0x8E);  /* IRQ 12 - PS/2 Mouse */
-    idt_set_entry(45, (unsigned int)isr45, 0x08, 0x8E);  /* IRQ 13 - FPU */
-    idt_set_entry(46, (unsigned int)isr46, 0x08, 0x8E);  /* IRQ 14 - Primary ATA */
-    idt_set_entry(47, (unsigned int)isr47, 0x08, 0x8E);  /* IRQ 15 - Secondary ATA */
+    for (unsigned int i = 0; i < IDT_ENTRIES; i++) {
+        idt_set_entry(i, isr_stub_table[i], KERNEL_CS, IDT_GATE_INTERRUPT);
+        trap_handlers[i] = default_handler(i);
+    }
     
-    /* Load IDT */
-    __asm__ volatile ("lidt %0" : : "m"(idt_reg));
+    idt_load();
     
     debug_info("IDT initialized");
 }
 
-/* Register an interrupt handler (for future use) */
+/* Load the (shared) IDT on the calling CPU */
+void idt_load(void) {
+    __asm__ volatile ("lidt %0" : : "m"(idt_reg));
+}
+
+/* Point an IDT gate directly at a raw assembly handler (bypasses dispatch) */
 void idt_register_handler(unsigned char num, interrupt_handler_t handler) {
-    idt_set_entry(num, (unsigned int)handler, 0x08, 0x8E);
+    idt_set_entry(num, (unsigned int)handler, KERNEL_CS, IDT_GATE_INTERRUPT);
 }
 
+/* Install a C handler for a vector in the dispatch table (NULL restores the default) */
+void idt_set_handler(unsigned char vector, trap_handler_t handler) {
+    trap_handlers[vector] = handler ? handler : default_handler(vector);
+}
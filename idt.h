@@ -11,6 +11,25 @@
 #ifndef IDT_H
 #define IDT_H
 
+/* Number of IDT entries */
+#define IDT_ENTRIES 256
+
+#include "gdt.h"  /* KERNEL_CS, KERNEL_DS */
+
+/* Gate flags: Present (bit 7), DPL 00 (bits 6-5), 32-bit interrupt gate */
+#define IDT_GATE_INTERRUPT 0x8E
+
+/* The same with DPL 3: reachable with int $n from ring 3 (syscall.h) */
+#define IDT_GATE_USER_INTERRUPT 0xEE
+
+/* Exception vectors used by name */
+#define VECTOR_DEBUG            1
+#define VECTOR_BREAKPOINT       3
+#define VECTOR_NO_COPROCESSOR   7
+#define VECTOR_DOUBLE_FAULT     8
+#define VECTOR_GENERAL_PROTECTION 13
+#define VECTOR_PAGE_FAULT       14
+
 /* IDT Entry Structure (8 bytes)
  * 
  * Each entry describes an interrupt handler:
@@ -35,20 +54,59 @@ struct idt_register {
     unsigned int base;           /* Base address of IDT */
 } __attribute__((packed));
 
+/* Trap Frame
+ * 
+ * Built on the stack by the common interrupt entry path in idt_asm.c
+ * (lowest address first). Handlers may modify it, e.g. change eip to
+ * resume somewhere else; it is restored on return.
+ */
+struct trap_frame {
+    unsigned int cr2;            /* Faulting address (valid for page faults) */
+    unsigned long long handler_exit_tsc;  /* Set by interrupt_dispatch (irqstat.h) */
+    unsigned long long entry_tsc;         /* RDTSC at stub entry (irqstat.h) */
+    unsigned int edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;  /* pusha */
+    unsigned int gs, fs, es, ds;
+    unsigned int vector;         /* Interrupt vector number */
+    unsigned int error_code;     /* CPU error code, or 0 */
+    unsigned int eip, cs, eflags;  /* Pushed by the CPU */
+    unsigned int user_esp, user_ss;  /* Pushed by the CPU on a ring change only */
+};
+
+/* C-level interrupt handler, called through the dispatch table */
+typedef void (*trap_handler_t)(struct trap_frame* frame);
+
 /* IDT Functions */
 
 /* Initialize and load the IDT */
 void idt_init(void);
 
+/* Load the (shared) IDT on the calling CPU; used by application processors */
+void idt_load(void);
+
 /* Set an IDT entry */
 void idt_set_entry(unsigned char num, unsigned int handler, unsigned short selector, unsigned char flags);
 
-/* Exception handler function type */
+/* Raw gate handler type (must end with iret) */
 typedef void (*interrupt_handler_t)(void);
 
-/* Register an interrupt handler */
+/* Point an IDT gate directly at a raw assembly handler (bypasses dispatch) */
 void idt_register_handler(unsigned char num, interrupt_handler_t handler);
 
+/* Install a C handler for a vector in the dispatch table (NULL restores the default) */
+void idt_set_handler(unsigned char vector, trap_handler_t handler);
+
+/* Common C entry point, called by isr_common for every vector */
+void interrupt_dispatch(struct trap_frame* frame);
+
+/* Default handler for CPU exceptions (vectors 0-31) */
+void exception_handler(struct trap_frame* frame);
+
+/* Per-vector entry stubs (idt_asm.c) */
+extern const unsigned int isr_stub_table[IDT_ENTRIES];
+
+/* Check whether the CPU is currently running an interrupt or exception handler */
+int in_interrupt(void);
+
 /* Exception names for debugging */
 extern const char* exception_names[];
 
@@ -1,93 +1,118 @@
-/* 
+/*
  * Interrupt Handler Stubs (Assembly)
- * 
- * These are assembly stubs that handle interrupts and call our C handlers.
- * We use inline assembly to create these stubs.
+ *
+ * All 256 interrupt vectors enter the kernel through a tiny per-vector stub
+ * and one shared entry/exit path, written as top-level assembly (so no C
+ * prologue ever runs before the registers are saved).
+ *
+ * Per-vector stub (isrN, 16 bytes each):
+ * 1. Pushes a dummy error code, unless the CPU already pushed one
+ *    (vectors 8, 10-14, 17, 21, 29, 30)
+ * 2. Pushes the vector number
+ * 3. Jumps to isr_common
+ *
+ * isr_common:
+ * 1. Saves the data segment registers and all general-purpose registers
+ * 2. Pushes the entry timestamp and a slot for the handler exit timestamp
+ *    (CONFIG_IRQSTAT, see irqstat.h; just reserved space otherwise)
+ * 3. Pushes CR2 (the faulting address for page faults)
+ * 4. Loads the kernel data segments, the per-CPU segment into GS
+ *    (percpu.h) and clears the direction flag
+ * 5. Calls interrupt_dispatch(struct trap_frame*)
+ * 6. Restores everything, drops the vector and error code, and returns
+ *    with iret - so a handler that returns resumes the interrupted code
+ *
+ * The layout pushed here must match struct trap_frame in idt.h.
  */
 
 #include "idt.h"
+#include "irqstat.h"
 
-/* Forward declarations */
-void exception_handler(unsigned int interrupt_num);
-void irq_handler(unsigned int interrupt_num);
+/* Stringify a macro value for use inside the assembly below */
+#define IDT_STR_(x) #x
+#define IDT_STR(x) IDT_STR_(x)
 
-/* 
- * Interrupt Handler Stub Macro
- * 
- * Creates an interrupt handler stub that:
- * 1. Saves all registers
- * 2. Pushes the interrupt number
- * 3. Calls the C exception handler
- * 4. Restores registers
- * 5. Returns from interrupt
- * 
- * Note: The CPU automatically pushes EFLAGS, CS, and EIP when an interrupt occurs.
- * Some exceptions also push an error code automatically.
- */
-#define ISR_STUB(num) \
-void isr##num(void) { \
-    __asm__ volatile ( \
-        "pusha\n"              /* Save all general-purpose registers */ \
-        "pushl $" #num "\n"    /* Push interrupt number */ \
-        "call exception_handler\n" \
-        "addl $4, %%esp\n"     /* Remove interrupt number from stack */ \
-        "popa\n"               /* Restore all general-purpose registers */ \
-        "iret\n"               /* Return from interrupt (restores EFLAGS, CS, EIP) */ \
-        ::: "memory" \
-    ); \
-}
+__asm__ (
+    ".altmacro\n"
+
+    /* One entry stub per vector */
+    ".macro ISR_STUB n\n"
+    "    .globl isr\\n\n"
+    "    .type isr\\n, @function\n"
+    "    .balign 16\n"
+    "isr\\n:\n"
+    "    .if (\\n == 8) || (\\n >= 10 && \\n <= 14) || (\\n == 17) || (\\n == 21) || (\\n == 29) || (\\n == 30)\n"
+    "    .else\n"
+    "    pushl $0\n"                     /* Dummy error code */
+    "    .endif\n"
+    "    pushl $\\n\n"                   /* Vector number */
+    "    jmp isr_common\n"
+    ".endm\n"
+
+    ".macro ISR_TABLE_ENTRY n\n"
+    "    .long isr\\n\n"
+    ".endm\n"
 
-/* Create interrupt stubs for exceptions 0-19 */
-ISR_STUB(0)
-ISR_STUB(1)
-ISR_STUB(2)
-ISR_STUB(3)
-ISR_STUB(4)
-ISR_STUB(5)
-ISR_STUB(6)
-ISR_STUB(7)
-ISR_STUB(8)
-ISR_STUB(9)
-ISR_STUB(10)
-ISR_STUB(11)
-ISR_STUB(12)
-ISR_STUB(13)
-ISR_STUB(14)
-ISR_STUB(15)
-ISR_STUB(16)
-ISR_STUB(17)
-ISR_STUB(18)
-ISR_STUB(19)
+    ".text\n"
+    ".set isr_vector, 0\n"
+    ".rept " IDT_STR(IDT_ENTRIES) "\n"
+    "    ISR_STUB %isr_vector\n"
+    "    .set isr_vector, isr_vector + 1\n"
+    ".endr\n"
 
-/* IRQ Handler Stub Macro - calls irq_handler instead of exception_handler */
-#define IRQ_STUB(num) \
-void isr##num(void) { \
-    __asm__ volatile ( \
-        "pusha\n"              /* Save all general-purpose registers */ \
-        "pushl $" #num "\n"    /* Push interrupt number */ \
-        "call irq_handler\n"   /* Call IRQ handler (sends EOI) */ \
-        "addl $4, %%esp\n"     /* Remove interrupt number from stack */ \
-        "popa\n"               /* Restore all general-purpose registers */ \
-        "iret\n"               /* Return from interrupt (restores EFLAGS, CS, EIP) */ \
-        ::: "memory" \
-    ); \
-}
+    /* Common entry/exit path */
+    ".balign 16\n"
+    ".globl isr_common\n"
+    ".type isr_common, @function\n"
+    "isr_common:\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    pushl %fs\n"
+    "    pushl %gs\n"
+    "    pusha\n"                        /* Save all general-purpose registers */
+#if CONFIG_IRQSTAT
+    "    rdtsc\n"
+    "    pushl %edx\n"                   /* entry_tsc */
+    "    pushl %eax\n"
+    "    subl $8, %esp\n"                /* handler_exit_tsc */
+#else
+    "    subl $16, %esp\n"               /* Unused timestamp slots */
+#endif
+    "    movl %cr2, %eax\n"
+    "    pushl %eax\n"                   /* Faulting address (page faults) */
+    "    movw $" IDT_STR(KERNEL_DS) ", %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw $" IDT_STR(GDT_PERCPU_SEL) ", %ax\n"
+    "    movw %ax, %gs\n"
+    "    cld\n"                          /* C code expects DF clear */
+    "    pushl %esp\n"                   /* Argument: struct trap_frame* */
+    "    call interrupt_dispatch\n"
+#if CONFIG_IRQSTAT
+    "    leal 4(%esp), %eax\n"           /* The callee may have reused its */
+    "    movl %eax, (%esp)\n"            /* argument slot: reload the frame */
+    "    call irqstat_iret\n"            /* Record the exit overhead */
+#endif
+    "    addl $24, %esp\n"               /* Drop the argument, CR2 and timestamps */
+    "    popa\n"                         /* Restore general-purpose registers */
+    "    popl %gs\n"
+    "    popl %fs\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    addl $8, %esp\n"                /* Drop vector number and error code */
+    "    iret\n"                         /* Return from interrupt (restores EFLAGS, CS, EIP) */
 
-/* Create interrupt stubs for IRQs 32-47 */
-IRQ_STUB(32)
-IRQ_STUB(33)
-IRQ_STUB(34)
-IRQ_STUB(35)
-IRQ_STUB(36)
-IRQ_STUB(37)
-IRQ_STUB(38)
-IRQ_STUB(39)
-IRQ_STUB(40)
-IRQ_STUB(41)
-IRQ_STUB(42)
-IRQ_STUB(43)
-IRQ_STUB(44)
-IRQ_STUB(45)
-IRQ_STUB(46)
-IRQ_STUB(47)
+    /* Stub address table used by idt_init() */
+    ".section .rodata\n"
+    ".balign 4\n"
+    ".globl isr_stub_table\n"
+    "isr_stub_table:\n"
+    ".set isr_vector, 0\n"
+    ".rept " IDT_STR(IDT_ENTRIES) "\n"
+    "    ISR_TABLE_ENTRY %isr_vector\n"
+    "    .set isr_vector, isr_vector + 1\n"
+    ".endr\n"
 
+    ".noaltmacro\n"
+    ".text\n"
+);
@@ -0,0 +1,70 @@
+/*
+ * Port I/O and Interrupt Flag Helpers
+ *
+ * Small inline wrappers around the x86 `in`/`out` instructions and the
+ * EFLAGS.IF manipulation used by drivers that share state with interrupt
+ * handlers.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+/* Write a byte to an I/O port */
+static inline void outb(unsigned short port, unsigned char value) {
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/* Read a byte from an I/O port */
+static inline unsigned char inb(unsigned short port) {
+    unsigned char value;
+    __asm__ volatile ("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+/* Write a 16-bit word to an I/O port */
+static inline void outw(unsigned short port, unsigned short value) {
+    __asm__ volatile ("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/* Read a 16-bit word from an I/O port */
+static inline unsigned short inw(unsigned short port) {
+    unsigned short value;
+    __asm__ volatile ("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+/* Wait roughly 1 microsecond by writing to an unused port (POST code port) */
+static inline void io_wait(void) {
+    __asm__ volatile ("outb %%al, $0x80" : : "a"(0));
+}
+
+/* EFLAGS Interrupt Flag */
+#define EFLAGS_IF 0x200
+
+/* Disable interrupts and return the previous EFLAGS */
+static inline unsigned int irq_save(void) {
+    unsigned int flags;
+    __asm__ volatile ("pushfl\n"
+                      "popl %0\n"
+                      "cli"
+                      : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Restore interrupt state saved by irq_save() */
+static inline void irq_restore(unsigned int flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+/* Check whether interrupts are currently enabled */
+static inline int irqs_enabled(void) {
+    unsigned int flags;
+    __asm__ volatile ("pushfl\n"
+                      "popl %0"
+                      : "=r"(flags));
+    return (flags & EFLAGS_IF) != 0;
+}
+
+#endif /* IO_H */
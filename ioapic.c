@@ -0,0 +1,170 @@
+/*
+ * I/O APIC Implementation
+ */
+
+#include "ioapic.h"
+#include "irqchip.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "paging.h"
+#include "pic.h"
+#include "debug.h"
+
+#define NR_ISA_IRQS 16
+
+struct ioapic {
+    volatile unsigned int* base;
+    unsigned int id;
+    unsigned int gsi_base;
+    unsigned int entries;        /* Number of redirection entries */
+};
+
+static struct ioapic ioapics[ACPI_MAX_IOAPICS];
+static unsigned int ioapic_count = 0;
+
+/* Routing of each ISA IRQ: its I/O APIC, pin and a shadow of the low dword
+ * of its redirection entry (so masking needs no read) */
+static struct ioapic* isa_ioapic[NR_ISA_IRQS];
+static unsigned int isa_pin[NR_ISA_IRQS];
+static unsigned int isa_redir_low[NR_ISA_IRQS];
+
+static unsigned int ioapic_read(struct ioapic* ioapic, unsigned int reg) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(struct ioapic* ioapic, unsigned int reg, unsigned int value) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    ioapic->base[IOAPIC_WINDOW / 4] = value;
+}
+
+/* Find the I/O APIC serving a GSI */
+static struct ioapic* ioapic_for_gsi(unsigned int gsi) {
+    for (unsigned int i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].entries) {
+            return &ioapics[i];
+        }
+    }
+    return 0;
+}
+
+/* Program the redirection entries of every ISA IRQ */
+int ioapic_init(void) {
+    const struct acpi_madt_info* madt = acpi_get_madt();
+    unsigned int claimed[NR_ISA_IRQS];
+    unsigned int destination;
+
+    if (madt == 0 || madt->ioapic_count == 0 || !lapic_enabled()) {
+        return -1;
+    }
+
+    /* Mask every pin of every I/O APIC */
+    for (unsigned int i = 0; i < madt->ioapic_count; i++) {
+        struct ioapic* ioapic = &ioapics[ioapic_count++];
+        ioapic->base = paging_map_mmio(madt->ioapics[i].address, PAGE_SIZE);
+        ioapic->id = madt->ioapics[i].id;
+        ioapic->gsi_base = madt->ioapics[i].gsi_base;
+        ioapic->entries = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        for (unsigned int pin = 0; pin < ioapic->entries; pin++) {
+            ioapic_write(ioapic, IOAPIC_REG_REDIR + 2 * pin, IOAPIC_REDIR_MASKED);
+            ioapic_write(ioapic, IOAPIC_REG_REDIR + 2 * pin + 1, 0);
+        }
+    }
+
+    /* A GSI taken by an override (IRQ 0 -> GSI 2) is no longer available
+     * to the ISA IRQ with the same number */
+    for (unsigned int irq = 0; irq < NR_ISA_IRQS; irq++) {
+        claimed[irq] = 0;
+    }
+    for (unsigned int irq = 0; irq < NR_ISA_IRQS; irq++) {
+        unsigned int gsi = madt->isa_irqs[irq].gsi;
+        if (gsi != irq && gsi < NR_ISA_IRQS) {
+            claimed[gsi] = 1;
+        }
+    }
+
+    /* Deliver everything to the boot CPU for now */
+    destination = lapic_id() << 24;
+
+    for (unsigned int irq = 0; irq < NR_ISA_IRQS; irq++) {
+        unsigned int gsi = madt->isa_irqs[irq].gsi;
+        unsigned int flags = madt->isa_irqs[irq].flags;
+        struct ioapic* ioapic = ioapic_for_gsi(gsi);
+        unsigned int low = (PIC_IRQ_BASE + irq) | IOAPIC_REDIR_MASKED;
+
+        isa_ioapic[irq] = 0;
+        if (ioapic == 0 || (gsi == irq && claimed[irq])) {
+            continue;
+        }
+
+        /* "Conforms to bus" means ISA defaults: edge triggered, active high */
+        if ((flags & ACPI_MADT_POLARITY_MASK) == ACPI_MADT_POLARITY_LOW) {
+            low |= IOAPIC_REDIR_ACTIVE_LOW;
+        }
+        if ((flags & ACPI_MADT_TRIGGER_MASK) == ACPI_MADT_TRIGGER_LEVEL) {
+            low |= IOAPIC_REDIR_LEVEL;
+        }
+
+        isa_ioapic[irq] = ioapic;
+        isa_pin[irq] = gsi - ioapic->gsi_base;
+        isa_redir_low[irq] = low;
+
+        ioapic_write(ioapic, IOAPIC_REG_REDIR + 2 * isa_pin[irq] + 1, destination);
+        ioapic_write(ioapic, IOAPIC_REG_REDIR + 2 * isa_pin[irq], low);
+    }
+
+    debug_logf(LOG_INFO, "ioapic: %u I/O APIC(s), IRQ 0 on GSI %u", ioapic_count,
+               madt->isa_irqs[0].gsi);
+    return 0;
+}
+
+/* Send an ISA IRQ to another CPU */
+void ioapic_set_destination(unsigned int irq, unsigned int apic_id) {
+    if (irq >= NR_ISA_IRQS || isa_ioapic[irq] == 0) {
+        return;
+    }
+    ioapic_write(isa_ioapic[irq], IOAPIC_REG_REDIR + 2 * isa_pin[irq] + 1, apic_id << 24);
+}
+
+/* ============================================================================
+ * irqchip Backend
+ * ============================================================================
+ */
+
+static void ioapic_chip_mask(unsigned int irq) {
+    if (irq >= NR_ISA_IRQS || isa_ioapic[irq] == 0) {
+        return;
+    }
+    isa_redir_low[irq] |= IOAPIC_REDIR_MASKED;
+    ioapic_write(isa_ioapic[irq], IOAPIC_REG_REDIR + 2 * isa_pin[irq], isa_redir_low[irq]);
+}
+
+static void ioapic_chip_unmask(unsigned int irq) {
+    if (irq >= NR_ISA_IRQS || isa_ioapic[irq] == 0) {
+        return;
+    }
+    isa_redir_low[irq] &= ~IOAPIC_REDIR_MASKED;
+    ioapic_write(isa_ioapic[irq], IOAPIC_REG_REDIR + 2 * isa_pin[irq], isa_redir_low[irq]);
+}
+
+/* The local APIC forwards the EOI of level-triggered interrupts to the I/O APIC */
+static void ioapic_chip_eoi(unsigned int irq) {
+    (void)irq;
+    lapic_eoi();
+}
+
+static void ioapic_chip_shutdown(void) {
+    for (unsigned int irq = 0; irq < NR_ISA_IRQS; irq++) {
+        ioapic_chip_mask(irq);
+    }
+}
+
+struct irqchip ioapic_chip = {
+    .name = "ioapic",
+    .mask = ioapic_chip_mask,
+    .unmask = ioapic_chip_unmask,
+    .eoi = ioapic_chip_eoi,
+    .is_spurious = 0,
+    .shutdown = ioapic_chip_shutdown,
+};
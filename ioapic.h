@@ -0,0 +1,42 @@
+/*
+ * I/O APIC Header
+ *
+ * The I/O APIC replaces the 8259 as the router for external interrupts.
+ * Each input pin (global system interrupt, GSI) has a 64-bit redirection
+ * entry holding the vector, trigger mode, polarity, mask bit and the
+ * destination APIC ID. ISA IRQ n is routed to vector PIC_IRQ_BASE + n on
+ * the GSI given by the MADT (identity unless overridden; e.g. the PIT's
+ * IRQ 0 usually arrives on GSI 2), with the override's polarity and
+ * trigger mode. EOI goes to the local APIC.
+ */
+
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+/* Indirect register access: select at +0x00, data at +0x10 */
+#define IOAPIC_REGSEL      0x00
+#define IOAPIC_WINDOW      0x10
+
+/* Registers */
+#define IOAPIC_REG_ID      0x00
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDIR   0x10  /* Entry n: 0x10 + 2n (low), 0x11 + 2n (high) */
+
+/* Redirection entry bits (low dword) */
+#define IOAPIC_REDIR_ACTIVE_LOW  (1u << 13)
+#define IOAPIC_REDIR_LEVEL       (1u << 15)
+#define IOAPIC_REDIR_MASKED      (1u << 16)
+
+struct irqchip;
+
+/* Program the redirection entries of every ISA IRQ (masked) from the MADT.
+ * Returns 0 on success, -1 if the MADT lists no I/O APIC. */
+int ioapic_init(void);
+
+/* Send an ISA IRQ to another CPU (APIC ID) */
+void ioapic_set_destination(unsigned int irq, unsigned int apic_id);
+
+/* The I/O APIC + local APIC backend for irq.c */
+extern struct irqchip ioapic_chip;
+
+#endif /* IOAPIC_H */
@@ -0,0 +1,253 @@
+/*
+ * Hardware IRQ Registry Implementation
+ *
+ * Each line has a singly linked chain of irq_action nodes taken from a
+ * static pool. The chains, the pool and the controller backend are
+ * guarded by one reader-writer lock: the dispatcher walks a chain as a
+ * reader, so several CPUs can take interrupts at once, while
+ * request_irq(), free_irq() and irq_set_chip() take it as writers with
+ * interrupts disabled. A node is never unlinked or reused while any CPU
+ * is still running its handler.
+ *
+ * Masking, unmasking and EOI go through the current irqchip backend
+ * (irqchip.h), so the same dispatcher serves the 8259 and the I/O APIC.
+ */
+
+#include "irq.h"
+#include "idt.h"
+#include "pic.h"
+#include "irqchip.h"
+#include "spinlock.h"
+#include "io.h"
+#include "debug.h"
+
+/* One registered handler */
+struct irq_action {
+    irq_handler_t handler;
+    void* context;
+    unsigned int flags;
+    const char* name;
+    struct irq_action* next;
+};
+
+static struct irq_action action_pool[IRQ_MAX_ACTIONS];
+static struct irq_action* free_actions = 0;
+static struct irq_action* irq_actions[NR_IRQS];
+static struct irq_stats irq_counters[NR_IRQS];
+
+static struct lock_class irq_lock_class = LOCK_CLASS_INIT("irq");
+static struct rwlock irq_lock = RWLOCK_INIT(&irq_lock_class);
+
+/* Interrupt controller backend (the 8259 until irq_set_chip() is called) */
+static struct irqchip* irq_chip = &pic_chip;
+
+/* Dispatch a hardware interrupt to the handlers of its line */
+static void irq_dispatch(struct trap_frame* frame) {
+    unsigned int irq = frame->vector - PIC_IRQ_BASE;
+    int handled = IRQ_NONE;
+
+    /* Interrupts are already disabled here */
+    read_lock(&irq_lock);
+
+    /* A spurious IRQ 7/15 has no ISR bit set and must not get a normal EOI */
+    if (irq_chip->is_spurious != 0 && irq_chip->is_spurious(irq)) {
+        irq_counters[irq].spurious++;
+        read_unlock(&irq_lock);
+        return;
+    }
+
+    for (struct irq_action* action = irq_actions[irq]; action != 0; action = action->next) {
+        handled |= action->handler(irq, action->context);
+    }
+
+    if (handled) {
+        irq_counters[irq].handled++;
+    } else {
+        irq_counters[irq].unhandled++;
+    }
+
+    /* Acknowledge the interrupt at the controller */
+    irq_chip->eoi(irq);
+    read_unlock(&irq_lock);
+}
+
+/* Install the IRQ dispatcher on vectors 32-47 */
+void irq_init(void) {
+    free_actions = 0;
+    for (int i = IRQ_MAX_ACTIONS - 1; i >= 0; i--) {
+        action_pool[i].next = free_actions;
+        free_actions = &action_pool[i];
+    }
+
+    for (unsigned int irq = 0; irq < NR_IRQS; irq++) {
+        irq_actions[irq] = 0;
+        idt_set_handler(PIC_IRQ_BASE + irq, irq_dispatch);
+    }
+}
+
+/* Register a handler on an IRQ line and unmask the line */
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned int irqflags,
+                const char* name, void* context) {
+    if (irq >= NR_IRQS || handler == 0) {
+        return -1;
+    }
+
+    unsigned int flags = write_lock_irqsave(&irq_lock);
+
+    /* free_irq() finds a handler by (handler, context): keep that unique */
+    struct irq_action** link = &irq_actions[irq];
+    for (; *link != 0; link = &(*link)->next) {
+        if ((*link)->handler == handler && (*link)->context == context) {
+            write_unlock_irqrestore(&irq_lock, flags);
+            debug_logf(LOG_ERROR, "request_irq: %s is already registered on IRQ %u", name, irq);
+            return -1;
+        }
+    }
+
+    struct irq_action* action = free_actions;
+    if (action == 0) {
+        write_unlock_irqrestore(&irq_lock, flags);
+        debug_logf(LOG_ERROR, "request_irq: no free handler slot for IRQ %u (%s)", irq, name);
+        return -1;
+    }
+    free_actions = action->next;
+
+    action->handler = handler;
+    action->context = context;
+    action->flags = irqflags;
+    action->name = name;
+    action->next = 0;
+
+    /* Append (link is the chain's tail), so handlers run in registration order */
+    *link = action;
+
+    irq_chip->unmask(irq);
+
+    write_unlock_irqrestore(&irq_lock, flags);
+    return 0;
+}
+
+/* Remove the handler registered with `handler` and `context` */
+int free_irq(unsigned int irq, irq_handler_t handler, void* context) {
+    if (irq >= NR_IRQS) {
+        return -1;
+    }
+
+    unsigned int flags = write_lock_irqsave(&irq_lock);
+
+    for (struct irq_action** link = &irq_actions[irq]; *link != 0; link = &(*link)->next) {
+        struct irq_action* action = *link;
+        if (action->handler != handler || action->context != context) {
+            continue;
+        }
+
+        *link = action->next;
+        action->next = free_actions;
+        free_actions = action;
+
+        if (irq_actions[irq] == 0 && irq != 2) {
+            irq_chip->mask(irq);  /* Keep the cascade line open */
+        }
+
+        write_unlock_irqrestore(&irq_lock, flags);
+        return 0;
+    }
+
+    write_unlock_irqrestore(&irq_lock, flags);
+    return -1;
+}
+
+/* Switch to another interrupt controller backend */
+void irq_set_chip(struct irqchip* chip) {
+    struct {
+        irq_handler_t handler;
+        void* context;
+        unsigned int irq;
+    } poll[IRQ_MAX_ACTIONS];
+    unsigned int npoll = 0;
+    unsigned int flags = write_lock_irqsave(&irq_lock);
+
+    /* Silence the old controller, then open the lines that have handlers */
+    irq_chip->shutdown();
+    irq_chip = chip;
+    for (unsigned int irq = 0; irq < NR_IRQS; irq++) {
+        if (irq_actions[irq] != 0) {
+            irq_chip->unmask(irq);
+        }
+    }
+
+    /* A device that raised its (edge-triggered) line while the switch was
+     * in progress would never produce another edge. Note the handlers that
+     * can tell from the device whether it has something pending; handlers
+     * without IRQF_POLL (the PIT tick) must only run for real interrupts. */
+    for (unsigned int irq = 0; irq < NR_IRQS; irq++) {
+        for (struct irq_action* action = irq_actions[irq]; action != 0; action = action->next) {
+            if (action->flags & IRQF_POLL) {
+                poll[npoll].handler = action->handler;
+                poll[npoll].context = action->context;
+                poll[npoll].irq = irq;
+                npoll++;
+            }
+        }
+    }
+
+    write_unlock_irqrestore(&irq_lock, flags);
+
+    /* Poll them without the lock (a handler may take it itself), with
+     * interrupts disabled as in a real interrupt */
+    for (unsigned int i = 0; i < npoll; i++) {
+        flags = irq_save();
+        poll[i].handler(poll[i].irq, poll[i].context);
+        irq_restore(flags);
+    }
+
+    debug_logf(LOG_INFO, "irq: using the %s interrupt controller", chip->name);
+}
+
+/* Current interrupt controller backend */
+struct irqchip* irq_get_chip(void) {
+    return irq_chip;
+}
+
+/* Get the counters of one IRQ line */
+void irq_get_stats(unsigned int irq, struct irq_stats* stats) {
+    if (irq >= NR_IRQS) {
+        stats->handled = stats->unhandled = stats->spurious = 0;
+        return;
+    }
+
+    unsigned int flags = irq_save();
+    *stats = irq_counters[irq];
+    irq_restore(flags);
+}
+
+/* Print the per-line counters and handler names */
+void irq_dump_stats(void) {
+    kprintf("IRQ    handled  unhandled   spurious  handlers (%s)\n", irq_chip->name);
+
+    for (unsigned int irq = 0; irq < NR_IRQS; irq++) {
+        struct irq_stats stats;
+        char names[64];
+        int len = 0;
+
+        irq_get_stats(irq, &stats);
+
+        /* Copy the names, so nothing is printed with the lock held */
+        names[0] = '\0';
+        unsigned int flags = read_lock_irqsave(&irq_lock);
+        for (struct irq_action* action = irq_actions[irq]; action != 0; action = action->next) {
+            if (len < (int)sizeof(names)) {
+                len += ksnprintf(names + len, sizeof(names) - len, " %s",
+                                 action->name ? action->name : "?");
+            }
+        }
+        read_unlock_irqrestore(&irq_lock, flags);
+
+        if (names[0] == '\0' && stats.handled == 0 &&
+            stats.unhandled == 0 && stats.spurious == 0) {
+            continue;
+        }
+
+        kprintf("%3u %10u %10u %10u %s\n", irq, stats.handled, stats.unhandled, stats.spurious, names);
+    }
+}
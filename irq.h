@@ -0,0 +1,70 @@
+/*
+ * Hardware IRQ Registry Header
+ *
+ * Drivers own an IRQ line by registering a handler with request_irq().
+ * Several handlers may share one line; they are called in registration
+ * order and each reports whether its device actually raised the
+ * interrupt. Spurious IRQ 7 / IRQ 15 from the 8259 are filtered out
+ * before any handler runs.
+ */
+
+#ifndef IRQ_H
+#define IRQ_H
+
+/* Number of legacy IRQ lines */
+#define NR_IRQS 16
+
+/* Maximum number of registered handlers across all lines */
+#define IRQ_MAX_ACTIONS 32
+
+/* request_irq() flags */
+#define IRQF_POLL    0x1  /* The handler checks its device's status and may
+                           * be called when no interrupt is pending */
+
+/* Handler return values */
+#define IRQ_NONE     0  /* Not our device */
+#define IRQ_HANDLED  1  /* Interrupt serviced */
+
+/* IRQ handler: receives the IRQ number and the context given to request_irq() */
+typedef int (*irq_handler_t)(unsigned int irq, void* context);
+
+/* Per-line counters */
+struct irq_stats {
+    unsigned int handled;    /* At least one handler returned IRQ_HANDLED */
+    unsigned int unhandled;  /* No handler claimed the interrupt */
+    unsigned int spurious;   /* Spurious IRQ 7/15 detected via the ISR register */
+};
+
+/* Install the IRQ dispatcher on vectors 32-47 */
+void irq_init(void);
+
+/* Register a handler on an IRQ line and unmask the line (flags: IRQF_*).
+ * Returns 0 on success, -1 on a bad line, when no handler slot is free or
+ * when the same handler is already registered on the line with the same
+ * context. */
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned int flags,
+                const char* name, void* context);
+
+/* Remove the handler registered with `handler` and `context`; masks the
+ * line when it was the last one. Returns 0 on success, -1 if no such
+ * handler exists. */
+int free_irq(unsigned int irq, irq_handler_t handler, void* context);
+
+struct irqchip;
+
+/* Switch to another interrupt controller backend: masks every line on the
+ * old one and unmasks the lines that have handlers on the new one. IRQF_POLL
+ * handlers are then called once, in case their device raised an edge the
+ * switch lost. */
+void irq_set_chip(struct irqchip* chip);
+
+/* Current interrupt controller backend */
+struct irqchip* irq_get_chip(void);
+
+/* Get the counters of one IRQ line */
+void irq_get_stats(unsigned int irq, struct irq_stats* stats);
+
+/* Print the per-line counters and handler names */
+void irq_dump_stats(void);
+
+#endif /* IRQ_H */
@@ -0,0 +1,38 @@
+/*
+ * Interrupt Controller (irqchip) Interface
+ *
+ * The IRQ layer (irq.c) never talks to interrupt controller hardware
+ * directly; it goes through the current struct irqchip. Two backends exist:
+ * - pic_chip (pic.c): the legacy 8259 pair, always available
+ * - ioapic_chip (ioapic.c): I/O APIC routing with local APIC EOI,
+ *   installed by apic_init() when ACPI describes the APICs
+ *
+ * Both deliver ISA IRQ n on vector PIC_IRQ_BASE + n, so the IDT layout does
+ * not depend on the backend.
+ */
+
+#ifndef IRQCHIP_H
+#define IRQCHIP_H
+
+struct irqchip {
+    const char* name;
+
+    /* Stop / start delivering an IRQ line */
+    void (*mask)(unsigned int irq);
+    void (*unmask)(unsigned int irq);
+
+    /* Acknowledge a serviced interrupt */
+    void (*eoi)(unsigned int irq);
+
+    /* Return 1 if the interrupt was spurious (it then gets no EOI);
+     * may be null if the controller never raises spurious IRQs on a line */
+    int (*is_spurious)(unsigned int irq);
+
+    /* Mask every line (used when another backend takes over) */
+    void (*shutdown)(void);
+};
+
+/* The legacy 8259 backend */
+extern struct irqchip pic_chip;
+
+#endif /* IRQCHIP_H */
@@ -0,0 +1,166 @@
+/*
+ * Interrupt Latency Statistics Implementation
+ *
+ * Statistics are only updated from interrupt_dispatch() and isr_common,
+ * which run with interrupts disabled, into the calling CPU's own table, so
+ * no locking is needed and CPUs do not share cache lines. Readers sum the
+ * tables of all CPUs.
+ */
+
+#include "irqstat.h"
+#include "idt.h"
+#include "io.h"
+#include "cpu.h"
+#include "percpu.h"
+#include "serial.h"
+#include "kprintf.h"
+
+struct irqstat_cpu {
+    struct irqstat_vector vec[IDT_ENTRIES];
+} __cacheline_aligned;
+
+/* Tables in use; a single all-zero one when built without statistics */
+#define IRQSTAT_CPUS (CONFIG_IRQSTAT ? NR_CPUS : 1)
+
+static struct irqstat_cpu irqstat_cpus[IRQSTAT_CPUS];
+
+#if CONFIG_IRQSTAT
+
+/* Clamp a cycle count to 32 bits */
+static inline unsigned int irqstat_cycles(unsigned long long delta) {
+    return (delta >> 32) ? 0xFFFFFFFFu : (unsigned int)delta;
+}
+
+/* Histogram bucket: floor(log2(cycles)), capped at the last bucket */
+static inline unsigned int irqstat_bucket(unsigned int cycles) {
+    unsigned int bucket = 31 - __builtin_clz(cycles | 1);
+    return bucket < IRQSTAT_BUCKETS ? bucket : IRQSTAT_BUCKETS - 1;
+}
+
+/* Record the stub entry, handler entry and handler exit stamps of one interrupt */
+void irqstat_record(unsigned int vector, unsigned long long entry_tsc,
+                    unsigned long long handler_start, unsigned long long handler_end) {
+    struct irqstat_vector* stat = &irqstat_cpus[smp_processor_id()].vec[vector & (IDT_ENTRIES - 1)];
+    unsigned int entry = irqstat_cycles(handler_start - entry_tsc);
+    unsigned int handler = irqstat_cycles(handler_end - handler_start);
+
+    stat->count++;
+    stat->handler_total += handler;
+    stat->entry_hist[irqstat_bucket(entry)]++;
+    stat->handler_hist[irqstat_bucket(handler)]++;
+    if (entry > stat->entry_max) {
+        stat->entry_max = entry;
+    }
+    if (handler > stat->handler_max) {
+        stat->handler_max = handler;
+    }
+}
+
+/* Record the exit overhead (called from isr_common just before iret) */
+void irqstat_iret(struct trap_frame* frame) {
+    struct irqstat_vector* stat = &irqstat_cpus[smp_processor_id()].vec[frame->vector & (IDT_ENTRIES - 1)];
+    unsigned int exit = irqstat_cycles(rdtsc() - frame->handler_exit_tsc);
+
+    if (exit > stat->exit_max) {
+        stat->exit_max = exit;
+    }
+}
+
+#endif /* CONFIG_IRQSTAT */
+
+/* Get one vector's statistics, summed over all CPUs (zeroed when disabled) */
+void irqstat_get(unsigned int vector, struct irqstat_vector* out) {
+    unsigned int flags = irq_save();
+
+    *out = (struct irqstat_vector){ 0 };
+    for (unsigned int cpu = 0; cpu < IRQSTAT_CPUS; cpu++) {
+        const struct irqstat_vector* stat = &irqstat_cpus[cpu].vec[vector & (IDT_ENTRIES - 1)];
+
+        if (stat->count == 0) {
+            continue;
+        }
+        out->count += stat->count;
+        out->handler_total += stat->handler_total;
+        if (stat->entry_max > out->entry_max) {
+            out->entry_max = stat->entry_max;
+        }
+        if (stat->handler_max > out->handler_max) {
+            out->handler_max = stat->handler_max;
+        }
+        if (stat->exit_max > out->exit_max) {
+            out->exit_max = stat->exit_max;
+        }
+        for (unsigned int b = 0; b < IRQSTAT_BUCKETS; b++) {
+            out->entry_hist[b] += stat->entry_hist[b];
+            out->handler_hist[b] += stat->handler_hist[b];
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/* Clear all statistics on all CPUs */
+void irqstat_reset(void) {
+    unsigned int flags = irq_save();
+
+    for (unsigned int cpu = 0; cpu < IRQSTAT_CPUS; cpu++) {
+        for (unsigned int v = 0; v < IDT_ENTRIES; v++) {
+            irqstat_cpus[cpu].vec[v] = (struct irqstat_vector){ 0 };
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/* Print one histogram line: "irqhist <kind> <vector> b0 b1 ... b23" */
+static void irqstat_dump_hist(const char* kind, unsigned int vector, const unsigned int* hist) {
+    char line[32 + IRQSTAT_BUCKETS * 11];
+    int len = ksnprintf(line, sizeof(line), "irqhist %s %u", kind, vector);
+
+    for (unsigned int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        len += ksnprintf(line + len, sizeof(line) - len, " %u", hist[b]);
+    }
+    ksnprintf(line + len, sizeof(line) - len, "\n");
+    serial_puts(line);
+}
+
+/* Dump all vectors that fired as a machine-readable table over serial
+ *
+ * Format (all times in TSC cycles):
+ *   # irqstat v1 buckets=24
+ *   irqstat <vector> <count> <entry_max> <handler_max> <exit_max> <handler_total>
+ *   irqhist entry <vector> <bucket 0> ... <bucket 23>
+ *   irqhist handler <vector> <bucket 0> ... <bucket 23>
+ *   # end irqstat
+ */
+void irqstat_dump(void) {
+    char line[128];
+
+    if (!CONFIG_IRQSTAT) {
+        serial_puts("# irqstat disabled (built with CONFIG_IRQSTAT=0)\n");
+        return;
+    }
+
+    ksnprintf(line, sizeof(line), "# irqstat v1 buckets=%u\n", IRQSTAT_BUCKETS);
+    serial_puts(line);
+
+    for (unsigned int v = 0; v < IDT_ENTRIES; v++) {
+        struct irqstat_vector stat;
+        irqstat_get(v, &stat);
+        if (stat.count == 0) {
+            continue;
+        }
+
+        ksnprintf(line, sizeof(line), "irqstat %u %u %u %u %u %llu\n",
+                  v, stat.count, stat.entry_max, stat.handler_max,
+                  stat.exit_max, stat.handler_total);
+        serial_puts(line);
+        irqstat_dump_hist("entry", v, stat.entry_hist);
+        irqstat_dump_hist("handler", v, stat.handler_hist);
+
+        /* The table can be larger than the TX ring: push it out as we go */
+        serial_flush();
+    }
+
+    serial_puts("# end irqstat\n");
+}
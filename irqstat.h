@@ -0,0 +1,62 @@
+/*
+ * Interrupt Latency Statistics Header
+ *
+ * Every interrupt is timestamped with RDTSC at four points:
+ *   1. stub entry     - in isr_common, right after the registers are saved
+ *   2. handler entry  - in interrupt_dispatch, before the C handler runs
+ *   3. handler exit   - in interrupt_dispatch, after the C handler returns
+ *   4. iret           - in isr_common, just before the registers are restored
+ *
+ * For each vector we keep log2-bucketed histograms of the entry overhead
+ * (1 -> 2) and the handler duration (2 -> 3), plus counts and maxima of
+ * all three intervals, in a table per CPU. The cost is three RDTSCs and a
+ * few adds per interrupt; building with CONFIG_IRQSTAT=0 removes all of
+ * it, including the timestamps in the assembly stub.
+ */
+
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+/* Enabled unless the build says otherwise (make CONFIG_IRQSTAT=0) */
+#ifndef CONFIG_IRQSTAT
+#define CONFIG_IRQSTAT 1
+#endif
+
+/* Histogram buckets: bucket b counts durations in [2^b, 2^(b+1)) cycles,
+ * the last bucket also takes everything longer */
+#define IRQSTAT_BUCKETS 24
+
+struct trap_frame;
+
+/* Per-vector statistics */
+struct irqstat_vector {
+    unsigned int count;
+    unsigned int entry_max;        /* Cycles, stub entry -> handler entry */
+    unsigned int handler_max;      /* Cycles, handler entry -> handler exit */
+    unsigned int exit_max;         /* Cycles, handler exit -> iret */
+    unsigned long long handler_total;
+    unsigned int entry_hist[IRQSTAT_BUCKETS];
+    unsigned int handler_hist[IRQSTAT_BUCKETS];
+};
+
+#if CONFIG_IRQSTAT
+
+/* Record the stub entry, handler entry and handler exit stamps of one interrupt */
+void irqstat_record(unsigned int vector, unsigned long long entry_tsc,
+                    unsigned long long handler_start, unsigned long long handler_end);
+
+/* Record the exit overhead (called from isr_common just before iret) */
+void irqstat_iret(struct trap_frame* frame);
+
+#endif /* CONFIG_IRQSTAT */
+
+/* Get one vector's statistics, summed over all CPUs (zeroed when disabled) */
+void irqstat_get(unsigned int vector, struct irqstat_vector* out);
+
+/* Clear all statistics on all CPUs */
+void irqstat_reset(void);
+
+/* Dump all vectors that fired as a machine-readable table over serial */
+void irqstat_dump(void);
+
+#endif /* IRQSTAT_H */
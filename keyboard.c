@@ -0,0 +1,456 @@
+/*
+ * PS/2 Keyboard Driver Implementation
+ *
+ * Both rings use free-running indices, masked on access. The scancode
+ * ring's head belongs to the IRQ handler and its tail to the kbd thread;
+ * the character ring's head belongs to the kbd thread and its tail to
+ * the readers, which take it with interrupts disabled (readers run on the
+ * boot CPU with the scheduler, so that is enough to serialize them).
+ *
+ * The decoder state (pending prefix, modifiers, locks) is only touched by
+ * the kbd thread.
+ */
+
+#include "keyboard.h"
+#include "sched.h"
+#include "irq.h"
+#include "cpu.h"
+#include "math64.h"
+#include "io.h"
+#include "debug.h"
+
+#define KBD_SCANCODE_MASK  (KBD_SCANCODE_RING - 1)
+#define KBD_CHAR_MASK      (KBD_CHAR_RING - 1)
+
+/* Bytes the handler reads per interrupt at most (the 8042 holds one) */
+#define KBD_IRQ_BUDGET     16
+
+/* Priority of the kbd thread: above ordinary threads, so a key is
+ * decoded as soon as the interrupt returns */
+#define KBD_THREAD_PRIO    (SCHED_PRIO_DEFAULT - 4)
+
+/* Set 1 codes with a meaning of their own (E0 keys are | 0x80) */
+#define SC_LCTRL           0x1D
+#define SC_LSHIFT          0x2A
+#define SC_RSHIFT          0x36
+#define SC_LALT            0x38
+#define SC_CAPS            0x3A
+#define SC_NUM             0x45
+#define SC_SCROLL          0x46
+#define SC_F1              0x3B
+#define SC_F10             0x44
+#define SC_F11             0x57
+#define SC_F12             0x58
+#define SC_KEYPAD_FIRST    0x47
+#define SC_KEYPAD_LAST     0x53
+#define SC_EXTENDED        0x80
+#define SC_RCTRL           (SC_EXTENDED | SC_LCTRL)
+#define SC_RALT            (SC_EXTENDED | SC_LALT)
+#define SC_FAKE_SHIFT      (SC_EXTENDED | SC_LSHIFT)   /* Sent around PrtSc etc. */
+
+/* Bytes after the E1 of a Pause press (E1 1D 45 E1 9D C5) */
+#define SC_PAUSE_TAIL      5
+
+static volatile unsigned char scancode_ring[KBD_SCANCODE_RING];
+static volatile unsigned int sc_head = 0;
+static volatile unsigned int sc_tail = 0;
+static struct wait_queue sc_wait = WAIT_QUEUE_INIT;
+
+static volatile unsigned short char_ring[KBD_CHAR_RING];
+static volatile unsigned int char_head = 0;
+static volatile unsigned int char_tail = 0;
+static struct wait_queue char_wait = WAIT_QUEUE_INIT;
+
+static kbd_event_fn_t event_handler = 0;
+static struct kbd_stats stats;
+
+/* Decoder state */
+static int extended = 0;
+static unsigned int pause_bytes = 0;
+static unsigned int modifiers = 0;
+static unsigned int shift_keys = 0;        /* Left (1) and right (2) Shift held */
+static unsigned int ctrl_keys = 0;
+static unsigned int alt_keys = 0;
+static unsigned int locks_held = 0;        /* Lock keys down (no toggle on repeat) */
+
+/* US layout for set 1 codes 0x00-0x39, without and with Shift */
+static const char kbd_map[] =
+    "\0" "\033" "1234567890-=" "\b\t" "qwertyuiop[]" "\n" "\0"
+    "asdfghjkl;'`" "\0" "\\" "zxcvbnm,./" "\0" "*" "\0" " ";
+static const char kbd_map_shift[] =
+    "\0" "\033" "!@#$%^&*()_+" "\b\t" "QWERTYUIOP{}" "\n" "\0"
+    "ASDFGHJKL:\"~" "\0" "|" "ZXCVBNM<>?" "\0" "*" "\0" " ";
+
+_Static_assert(sizeof(kbd_map) == 0x3A + 1 && sizeof(kbd_map_shift) == 0x3A + 1,
+               "keyboard maps must cover codes 0x00-0x39");
+
+/* Keypad 0x47-0x53 with Num Lock on, and as navigation keys */
+static const char kbd_keypad[] = "789-456+1230.";
+static const unsigned short kbd_keypad_nav[] = {
+    KEY_HOME, KEY_UP, KEY_PAGE_UP, '-', KEY_LEFT, 0, KEY_RIGHT, '+',
+    KEY_END, KEY_DOWN, KEY_PAGE_DOWN, KEY_INSERT, KEY_DELETE,
+};
+
+/* ============================================================================
+ * Interrupt Handler (Producer)
+ * ============================================================================
+ */
+
+static int kbd_irq_handler(unsigned int irq, void* context) {
+    unsigned long long start = rdtsc();
+    unsigned int head = sc_head;
+    unsigned int queued = 0;
+    int handled = IRQ_NONE;
+    unsigned int cycles;
+
+    (void)irq;
+    (void)context;
+
+    for (unsigned int i = 0; i < KBD_IRQ_BUDGET; i++) {
+        unsigned char status = inb(KBD_STATUS_PORT);
+        unsigned char byte;
+
+        if (!(status & KBD_STATUS_OBF)) {
+            break;
+        }
+        byte = inb(KBD_DATA_PORT);
+        handled = IRQ_HANDLED;
+
+        if (status & KBD_STATUS_AUX) {
+            stats.aux_bytes++;
+        } else if (head - __atomic_load_n(&sc_tail, __ATOMIC_ACQUIRE) >= KBD_SCANCODE_RING) {
+            stats.overruns++;
+        } else {
+            scancode_ring[head & KBD_SCANCODE_MASK] = byte;
+            head++;
+            queued++;
+        }
+    }
+    if (handled == IRQ_NONE) {
+        return IRQ_NONE;
+    }
+
+    if (queued != 0) {
+        __atomic_store_n(&sc_head, head, __ATOMIC_RELEASE);
+        stats.scancodes += queued;
+        wait_wake_one(&sc_wait);
+    }
+
+    stats.irqs++;
+    cycles = (unsigned int)(rdtsc() - start);
+    stats.isr_cycles += cycles;
+    if (cycles > stats.isr_max_cycles) {
+        stats.isr_max_cycles = cycles;
+    }
+    return IRQ_HANDLED;
+}
+
+/* ============================================================================
+ * Decoder (Consumer)
+ * ============================================================================
+ */
+
+/* Queue a key for the readers (kbd thread only) */
+static void kbd_queue_char(unsigned short key) {
+    unsigned int head = char_head;
+
+    if (head - __atomic_load_n(&char_tail, __ATOMIC_ACQUIRE) >= KBD_CHAR_RING) {
+        stats.char_overruns++;
+        return;
+    }
+    char_ring[head & KBD_CHAR_MASK] = key;
+    __atomic_store_n(&char_head, head + 1, __ATOMIC_RELEASE);
+    stats.chars++;
+}
+
+/* Character or KEY_* of a key under the current modifiers, 0 if none */
+static unsigned short kbd_translate(unsigned int keycode) {
+    int shift = (modifiers & KBD_MOD_SHIFT) != 0;
+    unsigned char c;
+
+    if (keycode & SC_EXTENDED) {
+        switch (keycode & ~SC_EXTENDED) {
+            case 0x1C: return '\n';           /* Keypad Enter */
+            case 0x35: return '/';            /* Keypad / */
+            case 0x47: return KEY_HOME;
+            case 0x48: return KEY_UP;
+            case 0x49: return KEY_PAGE_UP;
+            case 0x4B: return KEY_LEFT;
+            case 0x4D: return KEY_RIGHT;
+            case 0x4F: return KEY_END;
+            case 0x50: return KEY_DOWN;
+            case 0x51: return KEY_PAGE_DOWN;
+            case 0x52: return KEY_INSERT;
+            case 0x53: return KEY_DELETE;
+            default:   return 0;
+        }
+    }
+
+    if (keycode >= SC_F1 && keycode <= SC_F10) {
+        return (unsigned short)(KEY_F1 + keycode - SC_F1);
+    }
+    if (keycode == SC_F11 || keycode == SC_F12) {
+        return (unsigned short)(KEY_F1 + 10 + keycode - SC_F11);
+    }
+    if (keycode >= SC_KEYPAD_FIRST && keycode <= SC_KEYPAD_LAST) {
+        /* Shift inverts Num Lock on the keypad */
+        if ((modifiers & KBD_MOD_NUM) && !shift) {
+            return (unsigned char)kbd_keypad[keycode - SC_KEYPAD_FIRST];
+        }
+        return kbd_keypad_nav[keycode - SC_KEYPAD_FIRST];
+    }
+    if (keycode >= sizeof(kbd_map) - 1) {
+        return 0;
+    }
+
+    c = (unsigned char)kbd_map[keycode];
+    if (c >= 'a' && c <= 'z') {
+        if (modifiers & KBD_MOD_CTRL) {
+            return c & 0x1F;
+        }
+        if (shift != ((modifiers & KBD_MOD_CAPS) != 0)) {
+            c = (unsigned char)(c - 'a' + 'A');
+        }
+        return c;
+    }
+    return (unsigned char)(shift ? kbd_map_shift[keycode] : kbd_map[keycode]);
+}
+
+/* Track a modifier key; returns 1 if `keycode` was one */
+static int kbd_modifier(unsigned int keycode, int pressed) {
+    unsigned int* held;
+    unsigned int bit;
+    unsigned int lock;
+
+    switch (keycode) {
+        case SC_LSHIFT: held = &shift_keys; bit = 1; break;
+        case SC_RSHIFT: held = &shift_keys; bit = 2; break;
+        case SC_LCTRL:  held = &ctrl_keys;  bit = 1; break;
+        case SC_RCTRL:  held = &ctrl_keys;  bit = 2; break;
+        case SC_LALT:   held = &alt_keys;   bit = 1; break;
+        case SC_RALT:   held = &alt_keys;   bit = 2; break;
+        case SC_CAPS:   lock = KBD_MOD_CAPS;   goto toggle;
+        case SC_NUM:    lock = KBD_MOD_NUM;    goto toggle;
+        case SC_SCROLL: lock = KBD_MOD_SCROLL; goto toggle;
+        default:        return 0;
+    }
+
+    if (pressed) {
+        *held |= bit;
+    } else {
+        *held &= ~bit;
+    }
+    modifiers &= ~(KBD_MOD_SHIFT | KBD_MOD_CTRL | KBD_MOD_ALT);
+    modifiers |= (shift_keys ? KBD_MOD_SHIFT : 0) | (ctrl_keys ? KBD_MOD_CTRL : 0) |
+                 (alt_keys ? KBD_MOD_ALT : 0);
+    return 1;
+
+toggle:
+    /* Typematic repeat sends more presses: toggle on the first only */
+    if (pressed && !(locks_held & lock)) {
+        modifiers ^= lock;
+    }
+    if (pressed) {
+        locks_held |= lock;
+    } else {
+        locks_held &= ~lock;
+    }
+    return 1;
+}
+
+/* Feed one scancode byte to the decoder */
+static void kbd_decode(unsigned char code) {
+    struct key_event event;
+    unsigned int keycode;
+    int pressed;
+
+    if (pause_bytes != 0) {
+        pause_bytes--;
+        return;
+    }
+    if (code == 0xE1) {
+        pause_bytes = SC_PAUSE_TAIL;
+        return;
+    }
+    if (code == 0xE0) {
+        extended = 1;
+        return;
+    }
+
+    pressed = !(code & 0x80);
+    keycode = (code & 0x7F) | (extended ? SC_EXTENDED : 0);
+    extended = 0;
+    if (keycode == SC_FAKE_SHIFT || keycode == (SC_EXTENDED | SC_RSHIFT)) {
+        return;
+    }
+
+    event.keycode = (unsigned short)keycode;
+    event.key = kbd_modifier(keycode, pressed) ? 0 : kbd_translate(keycode);
+    event.pressed = (unsigned char)pressed;
+    event.modifiers = (unsigned char)modifiers;
+    stats.events++;
+
+    if (event_handler != 0) {
+        event_handler(&event);
+    }
+    if (pressed && event.key != 0) {
+        kbd_queue_char(event.key);
+    }
+}
+
+/* Decode every queued scancode, one batch per wakeup */
+static void kbd_thread(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        unsigned int tail = sc_tail;
+        unsigned int head;
+        unsigned int chars = stats.chars;
+
+        wait_event(&sc_wait, __atomic_load_n(&sc_head, __ATOMIC_ACQUIRE) != tail);
+        head = __atomic_load_n(&sc_head, __ATOMIC_ACQUIRE);
+
+        if (head - tail > stats.max_batch) {
+            stats.max_batch = head - tail;
+        }
+        stats.batches++;
+        while (tail != head) {
+            kbd_decode(scancode_ring[tail & KBD_SCANCODE_MASK]);
+            tail++;
+        }
+        __atomic_store_n(&sc_tail, tail, __ATOMIC_RELEASE);
+
+        if (stats.chars != chars) {
+            wait_wake_all(&char_wait);
+        }
+    }
+}
+
+/* ============================================================================
+ * Readers
+ * ============================================================================
+ */
+
+/* Next key, or -1 if none is queued */
+int kbd_trygetchar(void) {
+    unsigned int flags = irq_save();
+    unsigned int tail = char_tail;
+    int key = -1;
+
+    if (tail != __atomic_load_n(&char_head, __ATOMIC_ACQUIRE)) {
+        key = char_ring[tail & KBD_CHAR_MASK];
+        __atomic_store_n(&char_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    irq_restore(flags);
+    return key;
+}
+
+/* Next key, blocking until there is one */
+int kbd_getchar(void) {
+    int key;
+
+    while ((key = kbd_trygetchar()) < 0) {
+        wait_event(&char_wait, char_tail != __atomic_load_n(&char_head, __ATOMIC_ACQUIRE));
+    }
+    return key;
+}
+
+/* Copy up to `len` queued characters without blocking */
+unsigned int kbd_read(char* buf, unsigned int len) {
+    unsigned int n = 0;
+
+    while (n < len) {
+        int key = kbd_trygetchar();
+        if (key < 0) {
+            break;
+        }
+        if (key <= 0xFF) {
+            buf[n++] = (char)key;
+        }
+    }
+    return n;
+}
+
+/* Receive every key event */
+void kbd_set_event_handler(kbd_event_fn_t fn) {
+    event_handler = fn;
+}
+
+/* ============================================================================
+ * Initialization and Statistics
+ * ============================================================================
+ */
+
+/* Feed the decoder a recorded sequence before the keyboard is live:
+ * Shift+A, a, Up, Ctrl+C, Caps Lock on, 1, q, Caps Lock off, Pause, Enter.
+ * Returns the number of keys that came out wrong. */
+static unsigned int kbd_selftest(void) {
+    static const unsigned char codes[] = {
+        0x2A, 0x1E, 0x9E, 0xAA, 0x1E, 0x9E, 0xE0, 0x48, 0xE0, 0xC8,
+        0x1D, 0x2E, 0xAE, 0x9D, 0x3A, 0xBA, 0x02, 0x82, 0x10, 0x90,
+        0x3A, 0xBA, 0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5, 0x1C, 0x9C,
+    };
+    static const unsigned short expect[] = { 'A', 'a', KEY_UP, 0x03, '1', 'Q', '\n' };
+    unsigned int bad = 0;
+
+    for (unsigned int i = 0; i < sizeof(codes); i++) {
+        kbd_decode(codes[i]);
+    }
+    for (unsigned int i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+        bad += kbd_trygetchar() != expect[i];
+    }
+    bad += kbd_trygetchar() != -1;
+    bad += modifiers != 0;
+
+    stats.events = 0;
+    stats.chars = 0;
+    return bad;
+}
+
+/* Flush the controller, start the kbd thread and take IRQ 1 */
+int kbd_init(void) {
+    unsigned int flushed = 0;
+    unsigned int bad = kbd_selftest();
+
+    /* A byte left from before boot would keep the line from raising
+     * another edge */
+    while ((inb(KBD_STATUS_PORT) & KBD_STATUS_OBF) && flushed < KBD_IRQ_BUDGET) {
+        inb(KBD_DATA_PORT);
+        flushed++;
+    }
+
+    if (thread_create("kbd", kbd_thread, 0, KBD_THREAD_PRIO) == 0) {
+        debug_error("kbd: cannot start the decoder thread");
+        return -1;
+    }
+    if (request_irq(KBD_IRQ, kbd_irq_handler, IRQF_POLL, "kbd", 0) != 0) {
+        return -1;
+    }
+
+    debug_logf(bad ? LOG_ERROR : LOG_INFO,
+               "kbd: PS/2 keyboard on IRQ %u, %u-byte scancode ring, decoder self-test %s, %u stale bytes flushed",
+               KBD_IRQ, KBD_SCANCODE_RING, bad ? "FAILED" : "ok", flushed);
+    return bad ? -1 : 0;
+}
+
+/* Get a snapshot of the counters */
+void kbd_get_stats(struct kbd_stats* out) {
+    unsigned int flags = irq_save();
+
+    *out = stats;
+    irq_restore(flags);
+}
+
+/* Print the counters */
+void kbd_dump_stats(void) {
+    struct kbd_stats s;
+    unsigned int avg;
+
+    kbd_get_stats(&s);
+    avg = s.irqs ? (unsigned int)div_u64(s.isr_cycles, s.irqs) : 0;
+    kprintf("Keyboard: %u irqs, %u scancodes, %u overruns, %u mouse bytes\n",
+            s.irqs, s.scancodes, s.overruns, s.aux_bytes);
+    kprintf("  %u batches (max %u), %u events, %u chars, %u char overruns\n",
+            s.batches, s.max_batch, s.events, s.chars, s.char_overruns);
+    kprintf("  ISR %u cycles avg, %u max\n", avg, s.isr_max_cycles);
+}
@@ -0,0 +1,104 @@
+/*
+ * PS/2 Keyboard Driver Header
+ *
+ * The IRQ 1 handler does as little as possible: it reads every pending
+ * byte from the 8042 controller into a scancode ring and wakes the
+ * consumer. The ring has exactly one producer (the handler, on the boot
+ * CPU, where the I/O APIC delivers IRQ 1) and one consumer (the "kbd"
+ * thread), so it needs no lock: each side owns one index and publishes
+ * it with a release store.
+ *
+ * The kbd thread takes everything queued so far as one batch and decodes
+ * it outside interrupt context: scancode set 1 (what the controller
+ * delivers with translation on), E0-prefixed extended keys, the E1 Pause
+ * sequence, Shift/Ctrl/Alt and the Caps/Num/Scroll locks, with a US
+ * layout. Each key press or release becomes a struct key_event, passed
+ * to an optional event handler; presses that produce a character are
+ * queued for kbd_getchar() in a second single-producer ring.
+ */
+
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+/* 8042 controller ports and status bits */
+#define KBD_DATA_PORT      0x60
+#define KBD_STATUS_PORT    0x64
+#define KBD_STATUS_OBF     0x01    /* Output buffer full: a byte to read */
+#define KBD_STATUS_AUX     0x20    /* ... and it came from the mouse port */
+
+#define KBD_IRQ            1
+
+/* Ring sizes (powers of two) */
+#define KBD_SCANCODE_RING  256
+#define KBD_CHAR_RING      256
+
+/* Keys without a character, as returned by kbd_getchar() (above 0xFF) */
+#define KEY_UP             0x100
+#define KEY_DOWN           0x101
+#define KEY_LEFT           0x102
+#define KEY_RIGHT          0x103
+#define KEY_HOME           0x104
+#define KEY_END            0x105
+#define KEY_PAGE_UP        0x106
+#define KEY_PAGE_DOWN      0x107
+#define KEY_INSERT         0x108
+#define KEY_DELETE         0x109
+#define KEY_F1             0x110   /* KEY_F1 .. KEY_F1 + 11 */
+
+/* Modifier and lock state (key_event.modifiers) */
+#define KBD_MOD_SHIFT      0x01
+#define KBD_MOD_CTRL       0x02
+#define KBD_MOD_ALT        0x04
+#define KBD_MOD_CAPS       0x10
+#define KBD_MOD_NUM        0x20
+#define KBD_MOD_SCROLL     0x40
+
+/* One key press or release */
+struct key_event {
+    unsigned short keycode;        /* Set 1 make code, | 0x80 for E0 keys */
+    unsigned short key;            /* Character or KEY_*, 0 if none */
+    unsigned char pressed;         /* 0 for a release */
+    unsigned char modifiers;       /* KBD_MOD_* after this event */
+};
+
+typedef void (*kbd_event_fn_t)(const struct key_event* event);
+
+/* Counters (cycles are TSC cycles) */
+struct kbd_stats {
+    unsigned int irqs;
+    unsigned int scancodes;        /* Bytes queued by the handler */
+    unsigned int overruns;         /* ... dropped because the ring was full */
+    unsigned int aux_bytes;        /* Mouse bytes discarded */
+    unsigned int batches;          /* Consumer passes over the ring */
+    unsigned int max_batch;        /* Most scancodes decoded in one pass */
+    unsigned int events;           /* Key presses and releases */
+    unsigned int chars;            /* Keys queued for kbd_getchar() */
+    unsigned int char_overruns;    /* ... dropped because nobody read them */
+    unsigned long long isr_cycles; /* Total time in the IRQ handler */
+    unsigned int isr_max_cycles;
+};
+
+/* Flush the controller, start the kbd thread and take IRQ 1 (after
+ * sched_init). Returns 0 on success. */
+int kbd_init(void);
+
+/* Next key (a character or KEY_*), blocking until there is one */
+int kbd_getchar(void);
+
+/* Next key, or -1 if none is queued */
+int kbd_trygetchar(void);
+
+/* Copy up to `len` queued characters (KEY_* skipped) without blocking;
+ * returns how many. Fits syscall_set_stdin(). */
+unsigned int kbd_read(char* buf, unsigned int len);
+
+/* Receive every key event (0 to stop); called from the kbd thread */
+void kbd_set_event_handler(kbd_event_fn_t fn);
+
+/* Get a snapshot of the counters */
+void kbd_get_stats(struct kbd_stats* stats);
+
+/* Print the counters */
+void kbd_dump_stats(void);
+
+#endif /* KEYBOARD_H */
@@ -0,0 +1,180 @@
+/*
+ * Kernel Log Ring Buffer Implementation
+ *
+ * Multi-producer, single-consumer ring of fixed-size log records.
+ *
+ * Writers:
+ *   1. Reserve a sequence number with an atomic fetch-and-add on klog_head.
+ *   2. Mark the slot busy (atomic exchange), fill it in.
+ *   3. Publish it by storing seq + 1 into the slot (release).
+ *   A writer that finds the slot still busy with an older lap gives up and
+ *   raises the slot's skip field to seq + 1 instead, so the reader does
+ *   not wait for a record that will never be published.
+ *
+ * Reader:
+ *   Walks klog_tail towards klog_head. A slot whose sequence number does
+ *   not match yet is still being written and is retried later, unless its
+ *   skip field names the wanted record; a slot holding a newer sequence
+ *   number was overwritten by a later lap.
+ */
+
+#include "klog.h"
+#include "cpu.h"
+
+#define KLOG_MASK      (KLOG_RECORDS - 1)
+#define KLOG_SEQ_BUSY  0xFFFFFFFFu
+
+/* The ring and its indices are global so they can be inspected from GDB */
+struct klog_record klog_ring[KLOG_RECORDS];
+volatile unsigned int klog_head = 0;   /* Next sequence number to reserve */
+volatile unsigned int klog_tail = 0;   /* Next sequence number to flush */
+
+_Static_assert(sizeof(struct klog_record) == 128, "klog records must fill two cache lines");
+
+static volatile unsigned int klog_reader_busy = 0;
+static struct klog_stats stats;
+
+/* Record that `seq` was dropped at a busy slot. One field per slot is
+ * enough: only the newest drop on a slot can still be ahead of the reader,
+ * because reserving a later lap's number moves klog_head more than
+ * KLOG_RECORDS past every older one, and klog_read() steps over anything
+ * that far behind. The field only moves forward, so a writer that stores
+ * late cannot hide a newer drop behind an older one. */
+static void klog_mark_dropped(struct klog_record* rec, unsigned int seq) {
+    unsigned int skip = __atomic_load_n(&rec->skip, __ATOMIC_RELAXED);
+
+    while ((int)(seq + 1 - skip) > 0 &&
+           !__atomic_compare_exchange_n(&rec->skip, &skip, seq + 1, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        /* skip was refreshed with the current value */
+    }
+}
+
+/* Copy one record field by field (no memcpy in a freestanding kernel) */
+static void klog_copy_record(struct klog_record* dst, const struct klog_record* src) {
+    dst->seq = src->seq;
+    dst->level = src->level;
+    dst->timestamp = src->timestamp;
+    for (unsigned int i = 0; i < KLOG_MESSAGE_LEN; i++) {
+        dst->message[i] = src->message[i];
+        if (src->message[i] == '\0') {
+            break;
+        }
+    }
+    dst->message[KLOG_MESSAGE_LEN - 1] = '\0';
+}
+
+/* Append a record; safe from any context, never blocks */
+void klog_write(unsigned int level, const char* message) {
+    unsigned int seq = __atomic_fetch_add(&klog_head, 1, __ATOMIC_ACQ_REL);
+    struct klog_record* rec = &klog_ring[seq & KLOG_MASK];
+
+    /* Claim the slot; if another writer still owns it, give up and tell
+     * the reader to step over this sequence number */
+    if (__atomic_exchange_n(&rec->seq, KLOG_SEQ_BUSY, __ATOMIC_ACQUIRE) == KLOG_SEQ_BUSY) {
+        klog_mark_dropped(rec, seq);
+        __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec->level = level;
+    rec->timestamp = rdtsc();
+
+    unsigned int i = 0;
+    while (i < KLOG_MESSAGE_LEN - 1 && message[i] != '\0') {
+        rec->message[i] = message[i];
+        i++;
+    }
+    rec->message[i] = '\0';
+
+    /* Publish */
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stats.written, 1, __ATOMIC_RELAXED);
+}
+
+/* Read the next unflushed record in order */
+int klog_read(struct klog_record* out) {
+    int found = 0;
+
+    /* Single consumer: a concurrent reader simply backs off */
+    if (__atomic_exchange_n(&klog_reader_busy, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    unsigned int head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = klog_tail;
+
+    while (tail != head) {
+        /* Writers lapped the reader: skip what has been overwritten */
+        if (head - tail > KLOG_RECORDS) {
+            stats.overwritten += head - tail - KLOG_RECORDS;
+            tail = head - KLOG_RECORDS;
+        }
+
+        struct klog_record* rec = &klog_ring[tail & KLOG_MASK];
+        unsigned int seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+        if (seq != tail + 1) {
+            if (__atomic_load_n(&rec->skip, __ATOMIC_ACQUIRE) == tail + 1) {
+                /* Dropped by its writer (already counted) */
+                tail++;
+                continue;
+            }
+            if (seq == KLOG_SEQ_BUSY || (int)(seq - (tail + 1)) < 0) {
+                /* Reserved but not yet published: try again later */
+                break;
+            }
+            /* A newer lap already reused this slot */
+            stats.overwritten++;
+            tail++;
+            continue;
+        }
+
+        klog_copy_record(out, rec);
+
+        /* The writer may have lapped us while we were copying */
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            stats.dropped++;
+            tail++;
+            continue;
+        }
+
+        tail++;
+        stats.flushed++;
+        found = 1;
+        break;
+    }
+
+    klog_tail = tail;
+    __atomic_store_n(&klog_reader_busy, 0, __ATOMIC_RELEASE);
+    return found;
+}
+
+/* Check whether records are waiting to be flushed */
+int klog_pending(void) {
+    return klog_tail != __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+}
+
+/* Visit every record still held in the ring, oldest first */
+void klog_dump(void (*visit)(const struct klog_record* record)) {
+    struct klog_record copy;
+    unsigned int head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    unsigned int seq = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+
+    for (; seq != head; seq++) {
+        struct klog_record* rec = &klog_ring[seq & KLOG_MASK];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+            continue;
+        }
+        klog_copy_record(&copy, rec);
+        visit(&copy);
+    }
+}
+
+/* Get a snapshot of the log ring statistics */
+void klog_get_stats(struct klog_stats* out) {
+    out->written = stats.written;
+    out->flushed = stats.flushed;
+    out->overwritten = stats.overwritten;
+    out->dropped = stats.dropped;
+}
@@ -0,0 +1,58 @@
+/*
+ * Kernel Log Ring Buffer Header
+ *
+ * Log records (timestamp, level, message) are written into a fixed-size
+ * ring that is lock-free and safe to use from interrupt context. Writers
+ * reserve a slot with a single atomic increment and publish it by storing
+ * the slot's sequence number last. A single reader drains the ring later
+ * (from the idle loop, or on demand) and hands each record to the output
+ * sinks, so a log call from an interrupt handler only costs a memcpy.
+ *
+ * When the ring wraps before it is drained, the oldest records are
+ * overwritten and counted. The whole ring stays in memory, so its contents
+ * can be dumped after a crash (debug_dmesg(), or the `dmesg` GDB command
+ * in debug.gdb).
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+/* Ring geometry (KLOG_RECORDS must be a power of two) */
+#define KLOG_RECORDS      256
+#define KLOG_MESSAGE_LEN  108
+
+/* One log record (128 bytes, two cache lines) */
+struct klog_record {
+    volatile unsigned int seq;      /* Sequence number + 1 once committed, 0 while being written */
+    unsigned int level;             /* LOG_DEBUG .. LOG_PANIC */
+    unsigned long long timestamp;   /* Time stamp counter at the time of the call */
+    volatile unsigned int skip;     /* Sequence number + 1 of a record dropped on this slot */
+    char message[KLOG_MESSAGE_LEN]; /* NUL-terminated, truncated if too long */
+};
+
+/* Log ring statistics */
+struct klog_stats {
+    unsigned int written;      /* Records committed */
+    unsigned int flushed;      /* Records handed to the sinks */
+    unsigned int overwritten;  /* Records replaced before they were flushed */
+    unsigned int dropped;      /* Records lost to a busy or torn slot */
+};
+
+/* Append a record; safe from any context, never blocks */
+void klog_write(unsigned int level, const char* message);
+
+/* Read the next unflushed record in order. Returns 1 if a record was
+ * copied to `out`, 0 if nothing is pending (or another reader is active). */
+int klog_read(struct klog_record* out);
+
+/* Check whether records are waiting to be flushed */
+int klog_pending(void);
+
+/* Visit every record still held in the ring, oldest first, whether or not
+ * it has been flushed. Does not consume anything. */
+void klog_dump(void (*visit)(const struct klog_record* record));
+
+/* Get a snapshot of the log ring statistics */
+void klog_get_stats(struct klog_stats* stats);
+
+#endif /* KLOG_H */
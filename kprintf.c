@@ -0,0 +1,366 @@
+/*
+ * Formatted Output Engine Implementation
+ *
+ * Decimal conversion emits two digits per step from a 200-byte lookup
+ * table, so a 32-bit number costs at most five divisions by the constant
+ * 100 (which the compiler turns into a multiply). 64-bit values are first
+ * split into 8-digit chunks with the native 64-by-32 divide (math64.h).
+ */
+
+#include "kprintf.h"
+#include "math64.h"
+
+/* Conversion flags */
+#define FMT_LEFT     0x01  /* '-' */
+#define FMT_ZERO     0x02  /* '0' */
+#define FMT_PLUS     0x04  /* '+' */
+#define FMT_SPACE    0x08  /* ' ' */
+#define FMT_ALT      0x10  /* '#' */
+#define FMT_UPPER    0x20  /* %X */
+#define FMT_PTR      0x40  /* %p: "0x" prefix even for zero */
+
+/* Output cursor: counts every character, stores only what fits */
+struct fmt_out {
+    char* buffer;
+    unsigned int size;
+    unsigned int pos;
+};
+
+/* Parsed conversion specification */
+struct fmt_spec {
+    unsigned int flags;
+    int width;
+    int precision;  /* -1 if not given */
+};
+
+/* "00" "01" ... "99" */
+static const char digit_pairs[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+static inline void fmt_putc(struct fmt_out* out, char c) {
+    if (out->pos + 1 < out->size) {
+        out->buffer[out->pos] = c;
+    }
+    out->pos++;
+}
+
+static void fmt_repeat(struct fmt_out* out, char c, int count) {
+    while (count-- > 0) {
+        fmt_putc(out, c);
+    }
+}
+
+/* Write a 32-bit value in decimal, ending just before `end`; returns the start */
+static char* fmt_u32_dec(char* end, unsigned int value) {
+    while (value >= 100) {
+        unsigned int pair = (value % 100) * 2;
+        value /= 100;
+        *--end = digit_pairs[pair + 1];
+        *--end = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--end = digit_pairs[value * 2 + 1];
+        *--end = digit_pairs[value * 2];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+/* Write exactly 8 decimal digits (with leading zeros), ending before `end` */
+static char* fmt_u32_dec8(char* end, unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+        unsigned int pair = (value % 100) * 2;
+        value /= 100;
+        *--end = digit_pairs[pair + 1];
+        *--end = digit_pairs[pair];
+    }
+    return end;
+}
+
+/* Convert a value to digits in `base`, ending before `end`; returns the start */
+static char* fmt_digits(char* end, unsigned long long value, unsigned int base, int upper) {
+    const char* digits = upper ? hex_upper : hex_lower;
+
+    if (base == 10) {
+        /* Peel off 8-digit chunks until the rest fits in 32 bits */
+        while (value > 0xFFFFFFFFull) {
+            unsigned int chunk;
+            value = div_u64_rem(value, 100000000u, &chunk);
+            end = fmt_u32_dec8(end, chunk);
+        }
+        return fmt_u32_dec(end, (unsigned int)value);
+    }
+
+    unsigned int shift = (base == 16) ? 4 : 3;
+    unsigned int mask = base - 1;
+    do {
+        *--end = digits[value & mask];
+        value >>= shift;
+    } while (value != 0);
+    return end;
+}
+
+/* Emit a formatted integer with sign, prefix, precision and padding */
+static void fmt_integer(struct fmt_out* out, const struct fmt_spec* spec,
+                        unsigned long long value, int negative, unsigned int base) {
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* start;
+    const char* prefix = "";
+    int digits;
+    int zeros = 0;
+    int prefix_len;
+    int total;
+
+    if (value == 0 && spec->precision == 0) {
+        start = end;  /* "%.0d" of zero prints nothing */
+    } else {
+        start = fmt_digits(end, value, base, spec->flags & FMT_UPPER);
+    }
+    digits = (int)(end - start);
+
+    if (negative) {
+        prefix = "-";
+    } else if (base == 10 && (spec->flags & FMT_PLUS)) {
+        prefix = "+";
+    } else if (base == 10 && (spec->flags & FMT_SPACE)) {
+        prefix = " ";
+    } else if ((spec->flags & FMT_PTR) || ((spec->flags & FMT_ALT) && value != 0)) {
+        if (base == 16) {
+            prefix = (spec->flags & FMT_UPPER) ? "0X" : "0x";
+        } else if (base == 8) {
+            prefix = "0";
+        }
+    }
+    prefix_len = 0;
+    while (prefix[prefix_len] != '\0') {
+        prefix_len++;
+    }
+
+    if (spec->precision > digits) {
+        zeros = spec->precision - digits;
+    }
+    total = prefix_len + zeros + digits;
+
+    /* Zero padding fills the width only when no precision was given */
+    if ((spec->flags & FMT_ZERO) && !(spec->flags & FMT_LEFT) &&
+        spec->precision < 0 && spec->width > total) {
+        zeros += spec->width - total;
+        total = spec->width;
+    }
+
+    if (!(spec->flags & FMT_LEFT)) {
+        fmt_repeat(out, ' ', spec->width - total);
+    }
+    for (int i = 0; i < prefix_len; i++) {
+        fmt_putc(out, prefix[i]);
+    }
+    fmt_repeat(out, '0', zeros);
+    while (start < end) {
+        fmt_putc(out, *start++);
+    }
+    if (spec->flags & FMT_LEFT) {
+        fmt_repeat(out, ' ', spec->width - total);
+    }
+}
+
+/* Emit a string honoring precision (maximum length) and width */
+static void fmt_string(struct fmt_out* out, const struct fmt_spec* spec, const char* str) {
+    int len = 0;
+
+    if (str == 0) {
+        str = "(null)";
+    }
+    while (str[len] != '\0' && (spec->precision < 0 || len < spec->precision)) {
+        len++;
+    }
+
+    if (!(spec->flags & FMT_LEFT)) {
+        fmt_repeat(out, ' ', spec->width - len);
+    }
+    for (int i = 0; i < len; i++) {
+        fmt_putc(out, str[i]);
+    }
+    if (spec->flags & FMT_LEFT) {
+        fmt_repeat(out, ' ', spec->width - len);
+    }
+}
+
+/* Format into `buffer` (at most `size` bytes including the terminator) */
+int kvsnprintf(char* buffer, unsigned int size, const char* format, va_list args) {
+    struct fmt_out out = { buffer, size, 0 };
+    const char* p = format;
+
+    while (*p != '\0') {
+        if (*p != '%') {
+            fmt_putc(&out, *p++);
+            continue;
+        }
+        p++;
+
+        struct fmt_spec spec = { 0, 0, -1 };
+
+        /* Flags */
+        for (;;) {
+            if (*p == '-') {
+                spec.flags |= FMT_LEFT;
+            } else if (*p == '0') {
+                spec.flags |= FMT_ZERO;
+            } else if (*p == '+') {
+                spec.flags |= FMT_PLUS;
+            } else if (*p == ' ') {
+                spec.flags |= FMT_SPACE;
+            } else if (*p == '#') {
+                spec.flags |= FMT_ALT;
+            } else {
+                break;
+            }
+            p++;
+        }
+
+        /* Width */
+        if (*p == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < 0) {
+                spec.flags |= FMT_LEFT;
+                spec.width = -spec.width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                spec.width = spec.width * 10 + (*p++ - '0');
+            }
+        }
+
+        /* Precision */
+        if (*p == '.') {
+            p++;
+            spec.precision = 0;
+            if (*p == '*') {
+                spec.precision = va_arg(args, int);
+                if (spec.precision < 0) {
+                    spec.precision = -1;
+                }
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    spec.precision = spec.precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+
+        /* Length modifier: number of 'l's, or 'h'/'hh' (promoted anyway) */
+        int longs = 0;
+        int shorts = 0;
+        while (*p == 'l' || *p == 'h' || *p == 'z') {
+            if (*p == 'l') {
+                longs++;
+            } else if (*p == 'h') {
+                shorts++;
+            }
+            p++;
+        }
+
+        unsigned long long value;
+        char conv = *p;
+        if (conv == '\0') {
+            break;
+        }
+        p++;
+
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                long long sval = (longs >= 2) ? va_arg(args, long long) : va_arg(args, int);
+                if (shorts == 1) {
+                    sval = (short)sval;
+                } else if (shorts >= 2) {
+                    sval = (signed char)sval;
+                }
+                int negative = sval < 0;
+                value = negative ? (unsigned long long)(-(sval + 1)) + 1 : (unsigned long long)sval;
+                fmt_integer(&out, &spec, value, negative, 10);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o': {
+                value = (longs >= 2) ? va_arg(args, unsigned long long) : va_arg(args, unsigned int);
+                if (shorts == 1) {
+                    value = (unsigned short)value;
+                } else if (shorts >= 2) {
+                    value = (unsigned char)value;
+                }
+                if (conv == 'X') {
+                    spec.flags |= FMT_UPPER;
+                }
+                fmt_integer(&out, &spec, value, 0,
+                            conv == 'u' ? 10 : (conv == 'o' ? 8 : 16));
+                break;
+            }
+            case 'p': {
+                /* Pointers: 0x followed by all 8 hex digits; the width
+                 * applies to the whole "0x..." string, as for %#x */
+                value = (unsigned int)va_arg(args, void*);
+                if (spec.precision < 8) {
+                    spec.precision = 8;
+                }
+                spec.flags |= FMT_PTR;
+                fmt_integer(&out, &spec, value, 0, 16);
+                break;
+            }
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                if (!(spec.flags & FMT_LEFT)) {
+                    fmt_repeat(&out, ' ', spec.width - 1);
+                }
+                fmt_putc(&out, c);
+                if (spec.flags & FMT_LEFT) {
+                    fmt_repeat(&out, ' ', spec.width - 1);
+                }
+                break;
+            }
+            case 's':
+                fmt_string(&out, &spec, va_arg(args, const char*));
+                break;
+            case '%':
+                fmt_putc(&out, '%');
+                break;
+            default:
+                /* Unknown conversion: print it verbatim */
+                fmt_putc(&out, '%');
+                fmt_putc(&out, conv);
+                break;
+        }
+    }
+
+    if (size > 0) {
+        out.buffer[out.pos < size ? out.pos : size - 1] = '\0';
+    }
+    return (int)out.pos;
+}
+
+/* Format into `buffer` (at most `size` bytes including the terminator) */
+int ksnprintf(char* buffer, unsigned int size, const char* format, ...) {
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,38 @@
+/*
+ * Formatted Output Engine Header
+ *
+ * A small freestanding vsnprintf. Output always goes into a caller-provided
+ * buffer; the debug layer (debug.h) formats a line once and hands that
+ * buffer to every output sink.
+ *
+ * Supported conversions:
+ *   %d %i %u %x %X %o %c %s %p %%
+ * Flags: '-' (left justify), '0' (zero pad), '+', ' ', '#' (0x / 0 prefix)
+ * Width and precision, including '*'
+ * Length modifiers: hh, h, l, ll (64-bit), z
+ */
+
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+/* Variable arguments (no <stdarg.h> with -nostdinc) */
+#ifndef va_start
+typedef __builtin_va_list va_list;
+#define va_start(ap, last) __builtin_va_start(ap, last)
+#define va_arg(ap, type)   __builtin_va_arg(ap, type)
+#define va_end(ap)         __builtin_va_end(ap)
+#define va_copy(dst, src)  __builtin_va_copy(dst, src)
+#endif
+
+/* Let the compiler check format strings at call sites */
+#define KPRINTF_FORMAT(fmt_index, first_arg) \
+    __attribute__((format(printf, fmt_index, first_arg)))
+
+/* Format into `buffer` (at most `size` bytes including the terminator).
+ * Returns the length the full output would have had, like C99 vsnprintf. */
+int kvsnprintf(char* buffer, unsigned int size, const char* format, va_list args);
+
+/* Format into `buffer` (at most `size` bytes including the terminator) */
+int ksnprintf(char* buffer, unsigned int size, const char* format, ...) KPRINTF_FORMAT(3, 4);
+
+#endif /* KPRINTF_H */
@@ -0,0 +1,203 @@
+/*
+ * Kernel Timekeeping Implementation
+ */
+
+#include "ktime.h"
+#include "pit.h"
+#include "cpu.h"
+#include "io.h"
+#include "math64.h"
+#include "debug.h"
+
+static unsigned int tsc_khz = 0;          /* 0 until calibrated */
+static unsigned int tsc_mult = 0;         /* ns = cycles * tsc_mult >> KTIME_SHIFT */
+static unsigned long long tsc_base = 0;   /* TSC value at ktime 0 */
+
+/* PIT cycles in one calibration run */
+#define KTIME_CALIBRATE_LATCH (PIT_FREQUENCY / 1000 * KTIME_CALIBRATE_MS)
+
+/* Check CPUID for a time stamp counter */
+static int ktime_cpu_has_tsc(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_1_EDX_TSC) != 0;
+}
+
+/* Check CPUID for a TSC that runs at a constant rate in every P/C-state */
+static int ktime_tsc_invariant(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) {
+        return 0;
+    }
+    cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+}
+
+/* Calibrate the TSC against the PIT */
+void ktime_init(void) {
+    unsigned long long best = ~0ull;
+    unsigned long long worst = 0;
+    unsigned long long khz;
+
+    if (!ktime_cpu_has_tsc()) {
+        debug_warn("ktime: no TSC, falling back to the PIT tick");
+        return;
+    }
+
+    /* The polling loop can only overshoot (SMIs, emulation), so the
+     * shortest run is the most accurate one */
+    for (unsigned int i = 0; i < KTIME_CALIBRATE_RUNS; i++) {
+        unsigned int flags = irq_save();
+        unsigned long long cycles = pit_wait_tsc(KTIME_CALIBRATE_LATCH);
+        irq_restore(flags);
+
+        if (cycles < best) {
+            best = cycles;
+        }
+        if (cycles > worst) {
+            worst = cycles;
+        }
+    }
+
+    /* kHz = cycles / (latch / PIT_FREQUENCY seconds) / 1000 */
+    khz = div_u64(best * PIT_FREQUENCY, KTIME_CALIBRATE_LATCH * 1000u);
+    if (khz == 0 || khz > 0xFFFFFFFFull) {
+        debug_error("ktime: TSC calibration failed");
+        return;
+    }
+
+    tsc_mult = (unsigned int)div_u64((unsigned long long)NSEC_PER_MSEC << KTIME_SHIFT,
+                                     (unsigned int)khz);
+    tsc_base = rdtsc();
+    tsc_khz = (unsigned int)khz;
+
+    debug_logf(LOG_INFO, "ktime: TSC %u.%03u MHz (%s), calibration spread %u cycles",
+               tsc_khz / 1000, tsc_khz % 1000,
+               ktime_tsc_invariant() ? "invariant" : "not invariant",
+               (unsigned int)(worst - best));
+}
+
+/* Measured TSC frequency in kHz (0 if not calibrated) */
+unsigned int ktime_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/* Convert a raw TSC reading to ktime nanoseconds */
+unsigned long long ktime_tsc_to_ns(unsigned long long tsc) {
+    if (tsc_khz == 0 || tsc < tsc_base) {
+        return 0;
+    }
+    return mul_u64_u32_shr(tsc - tsc_base, tsc_mult, KTIME_SHIFT);
+}
+
+/* Monotonic nanoseconds since ktime_init() */
+unsigned long long ktime_get_ns(void) {
+    unsigned int hz;
+
+    if (tsc_khz != 0) {
+        return mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, KTIME_SHIFT);
+    }
+
+    /* Fallback: tick resolution */
+    hz = pit_get_hz();
+    if (hz == 0) {
+        return 0;
+    }
+    return pit_get_jiffies() * (NSEC_PER_SEC / hz);
+}
+
+/* Spin for a number of TSC cycles */
+static void ktime_delay_cycles(unsigned long long cycles) {
+    unsigned long long start = rdtsc();
+
+    while (rdtsc() - start < cycles) {
+        cpu_relax();
+    }
+}
+
+/* Spin on PIT channel 2 for `ns` nanoseconds (uncalibrated fallback) */
+static void ktime_delay_pit(unsigned int ns) {
+    /* PIT cycles = ns * 1.193182 / 1000; round up so the delay is never short */
+    unsigned long long count = div_u64((unsigned long long)ns * PIT_FREQUENCY + NSEC_PER_SEC - 1,
+                                       NSEC_PER_SEC);
+
+    while (count > 0) {
+        unsigned int chunk = count > 0xFFFF ? 0xFFFF : (unsigned int)count;
+        pit_wait_tsc(chunk);
+        count -= chunk;
+    }
+}
+
+/* Busy-wait for at least `us` microseconds */
+void udelay(unsigned int us) {
+    if (tsc_khz == 0) {
+        while (us > 1000000) {
+            ktime_delay_pit(NSEC_PER_SEC);
+            us -= 1000000;
+        }
+        ktime_delay_pit(us * NSEC_PER_USEC);
+        return;
+    }
+    ktime_delay_cycles(div_u64((unsigned long long)us * tsc_khz, 1000));
+}
+
+/* Busy-wait for at least `ns` nanoseconds */
+void ndelay(unsigned int ns) {
+    if (tsc_khz == 0) {
+        ktime_delay_pit(ns);
+        return;
+    }
+    ktime_delay_cycles(div_u64((unsigned long long)ns * tsc_khz, NSEC_PER_MSEC));
+}
+
+/* Compare the TSC clock with the PIT tick and log the drift */
+int ktime_selfcheck(unsigned int ms) {
+    unsigned int hz = pit_get_hz();
+    unsigned long long start_jiffies, ticks, start_ns, elapsed_ns, expected_ns;
+    unsigned long long diff;
+    unsigned int ppm, elapsed_ms, elapsed_rem;
+    int faster;
+
+    if (tsc_khz == 0 || hz == 0 || !irqs_enabled()) {
+        debug_warn("ktime: self-check skipped (needs a calibrated TSC and the PIT tick)");
+        return 0;
+    }
+
+    if (ms > 1000) {
+        ms = 1000;
+    }
+    ticks = div_u64((unsigned long long)ms * hz, 1000);
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    /* Start on a tick edge so both clocks measure whole ticks */
+    start_jiffies = pit_get_jiffies();
+    while (pit_get_jiffies() == start_jiffies) {
+        cpu_relax();
+    }
+    start_jiffies++;
+    start_ns = ktime_get_ns();
+
+    while (pit_get_jiffies() < start_jiffies + ticks) {
+        cpu_relax();
+    }
+    elapsed_ns = ktime_get_ns() - start_ns;
+
+    /* One tick is divisor / PIT_FREQUENCY seconds, not exactly 1 / hz */
+    expected_ns = div_u64(ticks * pit_get_divisor() * NSEC_PER_SEC, PIT_FREQUENCY);
+
+    faster = elapsed_ns >= expected_ns;
+    diff = faster ? elapsed_ns - expected_ns : expected_ns - elapsed_ns;
+    ppm = (unsigned int)div_u64(diff * 1000000u, (unsigned int)expected_ns);
+
+    elapsed_ms = (unsigned int)div_u64_rem(elapsed_ns, NSEC_PER_MSEC, &elapsed_rem);
+    debug_logf(LOG_INFO, "ktime: TSC %u kHz, drift vs PIT %c%u ppm over %u ticks (%u.%03u ms)",
+               tsc_khz, faster ? '+' : '-', ppm, (unsigned int)ticks,
+               elapsed_ms, elapsed_rem / NSEC_PER_USEC);
+
+    return faster ? (int)ppm : -(int)ppm;
+}
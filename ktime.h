@@ -0,0 +1,53 @@
+/*
+ * Kernel Timekeeping Header
+ *
+ * The time stamp counter is the kernel clocksource: it is calibrated once
+ * against PIT channel 2 at boot, after which reading the time is a single
+ * rdtsc plus a fixed-point multiply (no port I/O, no locks):
+ *
+ *   ns = (tsc - tsc_base) * mult >> KTIME_SHIFT
+ *
+ * The PIT tick (pit.h) is kept as an independent reference; ktime_selfcheck()
+ * compares the two and reports the drift over serial (it needs the periodic
+ * tick, so it runs before the timer core switches the PIT to one-shot).
+ *
+ * Until ktime_init() has run (or on a CPU without a TSC) the clock falls back
+ * to jiffies and the delays fall back to polling PIT channel 2.
+ */
+
+#ifndef KTIME_H
+#define KTIME_H
+
+/* Length of one calibration run and number of runs (the shortest wins) */
+#define KTIME_CALIBRATE_MS    10
+#define KTIME_CALIBRATE_RUNS  5
+
+/* Fixed-point shift of the cycles-to-nanoseconds multiplier */
+#define KTIME_SHIFT  22
+
+#define NSEC_PER_USEC  1000u
+#define NSEC_PER_MSEC  1000000u
+#define NSEC_PER_SEC   1000000000u
+
+/* Calibrate the TSC against the PIT (interrupts may be on or off) */
+void ktime_init(void);
+
+/* Measured TSC frequency in kHz (0 if not calibrated) */
+unsigned int ktime_tsc_khz(void);
+
+/* Monotonic nanoseconds since ktime_init() */
+unsigned long long ktime_get_ns(void);
+
+/* Convert a raw TSC reading (e.g. a log timestamp) to ktime nanoseconds */
+unsigned long long ktime_tsc_to_ns(unsigned long long tsc);
+
+/* Busy-wait delays */
+void udelay(unsigned int us);
+void ndelay(unsigned int ns);
+
+/* Compare the TSC clock with the PIT tick over `ms` (<= 1000) milliseconds and log the
+ * TSC frequency and the drift. Needs interrupts enabled and pit_init().
+ * Returns the drift in ppm (TSC minus PIT), or 0 if it could not run. */
+int ktime_selfcheck(unsigned int ms);
+
+#endif /* KTIME_H */
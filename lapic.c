@@ -0,0 +1,279 @@
+/*
+ * Local APIC Implementation
+ */
+
+#include "lapic.h"
+#include "idt.h"
+#include "paging.h"
+#include "io.h"
+#include "cpu.h"
+#include "ktime.h"
+#include "math64.h"
+#include "clockevent.h"
+#include "debug.h"
+
+static volatile unsigned int* lapic_base = 0;  /* xAPIC MMIO window */
+static int lapic_is_x2apic = 0;
+static int lapic_is_enabled = 0;
+static unsigned int lapic_timer_khz = 0;       /* Timer counts per ms (divide by 16) */
+
+static struct lapic_stats stats;
+static struct clockevent lapic_clockevent;
+
+/* ============================================================================
+ * Register Access
+ * ============================================================================
+ */
+
+/* Read a register */
+unsigned int lapic_read(unsigned int reg) {
+    if (lapic_is_x2apic) {
+        return (unsigned int)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return lapic_base[reg / 4];
+}
+
+/* Write a register */
+void lapic_write(unsigned int reg, unsigned int value) {
+    if (lapic_is_x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    lapic_base[reg / 4] = value;
+}
+
+/* Signal end of interrupt: one store (or one MSR write) */
+void lapic_eoi(void) {
+    if (lapic_is_x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (LAPIC_REG_EOI >> 4), 0);
+        return;
+    }
+    lapic_base[LAPIC_REG_EOI / 4] = 0;
+}
+
+/* APIC ID of the calling CPU */
+unsigned int lapic_id(void) {
+    unsigned int id = lapic_read(LAPIC_REG_ID);
+
+    /* The xAPIC ID lives in bits 24-31, the x2APIC ID is the whole register */
+    return lapic_is_x2apic ? id : id >> 24;
+}
+
+int lapic_enabled(void) {
+    return lapic_is_enabled;
+}
+
+int lapic_x2apic(void) {
+    return lapic_is_x2apic;
+}
+
+/* ============================================================================
+ * Interrupt Handlers
+ * ============================================================================
+ */
+
+/* Spurious vector: the APIC withdrew the interrupt, no EOI */
+static void lapic_spurious_handler(struct trap_frame* frame) {
+    (void)frame;
+    stats.spurious++;
+}
+
+/* Error vector: latch and report the error status */
+static void lapic_error_handler(struct trap_frame* frame) {
+    (void)frame;
+
+    /* The ESR is updated by a write, then read */
+    lapic_write(LAPIC_REG_ESR, 0);
+    stats.last_esr = lapic_read(LAPIC_REG_ESR);
+    stats.errors++;
+    lapic_eoi();
+
+    debug_logf(LOG_WARN, "lapic: error interrupt, ESR 0x%x", stats.last_esr);
+}
+
+/* Enable the APIC of the calling CPU (global enable, x2APIC switch, LVTs) */
+void lapic_setup_cpu(void) {
+    unsigned long long base;
+
+    /* Globally enable the APIC, then switch to x2APIC mode when the CPU has
+     * it (going straight from disabled to x2APIC is an invalid transition) */
+    base = rdmsr(MSR_APIC_BASE) | MSR_APIC_BASE_ENABLE;
+    wrmsr(MSR_APIC_BASE, base);
+    if (lapic_is_x2apic) {
+        wrmsr(MSR_APIC_BASE, base | MSR_APIC_BASE_X2APIC);
+    }
+
+    /* Accept every priority, leave LINT0/LINT1 (8259 ExtINT, NMI) masked:
+     * external interrupts come through the I/O APIC */
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_ERROR_VECTOR);
+
+    /* Clear stale errors (back-to-back writes, see the SDM) */
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_write(LAPIC_REG_ESR, 0);
+
+    /* Software-enable the APIC with the spurious vector */
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_eoi();
+}
+
+/* Enable the local APIC of the boot CPU */
+int lapic_init(unsigned int address) {
+    unsigned int eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_1_EDX_APIC) || !(edx & CPUID_1_EDX_MSR)) {
+        return -1;
+    }
+    lapic_is_x2apic = (ecx & CPUID_1_ECX_X2APIC) != 0;
+
+    if (address == 0) {
+        address = (unsigned int)(rdmsr(MSR_APIC_BASE) & 0xFFFFF000u);
+    }
+    lapic_base = paging_map_mmio(address, PAGE_SIZE);
+
+    idt_set_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious_handler);
+    idt_set_handler(LAPIC_ERROR_VECTOR, lapic_error_handler);
+
+    lapic_setup_cpu();
+
+    lapic_is_enabled = 1;
+    debug_logf(LOG_INFO, "lapic: APIC ID %u, version 0x%x, %s mode",
+               lapic_id(), lapic_read(LAPIC_REG_VERSION) & 0xFF,
+               lapic_is_x2apic ? "x2APIC" : "xAPIC");
+    return 0;
+}
+
+/* ============================================================================
+ * Inter-Processor Interrupts
+ * ============================================================================
+ */
+
+/* Send an IPI: `command` is the low ICR dword (vector, delivery mode,
+ * level, shorthand), `apic_id` the destination when no shorthand is used */
+void lapic_send_ipi(unsigned int apic_id, unsigned int command) {
+    if (lapic_is_x2apic) {
+        /* One 64-bit MSR, no delivery status to poll */
+        wrmsr(MSR_X2APIC_BASE + (LAPIC_REG_ICR_LOW >> 4),
+              ((unsigned long long)apic_id << 32) | command);
+        return;
+    }
+
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, command);
+
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+/* ============================================================================
+ * Timer Clock Event Device
+ * ============================================================================
+ */
+
+/* Timer interrupt */
+static void lapic_timer_handler(struct trap_frame* frame) {
+    (void)frame;
+
+    stats.timer_events++;
+    lapic_clockevent.events++;
+    if (lapic_clockevent.event_handler != 0) {
+        lapic_clockevent.event_handler(&lapic_clockevent);
+    }
+    lapic_eoi();
+}
+
+static void lapic_timer_shutdown(void) {
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+}
+
+/* Periodic mode is never selected (the device is one-shot capable and the
+ * timer core only uses it with a calibrated TSC); keep it disarmed */
+static void lapic_timer_set_periodic(void) {
+    lapic_timer_shutdown();
+}
+
+static void lapic_timer_set_oneshot(void) {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR);  /* One-shot, unmasked */
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+}
+
+/* Raise the timer interrupt once after `delta_ns` */
+static void lapic_timer_set_next_event(unsigned int delta_ns) {
+    unsigned long long count = div_u64((unsigned long long)delta_ns * lapic_timer_khz +
+                                       NSEC_PER_MSEC - 1, NSEC_PER_MSEC);
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFFFFFFull) {
+        count = 0xFFFFFFFFull;
+    }
+    lapic_write(LAPIC_REG_TIMER_INITIAL, (unsigned int)count);
+}
+
+static struct clockevent lapic_clockevent = {
+    .name = "lapic",
+    .rating = 200,
+    .features = CLOCKEVENT_FEAT_ONESHOT,
+    .min_delta_ns = 1000,
+    .set_periodic = lapic_timer_set_periodic,
+    .set_oneshot = lapic_timer_set_oneshot,
+    .shutdown = lapic_timer_shutdown,
+    .set_next_event = lapic_timer_set_next_event,
+};
+
+/* Calibrate the LAPIC timer and register it with the timer core */
+void lapic_timer_init(void) {
+    unsigned long long start_ns, elapsed_ns, max_ns;
+    unsigned int counted;
+    unsigned int flags;
+
+    if (!lapic_is_enabled || ktime_tsc_khz() == 0) {
+        return;
+    }
+
+    /* Count down from the maximum for 10 ms of ktime */
+    flags = irq_save();
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    start_ns = ktime_get_ns();
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFFu);
+    udelay(10000);
+    counted = 0xFFFFFFFFu - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    elapsed_ns = ktime_get_ns() - start_ns;
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+    irq_restore(flags);
+
+    lapic_timer_khz = (unsigned int)div_u64((unsigned long long)counted * NSEC_PER_MSEC,
+                                            (unsigned int)elapsed_ns);
+    if (lapic_timer_khz == 0) {
+        debug_warn("lapic: timer calibration failed");
+        return;
+    }
+
+    /* The longest delay is a full 32-bit count */
+    max_ns = div_u64(0xFFFFFFFFull * NSEC_PER_MSEC, lapic_timer_khz);
+    lapic_clockevent.max_delta_ns = max_ns > 0xFFFFFFFFull ? 0xFFFFFFFFu : (unsigned int)max_ns;
+
+    idt_set_handler(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+    debug_logf(LOG_INFO, "lapic: timer %u kHz (bus clock / 16)", lapic_timer_khz);
+
+    clockevent_register(&lapic_clockevent);
+}
+
+/* Get a snapshot of the local APIC counters */
+void lapic_get_stats(struct lapic_stats* out) {
+    unsigned int flags = irq_save();
+
+    out->spurious = stats.spurious;
+    out->errors = stats.errors;
+    out->last_esr = stats.last_esr;
+    out->timer_events = stats.timer_events;
+
+    irq_restore(flags);
+}
@@ -0,0 +1,104 @@
+/*
+ * Local APIC Header
+ *
+ * Every CPU has a local APIC that receives interrupts (from the I/O APIC,
+ * other CPUs and its own timer) and must be told when one has been
+ * serviced. In xAPIC mode its registers are memory-mapped at the MADT
+ * address (0xFEE00000 by default), so an EOI is one 32-bit store instead of
+ * the 8259's port writes. When the CPU supports x2APIC the same registers
+ * are accessed as MSRs 0x800 + (offset >> 4) instead. The same registers
+ * send inter-processor interrupts (INIT/SIPI for SMP bring-up, function
+ * call requests).
+ *
+ * The LAPIC timer is also registered as a one-shot clock event device
+ * (clockevent.h) once it has been calibrated against ktime.
+ */
+
+#ifndef LAPIC_H
+#define LAPIC_H
+
+/* IA32_APIC_BASE MSR */
+#define MSR_APIC_BASE             0x1B
+#define MSR_APIC_BASE_BSP         (1u << 8)
+#define MSR_APIC_BASE_X2APIC      (1u << 10)
+#define MSR_APIC_BASE_ENABLE      (1u << 11)
+#define MSR_X2APIC_BASE           0x800
+
+/* Register offsets (xAPIC MMIO) */
+#define LAPIC_REG_ID              0x020
+#define LAPIC_REG_VERSION         0x030
+#define LAPIC_REG_TPR             0x080
+#define LAPIC_REG_EOI             0x0B0
+#define LAPIC_REG_SVR             0x0F0
+#define LAPIC_REG_ESR             0x280
+#define LAPIC_REG_ICR_LOW         0x300
+#define LAPIC_REG_ICR_HIGH        0x310
+#define LAPIC_REG_LVT_TIMER       0x320
+#define LAPIC_REG_LVT_LINT0       0x350
+#define LAPIC_REG_LVT_LINT1       0x360
+#define LAPIC_REG_LVT_ERROR       0x370
+#define LAPIC_REG_TIMER_INITIAL   0x380
+#define LAPIC_REG_TIMER_CURRENT   0x390
+#define LAPIC_REG_TIMER_DIVIDE    0x3E0
+
+/* Register bits */
+#define LAPIC_SVR_ENABLE          0x100
+#define LAPIC_ICR_FIXED           0x00000
+#define LAPIC_ICR_INIT            0x00500
+#define LAPIC_ICR_STARTUP         0x00600
+#define LAPIC_ICR_PENDING         0x01000  /* Delivery status (xAPIC only) */
+#define LAPIC_ICR_ASSERT          0x04000
+#define LAPIC_ICR_LEVEL           0x08000
+#define LAPIC_ICR_ALL_BUT_SELF    0xC0000  /* Destination shorthand */
+#define LAPIC_LVT_MASKED          0x10000
+#define LAPIC_LVT_NMI             0x400
+#define LAPIC_TIMER_DIVIDE_16     0x03
+
+/* Vectors owned by the local APIC */
+#define LAPIC_TIMER_VECTOR        0xEF
+#define LAPIC_ERROR_VECTOR        0xFE
+#define LAPIC_SPURIOUS_VECTOR     0xFF
+
+/* Local APIC counters */
+struct lapic_stats {
+    unsigned int spurious;       /* Spurious-vector interrupts (no EOI needed) */
+    unsigned int errors;         /* Error interrupts */
+    unsigned int last_esr;       /* Error status of the last error interrupt */
+    unsigned int timer_events;   /* Timer interrupts */
+};
+
+/* Enable the local APIC of the calling CPU at `address` (from the MADT).
+ * Returns 0 on success, -1 if the CPU has no APIC. */
+int lapic_init(unsigned int address);
+
+/* Enable the local APIC of the calling CPU (application processors; the
+ * boot CPU gets this from lapic_init) */
+void lapic_setup_cpu(void);
+
+/* Send an IPI (`command` = low ICR dword: vector | LAPIC_ICR_* bits) */
+void lapic_send_ipi(unsigned int apic_id, unsigned int command);
+
+/* 1 once the local APIC is enabled */
+int lapic_enabled(void);
+
+/* 1 if the APIC is driven through x2APIC MSRs */
+int lapic_x2apic(void);
+
+/* APIC ID of the calling CPU */
+unsigned int lapic_id(void);
+
+/* Register access (xAPIC offsets, translated to MSRs in x2APIC mode) */
+unsigned int lapic_read(unsigned int reg);
+void lapic_write(unsigned int reg, unsigned int value);
+
+/* Signal end of interrupt */
+void lapic_eoi(void);
+
+/* Calibrate the LAPIC timer against ktime and register it as a clock event
+ * device (call after timer_init and ktime_init) */
+void lapic_timer_init(void);
+
+/* Get a snapshot of the local APIC counters */
+void lapic_get_stats(struct lapic_stats* stats);
+
+#endif /* LAPIC_H */
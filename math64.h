@@ -0,0 +1,60 @@
+/*
+ * 64-bit Arithmetic Helpers
+ *
+ * The kernel is linked without libgcc, so plain 64-bit division on i386
+ * (which compiles to a call to __udivdi3) is not available. These helpers
+ * do the common cases with the native 64-by-32 `divl` instruction, and
+ * scale 64-bit values by a 32-bit fixed-point factor with two 32x32 multiplies.
+ */
+
+#ifndef MATH64_H
+#define MATH64_H
+
+/* Divide a 64-bit value by a 32-bit divisor.
+ * Returns the quotient and stores the remainder (if `remainder` is non-null). */
+static inline unsigned long long div_u64_rem(unsigned long long dividend, unsigned int divisor,
+                                             unsigned int* remainder) {
+    unsigned int high = (unsigned int)(dividend >> 32);
+    unsigned int low = (unsigned int)dividend;
+    unsigned int q_high = high / divisor;
+    unsigned int rem = high % divisor;
+    unsigned int q_low;
+
+    /* rem < divisor, so the 64-by-32 divide cannot overflow */
+    __asm__ ("divl %4"
+             : "=a"(q_low), "=d"(rem)
+             : "a"(low), "d"(rem), "rm"(divisor));
+
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((unsigned long long)q_high << 32) | q_low;
+}
+
+/* Divide a 64-bit value by a 32-bit divisor, discarding the remainder */
+static inline unsigned long long div_u64(unsigned long long dividend, unsigned int divisor) {
+    return div_u64_rem(dividend, divisor, 0);
+}
+
+/* Multiply a 64-bit value by a 32-bit factor and shift the 96-bit product
+ * right by `shift` (< 32) bits: the mult/shift form of a fixed-point scale */
+static inline unsigned long long mul_u64_u32_shr(unsigned long long value, unsigned int mult,
+                                                 unsigned int shift) {
+    unsigned long long low = (unsigned long long)(unsigned int)value * mult;
+    unsigned long long high = (unsigned long long)(unsigned int)(value >> 32) * mult;
+
+    return (low >> shift) + (high << (32 - shift));
+}
+
+/* Index of the lowest set bit of a non-zero 64-bit value
+ * (__builtin_ctzll would call __ctzdi2 from libgcc on i386) */
+static inline unsigned int ctz_u64(unsigned long long value) {
+    unsigned int low = (unsigned int)value;
+
+    if (low != 0) {
+        return __builtin_ctz(low);
+    }
+    return 32 + __builtin_ctz((unsigned int)(value >> 32));
+}
+
+#endif /* MATH64_H */
@@ -0,0 +1,75 @@
+/*
+ * Multiboot Information Header
+ *
+ * Structures the bootloader passes to kernel_main (Multiboot 0.6.96).
+ * All addresses are physical.
+ */
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+/* Multiboot Specification Constants */
+#define MULTIBOOT_HEADER_MAGIC      0x1BADB002
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+#define MULTIBOOT_HEADER_FLAGS      0x00000003  /* Align modules on page boundaries + provide memory map */
+
+/* multiboot_info.flags: which fields are valid */
+#define MULTIBOOT_INFO_MEMORY   0x001  /* mem_lower, mem_upper */
+#define MULTIBOOT_INFO_CMDLINE  0x004  /* cmdline */
+#define MULTIBOOT_INFO_MODS     0x008  /* mods_count, mods_addr */
+#define MULTIBOOT_INFO_MMAP     0x040  /* mmap_length, mmap_addr */
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE  1
+#define MULTIBOOT_MEMORY_RESERVED   2
+#define MULTIBOOT_MEMORY_ACPI       3  /* ACPI tables, reclaimable */
+#define MULTIBOOT_MEMORY_NVS        4
+#define MULTIBOOT_MEMORY_BAD        5
+
+/* Multiboot Information Structure
+ * 
+ * This structure is passed to our kernel by the bootloader.
+ * It contains information about memory, boot device, command line, etc.
+ */
+struct multiboot_info {
+    unsigned int flags;
+    unsigned int mem_lower;      /* Lower memory (in KB) */
+    unsigned int mem_upper;      /* Upper memory (in KB) */
+    unsigned int boot_device;
+    unsigned int cmdline;        /* Command line string */
+    unsigned int mods_count;
+    unsigned int mods_addr;
+    unsigned int syms[4];        /* Symbol table info */
+    unsigned int mmap_length;    /* Memory map length */
+    unsigned int mmap_addr;      /* Memory map address */
+    unsigned int drives_length;
+    unsigned int drives_addr;
+    unsigned int config_table;
+    unsigned int boot_loader_name;
+    unsigned int apm_table;
+    unsigned int vbe_control_info;
+    unsigned int vbe_mode_info;
+    unsigned short vbe_mode;
+    unsigned short vbe_interface_seg;
+    unsigned short vbe_interface_off;
+    unsigned short vbe_interface_len;
+};
+
+/* Memory map entry (E820 style). `size` does not count itself: the next
+ * entry starts at (char*)entry + entry->size + 4. */
+struct multiboot_mmap_entry {
+    unsigned int size;
+    unsigned long long addr;
+    unsigned long long len;
+    unsigned int type;
+} __attribute__((packed));
+
+/* Boot module */
+struct multiboot_module {
+    unsigned int mod_start;
+    unsigned int mod_end;        /* First byte after the module */
+    unsigned int string;
+    unsigned int reserved;
+};
+
+#endif /* MULTIBOOT_H */
@@ -0,0 +1,510 @@
+/*
+ * Paging Implementation
+ *
+ * paging_init():
+ * 1. Check CPUID for 4 MB pages (PSE) and global pages (PGE)
+ * 2. Map the first 4 MB with 4 KB pages: page 0 read-only, the kernel's
+ *    .text/.rodata (kernel_ro_start..kernel_ro_end) read-only, the rest
+ *    read/write; the user sections (user.h) also user-accessible
+ * 3. Map the rest of physical memory (up to pmm_phys_end(), rounded up to
+ *    4 MB) with 4 MB pages, or with 4 KB page tables without PSE
+ * 4. Load CR3, enable CR4.PSE/PGE, then CR0.PG and CR0.WP
+ *
+ * Page tables come from the page allocator and are reached through the
+ * identity map. Changes to the tables are serialized by one lock taken
+ * with interrupts disabled.
+ */
+
+#include "paging.h"
+#include "pmm.h"
+#include "slab.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "idt.h"
+#include "cpu.h"
+#include "string.h"
+#include "io.h"
+#include "debug.h"
+
+#define PDE_INDEX(virt)  ((virt) >> 22)
+#define PTE_INDEX(virt)  (((virt) >> PAGE_SHIFT) & 0x3FF)
+
+/* Linker-provided symbols: read-only part of the kernel image */
+extern char kernel_ro_start[];
+extern char kernel_ro_end[];
+extern char user_text_start[];
+extern char user_text_end[];
+extern char user_bss_start[];
+extern char user_bss_end[];
+
+/* Kernel page directory and the table for the first 4 MB */
+static unsigned int kernel_pgdir[1024] __attribute__((aligned(PAGE_SIZE)));
+static unsigned int low_pgtable[1024] __attribute__((aligned(PAGE_SIZE)));
+
+static unsigned int global_flag = 0;      /* PAGE_GLOBAL when the CPU has PGE */
+static unsigned int cr4_flags = 0;        /* CR4 bits set on every CPU */
+static unsigned int direct_end = 0;       /* End of the identity map of RAM */
+static int paging_enabled = 0;
+
+static struct lock_class paging_lock_class = LOCK_CLASS_INIT("paging");
+static struct spinlock paging_spinlock = SPINLOCK_INIT(&paging_lock_class);
+
+/* Kernel heap break */
+static unsigned int heap_brk = KHEAP_START;
+
+/* vmalloc areas, sorted by address */
+struct vm_area {
+    struct vm_area* next;
+    unsigned int start;
+    unsigned int pages;
+};
+static struct vm_area* vm_areas = 0;
+
+static struct paging_stats stats;
+
+static unsigned int paging_lock(void) {
+    return spin_lock_irqsave(&paging_spinlock);
+}
+
+static void paging_unlock(unsigned int flags) {
+    spin_unlock_irqrestore(&paging_spinlock, flags);
+}
+
+/* Fill a page with zeros (non-temporal stores when the CPU has SSE2) */
+static void page_zero(unsigned int addr) {
+    memset((void*)addr, 0, PAGE_SIZE);
+}
+
+/* ============================================================================
+ * TLB Maintenance
+ * ============================================================================
+ */
+
+/* Invalidate one page on this CPU */
+void tlb_flush_page(unsigned int virt) {
+    invlpg(virt);
+    __atomic_fetch_add(&stats.tlb_flush_page, 1, __ATOMIC_RELAXED);
+}
+
+/* Invalidate all non-global TLB entries on this CPU */
+void tlb_flush_all(void) {
+    write_cr3(read_cr3());
+    __atomic_fetch_add(&stats.tlb_flush_all, 1, __ATOMIC_RELAXED);
+}
+
+struct tlb_range {
+    unsigned int virt;
+    unsigned int pages;
+};
+
+/* Runs on every CPU */
+static void tlb_shootdown_fn(void* arg) {
+    const struct tlb_range* range = arg;
+
+    for (unsigned int i = 0; i < range->pages; i++) {
+        tlb_flush_page(range->virt + i * PAGE_SIZE);
+    }
+}
+
+/* Invalidate a range on every CPU */
+void tlb_shootdown(unsigned int virt, unsigned int pages) {
+    struct tlb_range range = { virt, pages };
+
+    __atomic_fetch_add(&stats.tlb_shootdowns, 1, __ATOMIC_RELAXED);
+    if (smp_num_cpus() > 1) {
+        smp_call_function_all(tlb_shootdown_fn, &range);
+    } else {
+        tlb_shootdown_fn(&range);
+    }
+}
+
+/* ============================================================================
+ * Page Tables (lock held)
+ * ============================================================================
+ */
+
+/* Find the PTE for `virt`, allocating its page table if `create` is set.
+ * Returns 0 if there is no table or the address is in a 4 MB page. */
+static unsigned int* pte_lookup(unsigned int virt, int create) {
+    unsigned int* pde = &kernel_pgdir[PDE_INDEX(virt)];
+
+    if (!(*pde & PAGE_PRESENT)) {
+        unsigned int table;
+
+        if (!create) {
+            return 0;
+        }
+        table = pmm_alloc_page();
+        if (table == 0) {
+            return 0;
+        }
+        page_zero(table);
+        *pde = table | PAGE_PRESENT | PAGE_WRITE;
+        stats.page_tables++;
+    }
+    if (*pde & PAGE_LARGE) {
+        return 0;
+    }
+    return &((unsigned int*)(*pde & PAGE_MASK))[PTE_INDEX(virt)];
+}
+
+static int map_locked(unsigned int virt, unsigned int phys, unsigned int flags) {
+    unsigned int* pte = pte_lookup(virt, 1);
+
+    if (pte == 0) {
+        return -1;
+    }
+    *pte = (phys & PAGE_MASK) | (flags & ~PAGE_MASK) | PAGE_PRESENT;
+    return 0;
+}
+
+static unsigned int unmap_locked(unsigned int virt) {
+    unsigned int* pte = pte_lookup(virt, 0);
+    unsigned int phys;
+
+    if (pte == 0 || !(*pte & PAGE_PRESENT)) {
+        return 0;
+    }
+    phys = *pte & PAGE_MASK;
+    *pte = 0;
+    tlb_flush_page(virt);
+    return phys;
+}
+
+/* Map one 4 KB page */
+int paging_map(unsigned int virt, unsigned int phys, unsigned int flags) {
+    unsigned int irq_flags = paging_lock();
+    int result = map_locked(virt, phys, flags);
+
+    paging_unlock(irq_flags);
+    return result;
+}
+
+/* Remove a 4 KB mapping (local invlpg only) */
+unsigned int paging_unmap(unsigned int virt) {
+    unsigned int irq_flags = paging_lock();
+    unsigned int phys = unmap_locked(virt);
+
+    paging_unlock(irq_flags);
+    return phys;
+}
+
+/* Translate a virtual address */
+unsigned int paging_virt_to_phys(unsigned int virt) {
+    unsigned int pde = kernel_pgdir[PDE_INDEX(virt)];
+    unsigned int pte;
+
+    if (!paging_enabled) {
+        return virt;
+    }
+    if (!(pde & PAGE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PAGE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+    pte = ((unsigned int*)(pde & PAGE_MASK))[PTE_INDEX(virt)];
+    if (!(pte & PAGE_PRESENT)) {
+        return 0;
+    }
+    return (pte & PAGE_MASK) | (virt & ~PAGE_MASK);
+}
+
+/* Identity-map an MMIO range uncached */
+void* paging_map_mmio(unsigned int phys, unsigned int size) {
+    unsigned int start = phys & PAGE_MASK;
+    unsigned int end = phys + size;
+
+    if (paging_enabled && start >= direct_end) {
+        unsigned int flags = paging_lock();
+        for (unsigned int addr = start; addr < end && addr >= start; addr += PAGE_SIZE) {
+            map_locked(addr, addr, PAGE_WRITE | PAGE_PCD | PAGE_PWT | global_flag);
+        }
+        paging_unlock(flags);
+    }
+    return (void*)phys;
+}
+
+/* ============================================================================
+ * Demand-Zero Kernel Heap
+ * ============================================================================
+ */
+
+/* Move the kernel heap break up */
+void* kheap_grow(unsigned int increment) {
+    unsigned int flags = paging_lock();
+    unsigned int old = heap_brk;
+    void* result = 0;
+
+    if (increment <= KHEAP_END - heap_brk) {
+        heap_brk += increment;
+        result = (void*)old;
+    }
+
+    paging_unlock(flags);
+    return result;
+}
+
+/* Back a not-present heap page with a zeroed page; returns 0 on success */
+static int kheap_fault(unsigned int addr) {
+    unsigned int page = pmm_alloc_page();
+    unsigned int flags;
+    unsigned int* pte;
+    int result = 0;
+
+    if (page == 0) {
+        return -1;
+    }
+    page_zero(page);
+
+    flags = paging_lock();
+    pte = pte_lookup(addr, 1);
+    if (pte == 0) {
+        result = -1;
+    } else if (*pte & PAGE_PRESENT) {
+        /* Another CPU faulted on the same page first */
+        paging_unlock(flags);
+        pmm_free_page(page);
+        return 0;
+    } else {
+        *pte = page | PAGE_PRESENT | PAGE_WRITE | global_flag;
+        stats.heap_pages++;
+    }
+    paging_unlock(flags);
+
+    if (result != 0) {
+        pmm_free_page(page);
+    }
+    return result;
+}
+
+/* Page-fault handler (vector 14) */
+static void page_fault_handler(struct trap_frame* frame) {
+    unsigned int addr = frame->cr2;
+    unsigned int error = frame->error_code;
+
+    __atomic_fetch_add(&stats.page_faults, 1, __ATOMIC_RELAXED);
+
+    /* Kernel touch of a heap page below the break: map it and resume */
+    if (!(error & (PF_ERR_PRESENT | PF_ERR_USER | PF_ERR_RSVD)) &&
+        addr >= KHEAP_START && addr < heap_brk) {
+        if (kheap_fault(addr & PAGE_MASK) == 0) {
+            __atomic_fetch_add(&stats.demand_faults, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    /* A user task's fault only kills the task (exception_handler) */
+    if (!(error & PF_ERR_USER)) {
+        debug_panic_mode();
+    }
+    kprintf("Page fault at %08x: %s %s, %s mode%s\n", addr,
+            (error & PF_ERR_FETCH) ? "instruction fetch" : ((error & PF_ERR_WRITE) ? "write" : "read"),
+            (error & PF_ERR_PRESENT) ? "protection violation" : "page not present",
+            (error & PF_ERR_USER) ? "user" : "kernel",
+            (error & PF_ERR_RSVD) ? ", reserved bit set" : "");
+    exception_handler(frame);
+}
+
+/* ============================================================================
+ * vmalloc
+ * ============================================================================
+ */
+
+/* Allocate `size` bytes of virtually contiguous, page-granular memory */
+void* vmalloc(unsigned int size) {
+    unsigned int pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    struct vm_area* area;
+    struct vm_area** link;
+    unsigned int start = VMALLOC_START;
+    unsigned int flags;
+
+    if (pages == 0 || pages >= (VMALLOC_END - VMALLOC_START) >> PAGE_SHIFT) {
+        return 0;
+    }
+    area = kmalloc(sizeof(*area));
+    if (area == 0) {
+        return 0;
+    }
+
+    flags = paging_lock();
+
+    /* First fit, leaving one unmapped guard page after every area */
+    for (link = &vm_areas; *link != 0; link = &(*link)->next) {
+        if ((*link)->start - start >= (pages + 1) << PAGE_SHIFT) {
+            break;
+        }
+        start = (*link)->start + (((*link)->pages + 1) << PAGE_SHIFT);
+    }
+    if (*link == 0 && VMALLOC_END - start < (pages + 1) << PAGE_SHIFT) {
+        paging_unlock(flags);
+        kfree(area);
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int page = pmm_alloc_page();
+
+        if (page == 0 || map_locked(start + i * PAGE_SIZE, page, PAGE_WRITE | global_flag) != 0) {
+            /* Undo: nothing was visible to other CPUs yet */
+            if (page != 0) {
+                pmm_free_page(page);
+            }
+            while (i-- > 0) {
+                pmm_free_page(unmap_locked(start + i * PAGE_SIZE));
+            }
+            paging_unlock(flags);
+            kfree(area);
+            return 0;
+        }
+    }
+
+    area->start = start;
+    area->pages = pages;
+    area->next = *link;
+    *link = area;
+    stats.vmalloc_pages += pages;
+
+    paging_unlock(flags);
+    return (void*)start;
+}
+
+/* Free a vmalloc() area */
+void vfree(void* addr) {
+    struct vm_area** link;
+    struct vm_area* area = 0;
+    unsigned int flags;
+
+    if (addr == 0) {
+        return;
+    }
+
+    flags = paging_lock();
+    for (link = &vm_areas; *link != 0; link = &(*link)->next) {
+        if ((*link)->start == (unsigned int)addr) {
+            area = *link;
+            *link = area->next;
+            break;
+        }
+    }
+    if (area == 0) {
+        paging_unlock(flags);
+        debug_logf(LOG_ERROR, "vfree: %p is not a vmalloc area", addr);
+        return;
+    }
+
+    for (unsigned int i = 0; i < area->pages; i++) {
+        pmm_free_page(unmap_locked(area->start + i * PAGE_SIZE));
+    }
+    stats.vmalloc_pages -= area->pages;
+    paging_unlock(flags);
+
+    /* The pages may be reused right away: drop stale translations
+     * everywhere (the local ones are already gone) */
+    if (smp_num_cpus() > 1) {
+        tlb_shootdown(area->start, area->pages);
+    }
+    kfree(area);
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================
+ */
+
+/* Build the kernel page tables and enable paging on the boot CPU */
+void paging_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int ro_start = (unsigned int)kernel_ro_start;
+    unsigned int ro_end = (unsigned int)kernel_ro_end;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_1_EDX_PGE) {
+        global_flag = PAGE_GLOBAL;
+        cr4_flags |= CR4_PGE;
+    }
+    if (edx & CPUID_1_EDX_PSE) {
+        cr4_flags |= CR4_PSE;
+    }
+
+    /* First 4 MB: 4 KB pages with per-section protection */
+    for (unsigned int i = 0; i < 1024; i++) {
+        unsigned int addr = i * PAGE_SIZE;
+        unsigned int flags = PAGE_PRESENT | global_flag;
+
+        /* Page 0 stays readable (BIOS data area) but catches null writes */
+        if (addr != 0 && !(addr >= ro_start && addr < ro_end)) {
+            flags |= PAGE_WRITE;
+        }
+        if ((addr >= (unsigned int)user_text_start && addr < (unsigned int)user_text_end) ||
+            (addr >= (unsigned int)user_bss_start && addr < (unsigned int)user_bss_end)) {
+            flags |= PAGE_USER;
+        }
+        low_pgtable[i] = addr | flags;
+    }
+    /* PAGE_USER here only lets the PTEs decide */
+    kernel_pgdir[0] = (unsigned int)low_pgtable | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    if ((unsigned int)user_bss_end > LARGE_PAGE_SIZE) {
+        debug_error("paging: user sections above 4 MB are not user-accessible");
+    }
+
+    /* Rest of physical memory (including ACPI and firmware regions) */
+    direct_end = (pmm_phys_end() + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if (direct_end == 0 || direct_end > PAGING_DIRECT_LIMIT) {
+        direct_end = PAGING_DIRECT_LIMIT;
+    }
+    for (unsigned int addr = LARGE_PAGE_SIZE; addr < direct_end; addr += LARGE_PAGE_SIZE) {
+        if (cr4_flags & CR4_PSE) {
+            kernel_pgdir[PDE_INDEX(addr)] = addr | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE | global_flag;
+            stats.large_pages++;
+        } else {
+            for (unsigned int page = addr; page < addr + LARGE_PAGE_SIZE; page += PAGE_SIZE) {
+                if (map_locked(page, page, PAGE_WRITE | global_flag) != 0) {
+                    debug_error("paging: out of memory for page tables");
+                    return;
+                }
+            }
+        }
+    }
+
+    idt_set_handler(VECTOR_PAGE_FAULT, page_fault_handler);
+
+    paging_init_ap();
+    paging_enabled = 1;
+
+    debug_logf(LOG_INFO, "paging: direct map 0-%08x (%u x 4 MB%s), %s pages, kernel RO %08x-%08x",
+               direct_end - 1, stats.large_pages, (cr4_flags & CR4_PSE) ? "" : ", no PSE: 4 KB tables",
+               global_flag ? "global" : "non-global", ro_start, ro_end);
+}
+
+/* Enable paging on the calling CPU with the kernel tables */
+void paging_init_ap(void) {
+    write_cr3((unsigned int)kernel_pgdir);
+    if (cr4_flags != 0) {
+        write_cr4(read_cr4() | cr4_flags);
+    }
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+/* ============================================================================
+ * Statistics
+ * ============================================================================
+ */
+
+/* Get a snapshot of the paging statistics */
+void paging_get_stats(struct paging_stats* out) {
+    unsigned int flags = paging_lock();
+    *out = stats;
+    paging_unlock(flags);
+}
+
+/* Print the paging statistics */
+void paging_dump_stats(void) {
+    struct paging_stats s;
+
+    paging_get_stats(&s);
+    kprintf("Paging: %u large pages, %u page tables, %u heap pages, %u vmalloc pages\n",
+            s.large_pages, s.page_tables, s.heap_pages, s.vmalloc_pages);
+    kprintf("  page faults %u (demand-zero %u), TLB: %u invlpg, %u full flushes, %u shootdowns\n",
+            s.page_faults, s.demand_faults, s.tlb_flush_page, s.tlb_flush_all, s.tlb_shootdowns);
+}
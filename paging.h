@@ -0,0 +1,115 @@
+/*
+ * Paging Header
+ *
+ * Two-level 32-bit paging with one page directory shared by every CPU.
+ * Kernel virtual address space:
+ *
+ *   0x00000000 - direct map end   RAM, identity-mapped (phys == virt)
+ *                                   first 4 MB: 4 KB pages, so that the
+ *                                   kernel's .text/.rodata can be read-only
+ *                                   and page 0 catches null writes
+ *                                   above 4 MB: 4 MB PSE pages
+ *   VMALLOC_START - VMALLOC_END   vmalloc(): virtually contiguous, 4 KB
+ *                                   granular, a guard page after each area
+ *   KHEAP_START - KHEAP_END       demand-zero kernel heap: kheap_grow()
+ *                                   moves the break, pages appear on first
+ *                                   touch from the page-fault handler
+ *   MMIO (e.g. APICs)             identity-mapped uncached on request
+ *
+ * All kernel mappings are global, so they survive CR3 reloads. Single
+ * mappings are invalidated with invlpg, and removals are shot down on
+ * the other CPUs with an IPI.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "pmm.h"
+
+/* Page table entry bits */
+#define PAGE_PRESENT   0x001
+#define PAGE_WRITE     0x002
+#define PAGE_USER      0x004
+#define PAGE_PWT       0x008  /* Write-through */
+#define PAGE_PCD       0x010  /* Cache disable */
+#define PAGE_ACCESSED  0x020
+#define PAGE_DIRTY     0x040
+#define PAGE_LARGE     0x080  /* 4 MB page (PDE, needs CR4.PSE) */
+#define PAGE_GLOBAL    0x100  /* Kept across CR3 loads (needs CR4.PGE) */
+
+/* Page-fault error code bits */
+#define PF_ERR_PRESENT 0x01   /* Protection violation (clear: page not present) */
+#define PF_ERR_WRITE   0x02
+#define PF_ERR_USER    0x04
+#define PF_ERR_RSVD    0x08
+#define PF_ERR_FETCH   0x10
+
+#define LARGE_PAGE_SIZE 0x400000  /* 4 MB */
+
+/* Kernel address space layout */
+#define PAGING_DIRECT_LIMIT  0xC0000000u  /* RAM above 3 GB is not used */
+#define VMALLOC_START        0xD0000000u
+#define VMALLOC_END          0xE0000000u
+#define KHEAP_START          0xE0000000u
+#define KHEAP_END            0xF0000000u
+
+/* Paging statistics */
+struct paging_stats {
+    unsigned int large_pages;    /* 4 MB mappings in the direct map */
+    unsigned int page_tables;    /* Page tables allocated */
+    unsigned int page_faults;
+    unsigned int demand_faults;  /* Heap pages materialized on touch */
+    unsigned int heap_pages;
+    unsigned int vmalloc_pages;
+    unsigned int tlb_flush_page; /* Single-page invalidations (invlpg) */
+    unsigned int tlb_flush_all;  /* Full flushes (CR3 reload) */
+    unsigned int tlb_shootdowns; /* Cross-CPU invalidation requests */
+};
+
+/* Build the kernel page tables and enable paging on the boot CPU
+ * (after pmm_init) */
+void paging_init(void);
+
+/* Enable paging on an application processor with the kernel tables */
+void paging_init_ap(void);
+
+/* Map one 4 KB page; returns 0, or -1 if out of memory or the address
+ * lies in a 4 MB mapping */
+int paging_map(unsigned int virt, unsigned int phys, unsigned int flags);
+
+/* Remove a 4 KB mapping (local invlpg only); returns the physical
+ * address that was mapped, or 0 */
+unsigned int paging_unmap(unsigned int virt);
+
+/* Translate a virtual address; returns 0 if it is not mapped */
+unsigned int paging_virt_to_phys(unsigned int virt);
+
+/* Identity-map an MMIO range uncached; returns it as a pointer */
+void* paging_map_mmio(unsigned int phys, unsigned int size);
+
+/* Allocate `size` bytes of virtually contiguous, page-granular memory */
+void* vmalloc(unsigned int size);
+
+/* Free a vmalloc() area (call with interrupts enabled: other CPUs'
+ * TLBs are shot down) */
+void vfree(void* addr);
+
+/* Move the kernel heap break up by `increment` bytes; returns the old
+ * break, or 0 if the heap region is exhausted. The new pages are mapped
+ * (zero-filled) when first touched. */
+void* kheap_grow(unsigned int increment);
+
+/* Invalidate one page on this CPU / the whole non-global TLB */
+void tlb_flush_page(unsigned int virt);
+void tlb_flush_all(void);
+
+/* Invalidate a range on every CPU (interrupts enabled) */
+void tlb_shootdown(unsigned int virt, unsigned int pages);
+
+/* Get a snapshot of the paging statistics */
+void paging_get_stats(struct paging_stats* stats);
+
+/* Print the paging statistics */
+void paging_dump_stats(void);
+
+#endif /* PAGING_H */
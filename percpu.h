@@ -0,0 +1,66 @@
+/*
+ * Per-CPU Data Header
+ *
+ * Each CPU owns one struct percpu. The GS segment of every CPU has its
+ * base at that CPU's structure (gdt.h), and the structure starts with a
+ * pointer to itself, so this_cpu() is a single `movl %gs:0` and needs no
+ * APIC ID lookup.
+ *
+ * The structures are cache-line aligned (and so padded to whole cache
+ * lines): data written by one CPU never shares a line with another CPU's
+ * data.
+ */
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "gdt.h"
+
+#define NR_CPUS          16
+#define CACHE_LINE_SIZE  64
+
+#define __cacheline_aligned __attribute__((aligned(CACHE_LINE_SIZE)))
+
+struct trap_frame;
+struct fpu;
+
+struct percpu {
+    struct percpu* self;                  /* %gs:0, see this_cpu() */
+    unsigned int cpu;                     /* Logical CPU number, 0 = boot CPU */
+    unsigned int apic_id;
+    volatile unsigned int online;         /* Set by the CPU once it is running */
+    unsigned int interrupt_nesting;       /* Depth of running interrupt handlers */
+    struct trap_frame* irq_frame;         /* Frame of the innermost running handler */
+    unsigned int ipi_calls;               /* smp_call_function requests served */
+    struct fpu* fpu_current;              /* FPU context of the running code (fpu.h) */
+    struct fpu* fpu_owner;                /* Context whose state is in the registers */
+    unsigned int fpu_kernel;              /* Inside kernel_fpu_begin/end */
+    unsigned int preempt_count;           /* preempt_disable() depth (sched.h) */
+    unsigned int softirq_pending;         /* Raised softirq vectors (softirq.h) */
+    unsigned int softirq_active;          /* Running softirq handlers */
+    unsigned long long boot_ns;           /* ktime when the CPU came online */
+    struct gdt_entry gdt[GDT_ENTRIES] __attribute__((aligned(8)));
+    struct tss tss;                       /* Ring-0 stack for ring-3 entries */
+} __cacheline_aligned;
+
+/* Per-CPU areas, indexed by logical CPU number */
+extern struct percpu percpu_areas[NR_CPUS];
+
+/* Per-CPU data of the calling CPU */
+static inline struct percpu* this_cpu(void) {
+    struct percpu* cpu;
+    __asm__ volatile ("movl %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+/* Logical number of the calling CPU */
+static inline unsigned int smp_processor_id(void) {
+    unsigned int cpu;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(cpu) : "i"(__builtin_offsetof(struct percpu, cpu)));
+    return cpu;
+}
+
+/* Set up the boot CPU's per-CPU area and GDT (first thing in kernel_main) */
+void percpu_init_bsp(void);
+
+#endif /* PERCPU_H */
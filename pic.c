@@ -6,14 +6,10 @@
  */
 
 #include "pic.h"
+#include "irqchip.h"
 
 /* Initialize and remap PIC */
 void pic_init(void) {
-    /* Save current interrupt masks */
-    unsigned char a1, a2;
-    __asm__ volatile ("inb %1, %0" : "=a"(a1) : "Nd"((unsigned short)PIC1_DATA));
-    __asm__ volatile ("inb %1, %0" : "=a"(a2) : "Nd"((unsigned short)PIC2_DATA));
-    
     /* Start initialization sequence (ICW1) */
     __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)(PIC_ICW1_INIT | PIC_ICW1_ICW4)), "Nd"((unsigned short)PIC1_COMMAND));
     __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)(PIC_ICW1_INIT | PIC_ICW1_ICW4)), "Nd"((unsigned short)PIC2_COMMAND));
@@ -32,9 +28,10 @@ void pic_init(void) {
     __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_ICW4_8086), "Nd"((unsigned short)PIC1_DATA));
     __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_ICW4_8086), "Nd"((unsigned short)PIC2_DATA));
     
-    /* Restore interrupt masks (disable all interrupts initially) */
-    __asm__ volatile ("outb %0, %1" : : "a"(a1), "Nd"((unsigned short)PIC1_DATA));
-    __asm__ volatile ("outb %0, %1" : : "a"(a2), "Nd"((unsigned short)PIC2_DATA));
+    /* Mask every line except the cascade (IRQ 2); drivers unmask their own
+     * IRQ with pic_enable_irq() once their handler is ready */
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC1_INITIAL_MASK), "Nd"((unsigned short)PIC1_DATA));
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC2_INITIAL_MASK), "Nd"((unsigned short)PIC2_DATA));
 }
 
 /* Enable a specific IRQ */
@@ -96,3 +93,74 @@ void pic_send_eoi(unsigned char irq) {
     __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_EOI), "Nd"((unsigned short)PIC1_COMMAND));
 }
 
+
+/* Read the combined In-Service Register (slave in the high byte) */
+unsigned short pic_get_isr(void) {
+    unsigned char master, slave;
+    
+    /* OCW3: next read of the command port returns the ISR */
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_OCW3_READ_ISR), "Nd"((unsigned short)PIC1_COMMAND));
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_OCW3_READ_ISR), "Nd"((unsigned short)PIC2_COMMAND));
+    __asm__ volatile ("inb %1, %0" : "=a"(master) : "Nd"((unsigned short)PIC1_COMMAND));
+    __asm__ volatile ("inb %1, %0" : "=a"(slave) : "Nd"((unsigned short)PIC2_COMMAND));
+    
+    return ((unsigned short)slave << 8) | master;
+}
+
+/* Check for a spurious IRQ 7 or IRQ 15
+ * 
+ * The 8259 raises IRQ 7 (or 15 on the slave) when an interrupt request
+ * disappears before it is acknowledged. In that case the matching ISR bit
+ * is clear and the PIC must not get an EOI - except that a spurious IRQ 15
+ * still went through the master's cascade line, which does need one.
+ */
+int pic_check_spurious(unsigned char irq) {
+    if (irq != 7 && irq != 15) {
+        return 0;
+    }
+    
+    if (pic_get_isr() & (1 << irq)) {
+        return 0;  /* Real interrupt */
+    }
+    
+    if (irq == 15) {
+        __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)PIC_EOI), "Nd"((unsigned short)PIC1_COMMAND));
+    }
+    return 1;
+}
+
+/* Mask every line on both PICs (the APIC path has taken over) */
+void pic_mask_all(void) {
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0xFF), "Nd"((unsigned short)PIC1_DATA));
+    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0xFF), "Nd"((unsigned short)PIC2_DATA));
+}
+
+/* ============================================================================
+ * irqchip Backend
+ * ============================================================================
+ */
+
+static void pic_chip_mask(unsigned int irq) {
+    pic_disable_irq((unsigned char)irq);
+}
+
+static void pic_chip_unmask(unsigned int irq) {
+    pic_enable_irq((unsigned char)irq);
+}
+
+static void pic_chip_eoi(unsigned int irq) {
+    pic_send_eoi((unsigned char)irq);
+}
+
+static int pic_chip_is_spurious(unsigned int irq) {
+    return pic_check_spurious((unsigned char)irq);
+}
+
+struct irqchip pic_chip = {
+    .name = "8259",
+    .mask = pic_chip_mask,
+    .unmask = pic_chip_unmask,
+    .eoi = pic_chip_eoi,
+    .is_spurious = pic_chip_is_spurious,
+    .shutdown = pic_mask_all,
+};
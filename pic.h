@@ -5,6 +5,9 @@
  * There are two PICs: master (IRQ 0-7) and slave (IRQ 8-15).
  * 
  * We remap IRQs to interrupt vectors 32-47 to avoid conflicts with CPU exceptions (0-31).
+ *
+ * The 8259 is the fallback interrupt controller: irq.c reaches it through
+ * pic_chip (irqchip.h) until the APIC path takes over and masks it.
  */
 
 #ifndef PIC_H
@@ -23,6 +26,11 @@
 
 /* PIC Commands */
 #define PIC_EOI                 0x20  /* End of Interrupt */
+#define PIC_OCW3_READ_ISR       0x0B  /* OCW3: read In-Service Register */
+
+/* Initial interrupt masks: everything masked except the cascade (IRQ 2) */
+#define PIC1_INITIAL_MASK       0xFB
+#define PIC2_INITIAL_MASK       0xFF
 
 /* IRQ to Interrupt Vector Mapping */
 #define PIC_IRQ_BASE            32     /* Base interrupt vector for IRQs */
@@ -43,5 +51,15 @@ void pic_disable_irq(unsigned char irq);
 /* Send End of Interrupt to PIC */
 void pic_send_eoi(unsigned char irq);
 
+/* Read the combined In-Service Register (slave in the high byte) */
+unsigned short pic_get_isr(void);
+
+/* Check for a spurious IRQ 7/15; sends the cascade EOI a spurious IRQ 15 needs.
+ * Returns 1 if the interrupt was spurious (and must not be EOI'd). */
+int pic_check_spurious(unsigned char irq);
+
+/* Mask every line on both PICs */
+void pic_mask_all(void);
+
 #endif /* PIC_H */
 
@@ -0,0 +1,187 @@
+/*
+ * Programmable Interval Timer (PIT) Implementation
+ *
+ * pit_init() starts channel 0 as a periodic tick. pit_clockevent_init()
+ * then hands channel 0 to the timer core, which either keeps it periodic
+ * or switches it to one-shot mode (mode 0: count down once, raise IRQ 0 at
+ * terminal count). In one-shot mode jiffies are no longer counted by the
+ * interrupt but derived from ktime, so they keep advancing while the tick
+ * is stopped.
+ */
+
+#include "pit.h"
+#include "irq.h"
+#include "io.h"
+#include "cpu.h"
+#include "ktime.h"
+#include "math64.h"
+#include "clockevent.h"
+
+static volatile unsigned long long jiffies = 0;
+static unsigned int pit_hz = 0;
+static unsigned int pit_divisor = 0;  /* PIT cycles per tick */
+
+/* One-shot mode: jiffies = oneshot_jiffies + (ktime - oneshot_ns) / tick */
+static int pit_oneshot = 0;
+static unsigned long long oneshot_jiffies = 0;
+static unsigned long long oneshot_ns = 0;
+static unsigned int tick_ns = 0;
+
+static struct clockevent pit_clockevent;
+
+/* IRQ 0: a periodic tick or a one-shot expiry */
+static int pit_irq_handler(unsigned int irq, void* context) {
+    (void)irq;
+    (void)context;
+
+    if (!pit_oneshot) {
+        jiffies++;
+    }
+
+    pit_clockevent.events++;
+    if (pit_clockevent.event_handler != 0) {
+        pit_clockevent.event_handler(&pit_clockevent);
+    }
+    return IRQ_HANDLED;
+}
+
+/* Load channel 0 with a mode and a count */
+static void pit_load_channel0(unsigned char mode, unsigned int count) {
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LOHI | mode);
+    outb(PIT_CHANNEL0, (unsigned char)(count & 0xFF));
+    outb(PIT_CHANNEL0, (unsigned char)((count >> 8) & 0xFF));
+}
+
+/* Program channel 0 to fire IRQ 0 `hz` times per second */
+void pit_init(unsigned int hz) {
+    unsigned int divisor;
+
+    if (hz == 0) {
+        hz = CONFIG_HZ;
+    }
+    divisor = PIT_FREQUENCY / hz;
+    if (divisor == 0) {
+        divisor = 1;
+    } else if (divisor > 0xFFFF) {
+        divisor = 0;  /* 0 means 65536 */
+    }
+    pit_hz = hz;
+    pit_divisor = divisor ? divisor : 0x10000;
+    tick_ns = (unsigned int)div_u64((unsigned long long)pit_divisor * NSEC_PER_SEC, PIT_FREQUENCY);
+
+    pit_load_channel0(PIT_CMD_MODE2, divisor);
+
+    request_irq(PIT_IRQ, pit_irq_handler, 0, "pit", 0);
+}
+
+/* ============================================================================
+ * Clock Event Device
+ * ============================================================================
+ */
+
+/* Periodic tick at the pit_init() rate */
+static void pit_set_periodic(void) {
+    if (pit_oneshot) {
+        jiffies = pit_get_jiffies();
+        pit_oneshot = 0;
+    }
+    pit_load_channel0(PIT_CMD_MODE2, pit_divisor & 0xFFFF);
+}
+
+/* Stop counting: a mode 0 command without a count leaves the counter idle */
+static void pit_shutdown(void) {
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LOHI | PIT_CMD_MODE0);
+}
+
+/* Stop the tick and derive jiffies from ktime from now on */
+static void pit_set_oneshot(void) {
+    oneshot_jiffies = jiffies;
+    oneshot_ns = ktime_get_ns();
+    pit_oneshot = 1;
+    pit_shutdown();
+}
+
+/* Raise IRQ 0 once after `delta_ns` */
+static void pit_set_next_event(unsigned int delta_ns) {
+    /* Round up so the interrupt never arrives before the deadline */
+    unsigned int count = (unsigned int)div_u64((unsigned long long)delta_ns * PIT_FREQUENCY +
+                                               NSEC_PER_SEC - 1, NSEC_PER_SEC);
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+    pit_load_channel0(PIT_CMD_MODE0, count);
+}
+
+static struct clockevent pit_clockevent = {
+    .name = "pit",
+    .rating = 100,
+    .features = CLOCKEVENT_FEAT_PERIODIC | CLOCKEVENT_FEAT_ONESHOT,
+    .min_delta_ns = 2000,
+    .max_delta_ns = 54900000,  /* 0xFFFF PIT cycles */
+    .set_periodic = pit_set_periodic,
+    .set_oneshot = pit_set_oneshot,
+    .shutdown = pit_shutdown,
+    .set_next_event = pit_set_next_event,
+};
+
+/* Offer channel 0 to the timer core */
+void pit_clockevent_init(void) {
+    clockevent_register(&pit_clockevent);
+}
+
+/* ============================================================================
+ * Queries
+ * ============================================================================
+ */
+
+/* Ticks since pit_init() */
+unsigned long long pit_get_jiffies(void) {
+    unsigned int flags = irq_save();
+    unsigned long long value;
+
+    if (pit_oneshot) {
+        value = oneshot_jiffies + div_u64(ktime_get_ns() - oneshot_ns, tick_ns);
+    } else {
+        value = jiffies;
+    }
+
+    irq_restore(flags);
+    return value;
+}
+
+/* Configured tick rate */
+unsigned int pit_get_hz(void) {
+    return pit_hz;
+}
+
+/* PIT input cycles per tick */
+unsigned int pit_get_divisor(void) {
+    return pit_divisor;
+}
+
+/* Busy-wait on channel 2 for `count` PIT cycles; returns elapsed TSC cycles */
+unsigned long long pit_wait_tsc(unsigned int count) {
+    unsigned long long start, end;
+
+    if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+
+    /* Gate channel 2 on, speaker off */
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+
+    /* Mode 0: OUT2 goes high when the count reaches zero */
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL2 | PIT_CMD_LOHI | PIT_CMD_MODE0);
+    outb(PIT_CHANNEL2, (unsigned char)(count & 0xFF));
+    outb(PIT_CHANNEL2, (unsigned char)((count >> 8) & 0xFF));
+
+    start = rdtsc();
+    while ((inb(PIT_GATE_PORT) & 0x20) == 0) {
+        /* Busy wait for terminal count */
+    }
+    end = rdtsc();
+
+    return end - start;
+}
@@ -0,0 +1,56 @@
+/*
+ * Programmable Interval Timer (PIT, 8253/8254) Header
+ *
+ * The PIT has three 16-bit counters clocked at 1.193182 MHz:
+ * - Channel 0 is wired to IRQ 0 and drives the periodic kernel tick, or
+ *   serves as a one-shot clock event device for the timer core (timer.h)
+ * - Channel 2 is gated through port 0x61 and is used to calibrate the TSC
+ */
+
+#ifndef PIT_H
+#define PIT_H
+
+/* PIT I/O Ports */
+#define PIT_CHANNEL0    0x40
+#define PIT_CHANNEL2    0x42
+#define PIT_COMMAND     0x43
+#define PIT_GATE_PORT   0x61  /* Bit 0: channel 2 gate, bit 1: speaker, bit 5: OUT2 */
+
+/* PIT input clock in Hz */
+#define PIT_FREQUENCY   1193182
+
+/* Command byte fields */
+#define PIT_CMD_CHANNEL0   0x00
+#define PIT_CMD_CHANNEL2   0x80
+#define PIT_CMD_LOHI       0x30  /* Access mode: low byte, then high byte */
+#define PIT_CMD_MODE0      0x00  /* Interrupt on terminal count (one-shot) */
+#define PIT_CMD_MODE2      0x04  /* Rate generator (periodic) */
+
+#define PIT_IRQ 0
+
+/* Tick rate (override with make CONFIG_HZ=...) */
+#ifndef CONFIG_HZ
+#define CONFIG_HZ 1000
+#endif
+
+/* Program channel 0 to fire IRQ 0 `hz` times per second and start counting jiffies */
+void pit_init(unsigned int hz);
+
+/* Register channel 0 as a clock event device (call after timer_init);
+ * the timer core switches it to one-shot mode when the TSC is calibrated */
+void pit_clockevent_init(void);
+
+/* Ticks since pit_init() (derived from ktime once the tick is one-shot) */
+unsigned long long pit_get_jiffies(void);
+
+/* Configured tick rate */
+unsigned int pit_get_hz(void);
+
+/* PIT input cycles per tick (the exact tick period is divisor / PIT_FREQUENCY) */
+unsigned int pit_get_divisor(void);
+
+/* Busy-wait on channel 2 for `count` PIT cycles (interrupts not needed).
+ * Returns the TSC cycles that elapsed. */
+unsigned long long pit_wait_tsc(unsigned int count);
+
+#endif /* PIT_H */
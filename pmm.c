@@ -0,0 +1,743 @@
+/*
+ * Physical Memory Manager (PMM) Implementation
+ *
+ * Initialization:
+ * 1. Collect the available RAM regions from the Multiboot memory map
+ *    (clipped to the kernel's direct map, PAGING_DIRECT_LIMIT; without a
+ *    map, 1 MB + mem_upper is used)
+ * 2. Collect the reserved ranges: the low 1 MB (BIOS data, the AP
+ *    trampoline), the kernel image, the Multiboot info, memory map,
+ *    command line and modules
+ * 3. Place the page descriptor array (mem_map) in the first free spot
+ *    above 1 MB and reserve it too
+ * 4. Mark every page reserved, clear the pages of available regions, set
+ *    the reserved ranges again, and hand each run of free pages to the
+ *    buddy lists as maximal aligned blocks
+ *
+ * Locking: the buddy lists of both zones are protected by one MCS lock
+ * (spinlock.h) taken with interrupts disabled. Each CPU's hot-page cache
+ * is only touched by that CPU with interrupts disabled, so it needs no
+ * lock.
+ */
+
+#include "pmm.h"
+#include "paging.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "cpu.h"
+#include "io.h"
+#include "math64.h"
+#include "debug.h"
+
+/* Memory below 1 MB is left to the firmware and real-mode users */
+#define PMM_LOW_MEMORY    0x100000
+
+/* Capacity of the region tables built at boot */
+#define PMM_MAX_REGIONS   32
+#define PMM_MAX_RESERVED  16
+
+/* Physical address range [start, end) */
+struct pmm_range {
+    unsigned int start;
+    unsigned int end;
+};
+
+struct pmm_zone {
+    const char* name;
+    unsigned int start_pfn;
+    unsigned int end_pfn;
+    unsigned int managed_pages;
+    unsigned int free_pages;
+    struct page* free_list[PMM_MAX_ORDER];
+    unsigned int free_count[PMM_MAX_ORDER];
+};
+
+/* Per-CPU hot-page cache: head is the most recently freed page */
+struct pmm_pcp {
+    struct page* head;
+    struct page* tail;
+    unsigned int count;
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int hits;
+    unsigned int misses;
+} __cacheline_aligned;
+
+/* Linker-provided symbols: the kernel image */
+extern char kernel_start[];
+extern char kernel_end[];
+
+struct page* mem_map = 0;
+static unsigned int max_pfn = 0;
+static unsigned int phys_end = 0;   /* End of the highest memory map entry */
+
+static struct pmm_zone zones[PMM_NR_ZONES] = {
+    { .name = "DMA" },
+    { .name = "Normal" },
+};
+
+static struct pmm_pcp pcp_caches[NR_CPUS];
+
+/* The buddy lock: every CPU refilling or draining its page cache queues
+ * here, so it is an MCS lock. Each CPU queues on its own node (the lock
+ * never nests, and it is taken with interrupts disabled). */
+static struct lock_class pmm_lock_class = LOCK_CLASS_INIT("pmm");
+static struct mcs_lock pmm_buddy_lock = MCS_LOCK_INIT(&pmm_lock_class);
+static struct pmm_lock_node {
+    struct mcs_node node;
+} __cacheline_aligned pmm_lock_nodes[NR_CPUS];
+
+/* Boot-time region tables */
+static struct pmm_range available[PMM_MAX_REGIONS];
+static unsigned int available_count = 0;
+static struct pmm_range reserved[PMM_MAX_RESERVED];
+static unsigned int reserved_count = 0;
+
+/* Counters updated under the lock (batch moves between the buddy lists
+ * and the per-CPU caches are not counted as allocations) */
+static unsigned int total_pages = 0;
+static unsigned int reserved_pages = 0;
+static unsigned int stat_allocs = 0;
+static unsigned int stat_frees = 0;
+static unsigned int stat_failures = 0;
+static unsigned int stat_splits = 0;
+static unsigned int stat_merges = 0;
+
+/* Take the buddy lock with interrupts disabled; returns the saved flags */
+static unsigned int pmm_lock(void) {
+    unsigned int flags = irq_save();
+
+    mcs_lock(&pmm_buddy_lock, &pmm_lock_nodes[smp_processor_id()].node);
+    return flags;
+}
+
+static void pmm_unlock(unsigned int flags) {
+    mcs_unlock(&pmm_buddy_lock, &pmm_lock_nodes[smp_processor_id()].node);
+    irq_restore(flags);
+}
+
+static inline unsigned int pfn_zone(unsigned int pfn) {
+    return pfn < (ZONE_DMA_LIMIT >> PAGE_SHIFT) ? ZONE_DMA : ZONE_NORMAL;
+}
+
+/* ============================================================================
+ * Buddy Lists (lock held)
+ * ============================================================================
+ */
+
+/* Put a free block at the head of its free list */
+static void free_list_add(struct pmm_zone* zone, struct page* page, unsigned int order) {
+    page->flags = PG_BUDDY;
+    page->order = (unsigned char)order;
+    page->prev = 0;
+    page->next = zone->free_list[order];
+    if (page->next != 0) {
+        page->next->prev = page;
+    }
+    zone->free_list[order] = page;
+    zone->free_count[order]++;
+    zone->free_pages += 1u << order;
+}
+
+/* Unlink a free block from its free list */
+static void free_list_del(struct pmm_zone* zone, struct page* page, unsigned int order) {
+    if (page->prev != 0) {
+        page->prev->next = page->next;
+    } else {
+        zone->free_list[order] = page->next;
+    }
+    if (page->next != 0) {
+        page->next->prev = page->prev;
+    }
+    page->next = 0;
+    page->prev = 0;
+    page->flags &= ~PG_BUDDY;
+    zone->free_count[order]--;
+    zone->free_pages -= 1u << order;
+}
+
+/* Free a block, merging it with its buddy as long as the buddy is free */
+static void buddy_free(unsigned int pfn, unsigned int order) {
+    struct pmm_zone* zone = &zones[pfn_to_page(pfn)->zone];
+
+    while (order < PMM_MAX_ORDER - 1) {
+        unsigned int buddy_pfn = pfn ^ (1u << order);
+        struct page* buddy;
+
+        if (buddy_pfn >= max_pfn) {
+            break;
+        }
+        buddy = pfn_to_page(buddy_pfn);
+        if (!(buddy->flags & PG_BUDDY) || buddy->order != order ||
+            buddy->zone != pfn_to_page(pfn)->zone) {
+            break;
+        }
+
+        free_list_del(zone, buddy, order);
+        stat_merges++;
+        pfn &= ~(1u << order);
+        order++;
+    }
+
+    free_list_add(zone, pfn_to_page(pfn), order);
+}
+
+/* Take a block of the given order from a zone, splitting a larger one if
+ * needed; the unused halves go back on the smaller free lists */
+static struct page* buddy_alloc(struct pmm_zone* zone, unsigned int order) {
+    for (unsigned int current = order; current < PMM_MAX_ORDER; current++) {
+        struct page* page = zone->free_list[current];
+
+        if (page == 0) {
+            continue;
+        }
+
+        free_list_del(zone, page, current);
+        while (current > order) {
+            current--;
+            free_list_add(zone, page + (1u << current), current);
+            stat_splits++;
+        }
+        page->order = (unsigned char)order;
+        return page;
+    }
+    return 0;
+}
+
+/* Allocate from the zones allowed by `flags` (Normal first, then DMA) */
+static struct page* pmm_alloc_locked(unsigned int order, unsigned int flags) {
+    struct page* page = 0;
+
+    if (!(flags & PMM_ZONE_DMA)) {
+        page = buddy_alloc(&zones[ZONE_NORMAL], order);
+    }
+    if (page == 0) {
+        page = buddy_alloc(&zones[ZONE_DMA], order);
+    }
+
+    return page;
+}
+
+/* ============================================================================
+ * Per-CPU Hot-Page Cache (interrupts disabled)
+ * ============================================================================
+ */
+
+static void pcp_push(struct pmm_pcp* pcp, struct page* page) {
+    page->flags = PG_PCP;
+    page->prev = 0;
+    page->next = pcp->head;
+    if (pcp->head != 0) {
+        pcp->head->prev = page;
+    } else {
+        pcp->tail = page;
+    }
+    pcp->head = page;
+    pcp->count++;
+}
+
+static struct page* pcp_pop(struct pmm_pcp* pcp) {
+    struct page* page = pcp->head;
+
+    if (page == 0) {
+        return 0;
+    }
+    pcp->head = page->next;
+    if (pcp->head != 0) {
+        pcp->head->prev = 0;
+    } else {
+        pcp->tail = 0;
+    }
+    page->next = 0;
+    page->flags &= ~PG_PCP;
+    pcp->count--;
+    return page;
+}
+
+/* Refill an empty cache with a batch of pages from the buddy lists */
+static void pcp_refill(struct pmm_pcp* pcp) {
+    unsigned int flags = pmm_lock();
+
+    for (unsigned int i = 0; i < PMM_PCP_BATCH; i++) {
+        struct page* page = pmm_alloc_locked(0, 0);
+        if (page == 0) {
+            break;
+        }
+        pcp_push(pcp, page);
+    }
+
+    pmm_unlock(flags);
+}
+
+/* Return the coldest batch of pages to the buddy lists */
+static void pcp_drain(struct pmm_pcp* pcp) {
+    unsigned int flags = pmm_lock();
+
+    for (unsigned int i = 0; i < PMM_PCP_BATCH && pcp->tail != 0; i++) {
+        struct page* page = pcp->tail;
+
+        pcp->tail = page->prev;
+        if (pcp->tail != 0) {
+            pcp->tail->next = 0;
+        } else {
+            pcp->head = 0;
+        }
+        pcp->count--;
+        page->prev = 0;
+        page->flags &= ~PG_PCP;
+        buddy_free(page_to_pfn(page), 0);
+    }
+
+    pmm_unlock(flags);
+}
+
+/* ============================================================================
+ * Allocation API
+ * ============================================================================
+ */
+
+/* Allocate 2^order contiguous pages; returns the physical address or 0 */
+unsigned int pmm_alloc_pages(unsigned int order, unsigned int flags) {
+    struct page* page;
+    unsigned int irq_flags;
+
+    if (order >= PMM_MAX_ORDER || mem_map == 0) {
+        return 0;
+    }
+
+    if (order == 0 && !(flags & PMM_ZONE_DMA)) {
+        struct pmm_pcp* pcp;
+
+        irq_flags = irq_save();
+        pcp = &pcp_caches[smp_processor_id()];
+        if (pcp->head != 0) {
+            pcp->hits++;
+        } else {
+            pcp->misses++;
+            pcp_refill(pcp);
+        }
+        page = pcp_pop(pcp);
+        if (page != 0) {
+            pcp->allocs++;
+        }
+        irq_restore(irq_flags);
+    } else {
+        irq_flags = pmm_lock();
+        page = pmm_alloc_locked(order, flags);
+        if (page != 0) {
+            stat_allocs++;
+        }
+        pmm_unlock(irq_flags);
+    }
+
+    if (page == 0) {
+        __atomic_fetch_add(&stat_failures, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return page_to_phys(page);
+}
+
+/* Free a block returned by pmm_alloc_pages() with the same order */
+void pmm_free_pages(unsigned int addr, unsigned int order) {
+    unsigned int pfn = addr >> PAGE_SHIFT;
+    struct page* page;
+    unsigned int irq_flags;
+
+    if (addr == 0 || order >= PMM_MAX_ORDER) {
+        return;
+    }
+
+    page = pfn_to_page(pfn);
+    if (pfn >= max_pfn || (addr & ~PAGE_MASK) != 0 || (pfn & ((1u << order) - 1)) != 0 ||
+        (page->flags & (PG_RESERVED | PG_BUDDY | PG_PCP)) != 0) {
+        debug_logf(LOG_ERROR, "pmm: bad free of 0x%08x (order %u)", addr, order);
+        return;
+    }
+    page->owner = 0;
+
+    if (order == 0 && page->zone == ZONE_NORMAL) {
+        struct pmm_pcp* pcp;
+
+        irq_flags = irq_save();
+        pcp = &pcp_caches[smp_processor_id()];
+        pcp_push(pcp, page);
+        pcp->frees++;
+        if (pcp->count > PMM_PCP_HIGH) {
+            pcp_drain(pcp);
+        }
+        irq_restore(irq_flags);
+        return;
+    }
+
+    irq_flags = pmm_lock();
+    buddy_free(pfn, order);
+    stat_frees++;
+    pmm_unlock(irq_flags);
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================
+ */
+
+static unsigned int page_align_up(unsigned int addr) {
+    return (addr + PAGE_SIZE - 1) & PAGE_MASK;
+}
+
+/* Record a reserved physical range */
+static void pmm_reserve(unsigned int start, unsigned int end) {
+    if (end <= start) {
+        return;
+    }
+    if (reserved_count == PMM_MAX_RESERVED) {
+        debug_error("pmm: too many reserved ranges");
+        return;
+    }
+    reserved[reserved_count].start = start & PAGE_MASK;
+    reserved[reserved_count].end = end;
+    reserved_count++;
+}
+
+/* Record an available RAM region, clipped to the direct map */
+static void pmm_add_available(unsigned long long addr, unsigned long long len) {
+    unsigned long long end = addr + len;
+
+    if (end > PAGING_DIRECT_LIMIT) {
+        end = PAGING_DIRECT_LIMIT;
+    }
+    if (addr >= end) {
+        return;
+    }
+    if (available_count == PMM_MAX_REGIONS) {
+        debug_error("pmm: too many memory regions");
+        return;
+    }
+    available[available_count].start = (unsigned int)addr;
+    available[available_count].end = (unsigned int)end;
+    available_count++;
+}
+
+/* Name of a memory map entry type */
+static const char* mmap_type_name(unsigned int type) {
+    switch (type) {
+        case MULTIBOOT_MEMORY_AVAILABLE: return "usable";
+        case MULTIBOOT_MEMORY_ACPI:      return "ACPI data";
+        case MULTIBOOT_MEMORY_NVS:       return "ACPI NVS";
+        case MULTIBOOT_MEMORY_BAD:       return "unusable";
+        default:                         return "reserved";
+    }
+}
+
+/* Collect available regions and boot-time reservations from the Multiboot info */
+static void pmm_parse_multiboot(const struct multiboot_info* mbi) {
+    pmm_reserve(0, PMM_LOW_MEMORY);
+    pmm_reserve((unsigned int)kernel_start, (unsigned int)kernel_end);
+    pmm_reserve((unsigned int)mbi, (unsigned int)mbi + sizeof(*mbi));
+
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        unsigned int entry_addr = mbi->mmap_addr;
+        unsigned int end = mbi->mmap_addr + mbi->mmap_length;
+
+        pmm_reserve(mbi->mmap_addr, end);
+        while (entry_addr < end) {
+            const struct multiboot_mmap_entry* entry = (const struct multiboot_mmap_entry*)entry_addr;
+
+            debug_logf(LOG_INFO, "pmm: [mem 0x%09llx-0x%09llx] %s", entry->addr,
+                       entry->addr + entry->len - 1, mmap_type_name(entry->type));
+            if (entry->addr < PAGING_DIRECT_LIMIT) {
+                unsigned long long entry_end = entry->addr + entry->len;
+                if (entry_end > PAGING_DIRECT_LIMIT) {
+                    entry_end = PAGING_DIRECT_LIMIT;
+                }
+                if (entry_end > phys_end) {
+                    phys_end = (unsigned int)entry_end;
+                }
+            }
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                pmm_add_available(entry->addr, entry->len);
+            }
+            entry_addr += entry->size + 4;
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        debug_warn("pmm: no memory map, using mem_upper");
+        pmm_add_available(PMM_LOW_MEMORY, (unsigned long long)mbi->mem_upper * 1024);
+        phys_end = PMM_LOW_MEMORY + mbi->mem_upper * 1024;
+    }
+
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        const char* cmdline = (const char*)mbi->cmdline;
+        unsigned int len = 0;
+
+        while (len < PAGE_SIZE && cmdline[len] != '\0') {
+            len++;
+        }
+        pmm_reserve(mbi->cmdline, mbi->cmdline + len + 1);
+    }
+
+    if ((mbi->flags & MULTIBOOT_INFO_MODS) && mbi->mods_count != 0) {
+        const struct multiboot_module* mods = (const struct multiboot_module*)mbi->mods_addr;
+
+        pmm_reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(*mods));
+        for (unsigned int i = 0; i < mbi->mods_count; i++) {
+            pmm_reserve(mods[i].mod_start, mods[i].mod_end);
+        }
+    }
+}
+
+/* Find `size` bytes of available, unreserved memory above 1 MB */
+static unsigned int pmm_find_free(unsigned int size) {
+    for (unsigned int i = 0; i < available_count; i++) {
+        unsigned int candidate = page_align_up(available[i].start);
+        int moved = 1;
+
+        if (candidate < PMM_LOW_MEMORY) {
+            candidate = PMM_LOW_MEMORY;
+        }
+
+        /* Step past every reserved range the candidate overlaps */
+        while (moved) {
+            moved = 0;
+            if (candidate + size > available[i].end) {
+                break;
+            }
+            for (unsigned int r = 0; r < reserved_count; r++) {
+                if (candidate < reserved[r].end && candidate + size > reserved[r].start) {
+                    candidate = page_align_up(reserved[r].end);
+                    moved = 1;
+                }
+            }
+            if (!moved) {
+                return candidate;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Hand a run of free pages to the buddy lists as maximal aligned blocks */
+static void pmm_add_free_run(unsigned int pfn, unsigned int end_pfn) {
+    while (pfn < end_pfn) {
+        unsigned int order = PMM_MAX_ORDER - 1;
+
+        while (order > 0 && ((pfn & ((1u << order) - 1)) != 0 || pfn + (1u << order) > end_pfn)) {
+            order--;
+        }
+        zones[pfn_zone(pfn)].managed_pages += 1u << order;
+        buddy_free(pfn, order);
+        pfn += 1u << order;
+    }
+}
+
+/* Build the allocator from the Multiboot memory map */
+void pmm_init(const struct multiboot_info* mbi) {
+    unsigned int map_size;
+    unsigned int map_addr;
+    unsigned int run_start = 0;
+    int in_run = 0;
+
+    pmm_parse_multiboot(mbi);
+
+    /* Highest available page (exclusive) */
+    for (unsigned int i = 0; i < available_count; i++) {
+        unsigned int end_pfn = available[i].end >> PAGE_SHIFT;
+        if (end_pfn > max_pfn) {
+            max_pfn = end_pfn;
+        }
+    }
+    if (max_pfn == 0) {
+        debug_error("pmm: no usable memory");
+        return;
+    }
+
+    /* Place the page descriptor array */
+    map_size = page_align_up(max_pfn * sizeof(struct page));
+    map_addr = pmm_find_free(map_size);
+    if (map_addr == 0) {
+        debug_error("pmm: no room for the page array");
+        max_pfn = 0;
+        return;
+    }
+    pmm_reserve(map_addr, map_addr + map_size);
+    mem_map = (struct page*)map_addr;
+
+    /* Everything starts out reserved */
+    for (unsigned int pfn = 0; pfn < max_pfn; pfn++) {
+        struct page* page = &mem_map[pfn];
+        page->next = 0;
+        page->prev = 0;
+        page->order = 0;
+        page->zone = (unsigned char)pfn_zone(pfn);
+        page->flags = PG_RESERVED;
+        page->owner = 0;
+    }
+
+    /* Whole pages inside available regions become free ... */
+    for (unsigned int i = 0; i < available_count; i++) {
+        unsigned int start_pfn = page_align_up(available[i].start) >> PAGE_SHIFT;
+        unsigned int end_pfn = available[i].end >> PAGE_SHIFT;
+
+        for (unsigned int pfn = start_pfn; pfn < end_pfn; pfn++) {
+            if (mem_map[pfn].flags & PG_RESERVED) {
+                mem_map[pfn].flags = 0;
+                total_pages++;
+            }
+        }
+    }
+
+    /* ... unless a reserved range touches them */
+    for (unsigned int r = 0; r < reserved_count; r++) {
+        unsigned int start_pfn = reserved[r].start >> PAGE_SHIFT;
+        unsigned int end_pfn = page_align_up(reserved[r].end) >> PAGE_SHIFT;
+
+        if (end_pfn > max_pfn || end_pfn == 0) {
+            end_pfn = max_pfn;
+        }
+        for (unsigned int pfn = start_pfn; pfn < end_pfn; pfn++) {
+            if (mem_map[pfn].flags == 0) {
+                mem_map[pfn].flags = PG_RESERVED;
+                reserved_pages++;
+            }
+        }
+    }
+
+    /* Zone spans */
+    zones[ZONE_DMA].start_pfn = 0;
+    zones[ZONE_DMA].end_pfn = max_pfn < (ZONE_DMA_LIMIT >> PAGE_SHIFT) ? max_pfn : (ZONE_DMA_LIMIT >> PAGE_SHIFT);
+    zones[ZONE_NORMAL].start_pfn = zones[ZONE_DMA].end_pfn;
+    zones[ZONE_NORMAL].end_pfn = max_pfn;
+
+    /* Feed the runs of free pages to the buddy lists */
+    for (unsigned int pfn = 0; pfn <= max_pfn; pfn++) {
+        int free = pfn < max_pfn && mem_map[pfn].flags == 0;
+
+        if (free && !in_run) {
+            run_start = pfn;
+            in_run = 1;
+        } else if (!free && in_run) {
+            pmm_add_free_run(run_start, pfn);
+            in_run = 0;
+        }
+    }
+    stat_merges = 0;
+
+    debug_logf(LOG_INFO, "pmm: %u MB usable, %u KB reserved, %u MB free, page array at 0x%08x (%u KB)",
+               total_pages >> (20 - PAGE_SHIFT), reserved_pages << (PAGE_SHIFT - 10),
+               pmm_free_count() >> (20 - PAGE_SHIFT), map_addr, map_size >> 10);
+}
+
+/* ============================================================================
+ * Statistics
+ * ============================================================================
+ */
+
+/* End of physical memory described by the memory map (any type) */
+unsigned int pmm_phys_end(void) {
+    return phys_end > (max_pfn << PAGE_SHIFT) ? phys_end : (max_pfn << PAGE_SHIFT);
+}
+
+/* Number of free pages (buddy lists and per-CPU caches) */
+unsigned int pmm_free_count(void) {
+    unsigned int count = zones[ZONE_DMA].free_pages + zones[ZONE_NORMAL].free_pages;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        count += pcp_caches[cpu].count;
+    }
+    return count;
+}
+
+/* Fragmentation for an allocation of the given order, in permille */
+unsigned int pmm_fragmentation(unsigned int order) {
+    unsigned int free = pmm_free_count();
+    unsigned int usable = 0;
+
+    if (order >= PMM_MAX_ORDER) {
+        return 1000;
+    }
+
+    for (unsigned int z = 0; z < PMM_NR_ZONES; z++) {
+        for (unsigned int o = order; o < PMM_MAX_ORDER; o++) {
+            usable += zones[z].free_count[o] << o;
+        }
+    }
+    if (order == 0) {
+        return 0;  /* Every free page is usable */
+    }
+    if (free == 0) {
+        return 1000;
+    }
+    return (unsigned int)div_u64((unsigned long long)(free - usable) * 1000, free);
+}
+
+/* Get a snapshot of the allocator statistics */
+void pmm_get_stats(struct pmm_stats* out) {
+    unsigned int flags = pmm_lock();
+
+    out->total_pages = total_pages;
+    out->reserved_pages = reserved_pages;
+    out->allocs = stat_allocs;
+    out->frees = stat_frees;
+    out->failures = stat_failures;
+    out->splits = stat_splits;
+    out->merges = stat_merges;
+    out->pcp_pages = 0;
+    out->pcp_hits = 0;
+    out->pcp_misses = 0;
+
+    /* Per-CPU counters are read without stopping the other CPUs */
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        const struct pmm_pcp* pcp = &pcp_caches[cpu];
+
+        out->pcp_pages += pcp->count;
+        out->pcp_hits += pcp->hits;
+        out->pcp_misses += pcp->misses;
+        out->allocs += pcp->allocs;
+        out->frees += pcp->frees;
+    }
+
+    out->free_pages = out->pcp_pages;
+    for (unsigned int z = 0; z < PMM_NR_ZONES; z++) {
+        struct pmm_zone_stats* zs = &out->zones[z];
+
+        zs->name = zones[z].name;
+        zs->start_pfn = zones[z].start_pfn;
+        zs->end_pfn = zones[z].end_pfn;
+        zs->managed_pages = zones[z].managed_pages;
+        zs->free_pages = zones[z].free_pages;
+        for (unsigned int o = 0; o < PMM_MAX_ORDER; o++) {
+            zs->free_blocks[o] = zones[z].free_count[o];
+        }
+        out->free_pages += zones[z].free_pages;
+    }
+
+    pmm_unlock(flags);
+}
+
+/* Print zones, free blocks per order and fragmentation */
+void pmm_dump_stats(void) {
+    struct pmm_stats s;
+    unsigned int lookups;
+
+    pmm_get_stats(&s);
+    lookups = s.pcp_hits + s.pcp_misses;
+
+    kprintf("PMM: %u KB usable, %u KB reserved, %u KB free (%u pages in per-CPU caches)\n",
+            s.total_pages << 2, s.reserved_pages << 2, s.free_pages << 2, s.pcp_pages);
+    for (unsigned int z = 0; z < PMM_NR_ZONES; z++) {
+        const struct pmm_zone_stats* zs = &s.zones[z];
+
+        kprintf("  %-6s pfn %05x-%05x managed %6u free %6u blocks:",
+                zs->name, zs->start_pfn, zs->end_pfn, zs->managed_pages, zs->free_pages);
+        for (unsigned int o = 0; o < PMM_MAX_ORDER; o++) {
+            kprintf(" %u", zs->free_blocks[o]);
+        }
+        kprintf("\n");
+    }
+    kprintf("  allocs %u frees %u failures %u splits %u merges %u, per-CPU hit rate %u%%\n",
+            s.allocs, s.frees, s.failures, s.splits, s.merges,
+            lookups != 0 ? (unsigned int)div_u64((unsigned long long)s.pcp_hits * 100, lookups) : 0);
+    kprintf("  fragmentation (permille) by order:");
+    for (unsigned int o = 0; o < PMM_MAX_ORDER; o++) {
+        kprintf(" %u", pmm_fragmentation(o));
+    }
+    kprintf("\n");
+}
@@ -0,0 +1,146 @@
+/*
+ * Physical Memory Manager (PMM) Header
+ *
+ * Physical RAM is managed in 4 KB pages by a binary buddy allocator. A
+ * block of order n is 2^n contiguous pages whose first page number is a
+ * multiple of 2^n; its buddy is the block at pfn ^ 2^n. Freeing a block
+ * merges it with its buddy for as long as the buddy is free too, so both
+ * allocation and free take O(MAX_ORDER) steps.
+ *
+ * Memory is split into zones that never share a block:
+ *   ZONE_DMA     below 16 MB (reachable by ISA DMA)
+ *   ZONE_NORMAL  16 MB - 3 GB (the end of the kernel's direct map)
+ * Ordinary allocations are served from ZONE_NORMAL first and fall back to
+ * ZONE_DMA; PMM_ZONE_DMA restricts an allocation to ZONE_DMA.
+ *
+ * Single pages go through a small per-CPU cache of recently freed ("hot")
+ * pages, which needs neither the zone lock nor the buddy lists in the
+ * common case.
+ *
+ * RAM is identity-mapped (paging.h), so physical addresses are used
+ * directly as pointers.
+ */
+
+#ifndef PMM_H
+#define PMM_H
+
+#include "multiboot.h"
+
+#define PAGE_SHIFT  12
+#define PAGE_SIZE   (1u << PAGE_SHIFT)
+#define PAGE_MASK   (~(PAGE_SIZE - 1))
+
+/* Largest block is order PMM_MAX_ORDER - 1 (4 MB) */
+#define PMM_MAX_ORDER  11
+
+/* Zones */
+#define ZONE_DMA        0
+#define ZONE_NORMAL     1
+#define PMM_NR_ZONES    2
+#define ZONE_DMA_LIMIT  0x1000000  /* 16 MB */
+
+/* Allocation flags */
+#define PMM_ZONE_DMA    0x01  /* Only from ZONE_DMA */
+
+/* Per-CPU hot-page cache: refill/drain PMM_PCP_BATCH pages at a time,
+ * keep at most PMM_PCP_HIGH */
+#define PMM_PCP_HIGH    32
+#define PMM_PCP_BATCH   16
+
+/* struct page flags */
+#define PG_RESERVED  0x01  /* Not managed by the allocator */
+#define PG_BUDDY     0x02  /* First page of a free buddy block */
+#define PG_PCP       0x04  /* In a per-CPU cache */
+
+/* Page descriptor, one per physical page frame */
+struct page {
+    struct page* next;           /* Free list link */
+    struct page* prev;
+    unsigned char order;         /* Block order (PG_BUDDY pages) */
+    unsigned char zone;
+    unsigned short flags;        /* PG_* */
+    void* owner;                 /* Free for the owner of an allocated page */
+};
+
+/* Per-zone statistics */
+struct pmm_zone_stats {
+    const char* name;
+    unsigned int start_pfn;
+    unsigned int end_pfn;
+    unsigned int managed_pages;  /* Pages handed to the allocator */
+    unsigned int free_pages;     /* Free in the buddy lists */
+    unsigned int free_blocks[PMM_MAX_ORDER];
+};
+
+/* Allocator statistics */
+struct pmm_stats {
+    unsigned int total_pages;    /* RAM in the memory map (direct map only) */
+    unsigned int reserved_pages; /* Kernel, boot data, page array, low 1 MB */
+    unsigned int free_pages;     /* Buddy lists + per-CPU caches */
+    unsigned int pcp_pages;      /* Pages sitting in per-CPU caches */
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int pcp_hits;       /* Single-page allocations served by a per-CPU cache */
+    unsigned int pcp_misses;
+    unsigned int failures;
+    unsigned int splits;
+    unsigned int merges;
+    struct pmm_zone_stats zones[PMM_NR_ZONES];
+};
+
+/* Page descriptor array, indexed by page frame number */
+extern struct page* mem_map;
+
+static inline struct page* pfn_to_page(unsigned int pfn) {
+    return &mem_map[pfn];
+}
+
+static inline unsigned int page_to_pfn(const struct page* page) {
+    return (unsigned int)(page - mem_map);
+}
+
+static inline struct page* phys_to_page(unsigned int addr) {
+    return &mem_map[addr >> PAGE_SHIFT];
+}
+
+static inline unsigned int page_to_phys(const struct page* page) {
+    return page_to_pfn(page) << PAGE_SHIFT;
+}
+
+/* Build the allocator from the Multiboot memory map */
+void pmm_init(const struct multiboot_info* mbi);
+
+/* Allocate 2^order contiguous pages; returns the physical address or 0 */
+unsigned int pmm_alloc_pages(unsigned int order, unsigned int flags);
+
+/* Free a block returned by pmm_alloc_pages() with the same order */
+void pmm_free_pages(unsigned int addr, unsigned int order);
+
+/* Single pages (served by the per-CPU cache) */
+static inline unsigned int pmm_alloc_page(void) {
+    return pmm_alloc_pages(0, 0);
+}
+
+static inline void pmm_free_page(unsigned int addr) {
+    pmm_free_pages(addr, 0);
+}
+
+/* Number of free pages (buddy lists and per-CPU caches) */
+unsigned int pmm_free_count(void);
+
+/* End of physical memory described by the memory map, including
+ * firmware-reserved and ACPI regions (clipped to the direct map) */
+unsigned int pmm_phys_end(void);
+
+/* Fragmentation for an allocation of the given order, in permille: the
+ * share of free memory that sits in blocks too small to satisfy it
+ * (0 = unfragmented, 1000 = no block of that order is left) */
+unsigned int pmm_fragmentation(unsigned int order);
+
+/* Get a snapshot of the allocator statistics */
+void pmm_get_stats(struct pmm_stats* stats);
+
+/* Print zones, free blocks per order and fragmentation */
+void pmm_dump_stats(void);
+
+#endif /* PMM_H */
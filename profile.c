@@ -0,0 +1,381 @@
+/*
+ * Sampling Profiler Implementation
+ *
+ * Samples are taken in interrupt context, each CPU writing only its own
+ * struct profile_cpu. Buffers are allocated (with vmalloc) the first time
+ * a CPU is profiled and kept afterwards; profile_start() clears them
+ * before sampling is switched on. The timers belong to the boot CPU's
+ * timer core, so start/stop run there.
+ */
+
+#include "profile.h"
+#include "timer.h"
+#include "ktime.h"
+#include "smp.h"
+#include "lapic.h"
+#include "idt.h"
+#include "percpu.h"
+#include "paging.h"
+#include "serial.h"
+#include "string.h"
+#include "kprintf.h"
+#include "io.h"
+#include "debug.h"
+
+/* Linker-provided symbols: the kernel code */
+extern char kernel_ro_start[];
+extern char kernel_text_end[];
+
+/* Per-CPU profile */
+struct profile_cpu {
+    unsigned int* buckets;       /* EIP histogram */
+    unsigned int* chain;         /* Call-chain records */
+    unsigned int chain_used;     /* Words used in `chain` */
+    unsigned int samples;
+    unsigned int outside;
+    unsigned int chains;
+    unsigned int chain_dropped;
+} __cacheline_aligned;
+
+static struct profile_cpu profile_cpus[NR_CPUS];
+
+static volatile int running = 0;
+static unsigned int profile_hz = 0;
+static unsigned int profile_flags = 0;
+static unsigned int period_ns = 0;
+static unsigned int text_start = 0;
+static unsigned int text_size = 0;
+static unsigned int bucket_count = 0;
+static int vector_installed = 0;
+
+static struct timer sample_timer;
+static struct timer stop_timer;
+static volatile int dump_requested = 0;
+
+/* ============================================================================
+ * Sampling (interrupt context)
+ * ============================================================================
+ */
+
+/* Check that a frame-pointer slot can be read without faulting */
+static int profile_frame_ok(unsigned int fp, unsigned int stack_lo) {
+    if ((fp & 3) || fp < stack_lo || fp > stack_lo + PROFILE_STACK_LIMIT - 8) {
+        return 0;
+    }
+    return paging_virt_to_phys(fp) != 0 && paging_virt_to_phys(fp + 4) != 0;
+}
+
+/* Record the interrupted EIP and the return addresses found by walking
+ * the saved frame pointers */
+static void profile_callchain(struct profile_cpu* pc, const struct trap_frame* frame) {
+    unsigned int chain[PROFILE_MAX_DEPTH];
+    unsigned int depth = 0;
+
+    chain[depth++] = frame->eip;
+
+    /* Kernel-mode interrupt: no stack switch, so the interrupted stack
+     * pointer is just above the EIP/CS/EFLAGS the CPU pushed */
+    if (!(frame->cs & 3)) {
+        unsigned int stack_lo = (unsigned int)&frame->user_esp;
+        unsigned int fp = frame->ebp;
+
+        while (depth < PROFILE_MAX_DEPTH && profile_frame_ok(fp, stack_lo)) {
+            const unsigned int* words = (const unsigned int*)fp;
+            unsigned int ret = words[1];
+
+            /* Without frame pointers EBP is just another register:
+             * stop at anything that does not look like a frame */
+            if (ret - text_start >= text_size) {
+                break;
+            }
+            chain[depth++] = ret;
+            if (words[0] <= fp) {
+                break;
+            }
+            fp = words[0];
+        }
+    }
+
+    if (pc->chain_used + depth + 1 > PROFILE_CHAIN_WORDS) {
+        pc->chain_dropped++;
+        return;
+    }
+    pc->chain[pc->chain_used++] = depth;
+    for (unsigned int i = 0; i < depth; i++) {
+        pc->chain[pc->chain_used++] = chain[i];
+    }
+    pc->chains++;
+}
+
+/* Take one sample of the calling CPU from an interrupt frame */
+static void profile_sample(const struct trap_frame* frame) {
+    struct profile_cpu* pc = &profile_cpus[smp_processor_id()];
+    unsigned int offset;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE) || pc->buckets == 0) {
+        return;
+    }
+
+    pc->samples++;
+    offset = frame->eip - text_start;
+    if (offset < text_size) {
+        pc->buckets[offset >> PROFILE_SHIFT]++;
+    } else {
+        pc->outside++;
+    }
+
+    if ((profile_flags & PROFILE_CALLCHAIN) && pc->chain != 0) {
+        profile_callchain(pc, frame);
+    }
+}
+
+/* PROFILE_VECTOR handler: sample this CPU */
+static void profile_ipi_handler(struct trap_frame* frame) {
+    profile_sample(frame);
+    lapic_eoi();
+}
+
+/* Sampling timer (boot CPU): sample here, kick the others, re-arm */
+static void profile_timer_fn(struct timer* timer, void* data) {
+    struct trap_frame* frame = this_cpu()->irq_frame;
+    unsigned long long next = timer->expires + period_ns;
+    unsigned long long now;
+
+    (void)data;
+
+    if (!running) {
+        return;
+    }
+    if (frame != 0) {
+        profile_sample(frame);
+    }
+    if (smp_num_cpus() > 1) {
+        lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_FIXED |
+                          LAPIC_ICR_ASSERT | PROFILE_VECTOR);
+    }
+
+    /* Skip missed periods rather than firing back to back */
+    now = ktime_get_ns();
+    if (next <= now) {
+        next = now + period_ns;
+    }
+    timer_add(timer, next);
+}
+
+/* ============================================================================
+ * Control
+ * ============================================================================
+ */
+
+/* Start sampling every online CPU */
+int profile_start(unsigned int hz, unsigned int flags) {
+    unsigned int cpus = 0;
+
+    profile_stop();
+
+    if (hz == 0) {
+        hz = PROFILE_HZ;
+    }
+    if (hz > 10000) {
+        hz = 10000;
+    }
+
+    text_start = (unsigned int)kernel_ro_start;
+    text_size = (unsigned int)kernel_text_end - text_start;
+    bucket_count = (text_size + (1u << PROFILE_SHIFT) - 1) >> PROFILE_SHIFT;
+
+    /* Buffers for every online CPU, cleared */
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        struct profile_cpu* pc = &profile_cpus[i];
+
+        if (!percpu_areas[i].online) {
+            continue;
+        }
+        if (pc->buckets == 0) {
+            pc->buckets = vmalloc(bucket_count * sizeof(unsigned int));
+        }
+        if ((flags & PROFILE_CALLCHAIN) && pc->chain == 0) {
+            pc->chain = vmalloc(PROFILE_CHAIN_WORDS * sizeof(unsigned int));
+        }
+        if (pc->buckets == 0 || ((flags & PROFILE_CALLCHAIN) && pc->chain == 0)) {
+            debug_error("profile: out of memory for sample buffers");
+            return -1;
+        }
+        memset(pc->buckets, 0, bucket_count * sizeof(unsigned int));
+        pc->chain_used = 0;
+        pc->samples = 0;
+        pc->outside = 0;
+        pc->chains = 0;
+        pc->chain_dropped = 0;
+        cpus++;
+    }
+
+    if (!vector_installed) {
+        idt_set_handler(PROFILE_VECTOR, profile_ipi_handler);
+        timer_setup(&sample_timer, profile_timer_fn, 0);
+        vector_installed = 1;
+    }
+
+    profile_hz = hz;
+    profile_flags = flags;
+    period_ns = NSEC_PER_SEC / hz;
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    timer_add(&sample_timer, ktime_get_ns() + period_ns);
+
+    debug_logf(LOG_INFO, "profile: sampling %u CPU(s) at %u Hz, %u buckets of %u bytes%s",
+               cpus, hz, bucket_count, 1u << PROFILE_SHIFT,
+               (flags & PROFILE_CALLCHAIN) ? ", call chains" : "");
+    return 0;
+}
+
+/* Stop sampling */
+void profile_stop(void) {
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    if (vector_installed) {
+        timer_cancel(&sample_timer);
+    }
+}
+
+/* End of a timed run: stop now, dump from the idle loop */
+static void profile_stop_timer_fn(struct timer* timer, void* data) {
+    (void)timer;
+    (void)data;
+
+    profile_stop();
+    dump_requested = 1;
+}
+
+/* Stop and dump after `ms` milliseconds */
+void profile_stop_after(unsigned int ms) {
+    timer_cancel(&stop_timer);
+    timer_setup(&stop_timer, profile_stop_timer_fn, 0);
+    timer_add(&stop_timer, ktime_get_ns() + (unsigned long long)ms * NSEC_PER_MSEC);
+}
+
+/* Run a dump requested by profile_stop_after() */
+void profile_poll(void) {
+    if (dump_requested) {
+        dump_requested = 0;
+        profile_dump();
+    }
+}
+
+/* ============================================================================
+ * Dump
+ * ============================================================================
+ */
+
+/* Words are staged in a small buffer and written out with serial_write */
+struct profile_writer {
+    unsigned int buffer[64];
+    unsigned int used;
+    unsigned int sum;
+};
+
+static void profile_flush(struct profile_writer* w) {
+    serial_write(w->buffer, w->used * sizeof(unsigned int));
+    w->used = 0;
+}
+
+static void profile_put(struct profile_writer* w, unsigned int word) {
+    w->buffer[w->used++] = word;
+    w->sum += word;
+    if (w->used == sizeof(w->buffer) / sizeof(w->buffer[0])) {
+        profile_flush(w);
+    }
+}
+
+/* Nonzero buckets of one CPU */
+static unsigned int profile_nonzero(const struct profile_cpu* pc) {
+    unsigned int count = 0;
+
+    for (unsigned int b = 0; b < bucket_count; b++) {
+        count += pc->buckets[b] != 0;
+    }
+    return count;
+}
+
+/* Write the profile over serial */
+void profile_dump(void) {
+    struct profile_writer w;
+    unsigned int words = 8 + 1;
+    unsigned int cpus = 0;
+    unsigned int samples = 0;
+    char line[64];
+
+    if (running) {
+        profile_stop();
+    }
+
+    /* Size first: the framing line carries the byte count */
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct profile_cpu* pc = &profile_cpus[i];
+        if (pc->buckets == 0) {
+            continue;
+        }
+        words += 6 + 2 * profile_nonzero(pc) + pc->chain_used;
+        samples += pc->samples;
+        cpus++;
+    }
+
+    ksnprintf(line, sizeof(line), "# profile v%u binary %u\n", PROFILE_VERSION, words * 4);
+    serial_puts(line);
+
+    w.used = 0;
+    w.sum = 0;
+    profile_put(&w, PROFILE_MAGIC);
+    profile_put(&w, PROFILE_VERSION);
+    profile_put(&w, profile_hz);
+    profile_put(&w, PROFILE_SHIFT);
+    profile_put(&w, text_start);
+    profile_put(&w, bucket_count);
+    profile_put(&w, cpus);
+    profile_put(&w, profile_flags);
+
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct profile_cpu* pc = &profile_cpus[i];
+        if (pc->buckets == 0) {
+            continue;
+        }
+        profile_put(&w, i);
+        profile_put(&w, pc->samples);
+        profile_put(&w, pc->outside);
+        profile_put(&w, pc->chain_dropped);
+        profile_put(&w, profile_nonzero(pc));
+        for (unsigned int b = 0; b < bucket_count; b++) {
+            if (pc->buckets[b] != 0) {
+                profile_put(&w, b);
+                profile_put(&w, pc->buckets[b]);
+            }
+        }
+        profile_put(&w, pc->chain_used);
+        for (unsigned int k = 0; k < pc->chain_used; k++) {
+            profile_put(&w, pc->chain[k]);
+        }
+    }
+
+    profile_put(&w, w.sum);
+    profile_flush(&w);
+    serial_puts("\n# end profile\n");
+
+    debug_logf(LOG_INFO, "profile: dumped %u samples from %u CPU(s), %u bytes",
+               samples, cpus, words * 4);
+}
+
+/* Get a snapshot of the profiler statistics */
+void profile_get_stats(struct profile_stats* stats) {
+    stats->running = running;
+    stats->hz = profile_hz;
+    stats->flags = profile_flags;
+    stats->samples = 0;
+    stats->outside = 0;
+    stats->chains = 0;
+    stats->chain_dropped = 0;
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct profile_cpu* pc = &profile_cpus[i];
+        stats->samples += pc->samples;
+        stats->outside += pc->outside;
+        stats->chains += pc->chains;
+        stats->chain_dropped += pc->chain_dropped;
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * Sampling Profiler Header
+ *
+ * A statistical profiler driven by the timer interrupt. While it runs, a
+ * timer on the boot CPU fires PROFILE_HZ times a second; its callback
+ * samples the boot CPU from the interrupted trap frame and sends the
+ * PROFILE_VECTOR IPI to the other CPUs, which sample themselves.
+ *
+ * Every CPU has its own buffers, so sampling takes no lock:
+ *   - EIP buckets: one counter per 2^PROFILE_SHIFT bytes of kernel text
+ *     (kernel_ro_start..kernel_text_end); samples elsewhere are counted
+ *     as "outside"
+ *   - optionally (PROFILE_CALLCHAIN) a buffer of call chains found by
+ *     walking the saved frame pointers; it only finds callers in code
+ *     built with frame pointers (make CONFIG_FRAME_POINTER=1)
+ *
+ * profile_dump() writes everything as one binary record over serial,
+ * framed by text lines so it can be cut out of a log:
+ *
+ *   # profile v1 binary <bytes>
+ *   <bytes of little-endian 32-bit words>
+ *   # end profile
+ *
+ * Words: header { PROFILE_MAGIC, version, hz, shift, text_start,
+ * buckets, cpus, flags }, then per CPU { cpu, samples, outside,
+ * chain_dropped, nonzero buckets N, N x { bucket, count }, chain words W,
+ * W words of records { depth, eip, return addresses... } }, and finally
+ * the sum of all preceding words. profile.py symbolizes it against
+ * build/kernel.bin.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Default sampling rate (prime, so it does not beat against 1 ms timers) */
+#define PROFILE_HZ          997
+
+/* EIP bucket width: 2^PROFILE_SHIFT bytes */
+#define PROFILE_SHIFT       2
+
+/* Deepest call chain recorded (including the interrupted EIP) */
+#define PROFILE_MAX_DEPTH   16
+
+/* Per-CPU call-chain buffer size in 32-bit words */
+#define PROFILE_CHAIN_WORDS 16384
+
+/* How far above the interrupted stack pointer frames may lie */
+#define PROFILE_STACK_LIMIT 16384
+
+/* IPI that makes the other CPUs take a sample */
+#define PROFILE_VECTOR      0xF1
+
+/* Binary record magic ("ZKPF") and version */
+#define PROFILE_MAGIC       0x46504B5Au
+#define PROFILE_VERSION     1
+
+/* profile_start() flags */
+#define PROFILE_CALLCHAIN   0x01  /* Also record frame-pointer call chains */
+
+/* Profiler statistics (sums over all CPUs) */
+struct profile_stats {
+    unsigned int running;
+    unsigned int hz;
+    unsigned int flags;
+    unsigned int samples;
+    unsigned int outside;        /* Samples outside the kernel text */
+    unsigned int chains;         /* Call chains recorded */
+    unsigned int chain_dropped;  /* Call chains lost to a full buffer */
+};
+
+/* Start sampling every online CPU at `hz` (0 = PROFILE_HZ); clears the
+ * previous profile. Returns 0, or -1 if the buffers cannot be allocated. */
+int profile_start(unsigned int hz, unsigned int flags);
+
+/* Stop sampling (the profile is kept until the next start) */
+void profile_stop(void);
+
+/* Write the profile over serial (call from thread context) */
+void profile_dump(void);
+
+/* Stop and dump after `ms` milliseconds: the dump itself runs from
+ * profile_poll() in the idle loop */
+void profile_stop_after(unsigned int ms);
+
+/* Run a dump requested by profile_stop_after() (idle loop) */
+void profile_poll(void);
+
+/* Get a snapshot of the profiler statistics */
+void profile_get_stats(struct profile_stats* stats);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Symbolize a kernel profile dumped over serial (see profile.h).
+
+Usage:
+    profile.py build/kernel.bin serial.log [--folded FILE] [--top N] [--cpu N]
+
+Finds the last "# profile v1 binary <bytes>" record in the serial log,
+checks it, maps the EIP buckets and call chains to functions using the
+kernel's symbols (nm) and prints a flat profile. With --folded it also
+writes folded stacks ("outer;inner count" per line) for flamegraph.pl
+or speedscope; without recorded call chains each stack is just the
+sampled function.
+"""
+
+import argparse
+import bisect
+import collections
+import re
+import struct
+import subprocess
+import sys
+
+PROFILE_MAGIC = 0x46504B5A
+PROFILE_VERSION = 1
+
+
+def load_symbols(kernel):
+    """Sorted (address, name) list of the kernel's code symbols."""
+    out = subprocess.run(["nm", "-n", "--defined-only", kernel],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            symbols.append((int(fields[0], 16), fields[2]))
+    return symbols
+
+
+class Symbolizer:
+    def __init__(self, symbols):
+        self.addresses = [address for address, _ in symbols]
+        self.names = [name for _, name in symbols]
+
+    def __call__(self, address):
+        i = bisect.bisect_right(self.addresses, address) - 1
+        if i < 0:
+            return "0x%08x" % address
+        return self.names[i]
+
+
+def read_record(log):
+    """Words of the last complete profile record in the log."""
+    data = open(log, "rb").read()
+    matches = list(re.finditer(rb"# profile v(\d+) binary (\d+)\r?\n", data))
+    if not matches:
+        sys.exit("profile.py: no profile record in %s" % log)
+    match = matches[-1]
+    if int(match.group(1)) != PROFILE_VERSION:
+        sys.exit("profile.py: unsupported profile version %s" % match.group(1).decode())
+    size = int(match.group(2))
+    blob = data[match.end():match.end() + size]
+    if len(blob) != size or size % 4 != 0:
+        sys.exit("profile.py: truncated profile record (%d of %d bytes)" % (len(blob), size))
+    words = struct.unpack("<%dI" % (size // 4), blob)
+    if words[0] != PROFILE_MAGIC:
+        sys.exit("profile.py: bad profile magic 0x%08x" % words[0])
+    if sum(words[:-1]) & 0xFFFFFFFF != words[-1]:
+        sys.exit("profile.py: profile checksum mismatch (serial data corrupted)")
+    return words
+
+
+def parse(words):
+    """Header dict and a list of per-CPU dicts."""
+    keys = ("magic", "version", "hz", "shift", "text_start", "buckets", "cpus", "flags")
+    header = dict(zip(keys, words[:8]))
+    pos = 8
+    cpus = []
+    for _ in range(header["cpus"]):
+        cpu = dict(zip(("cpu", "samples", "outside", "chain_dropped"), words[pos:pos + 4]))
+        nonzero = words[pos + 4]
+        pos += 5
+        cpu["buckets"] = {words[pos + 2 * i]: words[pos + 2 * i + 1] for i in range(nonzero)}
+        pos += 2 * nonzero
+        chain_words = words[pos]
+        pos += 1
+        chain = words[pos:pos + chain_words]
+        pos += chain_words
+        cpu["chains"] = []
+        k = 0
+        while k < len(chain):
+            depth = chain[k]
+            cpu["chains"].append(chain[k + 1:k + 1 + depth])
+            k += 1 + depth
+        cpus.append(cpu)
+    return header, cpus
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("kernel", help="kernel ELF with symbols (build/kernel.bin)")
+    parser.add_argument("log", help="serial log containing a profile record")
+    parser.add_argument("--folded", metavar="FILE", help="write folded stacks to FILE")
+    parser.add_argument("--top", type=int, default=30, help="functions to list (default 30)")
+    parser.add_argument("--cpu", type=int, help="only this CPU")
+    args = parser.parse_args()
+
+    symbolize = Symbolizer(load_symbols(args.kernel))
+    header, cpus = parse(read_record(args.log))
+    if args.cpu is not None:
+        cpus = [cpu for cpu in cpus if cpu["cpu"] == args.cpu]
+
+    flat = collections.Counter()
+    samples = outside = dropped = 0
+    for cpu in cpus:
+        samples += cpu["samples"]
+        outside += cpu["outside"]
+        dropped += cpu["chain_dropped"]
+        for bucket, count in cpu["buckets"].items():
+            flat[symbolize(header["text_start"] + (bucket << header["shift"]))] += count
+
+    print("%d samples at %d Hz on %d CPU(s), %d outside the kernel text"
+          % (samples, header["hz"], len(cpus), outside))
+    print()
+    print("%7s %8s  %s" % ("%", "samples", "function"))
+    for name, count in flat.most_common(args.top):
+        print("%6.2f%% %8d  %s" % (100.0 * count / max(samples, 1), count, name))
+
+    if args.folded:
+        folded = collections.Counter()
+        chains = [chain for cpu in cpus for chain in cpu["chains"]]
+        if chains:
+            for chain in chains:
+                # Return addresses point after the call: look up the call itself
+                frames = [symbolize(chain[0])] + [symbolize(ret - 1) for ret in chain[1:]]
+                folded[";".join(reversed(frames))] += 1
+        else:
+            folded = flat
+        with open(args.folded, "w") as out:
+            for stack, count in sorted(folded.items()):
+                out.write("%s %d\n" % (stack, count))
+        print()
+        print("%d folded stacks written to %s%s" % (len(folded), args.folded,
+              " (%d call chains dropped)" % dropped if dropped else ""))
+
+
+if __name__ == "__main__":
+    main()
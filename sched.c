@@ -0,0 +1,692 @@
+/*
+ * Kernel Threads and Scheduler Implementation
+ *
+ * All scheduler state belongs to the boot CPU and is only touched with
+ * interrupts disabled there, which is the whole locking story until the
+ * scheduler goes SMP. sched_switch() is the one place that changes the
+ * running thread; everything else (yield, sleep, wait queues, preemption
+ * at interrupt exit) decides what state the current thread is left in and
+ * calls it.
+ */
+
+#include "sched.h"
+#include "slab.h"
+#include "paging.h"
+#include "ktime.h"
+#include "idt.h"
+#include "softirq.h"
+#include "bench.h"
+#include "profile.h"
+#include "math64.h"
+#include "kprintf.h"
+#include "cpu.h"
+#include "debug.h"
+
+/* sched_asm.c */
+extern struct thread* sched_switch_to(struct thread* prev, struct thread* next);
+extern void sched_thread_entry(void);
+void sched_thread_start(struct thread* prev);
+
+_Static_assert(__builtin_offsetof(struct thread, esp) == 0, "sched_asm.c expects esp first");
+
+/* Ready threads, one FIFO per priority, and the bitmap of non-empty ones */
+struct runqueue {
+    unsigned int bitmap;
+    struct thread* head[SCHED_PRIORITIES];
+    struct thread* tail[SCHED_PRIORITIES];
+    unsigned int nr_ready;
+    struct thread* current;
+    struct thread* idle;
+    volatile unsigned int need_resched;
+    unsigned long long slice_ns;
+    struct timer slice_timer;
+};
+
+static struct runqueue rq;
+static struct thread boot_thread;
+static struct thread* all_threads = 0;
+static struct thread* zombies = 0;
+static struct kmem_cache* thread_cache = 0;
+static unsigned int next_id = 0;
+static int sched_running = 0;
+static struct sched_stats stats;
+
+static const char* const state_names[] = { "running", "ready", "blocked", "dead" };
+
+/* ============================================================================
+ * Run Queues
+ * ============================================================================
+ */
+
+static void rq_enqueue(struct thread* t) {
+    unsigned int prio = t->priority;
+
+    t->next = 0;
+    if (rq.tail[prio] != 0) {
+        rq.tail[prio]->next = t;
+    } else {
+        rq.head[prio] = t;
+    }
+    rq.tail[prio] = t;
+    rq.bitmap |= 1u << prio;
+    rq.nr_ready++;
+}
+
+/* Take the first thread of the highest non-empty priority */
+static struct thread* rq_dequeue(void) {
+    unsigned int prio = __builtin_ctz(rq.bitmap);
+    struct thread* t = rq.head[prio];
+
+    rq.head[prio] = t->next;
+    if (rq.head[prio] == 0) {
+        rq.tail[prio] = 0;
+        rq.bitmap &= ~(1u << prio);
+    }
+    t->next = 0;
+    rq.nr_ready--;
+    return t;
+}
+
+/* Check for a ready thread of priority `prio` or better */
+static int rq_has_ready(unsigned int prio) {
+    return (rq.bitmap & ((2u << prio) - 1)) != 0;
+}
+
+/* ============================================================================
+ * Switching
+ * ============================================================================
+ */
+
+/* A timeslice ran out: preempt if someone else of this priority waits */
+static void sched_slice_fn(struct timer* timer, void* data) {
+    (void)data;
+
+    if (rq.current == rq.idle) {
+        return;
+    }
+    if (rq_has_ready(rq.current->priority)) {
+        rq.need_resched = 1;
+        stats.slice_expiries++;
+    } else {
+        timer_add(timer, ktime_get_ns() + rq.slice_ns);
+    }
+}
+
+/* Dead threads are freed later, off their own stack */
+static void sched_finish(struct thread* prev) {
+    if (prev->state == THREAD_DEAD) {
+        prev->next = zombies;
+        zombies = prev;
+    }
+}
+
+/* Run the best ready thread; the current one is queued again if it is
+ * still runnable. Interrupts must be disabled. */
+static void sched_switch(void) {
+    struct thread* prev = rq.current;
+    struct thread* next;
+    unsigned long long now = ktime_get_ns();
+
+    rq.need_resched = 0;
+    prev->runtime_ns += now - prev->last_run_ns;
+    prev->last_run_ns = now;
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        rq_enqueue(prev);
+    }
+
+    next = rq_dequeue();
+    next->state = THREAD_RUNNING;
+    if (next == rq.idle) {
+        timer_cancel(&rq.slice_timer);
+    } else {
+        timer_mod(&rq.slice_timer, now + rq.slice_ns);
+    }
+    if (next == prev) {
+        return;
+    }
+
+    if (prev->state == THREAD_READY) {
+        prev->preemptions++;
+    }
+    next->last_run_ns = now;
+    next->switches++;
+    stats.switches++;
+    rq.current = next;
+    fpu_switch(&next->fpu);
+
+    /* Entries from ring 3 (user tasks) land on top of the thread's stack */
+    if (next->stack != 0) {
+        this_cpu()->tss.esp0 = (unsigned int)next->stack + THREAD_STACK_SIZE;
+    }
+
+    prev = sched_switch_to(prev, next);
+    sched_finish(prev);
+}
+
+/* Make a blocked thread ready. Interrupts must be disabled. */
+static int sched_wake(struct thread* t) {
+    if (t->state != THREAD_BLOCKED) {
+        return 0;
+    }
+    t->state = THREAD_READY;
+    t->wait = 0;
+    rq_enqueue(t);
+    stats.wakeups++;
+    if (t->priority < rq.current->priority) {
+        rq.need_resched = 1;
+    }
+    return 1;
+}
+
+/* After a wakeup: switch now if that is due and allowed (`flags` are
+ * the caller's interrupt state; interrupt context switches on exit) */
+static void sched_resched_from(unsigned int flags) {
+    if (rq.need_resched && (flags & EFLAGS_IF) && !in_interrupt() &&
+        this_cpu()->preempt_count == 0) {
+        sched_switch();
+    }
+}
+
+/* Check whether the calling code can block in the scheduler */
+static int sched_can_block(void) {
+    return sched_running && smp_processor_id() == 0;
+}
+
+/* Switch if one is due */
+void schedule(void) {
+    unsigned int flags;
+
+    if (!sched_can_block()) {
+        return;
+    }
+    flags = irq_save();
+    if (rq.need_resched) {
+        sched_switch();
+    }
+    irq_restore(flags);
+}
+
+/* Check whether a switch is pending on this CPU */
+int sched_need_resched(void) {
+    return sched_running && rq.need_resched && smp_processor_id() == 0;
+}
+
+/* Leaving the outermost interrupt handler with interrupts disabled */
+int sched_irq_exit(const struct trap_frame* frame) {
+    if (!sched_need_resched() || this_cpu()->preempt_count != 0 ||
+        !(frame->eflags & EFLAGS_IF)) {
+        return 0;
+    }
+    stats.preemptions++;
+    sched_switch();
+    return 1;
+}
+
+/* ============================================================================
+ * Threads
+ * ============================================================================
+ */
+
+/* Fill in a thread's bookkeeping; it starts blocked */
+static void thread_setup(struct thread* t, const char* name, unsigned int priority) {
+    unsigned int i;
+
+    t->id = next_id++;
+    t->state = THREAD_BLOCKED;
+    t->priority = priority;
+    t->next = 0;
+    t->wait = 0;
+    t->stack = 0;
+    t->fn = 0;
+    t->arg = 0;
+    t->runtime_ns = 0;
+    t->last_run_ns = 0;
+    t->switches = 0;
+    t->preemptions = 0;
+    for (i = 0; i < THREAD_NAME_LEN - 1 && name[i] != '\0'; i++) {
+        t->name[i] = name[i];
+    }
+    t->name[i] = '\0';
+    fpu_context_init(&t->fpu);
+}
+
+/* First code run by a new thread (from sched_thread_entry) */
+void sched_thread_start(struct thread* prev) {
+    struct thread* self = rq.current;
+
+    sched_finish(prev);
+    __asm__ volatile ("sti");
+    self->fn(self->arg);
+    thread_exit();
+}
+
+/* Free the threads that have exited */
+static void sched_reap(void) {
+    unsigned int flags = irq_save();
+    struct thread* list = zombies;
+
+    zombies = 0;
+    irq_restore(flags);
+
+    while (list != 0) {
+        struct thread* t = list;
+        list = t->next;
+        vfree(t->stack);
+        kmem_cache_free(thread_cache, t);
+    }
+}
+
+/* Create a thread at any priority, the idle one included */
+static struct thread* thread_spawn(const char* name, thread_fn_t fn, void* arg, unsigned int priority) {
+    struct thread* t;
+    unsigned int* sp;
+    unsigned int flags;
+
+    sched_reap();
+
+    t = kmem_cache_alloc(thread_cache);
+    if (t == 0) {
+        return 0;
+    }
+    thread_setup(t, name, priority);
+    t->stack = vmalloc(THREAD_STACK_SIZE);
+    if (t->stack == 0) {
+        kmem_cache_free(thread_cache, t);
+        return 0;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    timer_setup(&t->sleep_timer, 0, 0);
+
+    /* Look like a thread that switched out: EBP, EBX, ESI, EDI and a
+     * return into sched_thread_entry */
+    sp = (unsigned int*)((char*)t->stack + THREAD_STACK_SIZE);
+    *--sp = (unsigned int)sched_thread_entry;
+    for (unsigned int i = 0; i < 4; i++) {
+        *--sp = 0;
+    }
+    t->esp = (unsigned int)sp;
+
+    flags = irq_save();
+    t->all_next = all_threads;
+    all_threads = t;
+    stats.threads++;
+    sched_wake(t);
+    sched_resched_from(flags);
+    irq_restore(flags);
+    return t;
+}
+
+/* Start a thread running fn(arg) */
+struct thread* thread_create(const char* name, thread_fn_t fn, void* arg, unsigned int priority) {
+    if (!sched_running) {
+        return 0;
+    }
+    if (priority >= SCHED_PRIO_IDLE) {
+        priority = SCHED_PRIO_IDLE - 1;
+    }
+    return thread_spawn(name, fn, arg, priority);
+}
+
+/* The calling thread */
+struct thread* thread_current(void) {
+    return rq.current;
+}
+
+/* Give the CPU to another ready thread of the same or higher priority */
+void thread_yield(void) {
+    unsigned int flags;
+
+    if (!sched_can_block()) {
+        return;
+    }
+    flags = irq_save();
+    sched_switch();
+    irq_restore(flags);
+}
+
+/* Sleep timer: wake the thread */
+static void sched_sleep_fn(struct timer* timer, void* data) {
+    (void)timer;
+    sched_wake(data);
+}
+
+/* Block for at least `ns` nanoseconds */
+void thread_sleep(unsigned long long ns) {
+    unsigned long long deadline = ktime_get_ns() + ns;
+    struct thread* self;
+    unsigned int flags;
+
+    if (!sched_can_block()) {
+        /* No scheduler here: wait for interrupts until the time is up */
+        while (ktime_get_ns() < deadline) {
+            __asm__ volatile ("sti; hlt");
+        }
+        return;
+    }
+
+    flags = irq_save();
+    self = rq.current;
+    timer_setup(&self->sleep_timer, sched_sleep_fn, self);
+    timer_add(&self->sleep_timer, deadline);
+    self->state = THREAD_BLOCKED;
+    sched_switch();
+    irq_restore(flags);
+}
+
+/* End the calling thread */
+void thread_exit(void) {
+    struct thread* self;
+    struct thread** link;
+
+    irq_save();
+    self = rq.current;
+    for (link = &all_threads; *link != 0; link = &(*link)->all_next) {
+        if (*link == self) {
+            *link = self->all_next;
+            break;
+        }
+    }
+    timer_cancel(&self->sleep_timer);
+    fpu_release(&self->fpu);
+    stats.threads--;
+    self->state = THREAD_DEAD;
+    sched_switch();
+
+    /* Not reached: a dead thread is never picked again */
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+/* Idle loop: free exited threads, run the bottom halves a budgeted run
+ * left over, write out log records queued by interrupt handlers and a
+ * profile whose timed run has ended, then wait for an interrupt */
+static void __attribute__((noreturn)) sched_idle_loop(void) {
+    for (;;) {
+        sched_reap();
+        softirq_idle();
+        debug_flush_log();
+        profile_poll();
+
+        /* Halt only if no record or softirq slipped in after the flush
+         * ("sti; hlt" cannot be interrupted in between) */
+        __asm__ volatile ("cli");
+        if (debug_log_pending() || softirq_pending()) {
+            __asm__ volatile ("sti");
+        } else {
+            __asm__ volatile ("sti; hlt");
+        }
+    }
+}
+
+static void sched_idle_fn(void* arg) {
+    (void)arg;
+    sched_idle_loop();
+}
+
+/* Boot is done: the boot thread blocks for good, the idle thread takes
+ * over its idle duties */
+void sched_idle_handoff(void) {
+    if (!sched_can_block()) {
+        sched_idle_loop();
+    }
+
+    irq_save();
+    rq.current->state = THREAD_BLOCKED;
+    sched_switch();
+
+    /* Not reached: nothing wakes the boot thread */
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+/* ============================================================================
+ * Wait Queues
+ * ============================================================================
+ */
+
+/* Block the calling thread on `wq` (interrupts disabled) */
+void wait_sleep(struct wait_queue* wq) {
+    struct thread* self;
+
+    if (!sched_can_block()) {
+        /* No scheduler: let an interrupt change the condition */
+        __asm__ volatile ("sti; hlt; cli");
+        return;
+    }
+
+    self = rq.current;
+    self->state = THREAD_BLOCKED;
+    self->wait = wq;
+    self->next = 0;
+    if (wq->tail != 0) {
+        wq->tail->next = self;
+    } else {
+        wq->head = self;
+    }
+    wq->tail = self;
+    sched_switch();
+}
+
+/* Wake up to `max` threads from the head of `wq` */
+static unsigned int wait_wake(struct wait_queue* wq, unsigned int max) {
+    unsigned int flags = irq_save();
+    unsigned int woken = 0;
+
+    while (woken < max && wq->head != 0) {
+        struct thread* t = wq->head;
+        wq->head = t->next;
+        if (wq->head == 0) {
+            wq->tail = 0;
+        }
+        woken += sched_wake(t);
+    }
+    sched_resched_from(flags);
+    irq_restore(flags);
+    return woken;
+}
+
+unsigned int wait_wake_one(struct wait_queue* wq) {
+    return wait_wake(wq, 1);
+}
+
+unsigned int wait_wake_all(struct wait_queue* wq) {
+    return wait_wake(wq, ~0u);
+}
+
+/* ============================================================================
+ * Ping-Pong
+ * ============================================================================
+ */
+
+/* Two threads hand a turn back and forth; each handoff is a wakeup plus
+ * a switch */
+struct pingpong {
+    struct wait_queue wait[2];
+    volatile unsigned int turn;
+    unsigned int rounds;
+    volatile unsigned int finished;
+    struct wait_queue done;
+    unsigned long long start_tsc;
+    unsigned long long end_tsc;
+};
+
+static struct pingpong pp;
+
+static void pingpong_fn(void* arg) {
+    unsigned int side = (unsigned int)arg;
+
+    /* "ping" already waits when "pong" starts: time from here */
+    if (side == 1) {
+        pp.start_tsc = rdtsc();
+    }
+    for (unsigned int i = 0; i < pp.rounds; i++) {
+        wait_event(&pp.wait[side], pp.turn == side);
+        pp.turn = !side;
+        wait_wake_one(&pp.wait[!side]);
+    }
+    if (side == 1) {
+        pp.end_tsc = rdtsc();
+    }
+    pp.finished++;
+    wait_wake_one(&pp.done);
+}
+
+/* Measure thread-to-thread switches */
+unsigned int sched_pingpong(unsigned int rounds) {
+    unsigned int khz = ktime_tsc_khz();
+    unsigned int switches = 2 * (rounds - 1);
+    unsigned int cycles;
+    unsigned int ns;
+
+    if (!sched_can_block() || rounds < 2) {
+        return 0;
+    }
+
+    wait_queue_init(&pp.wait[0]);
+    wait_queue_init(&pp.wait[1]);
+    wait_queue_init(&pp.done);
+    pp.turn = 0;
+    pp.rounds = rounds;
+    pp.finished = 0;
+
+    /* Above the caller, so it only gets the CPU back at the end */
+    if (thread_create("ping", pingpong_fn, (void*)0, SCHED_PRIO_DEFAULT - 1) == 0 ||
+        thread_create("pong", pingpong_fn, (void*)1, SCHED_PRIO_DEFAULT - 1) == 0) {
+        debug_error("sched: ping-pong threads not created");
+        return 0;
+    }
+    wait_event(&pp.done, pp.finished == 2);
+
+    cycles = (unsigned int)div_u64(pp.end_tsc - pp.start_tsc, switches);
+    ns = khz ? (unsigned int)div_u64((unsigned long long)cycles * 1000000, khz) : 0;
+    debug_logf(LOG_INFO, "sched: ping-pong %u switches, %u cycles (%u ns) per switch, %u switches/s",
+               switches, cycles, ns, ns ? 1000000000u / ns : 0);
+    return cycles;
+}
+
+/* Benchmark: one round trip (two switches) with a partner thread that
+ * stays parked between runs */
+static struct pingpong bench_pp;
+static struct thread* bench_partner = 0;
+
+static void bench_partner_fn(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        wait_event(&bench_pp.wait[1], bench_pp.turn == 1);
+        bench_pp.turn = 0;
+        wait_wake_one(&bench_pp.wait[0]);
+    }
+}
+
+static void sched_bench_prepare(void) {
+    if (bench_partner == 0) {
+        wait_queue_init(&bench_pp.wait[0]);
+        wait_queue_init(&bench_pp.wait[1]);
+        bench_pp.turn = 0;
+        bench_partner = thread_create("bench-pong", bench_partner_fn, 0,
+                                      thread_current()->priority);
+    }
+}
+
+static void sched_bench_roundtrip(void) {
+    unsigned int flags = irq_save();
+
+    bench_pp.turn = 1;
+    wait_wake_one(&bench_pp.wait[1]);
+    while (bench_pp.turn != 0) {
+        wait_sleep(&bench_pp.wait[0]);
+    }
+    irq_restore(flags);
+}
+
+static const struct bench sched_benches[] = {
+    { "sched_pingpong", sched_bench_roundtrip, sched_bench_prepare, 0, 0, 0, 0 },
+};
+
+/* ============================================================================
+ * Initialization and Statistics
+ * ============================================================================
+ */
+
+/* Adopt the boot code as thread "main" and start the idle thread */
+void sched_init(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), CACHE_LINE_SIZE);
+    if (thread_cache == 0) {
+        debug_error("sched: no thread cache");
+        return;
+    }
+
+    rq.slice_ns = (unsigned long long)CONFIG_SCHED_SLICE_MS * NSEC_PER_MSEC;
+    timer_setup(&rq.slice_timer, sched_slice_fn, 0);
+
+    thread_setup(&boot_thread, "main", SCHED_PRIO_DEFAULT);
+    timer_setup(&boot_thread.sleep_timer, 0, 0);
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.last_run_ns = ktime_get_ns();
+    boot_thread.switches = 1;
+    boot_thread.all_next = 0;
+    all_threads = &boot_thread;
+    stats.threads = 1;
+    rq.current = &boot_thread;
+    fpu_switch(&boot_thread.fpu);
+    sched_running = 1;
+
+    rq.idle = thread_spawn("idle", sched_idle_fn, 0, SCHED_PRIO_IDLE);
+    timer_add(&rq.slice_timer, ktime_get_ns() + rq.slice_ns);
+
+    if (bench_register(sched_benches, sizeof(sched_benches) / sizeof(sched_benches[0])) != 0) {
+        debug_warn("sched: benchmark table full");
+    }
+
+    debug_logf(LOG_INFO, "sched: %u priorities, %u ms timeslice, %u KB stacks",
+               SCHED_PRIORITIES, CONFIG_SCHED_SLICE_MS, THREAD_STACK_SIZE / 1024);
+}
+
+/* Set the timeslice in milliseconds */
+void sched_set_timeslice(unsigned int ms) {
+    unsigned int flags = irq_save();
+
+    rq.slice_ns = (unsigned long long)(ms ? ms : 1) * NSEC_PER_MSEC;
+    irq_restore(flags);
+}
+
+/* Get a snapshot of the scheduler statistics */
+void sched_get_stats(struct sched_stats* out) {
+    unsigned int flags = irq_save();
+
+    *out = stats;
+    out->ready = rq.nr_ready;
+    out->timeslice_ms = (unsigned int)div_u64(rq.slice_ns, NSEC_PER_MSEC);
+    irq_restore(flags);
+}
+
+/* Print the scheduler statistics and every thread */
+void sched_dump(void) {
+    struct sched_stats s;
+    unsigned long long now = ktime_get_ns();
+
+    sched_get_stats(&s);
+    kprintf("Scheduler: %u threads (%u ready), %u ms slice, %u switches, %u preemptions, %u slice expiries, %u wakeups\n",
+            s.threads, s.ready, s.timeslice_ms, s.switches, s.preemptions,
+            s.slice_expiries, s.wakeups);
+    kprintf("  %3s %-15s %4s %-8s %12s %8s %8s\n",
+            "id", "name", "prio", "state", "runtime_us", "switches", "preempt");
+
+    /* Threads are only created and freed by threads: no switch, no change */
+    preempt_disable();
+    for (struct thread* t = all_threads; t != 0; t = t->all_next) {
+        unsigned long long runtime = t->runtime_ns;
+        if (t == rq.current) {
+            runtime += now - t->last_run_ns;
+        }
+        kprintf("  %3u %-15s %4u %-8s %12u %8u %8u\n",
+                t->id, t->name, t->priority, state_names[t->state],
+                (unsigned int)div_u64(runtime, NSEC_PER_USEC), t->switches, t->preemptions);
+    }
+    preempt_enable();
+}
@@ -0,0 +1,193 @@
+/*
+ * Kernel Threads and Scheduler Header
+ *
+ * A kernel thread has its own stack (THREAD_STACK_SIZE bytes from
+ * vmalloc, so an overflow hits a guard page) and its own FPU context
+ * (fpu.h). Switching threads saves only the callee-saved registers and
+ * the stack pointer (sched_asm.c): everything else is already on the
+ * stack of the thread that called schedule().
+ *
+ * Ready threads wait in one FIFO run queue per priority (0 = highest,
+ * SCHED_PRIORITIES - 1 is reserved for the idle thread). A bitmap of the
+ * non-empty queues makes picking the next thread a single bit scan.
+ *
+ * Preemption: a thread runs for at most a timeslice (CONFIG_SCHED_SLICE_MS,
+ * or sched_set_timeslice()) while others of its priority are ready, and
+ * a wakeup of a higher-priority thread preempts at once. Both only set a
+ * flag in interrupt context; the switch happens on the way out of the
+ * outermost interrupt (interrupt_dispatch), unless preemption is disabled
+ * (preempt_disable(), or interrupts off).
+ *
+ * Threads block on wait queues (wait_event() / wait_wake_one()) or sleep
+ * for a time (thread_sleep()). Each thread accounts its run time.
+ *
+ * The scheduler runs on the boot CPU only, like the timer core it uses
+ * for timeslices and sleeps; application processors keep idling.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "fpu.h"
+#include "timer.h"
+#include "percpu.h"
+#include "io.h"
+
+/* Timeslice in milliseconds (override with make CONFIG_SCHED_SLICE_MS=n) */
+#ifndef CONFIG_SCHED_SLICE_MS
+#define CONFIG_SCHED_SLICE_MS 10
+#endif
+
+#define SCHED_PRIORITIES     32
+#define SCHED_PRIO_DEFAULT   16
+#define SCHED_PRIO_IDLE      (SCHED_PRIORITIES - 1)
+
+#define THREAD_STACK_SIZE    8192
+#define THREAD_NAME_LEN      16
+
+/* Thread states */
+#define THREAD_RUNNING       0
+#define THREAD_READY         1
+#define THREAD_BLOCKED       2
+#define THREAD_DEAD          3
+
+typedef void (*thread_fn_t)(void* arg);
+
+struct wait_queue;
+
+struct thread {
+    unsigned int esp;                 /* Saved stack pointer (must stay first: sched_asm.c) */
+    unsigned int id;
+    unsigned int state;
+    unsigned int priority;
+    struct thread* next;              /* Run queue or wait queue link */
+    struct thread* all_next;          /* List of all threads */
+    struct wait_queue* wait;          /* Queue the thread is blocked on */
+    void* stack;                      /* vmalloc'd stack (0 for the boot thread) */
+    thread_fn_t fn;
+    void* arg;
+    unsigned long long runtime_ns;    /* Time spent running */
+    unsigned long long last_run_ns;   /* When it was last switched in */
+    unsigned int switches;            /* Times switched in */
+    unsigned int preemptions;         /* Times switched out while still runnable */
+    struct timer sleep_timer;
+    char name[THREAD_NAME_LEN];
+    struct fpu fpu;
+};
+
+/* Threads blocked on an event, woken in FIFO order */
+struct wait_queue {
+    struct thread* head;
+    struct thread* tail;
+};
+
+#define WAIT_QUEUE_INIT { 0, 0 }
+
+/* Scheduler statistics */
+struct sched_stats {
+    unsigned int switches;            /* Context switches */
+    unsigned int preemptions;         /* ... forced at interrupt exit */
+    unsigned int slice_expiries;      /* Timeslices that ran out with others ready */
+    unsigned int wakeups;
+    unsigned int threads;             /* Threads alive, idle included */
+    unsigned int ready;               /* Threads in the run queues */
+    unsigned int timeslice_ms;
+};
+
+/* Adopt the running boot code as thread "main" and start the idle
+ * thread (after slab_init, paging_init and the timer core) */
+void sched_init(void);
+
+/* Boot is done: block thread "main" for good and leave the CPU to the
+ * idle thread, so every priority above idle can run. Without a scheduler
+ * the caller runs the idle loop itself. */
+void sched_idle_handoff(void) __attribute__((noreturn));
+
+/* Start a thread running fn(arg). Returns 0 when out of memory. */
+struct thread* thread_create(const char* name, thread_fn_t fn, void* arg, unsigned int priority);
+
+/* The calling thread */
+struct thread* thread_current(void);
+
+/* Give the CPU to another ready thread of the same or higher priority */
+void thread_yield(void);
+
+/* Block for at least `ns` nanoseconds */
+void thread_sleep(unsigned long long ns);
+
+/* End the calling thread (also what returning from its function does) */
+void thread_exit(void) __attribute__((noreturn));
+
+/* Switch to the highest-priority ready thread if it should run instead */
+void schedule(void);
+
+/* Set the timeslice in milliseconds */
+void sched_set_timeslice(unsigned int ms);
+
+/* Called by interrupt_dispatch when the outermost handler returns:
+ * preempts the interrupted thread if a switch is due. Returns 1 if it
+ * ran another thread before returning. */
+int sched_irq_exit(const struct trap_frame* frame);
+
+/* Check whether a switch is pending on this CPU */
+int sched_need_resched(void);
+
+/* Get a snapshot of the scheduler statistics */
+void sched_get_stats(struct sched_stats* stats);
+
+/* Print the scheduler statistics and every thread */
+void sched_dump(void);
+
+/* Measure thread-to-thread switches: two threads wake each other
+ * `rounds` times. Returns the average cycles per switch. */
+unsigned int sched_pingpong(unsigned int rounds);
+
+/* ============================================================================
+ * Wait Queues
+ * ============================================================================
+ */
+
+static inline void wait_queue_init(struct wait_queue* wq) {
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+/* Block the calling thread on `wq`. Interrupts must be disabled (so the
+ * condition checked before cannot change unseen); they are disabled
+ * again on return. */
+void wait_sleep(struct wait_queue* wq);
+
+/* Wake the first / every thread on `wq`; returns how many were woken */
+unsigned int wait_wake_one(struct wait_queue* wq);
+unsigned int wait_wake_all(struct wait_queue* wq);
+
+/* Block until `condition` holds; it is evaluated with interrupts off */
+#define wait_event(wq, condition)                   \
+    do {                                            \
+        unsigned int wait_flags_ = irq_save();      \
+        while (!(condition)) {                      \
+            wait_sleep(wq);                         \
+        }                                           \
+        irq_restore(wait_flags_);                   \
+    } while (0)
+
+/* ============================================================================
+ * Preemption Control
+ * ============================================================================
+ */
+
+/* Disable preemption (nests); the CPU still takes interrupts */
+static inline void preempt_disable(void) {
+    this_cpu()->preempt_count++;
+    __asm__ volatile ("" : : : "memory");
+}
+
+/* Re-enable preemption, switching now if one became due meanwhile */
+static inline void preempt_enable(void) {
+    __asm__ volatile ("" : : : "memory");
+    if (--this_cpu()->preempt_count == 0 && sched_need_resched() && irqs_enabled()) {
+        schedule();
+    }
+}
+
+#endif /* SCHED_H */
@@ -0,0 +1,51 @@
+/*
+ * Thread Switch (Assembly)
+ *
+ * struct thread* sched_switch_to(struct thread* prev, struct thread* next)
+ *
+ * Called from schedule() with interrupts disabled. The C calling
+ * convention lets a callee clobber EAX, ECX and EDX, so only EBX, ESI,
+ * EDI and EBP are pushed on the old stack before its ESP is stored in
+ * prev->esp; the new thread's ESP is loaded and the same registers popped.
+ * The `ret` then returns into whatever call of sched_switch_to the new
+ * thread made earlier, with EAX = prev (the thread switched away from).
+ *
+ * A new thread's stack is built by thread_create() to look like one that
+ * switched out: four zero registers and sched_thread_entry as the return
+ * address, which passes `prev` on to sched_thread_start().
+ */
+
+#include "sched.h"
+
+__asm__ (
+    ".text\n"
+    ".balign 16\n"
+    ".globl sched_switch_to\n"
+    ".type sched_switch_to, @function\n"
+    "sched_switch_to:\n"
+    "    movl 4(%esp), %eax\n"           /* prev */
+    "    movl 8(%esp), %edx\n"           /* next */
+    "    pushl %ebp\n"
+    "    pushl %ebx\n"
+    "    pushl %esi\n"
+    "    pushl %edi\n"
+    "    movl %esp, (%eax)\n"            /* prev->esp */
+    "    movl (%edx), %esp\n"            /* next->esp */
+    "    popl %edi\n"
+    "    popl %esi\n"
+    "    popl %ebx\n"
+    "    popl %ebp\n"
+    "    ret\n"
+    ".size sched_switch_to, . - sched_switch_to\n"
+
+    /* First switch into a new thread */
+    ".balign 16\n"
+    ".globl sched_thread_entry\n"
+    ".type sched_thread_entry, @function\n"
+    "sched_thread_entry:\n"
+    "    pushl %eax\n"                   /* prev */
+    "    call sched_thread_start\n"      /* Does not return */
+    "1:  hlt\n"
+    "    jmp 1b\n"
+    ".size sched_thread_entry, . - sched_thread_entry\n"
+);
@@ -3,59 +3,404 @@
  * 
  * This file implements serial port output functions.
  * COM1 is typically at I/O port 0x3F8.
+ *
+ * Output is staged in a TX ring buffer so that writers never spin on the
+ * line status register. The ring is drained either by the IRQ 4 handler
+ * (one 16-byte FIFO burst per THRE interrupt) or, before interrupts are
+ * available and in synchronous mode, by polling.
+ *
+ * Input is moved from the receive FIFO into an RX ring by the same
+ * handler, as many bytes as the UART holds per interrupt.
  */
 
 #include "serial.h"
+#include "spinlock.h"
+#include "io.h"
+#include "cpu.h"
+#include "irq.h"
+
+#define SERIAL_TX_RING_MASK (SERIAL_TX_RING_SIZE - 1)
+#define SERIAL_RX_RING_MASK (SERIAL_RX_RING_SIZE - 1)
+
+/* TX ring buffer: producers advance tx_head, the drainer advances tx_tail.
+ * Both indices run freely and are masked on access. The ring, the UART
+ * registers and the counters below belong to whoever holds serial_lock,
+ * which is taken with interrupts disabled (or from the IRQ 4 handler),
+ * so the ring is safe to use from any CPU and from IRQ context. */
+static volatile char tx_ring[SERIAL_TX_RING_SIZE];
+static volatile unsigned int tx_head = 0;
+static volatile unsigned int tx_tail = 0;
+
+static volatile int tx_irq_mode = 0;    /* Ring is drained by IRQ 4 */
+static volatile int tx_irq_armed = 0;   /* THRE interrupt currently enabled */
+static volatile int tx_sync = 0;        /* Synchronous (polled) output forced */
+static volatile int tx_lock_lost = 0;   /* Sync mode gave up on serial_lock */
+static unsigned char serial_ier = 0;    /* Shadow of the interrupt enable register */
+
+/* RX ring: the IRQ 4 handler owns rx_head, the reader owns rx_tail; each
+ * side publishes its index with a release store */
+static volatile unsigned char rx_ring[SERIAL_RX_RING_SIZE];
+static volatile unsigned int rx_head = 0;
+static volatile unsigned int rx_tail = 0;
+static serial_rx_fn_t rx_handler = 0;
+
+static struct serial_stats stats;
+
+static struct lock_class serial_lock_class = LOCK_CLASS_INIT("serial");
+static struct spinlock serial_lock = SPINLOCK_INIT(&serial_lock_class);
 
 /* Check if serial port is ready to transmit */
 static int serial_is_transmit_empty(void) {
-    unsigned char status;
-    __asm__ volatile ("inb %1, %0" : "=a"(status) : "Nd"((unsigned short)(SERIAL_COM1_BASE + 5)));
-    return (status & SERIAL_LINE_STATUS_THRE) != 0;
+    return (inb(SERIAL_LINE_STATUS_PORT(SERIAL_COM1_BASE)) & SERIAL_LINE_STATUS_THRE) != 0;
+}
+
+/* Move up to one FIFO worth of bytes from the ring into the UART.
+ * Caller must hold serial_lock and must have seen THRE set. */
+static void serial_fill_fifo(void) {
+    unsigned int n = 0;
+
+    while (n < SERIAL_FIFO_SIZE && tx_tail != tx_head) {
+        outb(SERIAL_DATA_PORT(SERIAL_COM1_BASE), tx_ring[tx_tail & SERIAL_TX_RING_MASK]);
+        tx_tail++;
+        n++;
+    }
+
+    if (n != 0) {
+        stats.fifo_bursts++;
+    }
 }
 
-/* Initialize serial port COM1 */
-void serial_init(void) {
+/* Enable or disable the THRE interrupt */
+static void serial_arm_tx(int arm) {
+    if (arm) {
+        serial_ier |= SERIAL_IER_THRE;
+    } else {
+        serial_ier &= ~SERIAL_IER_THRE;
+    }
+    tx_irq_armed = arm;
+    outb(SERIAL_INT_ENABLE_PORT(SERIAL_COM1_BASE), serial_ier);
+}
+
+/* Refill the FIFO from the ring and stop TX interrupts once it is empty */
+static void serial_tx_refill(void) {
+    if (serial_is_transmit_empty()) {
+        serial_fill_fifo();
+    }
+
+    if (tx_tail == tx_head && tx_irq_armed) {
+        serial_arm_tx(0);
+    }
+}
+
+/* Drain the ring by polling; serial_lock must be held */
+static void serial_drain_polled(void) {
+    while (tx_tail != tx_head) {
+        while (!serial_is_transmit_empty()) {
+            /* Busy wait for the FIFO to empty */
+        }
+        serial_fill_fifo();
+    }
+}
+
+/* Take serial_lock for output, with interrupts disabled. In synchronous
+ * mode - the panic path - the holder may be the code that panicked, on
+ * this very CPU, so give up after SERIAL_SYNC_LOCK_SPINS attempts and
+ * return 0; from then on output bypasses the ring and the lock. */
+static int serial_lock_output(unsigned int* flags) {
+    if (!tx_sync) {
+        *flags = spin_lock_irqsave(&serial_lock);
+        return 1;
+    }
+
+    *flags = irq_save();
+    if (!tx_lock_lost) {
+        for (unsigned int spins = 0; spins < SERIAL_SYNC_LOCK_SPINS; spins++) {
+            if (spin_trylock(&serial_lock)) {
+                return 1;
+            }
+            cpu_relax();
+        }
+        tx_lock_lost = 1;
+    }
+    irq_restore(*flags);
+    return 0;
+}
+
+/* Write one byte straight to the UART, without the ring or the lock */
+static void serial_put_unlocked(char c) {
+    while (!serial_is_transmit_empty()) {
+        /* Busy wait for the FIFO to empty */
+    }
+    outb(SERIAL_DATA_PORT(SERIAL_COM1_BASE), c);
+}
+
+/* Append a byte to the ring; serial_lock must be held.
+ * Returns 0 on success, -1 if the byte had to be dropped. */
+static int serial_enqueue(char c) {
+    if (tx_head - tx_tail >= SERIAL_TX_RING_SIZE) {
+        stats.ring_full++;
+
+        if (tx_irq_mode && !tx_sync) {
+            /* Never block an interrupt-driven writer: drop the byte */
+            stats.bytes_dropped++;
+            return -1;
+        }
+
+        /* Polled mode: make room synchronously */
+        serial_drain_polled();
+    }
+
+    tx_ring[tx_head & SERIAL_TX_RING_MASK] = c;
+    tx_head++;
+    stats.bytes_queued++;
+    return 0;
+}
+
+/* Push queued bytes towards the UART after new data was enqueued */
+static void serial_kick(void) {
+    if (!tx_irq_mode || tx_sync) {
+        serial_drain_polled();
+    } else if (!tx_irq_armed) {
+        /* Start the transmitter; the THRE interrupt takes over from here */
+        if (serial_is_transmit_empty()) {
+            serial_fill_fifo();
+        }
+        serial_arm_tx(1);
+    }
+}
+
+/* Initialize serial port COM1 at the given baud rate (50..115200) */
+void serial_init(unsigned int baud) {
+    unsigned int divisor;
+
+    if (baud == 0 || baud > SERIAL_BAUD_BASE) {
+        baud = SERIAL_BAUD_DEFAULT;
+    }
+    divisor = SERIAL_BAUD_BASE / baud;
+    if (divisor > 0xFFFF) {
+        divisor = 0xFFFF;
+    }
+
     /* Disable interrupts */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x00), "Nd"((unsigned short)(SERIAL_COM1_BASE + 1)));
+    serial_ier = 0;
+    outb(SERIAL_INT_ENABLE_PORT(SERIAL_COM1_BASE), 0x00);
     
     /* Enable DLAB (Divisor Latch Access Bit) to set baud rate */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x80), "Nd"((unsigned short)(SERIAL_COM1_BASE + 3)));
-    
-    /* Set divisor to 3 (38400 baud) - low byte */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x03), "Nd"((unsigned short)SERIAL_COM1_BASE));
+    outb(SERIAL_LINE_COMMAND_PORT(SERIAL_COM1_BASE), 0x80);
     
-    /* Set divisor - high byte */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x00), "Nd"((unsigned short)(SERIAL_COM1_BASE + 1)));
+    /* Set divisor - low byte, then high byte */
+    outb(SERIAL_DATA_PORT(SERIAL_COM1_BASE), (unsigned char)(divisor & 0xFF));
+    outb(SERIAL_INT_ENABLE_PORT(SERIAL_COM1_BASE), (unsigned char)((divisor >> 8) & 0xFF));
     
     /* 8 bits, no parity, one stop bit - disable DLAB */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x03), "Nd"((unsigned short)(SERIAL_COM1_BASE + 3)));
+    outb(SERIAL_LINE_COMMAND_PORT(SERIAL_COM1_BASE), 0x03);
     
     /* Enable FIFO, clear them, with 14-byte threshold */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0xC7), "Nd"((unsigned short)(SERIAL_COM1_BASE + 2)));
+    outb(SERIAL_FIFO_COMMAND_PORT(SERIAL_COM1_BASE), 0xC7);
     
-    /* Enable interrupts, RTS/DSR set */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)0x0B), "Nd"((unsigned short)(SERIAL_COM1_BASE + 4)));
+    /* DTR, RTS and OUT2 set (OUT2 gates the UART interrupt line) */
+    outb(SERIAL_MODEM_COMMAND_PORT(SERIAL_COM1_BASE), 0x0B);
+
+    tx_head = 0;
+    tx_tail = 0;
+    tx_irq_mode = 0;
+    tx_irq_armed = 0;
+}
+
+/* Move everything in the receive FIFO into the RX ring; serial_lock must
+ * be held. Returns the number of bytes read. */
+static unsigned int serial_rx_drain(void) {
+    unsigned int head = rx_head;
+    unsigned int n = 0;
+    unsigned char lsr;
+
+    while ((lsr = inb(SERIAL_LINE_STATUS_PORT(SERIAL_COM1_BASE))) & SERIAL_LINE_STATUS_DR) {
+        unsigned char c = inb(SERIAL_DATA_PORT(SERIAL_COM1_BASE));
+
+        if (lsr & SERIAL_LINE_STATUS_OE) {
+            stats.rx_fifo_lost++;
+        }
+        if (head - __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) >= SERIAL_RX_RING_SIZE) {
+            stats.rx_overruns++;
+        } else {
+            rx_ring[head & SERIAL_RX_RING_MASK] = c;
+            head++;
+        }
+        n++;
+    }
+
+    __atomic_store_n(&rx_head, head, __ATOMIC_RELEASE);
+    stats.bytes_received += n;
+    return n;
+}
+
+/* COM1 interrupt handler (IRQ 4) */
+static int serial_irq_handler(unsigned int irq, void* context) {
+    unsigned char iir;
+    unsigned int received = 0;
+    int handled = IRQ_NONE;
+
+    (void)irq;
+    (void)context;
+
+    spin_lock(&serial_lock);
+
+    /* Service every pending UART interrupt source. IRQ 4 is edge-triggered:
+     * the UART raises the line again only once nothing is pending, so a
+     * source left behind here would silence the port for good. */
+    for (;;) {
+        iir = inb(SERIAL_INT_IDENT_PORT(SERIAL_COM1_BASE));
+        if (iir & SERIAL_IIR_NO_INT) {
+            break;
+        }
+        handled = IRQ_HANDLED;
+
+        switch (iir & SERIAL_IIR_ID_MASK) {
+            case SERIAL_IIR_THRE:
+                stats.tx_irqs++;
+                serial_tx_refill();
+                break;
+            case SERIAL_IIR_LSR:
+                if (inb(SERIAL_LINE_STATUS_PORT(SERIAL_COM1_BASE)) & SERIAL_LINE_STATUS_OE) {
+                    stats.rx_fifo_lost++;
+                }
+                break;
+            case SERIAL_IIR_RDA:
+            case SERIAL_IIR_TIMEOUT:
+                stats.rx_irqs++;
+                received += serial_rx_drain();
+                break;
+            default:
+                inb(SERIAL_MODEM_STATUS_PORT(SERIAL_COM1_BASE));
+                break;
+        }
+    }
+
+    spin_unlock(&serial_lock);
+
+    if (received != 0 && rx_handler != 0) {
+        rx_handler();
+    }
+    return handled;
+}
+
+/* Switch the TX path to interrupt-driven draining (call after irq_init) */
+void serial_enable_irq(void) {
+    if (request_irq(SERIAL_COM1_IRQ, serial_irq_handler, IRQF_POLL, "serial", 0) != 0) {
+        return;  /* Keep polling */
+    }
+
+    unsigned int flags = spin_lock_irqsave(&serial_lock);
+
+    tx_irq_mode = 1;
+    if (tx_tail != tx_head) {
+        serial_kick();
+    }
+
+    /* Receive from here on; a byte that came in earlier is queued now */
+    serial_rx_drain();
+    serial_ier |= SERIAL_IER_RDA | SERIAL_IER_LSR;
+    outb(SERIAL_INT_ENABLE_PORT(SERIAL_COM1_BASE), serial_ier);
+
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* Switch to synchronous (polled) output; drains the ring first when enabled.
+ * The flag is set without serial_lock, which the caller may hold already. */
+void serial_set_sync(int sync) {
+    unsigned int flags;
+
+    __atomic_store_n(&tx_sync, sync, __ATOMIC_SEQ_CST);
+    if (sync && serial_lock_output(&flags)) {
+        serial_drain_polled();
+        spin_unlock_irqrestore(&serial_lock, flags);
+    }
+}
+
+/* Drain the TX ring by polling the UART (safe with interrupts disabled) */
+void serial_flush(void) {
+    unsigned int flags;
+
+    if (serial_lock_output(&flags)) {
+        serial_drain_polled();
+        spin_unlock_irqrestore(&serial_lock, flags);
+    }
 }
 
 /* Write a character to serial port */
 void serial_putchar(char c) {
-    /* Wait until transmitter is ready */
-    while (!serial_is_transmit_empty()) {
-        /* Busy wait */
+    unsigned int flags;
+
+    if (!serial_lock_output(&flags)) {
+        serial_put_unlocked(c);
+        return;
+    }
+    if (serial_enqueue(c) == 0) {
+        serial_kick();
     }
     
-    /* Send the character */
-    __asm__ volatile ("outb %0, %1" : : "a"((unsigned char)c), "Nd"((unsigned short)SERIAL_COM1_BASE));
+    spin_unlock_irqrestore(&serial_lock, flags);
 }
 
 /* Write a string to serial port */
 void serial_puts(const char* str) {
+    unsigned int flags;
+
+    if (!serial_lock_output(&flags)) {
+        for (unsigned int i = 0; str[i] != '\0'; i++) {
+            if (str[i] == '\n') {
+                serial_put_unlocked('\r');
+            }
+            serial_put_unlocked(str[i]);
+        }
+        return;
+    }
     for (unsigned int i = 0; str[i] != '\0'; i++) {
         if (str[i] == '\n') {
-            serial_putchar('\r');  /* Carriage return before newline */
+            serial_enqueue('\r');  /* Carriage return before newline */
         }
-        serial_putchar(str[i]);
+        serial_enqueue(str[i]);
+    }
+    serial_kick();
+
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* Write raw bytes (no newline translation). Never drops data: when the
+ * ring is full the writer polls the UART for room, one FIFO burst at a
+ * time, with interrupts enabled between chunks. */
+void serial_write(const void* data, unsigned int len) {
+    const char* bytes = data;
+
+    while (len > 0) {
+        unsigned int chunk = len < SERIAL_WRITE_CHUNK ? len : SERIAL_WRITE_CHUNK;
+        unsigned int flags;
+
+        if (!serial_lock_output(&flags)) {
+            for (unsigned int i = 0; i < len; i++) {
+                serial_put_unlocked(bytes[i]);
+            }
+            return;
+        }
+        if (SERIAL_TX_RING_SIZE - (tx_head - tx_tail) < chunk) {
+            stats.ring_full++;
+            while (SERIAL_TX_RING_SIZE - (tx_head - tx_tail) < chunk) {
+                while (!serial_is_transmit_empty()) {
+                    /* Busy wait for the FIFO to empty */
+                }
+                serial_fill_fifo();
+            }
+        }
+        for (unsigned int i = 0; i < chunk; i++) {
+            tx_ring[tx_head & SERIAL_TX_RING_MASK] = bytes[i];
+            tx_head++;
+        }
+        stats.bytes_queued += chunk;
+        serial_kick();
+
+        spin_unlock_irqrestore(&serial_lock, flags);
+        bytes += chunk;
+        len -= chunk;
     }
 }
 
@@ -99,3 +444,63 @@ void serial_puthex(unsigned int num) {
     }
 }
 
+/* Copy up to `len` received bytes without blocking */
+unsigned int serial_read(void* buf, unsigned int len) {
+    unsigned char* out = buf;
+    unsigned int tail = rx_tail;
+    unsigned int head;
+    unsigned int n = 0;
+
+    /* No receive interrupt: poll the FIFO */
+    if (!tx_irq_mode) {
+        unsigned int flags = spin_lock_irqsave(&serial_lock);
+        serial_rx_drain();
+        spin_unlock_irqrestore(&serial_lock, flags);
+    }
+
+    head = __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE);
+    while (n < len && tail != head) {
+        out[n++] = rx_ring[tail & SERIAL_RX_RING_MASK];
+        tail++;
+    }
+    __atomic_store_n(&rx_tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Queue bytes as if received. serial_lock keeps the IRQ 4 handler, the
+ * ring's producer, out meanwhile. */
+unsigned int serial_rx_inject(const void* data, unsigned int len) {
+    const unsigned char* bytes = data;
+    unsigned int flags = spin_lock_irqsave(&serial_lock);
+    unsigned int head = rx_head;
+    unsigned int n = 0;
+
+    while (n < len && head - __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) < SERIAL_RX_RING_SIZE) {
+        rx_ring[head & SERIAL_RX_RING_MASK] = bytes[n++];
+        head++;
+    }
+    __atomic_store_n(&rx_head, head, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&serial_lock, flags);
+
+    if (n != 0 && rx_handler != 0) {
+        rx_handler();
+    }
+    return n;
+}
+
+/* Check whether received bytes are waiting */
+int serial_rx_pending(void) {
+    return __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) != rx_tail;
+}
+
+/* Set the function told about new received bytes */
+void serial_set_rx_handler(serial_rx_fn_t fn) {
+    rx_handler = fn;
+}
+
+/* Get a snapshot of the transmit and receive statistics */
+void serial_get_stats(struct serial_stats* out) {
+    unsigned int flags = spin_lock_irqsave(&serial_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
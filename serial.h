@@ -13,6 +13,20 @@
  * 1. It works even when VGA isn't available
  * 2. Output can be logged to files
  * 3. It doesn't interfere with the display
+ *
+ * Transmit path:
+ * Characters are appended to a TX ring buffer and never wait for the UART.
+ * Once serial_enable_irq() has been called, the ring is drained by the
+ * COM1 interrupt (IRQ 4), which refills the 16550 FIFO in one burst per
+ * "transmitter empty" interrupt. Before that (and in synchronous mode,
+ * used by panic/halt) the ring is drained by polling.
+ *
+ * Receive path:
+ * The same interrupt empties the receive FIFO into an RX ring on every
+ * "data available" or "character timeout" interrupt. The handler is the
+ * ring's only producer and serial_read()'s caller its only consumer, so
+ * the ring takes no lock and receiving never holds up the TX ring. Bytes
+ * that find the ring full are counted as overruns and dropped.
  */
 
 #ifndef SERIAL_H
@@ -20,21 +34,89 @@
 
 /* Serial port I/O addresses for COM1 */
 #define SERIAL_COM1_BASE  0x3F8
+#define SERIAL_COM1_IRQ   4
 
 /* Serial port registers (offset from base) */
 #define SERIAL_DATA_PORT(base)      (base)
+#define SERIAL_INT_ENABLE_PORT(base)    (base + 1)
 #define SERIAL_FIFO_COMMAND_PORT(base)  (base + 2)
+#define SERIAL_INT_IDENT_PORT(base)     (base + 2)
 #define SERIAL_LINE_COMMAND_PORT(base)  (base + 3)
 #define SERIAL_MODEM_COMMAND_PORT(base) (base + 4)
 #define SERIAL_LINE_STATUS_PORT(base)   (base + 5)
+#define SERIAL_MODEM_STATUS_PORT(base)  (base + 6)
 
 /* Line status register bits */
+#define SERIAL_LINE_STATUS_DR    0x01  /* Data Ready */
+#define SERIAL_LINE_STATUS_OE    0x02  /* Overrun Error: the FIFO lost a byte */
 #define SERIAL_LINE_STATUS_THRE  0x20  /* Transmitter Holding Register Empty */
 
+/* Interrupt enable register bits */
+#define SERIAL_IER_RDA    0x01  /* Received Data Available */
+#define SERIAL_IER_THRE   0x02  /* Transmitter Holding Register Empty */
+#define SERIAL_IER_LSR    0x04  /* Receiver Line Status */
+
+/* Interrupt identification register: bit 0 clear = interrupt pending */
+#define SERIAL_IIR_NO_INT     0x01
+#define SERIAL_IIR_ID_MASK    0x0E
+#define SERIAL_IIR_MSR        0x00  /* Modem status change */
+#define SERIAL_IIR_THRE       0x02  /* Transmitter holding register empty */
+#define SERIAL_IIR_RDA        0x04  /* Received data available */
+#define SERIAL_IIR_LSR        0x06  /* Receiver line status */
+#define SERIAL_IIR_TIMEOUT    0x0C  /* Character timeout (FIFO mode) */
+
+/* The 16550 transmit FIFO holds 16 bytes */
+#define SERIAL_FIFO_SIZE  16
+
+/* UART input clock divided by 16: divisor = SERIAL_BAUD_BASE / baud */
+#define SERIAL_BAUD_BASE     115200
+#define SERIAL_BAUD_DEFAULT  115200
+
+/* TX ring buffer size (must be a power of two) */
+#define SERIAL_TX_RING_SIZE  8192
+
+/* RX ring buffer size (must be a power of two) */
+#define SERIAL_RX_RING_SIZE  256
+
+/* Largest piece serial_write() queues with interrupts disabled */
+#define SERIAL_WRITE_CHUNK   64
+
+/* Attempts at serial_lock in synchronous mode before output goes straight
+ * to the UART (the holder may never release it after a panic) */
+#define SERIAL_SYNC_LOCK_SPINS  (1u << 24)
+
+/* Transmit and receive statistics */
+struct serial_stats {
+    unsigned int bytes_queued;   /* Bytes accepted into the TX ring */
+    unsigned int bytes_dropped;  /* Bytes discarded because the ring was full */
+    unsigned int ring_full;      /* Number of times a write found the ring full */
+    unsigned int tx_irqs;        /* THRE interrupts serviced */
+    unsigned int fifo_bursts;    /* FIFO refills (interrupt or polled) */
+    unsigned int rx_irqs;        /* Data available / timeout interrupts serviced */
+    unsigned int bytes_received; /* Bytes read from the receive FIFO */
+    unsigned int rx_overruns;    /* ... dropped because the RX ring was full */
+    unsigned int rx_fifo_lost;   /* Overrun errors: the UART lost bytes */
+};
+
+/* Called from the IRQ 4 handler after bytes were added to the RX ring */
+typedef void (*serial_rx_fn_t)(void);
+
 /* Serial Port Functions */
 
-/* Initialize serial port COM1 */
-void serial_init(void);
+/* Initialize serial port COM1 at the given baud rate (50..115200) */
+void serial_init(unsigned int baud);
+
+/* Switch the TX path to interrupt-driven draining and start receiving
+ * (registers IRQ 4; call after irq_init) */
+void serial_enable_irq(void);
+
+/* Switch to synchronous (polled) output; drains the ring first when enabled.
+ * Safe on the panic path with serial_lock held: if the lock cannot be had,
+ * the ring is abandoned and output is written straight to the UART. */
+void serial_set_sync(int sync);
+
+/* Drain the TX ring by polling the UART (safe with interrupts disabled) */
+void serial_flush(void);
 
 /* Write a character to serial port */
 void serial_putchar(char c);
@@ -42,11 +124,31 @@ void serial_putchar(char c);
 /* Write a string to serial port */
 void serial_puts(const char* str);
 
+/* Write raw bytes (no newline translation); waits for room instead of
+ * dropping, so call it from thread context */
+void serial_write(const void* data, unsigned int len);
+
 /* Print unsigned integer to serial port */
 void serial_putuint(unsigned int num);
 
 /* Print hexadecimal to serial port */
 void serial_puthex(unsigned int num);
 
-#endif /* SERIAL_H */
+/* Copy up to `len` received bytes without blocking; returns how many.
+ * Only one reader at a time. */
+unsigned int serial_read(void* buf, unsigned int len);
 
+/* Queue bytes as if the UART had received them, and notify the RX
+ * handler (self-tests); returns how many fit in the RX ring */
+unsigned int serial_rx_inject(const void* data, unsigned int len);
+
+/* Check whether received bytes are waiting */
+int serial_rx_pending(void);
+
+/* Set the function told about new received bytes (0 for none) */
+void serial_set_rx_handler(serial_rx_fn_t fn);
+
+/* Get a snapshot of the transmit and receive statistics */
+void serial_get_stats(struct serial_stats* stats);
+
+#endif /* SERIAL_H */
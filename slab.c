@@ -0,0 +1,526 @@
+/*
+ * Slab Object Allocator Implementation
+ *
+ * Slab layout (2^slab_order pages, page aligned):
+ *
+ *   [struct slab][pad to align][color * CACHE_LINE_SIZE][obj 0][obj 1]...
+ *
+ * Every page of a slab points back to the slab header through
+ * struct page.owner, which is how kfree() and the flush path find the
+ * slab (and cache) of an object. Pages handed out directly by kmalloc()
+ * have no owner.
+ *
+ * Lock order: cache lock, then the page allocator's lock.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "cpu.h"
+#include "io.h"
+#include "math64.h"
+#include "debug.h"
+
+/* Empty slabs kept per cache before pages go back to the page allocator */
+#define KMEM_MAX_EMPTY_SLABS  1
+
+/* Objects moved per magazine refill */
+#define KMEM_REFILL_BATCH     (KMEM_MAGAZINE_SIZE / 2)
+
+#define KMALLOC_CACHES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+/* Slab header, at the start of the slab */
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct slab** list;          /* List the slab is on */
+    struct kmem_cache* cache;
+    void* freelist;              /* Free objects, linked through their first word */
+    unsigned int inuse;          /* Objects not on the free list */
+};
+
+/* The cache of kmem_cache structures */
+static struct kmem_cache cache_cache;
+
+/* All caches */
+static struct kmem_cache* cache_list = 0;
+static struct lock_class cache_list_lock_class = LOCK_CLASS_INIT("slab-list");
+static struct spinlock cache_list_lock = SPINLOCK_INIT(&cache_list_lock_class);
+
+/* One class for the locks of all caches */
+static struct lock_class cache_lock_class = LOCK_CLASS_INIT("slab");
+
+/* kmalloc size classes */
+static const char* const kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+static struct kmem_cache* kmalloc_caches[KMALLOC_CACHES];
+
+static unsigned int cache_lock(struct spinlock* lock) {
+    return spin_lock_irqsave(lock);
+}
+
+static void cache_unlock(struct spinlock* lock, unsigned int flags) {
+    spin_unlock_irqrestore(lock, flags);
+}
+
+/* ============================================================================
+ * Slab Layer (cache lock held)
+ * ============================================================================
+ */
+
+static void slab_list_add(struct slab** list, struct slab* slab) {
+    slab->list = list;
+    slab->prev = 0;
+    slab->next = *list;
+    if (slab->next != 0) {
+        slab->next->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_del(struct slab* slab) {
+    if (slab->prev != 0) {
+        slab->prev->next = slab->next;
+    } else {
+        *slab->list = slab->next;
+    }
+    if (slab->next != 0) {
+        slab->next->prev = slab->prev;
+    }
+    slab->list = 0;
+}
+
+/* Move a slab to the list matching its fill level */
+static void slab_relist(struct kmem_cache* cache, struct slab* slab) {
+    struct slab** list;
+
+    if (slab->inuse == 0) {
+        list = &cache->empty;
+    } else if (slab->inuse == cache->objects_per_slab) {
+        list = &cache->full;
+    } else {
+        list = &cache->partial;
+    }
+
+    if (slab->list != list) {
+        if (slab->list == &cache->empty) {
+            cache->empty_slabs--;
+        }
+        slab_list_del(slab);
+        slab_list_add(list, slab);
+        if (list == &cache->empty) {
+            cache->empty_slabs++;
+        }
+    }
+}
+
+/* Allocate and carve a new slab */
+static struct slab* slab_grow(struct kmem_cache* cache) {
+    unsigned int addr = pmm_alloc_pages(cache->slab_order, 0);
+    struct slab* slab;
+    unsigned char* object;
+
+    if (addr == 0) {
+        return 0;
+    }
+
+    slab = (struct slab*)addr;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = 0;
+    slab->list = 0;
+
+    for (unsigned int i = 0; i < (1u << cache->slab_order); i++) {
+        phys_to_page(addr + i * PAGE_SIZE)->owner = slab;
+    }
+
+    /* Color this slab, then thread the free list front to back */
+    object = (unsigned char*)addr + cache->first_offset + cache->color_next * CACHE_LINE_SIZE;
+    if (++cache->color_next >= cache->colors) {
+        cache->color_next = 0;
+    }
+    object += (cache->objects_per_slab - 1) * cache->size;
+    for (unsigned int i = 0; i < cache->objects_per_slab; i++) {
+        *(void**)object = slab->freelist;
+        slab->freelist = object;
+        object -= cache->size;
+    }
+
+    slab_list_add(&cache->empty, slab);
+    cache->empty_slabs++;
+    cache->slabs++;
+    cache->free_objects += cache->objects_per_slab;
+    cache->slab_grows++;
+    return slab;
+}
+
+/* Give an empty slab back to the page allocator */
+static void slab_release(struct kmem_cache* cache, struct slab* slab) {
+    unsigned int addr = (unsigned int)slab;
+
+    slab_list_del(slab);
+    cache->empty_slabs--;
+    cache->slabs--;
+    cache->free_objects -= cache->objects_per_slab;
+    cache->slab_shrinks++;
+
+    for (unsigned int i = 0; i < (1u << cache->slab_order); i++) {
+        phys_to_page(addr + i * PAGE_SIZE)->owner = 0;
+    }
+    pmm_free_pages(addr, cache->slab_order);
+}
+
+/* Take one object from the slabs (partial first, then empty, then grow) */
+static void* slab_get_object(struct kmem_cache* cache) {
+    struct slab* slab = cache->partial;
+    void* object;
+
+    if (slab == 0) {
+        slab = cache->empty;
+    }
+    if (slab == 0) {
+        slab = slab_grow(cache);
+        if (slab == 0) {
+            cache->failures++;
+            return 0;
+        }
+    }
+
+    object = slab->freelist;
+    slab->freelist = *(void**)object;
+    slab->inuse++;
+    cache->free_objects--;
+    cache->allocs++;
+    slab_relist(cache, slab);
+    return object;
+}
+
+/* Return one object to its slab */
+static void slab_put_object(struct kmem_cache* cache, void* object) {
+    struct slab* slab = (struct slab*)phys_to_page((unsigned int)object)->owner;
+
+    *(void**)object = slab->freelist;
+    slab->freelist = object;
+    slab->inuse--;
+    cache->free_objects++;
+    cache->frees++;
+    slab_relist(cache, slab);
+
+    if (slab->inuse == 0 && cache->empty_slabs > KMEM_MAX_EMPTY_SLABS) {
+        slab_release(cache, slab);
+    }
+}
+
+/* ============================================================================
+ * Per-CPU Magazines (interrupts disabled)
+ * ============================================================================
+ */
+
+static void magazine_swap(struct kmem_cpu_cache* cpu) {
+    void** magazine = cpu->loaded;
+    unsigned int rounds = cpu->loaded_rounds;
+
+    cpu->loaded = cpu->previous;
+    cpu->loaded_rounds = cpu->previous_rounds;
+    cpu->previous = magazine;
+    cpu->previous_rounds = rounds;
+}
+
+/* Fill the (empty) loaded magazine with a batch from the slabs */
+static void magazine_refill(struct kmem_cache* cache, struct kmem_cpu_cache* cpu) {
+    unsigned int flags = cache_lock(&cache->lock);
+
+    while (cpu->loaded_rounds < KMEM_REFILL_BATCH) {
+        void* object = slab_get_object(cache);
+        if (object == 0) {
+            break;
+        }
+        cpu->loaded[cpu->loaded_rounds++] = object;
+    }
+
+    cache_unlock(&cache->lock, flags);
+}
+
+/* Return every object of the previous magazine to the slabs */
+static void magazine_flush_previous(struct kmem_cache* cache, struct kmem_cpu_cache* cpu) {
+    unsigned int flags = cache_lock(&cache->lock);
+
+    while (cpu->previous_rounds > 0) {
+        slab_put_object(cache, cpu->previous[--cpu->previous_rounds]);
+    }
+
+    cache_unlock(&cache->lock, flags);
+}
+
+/* ============================================================================
+ * Cache API
+ * ============================================================================
+ */
+
+/* Fill in a cache descriptor: object stride, slab order and colors */
+static int kmem_cache_setup(struct kmem_cache* cache, const char* name,
+                            unsigned int size, unsigned int align) {
+    unsigned int header;
+    unsigned int leftover = 0;
+    unsigned int order;
+
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+    if ((align & (align - 1)) != 0) {
+        return -1;
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->size = (size + align - 1) & ~(align - 1);
+    header = (sizeof(struct slab) + align - 1) & ~(align - 1);
+
+    /* Smallest slab that holds at least one object and wastes at most 1/8 */
+    for (order = 0; order <= KMEM_MAX_SLAB_ORDER; order++) {
+        unsigned int bytes = PAGE_SIZE << order;
+
+        if (bytes < header + cache->size) {
+            continue;
+        }
+        leftover = (bytes - header) % cache->size;
+        if (leftover * 8 <= bytes || order == KMEM_MAX_SLAB_ORDER) {
+            break;
+        }
+    }
+    if (order > KMEM_MAX_SLAB_ORDER) {
+        return -1;
+    }
+
+    cache->slab_order = order;
+    cache->objects_per_slab = ((PAGE_SIZE << order) - header) / cache->size;
+    cache->first_offset = header;
+    cache->colors = leftover / CACHE_LINE_SIZE + 1;
+    cache->color_next = 0;
+    spin_lock_init(&cache->lock, &cache_lock_class);
+    cache->full = 0;
+    cache->partial = 0;
+    cache->empty = 0;
+    cache->slabs = 0;
+    cache->empty_slabs = 0;
+    cache->free_objects = 0;
+    cache->slab_grows = 0;
+    cache->slab_shrinks = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->failures = 0;
+
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        struct kmem_cpu_cache* cpu = &cache->cpu[i];
+
+        cpu->loaded = cpu->rounds[0];
+        cpu->previous = cpu->rounds[1];
+        cpu->loaded_rounds = 0;
+        cpu->previous_rounds = 0;
+        cpu->hits = 0;
+        cpu->misses = 0;
+    }
+
+    /* Register the cache */
+    unsigned int flags = cache_lock(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    cache_unlock(&cache_list_lock, flags);
+    return 0;
+}
+
+/* Create a cache of `size`-byte objects aligned to `align` */
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align) {
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+
+    if (cache == 0) {
+        return 0;
+    }
+    if (kmem_cache_setup(cache, name, size, align) != 0) {
+        kmem_cache_free(&cache_cache, cache);
+        return 0;
+    }
+    return cache;
+}
+
+/* Allocate an object (uninitialized) */
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    unsigned int flags = irq_save();
+    struct kmem_cpu_cache* cpu = &cache->cpu[smp_processor_id()];
+    void* object = 0;
+
+    if (cpu->loaded_rounds == 0 && cpu->previous_rounds != 0) {
+        magazine_swap(cpu);
+    }
+    if (cpu->loaded_rounds != 0) {
+        cpu->hits++;
+    } else {
+        cpu->misses++;
+        magazine_refill(cache, cpu);
+    }
+    if (cpu->loaded_rounds != 0) {
+        object = cpu->loaded[--cpu->loaded_rounds];
+    }
+
+    irq_restore(flags);
+    return object;
+}
+
+/* Return an object to its cache */
+void kmem_cache_free(struct kmem_cache* cache, void* object) {
+    unsigned int flags;
+    struct kmem_cpu_cache* cpu;
+
+    if (object == 0) {
+        return;
+    }
+
+    flags = irq_save();
+    cpu = &cache->cpu[smp_processor_id()];
+
+    if (cpu->loaded_rounds == KMEM_MAGAZINE_SIZE) {
+        if (cpu->previous_rounds != 0) {
+            magazine_flush_previous(cache, cpu);
+        }
+        magazine_swap(cpu);
+    }
+    cpu->loaded[cpu->loaded_rounds++] = object;
+
+    irq_restore(flags);
+}
+
+/* ============================================================================
+ * kmalloc
+ * ============================================================================
+ */
+
+/* Allocate `size` bytes (uninitialized) */
+void* kmalloc(unsigned int size) {
+    unsigned int shift = KMALLOC_MIN_SHIFT;
+    unsigned int order = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    if (size <= KMALLOC_MAX_CACHE_SIZE) {
+        struct kmem_cache* cache;
+
+        while ((1u << shift) < size) {
+            shift++;
+        }
+        cache = kmalloc_caches[shift - KMALLOC_MIN_SHIFT];
+        return cache != 0 ? kmem_cache_alloc(cache) : 0;
+    }
+
+    /* Large allocation: whole pages, no owner */
+    while ((PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return (void*)pmm_alloc_pages(order, 0);
+}
+
+/* Free memory returned by kmalloc() */
+void kfree(void* ptr) {
+    struct page* page;
+
+    if (ptr == 0) {
+        return;
+    }
+
+    page = phys_to_page((unsigned int)ptr);
+    if (page->owner != 0) {
+        kmem_cache_free(((struct slab*)page->owner)->cache, ptr);
+    } else {
+        pmm_free_pages((unsigned int)ptr, page->order);
+    }
+}
+
+/* Set up the cache of caches and the kmalloc size classes */
+void slab_init(void) {
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), CACHE_LINE_SIZE);
+
+    for (unsigned int i = 0; i < KMALLOC_CACHES; i++) {
+        unsigned int size = 1u << (KMALLOC_MIN_SHIFT + i);
+
+        /* Small objects stay word aligned, larger ones get whole cache lines */
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size,
+                                              size < CACHE_LINE_SIZE ? size : CACHE_LINE_SIZE);
+        if (kmalloc_caches[i] == 0) {
+            debug_error("slab: cannot create kmalloc caches");
+            return;
+        }
+    }
+
+    debug_logf(LOG_INFO, "slab: %u kmalloc size classes (%u-%u bytes)",
+               KMALLOC_CACHES, 1u << KMALLOC_MIN_SHIFT, KMALLOC_MAX_CACHE_SIZE);
+}
+
+/* ============================================================================
+ * Statistics
+ * ============================================================================
+ */
+
+/* Get a snapshot of a cache's statistics */
+void kmem_cache_get_stats(struct kmem_cache* cache, struct kmem_cache_stats* out) {
+    unsigned int flags = cache_lock(&cache->lock);
+    unsigned long long slab_bytes;
+
+    out->name = cache->name;
+    out->object_size = cache->object_size;
+    out->size = cache->size;
+    out->objects_per_slab = cache->objects_per_slab;
+    out->slab_pages = 1u << cache->slab_order;
+    out->slabs = cache->slabs;
+    out->objects_total = cache->slabs * cache->objects_per_slab;
+    out->slab_grows = cache->slab_grows;
+    out->slab_shrinks = cache->slab_shrinks;
+    out->failures = cache->failures;
+    out->objects_cached = 0;
+    out->hits = 0;
+    out->misses = 0;
+
+    /* Magazine counters are read without stopping the other CPUs */
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct kmem_cpu_cache* cpu = &cache->cpu[i];
+
+        out->objects_cached += cpu->loaded_rounds + cpu->previous_rounds;
+        out->hits += cpu->hits;
+        out->misses += cpu->misses;
+    }
+    out->objects_active = out->objects_total - cache->free_objects - out->objects_cached;
+
+    slab_bytes = (unsigned long long)out->slabs * (PAGE_SIZE << cache->slab_order);
+    if (slab_bytes == 0) {
+        out->fragmentation = 0;
+    } else {
+        unsigned long long live = (unsigned long long)out->objects_active * cache->object_size;
+        out->fragmentation = (unsigned int)div_u64((slab_bytes - live) * 1000, (unsigned int)slab_bytes);
+    }
+
+    cache_unlock(&cache->lock, flags);
+}
+
+/* Print usage, magazine hit rate and fragmentation of every cache */
+void kmem_dump_stats(void) {
+    kprintf("%-14s %6s %6s %5s %6s %7s %7s %6s %5s %5s\n",
+            "cache", "objsz", "stride", "pages", "slabs", "active", "total", "cached", "hit%", "frag");
+
+    for (struct kmem_cache* cache = cache_list; cache != 0; cache = cache->next) {
+        struct kmem_cache_stats s;
+        unsigned int lookups;
+
+        kmem_cache_get_stats(cache, &s);
+        lookups = s.hits + s.misses;
+        kprintf("%-14s %6u %6u %5u %6u %7u %7u %6u %5u %3u.%u\n",
+                s.name, s.object_size, s.size, s.slab_pages, s.slabs,
+                s.objects_active, s.objects_total, s.objects_cached,
+                lookups != 0 ? (unsigned int)div_u64((unsigned long long)s.hits * 100, lookups) : 0,
+                s.fragmentation / 10, s.fragmentation % 10);
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ * Slab Object Allocator Header
+ *
+ * A kmem_cache hands out objects of one fixed size. Objects live in slabs
+ * (one or a few contiguous pages from the page allocator); a slab header
+ * at the start of the slab keeps a free list threaded through the free
+ * objects. Slabs are kept on full, partial and empty lists.
+ *
+ * Cache coloring: the leftover space at the end of a slab is used to shift
+ * the first object of successive slabs by one more cache line, so objects
+ * at the same index in different slabs do not all map to the same cache
+ * sets.
+ *
+ * Per-CPU magazines: each CPU owns two small stacks of object pointers
+ * (the "loaded" and the "previous" magazine). Allocation pops from the
+ * loaded magazine and free pushes onto it, swapping with the previous one
+ * when empty/full; only when both are exhausted does the CPU take the
+ * cache lock and move a batch of objects to or from the slabs. Magazines
+ * are only touched by their CPU with interrupts disabled, so the common
+ * path takes no lock and touches no shared cache line.
+ *
+ * kmalloc() rounds sizes up to a power of two (8 .. KMALLOC_MAX_CACHE_SIZE
+ * bytes) and uses one cache per size class; larger requests get whole
+ * pages.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "percpu.h"
+#include "spinlock.h"
+
+/* Objects per magazine */
+#define KMEM_MAGAZINE_SIZE   16
+
+/* Largest slab: 2^KMEM_MAX_SLAB_ORDER pages */
+#define KMEM_MAX_SLAB_ORDER  3
+
+/* kmalloc size classes: 2^KMALLOC_MIN_SHIFT .. 2^KMALLOC_MAX_SHIFT bytes */
+#define KMALLOC_MIN_SHIFT    3
+#define KMALLOC_MAX_SHIFT    11
+#define KMALLOC_MAX_CACHE_SIZE (1u << KMALLOC_MAX_SHIFT)
+
+/* Per-CPU magazine pair */
+struct kmem_cpu_cache {
+    void** loaded;               /* Magazine in use */
+    void** previous;             /* Spare magazine (full or empty) */
+    unsigned int loaded_rounds;  /* Objects in `loaded` */
+    unsigned int previous_rounds;
+    unsigned int hits;           /* Allocations served by a magazine */
+    unsigned int misses;         /* Allocations that had to go to the slabs */
+    void* rounds[2][KMEM_MAGAZINE_SIZE];
+} __cacheline_aligned;
+
+struct slab;
+
+/* Object cache */
+struct kmem_cache {
+    const char* name;
+    unsigned int object_size;    /* Requested size */
+    unsigned int size;           /* Object stride (size rounded up to align) */
+    unsigned int align;
+    unsigned int slab_order;     /* Pages per slab = 2^slab_order */
+    unsigned int objects_per_slab;
+    unsigned int first_offset;   /* Offset of object 0 in an uncolored slab */
+    unsigned int colors;         /* Number of distinct color offsets */
+    unsigned int color_next;
+    struct spinlock lock;
+
+    /* Slab lists (cache lock held) */
+    struct slab* full;
+    struct slab* partial;
+    struct slab* empty;
+    unsigned int slabs;
+    unsigned int empty_slabs;
+    unsigned int free_objects;   /* Free objects in slabs (not magazines) */
+
+    /* Counters (cache lock held) */
+    unsigned int slab_grows;
+    unsigned int slab_shrinks;
+    unsigned int allocs;         /* Slab-layer allocations (magazine refills) */
+    unsigned int frees;          /* Slab-layer frees (magazine flushes) */
+    unsigned int failures;
+
+    struct kmem_cache* next;     /* All caches */
+    struct kmem_cpu_cache cpu[NR_CPUS];
+};
+
+/* Cache statistics */
+struct kmem_cache_stats {
+    const char* name;
+    unsigned int object_size;
+    unsigned int size;
+    unsigned int objects_per_slab;
+    unsigned int slab_pages;
+    unsigned int slabs;
+    unsigned int objects_total;  /* Capacity of all slabs */
+    unsigned int objects_active; /* Handed out to users */
+    unsigned int objects_cached; /* Waiting in per-CPU magazines */
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int slab_grows;
+    unsigned int slab_shrinks;
+    unsigned int failures;
+    unsigned int fragmentation;  /* Permille of slab memory not holding live objects */
+};
+
+/* Set up the cache of caches and the kmalloc size classes (after pmm_init) */
+void slab_init(void);
+
+/* Create a cache of `size`-byte objects aligned to `align` (0 = word,
+ * must be a power of two). Returns 0 on failure. */
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align);
+
+/* Allocate an object (uninitialized); returns 0 when out of memory */
+void* kmem_cache_alloc(struct kmem_cache* cache);
+
+/* Return an object to its cache */
+void kmem_cache_free(struct kmem_cache* cache, void* object);
+
+/* Allocate `size` bytes (uninitialized); returns 0 when out of memory */
+void* kmalloc(unsigned int size);
+
+/* Free memory returned by kmalloc() (0 is ignored) */
+void kfree(void* ptr);
+
+/* Get a snapshot of a cache's statistics */
+void kmem_cache_get_stats(struct kmem_cache* cache, struct kmem_cache_stats* stats);
+
+/* Print usage, magazine hit rate and fragmentation of every cache */
+void kmem_dump_stats(void);
+
+#endif /* SLAB_H */
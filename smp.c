@@ -0,0 +1,256 @@
+/*
+ * Symmetric Multiprocessing (SMP) Implementation
+ *
+ * Bring-up follows the Intel MP startup algorithm: for each AP the BSP
+ * patches the trampoline parameters (stack, entry point, CPU number),
+ * sends INIT, waits 10 ms, then sends two startup IPIs 200 us apart, and
+ * waits for the AP to set its `online` flag. APs are started one at a time,
+ * so a single trampoline copy and parameter block is enough.
+ *
+ * Cross-CPU calls use one global request (function, argument, count of
+ * CPUs still running it) protected by a lock. The caller sends one
+ * broadcast IPI to all other CPUs, runs the function itself and then spins
+ * until every other CPU has decremented the count.
+ */
+
+#include "smp.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "gdt.h"
+#include "idt.h"
+#include "softirq.h"
+#include "lapic.h"
+#include "paging.h"
+#include "cpufeature.h"
+#include "fpu.h"
+#include "acpi.h"
+#include "ktime.h"
+#include "math64.h"
+#include "cpu.h"
+#include "io.h"
+#include "debug.h"
+
+/* Largest trampoline image smp_boot() can save and restore */
+#define SMP_TRAMPOLINE_MAX  256
+
+/* Per-CPU areas, indexed by logical CPU number */
+struct percpu percpu_areas[NR_CPUS];
+
+/* AP kernel stacks (the BSP keeps the stack it was booted with) */
+static unsigned char ap_stacks[NR_CPUS][SMP_AP_STACK_SIZE] __attribute__((aligned(16)));
+
+/* Number of online CPUs, including the BSP */
+static volatile unsigned int cpus_online = 1;
+
+/* Pending cross-CPU call */
+static struct lock_class call_lock_class = LOCK_CLASS_INIT("smp-call");
+static struct spinlock call_lock = SPINLOCK_INIT(&call_lock_class);
+static smp_call_fn_t volatile call_fn;
+static void* volatile call_arg;
+static volatile unsigned int call_pending = 0;
+
+/* ============================================================================
+ * Per-CPU Areas
+ * ============================================================================
+ */
+
+/* Set up the boot CPU's per-CPU area and GDT (first thing in kernel_main) */
+void percpu_init_bsp(void) {
+    struct percpu* cpu = &percpu_areas[0];
+
+    cpu->self = cpu;
+    cpu->cpu = 0;
+    cpu->online = 1;
+    gdt_init_cpu(cpu);
+}
+
+/* Number of online CPUs */
+unsigned int smp_num_cpus(void) {
+    return cpus_online;
+}
+
+/* ============================================================================
+ * Cross-CPU Function Calls
+ * ============================================================================
+ */
+
+/* SMP_CALL_VECTOR handler: run the pending function on this CPU */
+static void smp_call_handler(struct trap_frame* frame) {
+    smp_call_fn_t fn = call_fn;
+    void* arg = call_arg;
+
+    (void)frame;
+
+    fn(arg);
+    this_cpu()->ipi_calls++;
+    __atomic_fetch_sub(&call_pending, 1, __ATOMIC_RELEASE);
+    lapic_eoi();
+}
+
+/* Run `fn(arg)` on every online CPU and wait until all have returned */
+void smp_call_function_all(smp_call_fn_t fn, void* arg) {
+    unsigned int others = cpus_online - 1;
+    unsigned int flags;
+
+    spin_lock(&call_lock);
+
+    call_fn = fn;
+    call_arg = arg;
+    __atomic_store_n(&call_pending, others, __ATOMIC_RELEASE);
+
+    /* Keep the ICR write and the local call free of interrupt handlers */
+    flags = irq_save();
+    if (others != 0) {
+        lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_FIXED |
+                          LAPIC_ICR_ASSERT | SMP_CALL_VECTOR);
+    }
+    fn(arg);
+    irq_restore(flags);
+
+    while (__atomic_load_n(&call_pending, __ATOMIC_ACQUIRE) != 0) {
+        cpu_relax();
+    }
+
+    spin_unlock(&call_lock);
+}
+
+/* ============================================================================
+ * Application Processor Startup
+ * ============================================================================
+ */
+
+/* C entry point of an application processor (called by the trampoline) */
+void smp_ap_entry(unsigned int cpu_index) {
+    struct percpu* cpu = &percpu_areas[cpu_index];
+
+    /* FPU/SSE first (memcpy may use it), then the kernel page tables, own
+     * GDT (and GS base), the shared IDT and this CPU's local APIC */
+    cpu_features_init_ap();
+    paging_init_ap();
+    gdt_init_cpu(cpu);
+    idt_load();
+    fpu_init_ap();
+    lapic_setup_cpu();
+
+    cpu->boot_ns = ktime_get_ns();
+    __atomic_fetch_add(&cpus_online, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+    debug_logf(LOG_INFO, "smp: CPU %u running, APIC ID %u", cpu_index, lapic_id());
+
+    /* Nothing to schedule yet: serve IPIs and their bottom halves */
+    for (;;) {
+        softirq_idle();
+        __asm__ volatile ("cli");
+        if (softirq_pending()) {
+            __asm__ volatile ("sti");
+        } else {
+            __asm__ volatile ("sti; hlt");
+        }
+    }
+}
+
+/* Start one AP with INIT-SIPI-SIPI. Returns 0 once it is online. */
+static int smp_start_ap(unsigned int cpu_index, unsigned int apic_id,
+                        volatile struct smp_trampoline_params* params) {
+    struct percpu* cpu = &percpu_areas[cpu_index];
+    unsigned long long start;
+    unsigned long long deadline;
+
+    cpu->self = cpu;
+    cpu->cpu = cpu_index;
+    cpu->apic_id = apic_id;
+    cpu->online = 0;
+
+    params->stack = (unsigned int)&ap_stacks[cpu_index][SMP_AP_STACK_SIZE];
+    params->entry = (unsigned int)smp_ap_entry;
+    params->cpu = cpu_index;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    start = ktime_get_ns();
+
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    udelay(10000);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT |
+                                (SMP_TRAMPOLINE_ADDR >> 12));
+        udelay(200);
+    }
+
+    deadline = start + (unsigned long long)SMP_AP_TIMEOUT_MS * NSEC_PER_MSEC;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (ktime_get_ns() > deadline) {
+            debug_logf(LOG_WARN, "smp: APIC ID %u did not come online", apic_id);
+            return -1;
+        }
+        cpu_relax();
+    }
+
+    debug_logf(LOG_INFO, "smp: CPU %u online after %u us", cpu_index,
+               (unsigned int)div_u64(cpu->boot_ns - start, NSEC_PER_USEC));
+    return 0;
+}
+
+/* Start the application processors listed in the MADT */
+unsigned int smp_boot(void) {
+    const struct acpi_madt_info* madt = acpi_get_madt();
+    unsigned char* trampoline = (unsigned char*)SMP_TRAMPOLINE_ADDR;
+    unsigned int size = (unsigned int)(smp_trampoline_end - smp_trampoline_start);
+    unsigned char saved[SMP_TRAMPOLINE_MAX];
+    volatile struct smp_trampoline_params* params;
+    unsigned int bsp_id;
+    unsigned int next = 1;
+    int stranded = 0;
+
+    if (madt == 0 || !lapic_enabled() || madt->cpu_count <= 1) {
+        debug_info("smp: single CPU");
+        return cpus_online;
+    }
+    if (size > SMP_TRAMPOLINE_MAX) {
+        debug_error("smp: trampoline too large");
+        return cpus_online;
+    }
+
+    bsp_id = lapic_id();
+    percpu_areas[0].apic_id = bsp_id;
+    percpu_areas[0].boot_ns = ktime_get_ns();
+
+    idt_set_handler(SMP_CALL_VECTOR, smp_call_handler);
+
+    /* Copy the trampoline to low memory, saving what was there */
+    __asm__ ("" : "+r"(trampoline));  /* Fixed low address: hide it from -Warray-bounds */
+    for (unsigned int i = 0; i < size; i++) {
+        saved[i] = trampoline[i];
+        trampoline[i] = smp_trampoline_start[i];
+    }
+    params = (volatile struct smp_trampoline_params*)
+             (trampoline + (smp_trampoline_params - smp_trampoline_start));
+
+    for (unsigned int i = 0; i < madt->cpu_count; i++) {
+        unsigned int apic_id = madt->cpu_apic_ids[i];
+
+        if (apic_id == bsp_id) {
+            continue;
+        }
+        if (next >= NR_CPUS) {
+            debug_logf(LOG_WARN, "smp: more than %u CPUs, ignoring the rest", NR_CPUS);
+            break;
+        }
+        if (smp_start_ap(next, apic_id, params) == 0) {
+            next++;
+        } else {
+            stranded = 1;
+        }
+    }
+
+    /* An AP that missed the deadline may still run the trampoline later */
+    if (!stranded) {
+        for (unsigned int i = 0; i < size; i++) {
+            trampoline[i] = saved[i];
+        }
+    }
+
+    debug_logf(LOG_INFO, "smp: %u of %u CPUs online", cpus_online, madt->cpu_count);
+    return cpus_online;
+}
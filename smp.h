@@ -0,0 +1,62 @@
+/*
+ * Symmetric Multiprocessing (SMP) Header
+ *
+ * The boot CPU (BSP) starts every other CPU listed in the MADT with the
+ * INIT-SIPI-SIPI sequence. A startup IPI makes the application processor
+ * (AP) begin executing in real mode at SMP_TRAMPOLINE_ADDR, where a small
+ * trampoline (smp_asm.c) switches to protected mode, loads the AP's stack
+ * and calls smp_ap_entry(). There the AP loads its own GDT (with its
+ * per-CPU GS base), the shared IDT and enables its local APIC, then idles
+ * waiting for IPIs.
+ *
+ * smp_call_function_all() runs a function on every online CPU and waits
+ * for all of them to finish.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+/* Physical address the trampoline is copied to (page aligned, below 1 MB);
+ * the startup IPI vector is the page number */
+#define SMP_TRAMPOLINE_ADDR  0x8000
+
+/* Kernel stack size of each application processor */
+#define SMP_AP_STACK_SIZE    16384
+
+/* IPI vector for smp_call_function_all() */
+#define SMP_CALL_VECTOR      0xF0
+
+/* How long to wait for an AP to come online */
+#define SMP_AP_TIMEOUT_MS    100
+
+/* Function run on every CPU */
+typedef void (*smp_call_fn_t)(void* arg);
+
+/* Trampoline parameters, patched by the BSP before each startup IPI */
+struct smp_trampoline_params {
+    unsigned int stack;          /* Initial ESP */
+    unsigned int entry;          /* smp_ap_entry */
+    unsigned int cpu;            /* Logical CPU number (argument to entry) */
+};
+
+/* Trampoline image and its parameter block (smp_asm.c) */
+extern const unsigned char smp_trampoline_start[];
+extern const unsigned char smp_trampoline_end[];
+extern const unsigned char smp_trampoline_params[];
+
+/* Start the application processors (after lapic_init and ktime_init).
+ * Returns the number of online CPUs. */
+unsigned int smp_boot(void);
+
+/* Number of online CPUs */
+unsigned int smp_num_cpus(void);
+
+/* C entry point of an application processor (called by the trampoline) */
+void smp_ap_entry(unsigned int cpu);
+
+/* Run `fn(arg)` on every online CPU, including the caller, and wait until
+ * all have returned. Call with interrupts enabled, not from an interrupt
+ * handler. On the other CPUs `fn` runs in interrupt context. */
+void smp_call_function_all(smp_call_fn_t fn, void* arg);
+
+#endif /* SMP_H */
@@ -0,0 +1,81 @@
+/*
+ * Application Processor Trampoline (Assembly)
+ *
+ * This code is not executed where it is linked: smp_boot() copies it to
+ * SMP_TRAMPOLINE_ADDR, and a startup IPI with vector
+ * SMP_TRAMPOLINE_ADDR >> 12 starts the AP there in real mode with
+ * CS = SMP_TRAMPOLINE_ADDR >> 4, IP = 0. Every address used after the copy
+ * is therefore written as SMP_TRAMPOLINE_ADDR + (label - start).
+ *
+ * 1. Real mode: load a temporary flat GDT and set CR0.PE
+ * 2. Far jump into 32-bit protected mode
+ * 3. Load the flat data segments and the stack from the parameter block
+ * 4. Call smp_ap_entry(cpu)
+ */
+
+#include "smp.h"
+#include "gdt.h"
+
+/* Stringify a macro value for use inside the assembly below */
+#define SMP_STR_(x) #x
+#define SMP_STR(x) SMP_STR_(x)
+
+/* Address of a trampoline label in the copy */
+#define TRAMP(label) "(" SMP_STR(SMP_TRAMPOLINE_ADDR) " + " #label " - smp_trampoline_start)"
+
+__asm__ (
+    ".section .rodata\n"
+    ".balign 16\n"
+    ".globl smp_trampoline_start\n"
+    "smp_trampoline_start:\n"
+    ".code16\n"
+    "    cli\n"
+    "    cld\n"
+    "    movw %cs, %ax\n"
+    "    movw %ax, %ds\n"                /* DS:offset addresses the copy */
+    "    lgdtl tramp_gdtr - smp_trampoline_start\n"
+    "    movl %cr0, %eax\n"
+    "    orl $1, %eax\n"                 /* CR0.PE */
+    "    movl %eax, %cr0\n"
+    "    ljmpl $" SMP_STR(KERNEL_CS) ", $" TRAMP(tramp_protected) "\n"
+
+    ".code32\n"
+    "tramp_protected:\n"
+    "    movw $" SMP_STR(KERNEL_DS) ", %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %ss\n"
+    "    xorw %ax, %ax\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    movl " TRAMP(tramp_stack) ", %esp\n"
+    "    pushl " TRAMP(tramp_cpu) "\n"   /* Argument: logical CPU number */
+    "    call *" TRAMP(tramp_entry) "\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+
+    /* Temporary flat GDT with the kernel's code and data selectors */
+    ".balign 8\n"
+    "tramp_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00CF9A000000FFFF\n"     /* 0x08: code, base 0, limit 4 GB */
+    "    .quad 0x00CF92000000FFFF\n"     /* 0x10: data, base 0, limit 4 GB */
+    "tramp_gdtr:\n"
+    "    .word 23\n"
+    "    .long " TRAMP(tramp_gdt) "\n"
+
+    /* Parameter block (struct smp_trampoline_params) */
+    ".balign 4\n"
+    ".globl smp_trampoline_params\n"
+    "smp_trampoline_params:\n"
+    "tramp_stack:\n"
+    "    .long 0\n"
+    "tramp_entry:\n"
+    "    .long 0\n"
+    "tramp_cpu:\n"
+    "    .long 0\n"
+    ".globl smp_trampoline_end\n"
+    "smp_trampoline_end:\n"
+    ".text\n"
+);
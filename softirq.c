@@ -0,0 +1,327 @@
+/*
+ * Softirq and Tasklet Implementation
+ *
+ * The pending mask and the "running softirqs" flag live in struct percpu,
+ * next to interrupt_nesting. A run clears the mask with interrupts
+ * disabled, enables them, calls the handlers of the bits it took and
+ * disables them again to look for new bits. Preemption stays disabled for
+ * the whole run, so an interrupt taken meanwhile neither switches threads
+ * (sched_irq_exit) nor starts a second run on the same stack.
+ *
+ * Counters and tasklet lists are per CPU as well and only touched by
+ * their own CPU, with interrupts disabled where a handler could race.
+ */
+
+#include "softirq.h"
+#include "idt.h"
+#include "percpu.h"
+#include "sched.h"
+#include "ktime.h"
+#include "math64.h"
+#include "cpu.h"
+#include "io.h"
+#include "kprintf.h"
+#include "debug.h"
+
+struct tasklet_list {
+    struct tasklet* head;
+    struct tasklet* tail;
+};
+
+struct softirq_cpu {
+    struct softirq_vector_stats vec[NR_SOFTIRQS];
+    unsigned int irq_exit_runs;
+    unsigned int idle_runs;
+    unsigned int restarts;
+    unsigned int deferred;
+    unsigned int tasklets;
+    struct tasklet_list hi;          /* SOFTIRQ_HI */
+    struct tasklet_list normal;      /* SOFTIRQ_TASKLET */
+} __cacheline_aligned;
+
+static void tasklet_hi_action(void);
+static void tasklet_action(void);
+
+static softirq_fn_t softirq_vec[NR_SOFTIRQS] = {
+    [SOFTIRQ_HI]      = tasklet_hi_action,
+    [SOFTIRQ_TASKLET] = tasklet_action,
+};
+
+static const char* const softirq_names[NR_SOFTIRQS] = {
+    [SOFTIRQ_HI]      = "hi",
+    [SOFTIRQ_LOG]     = "log",
+    [SOFTIRQ_TASKLET] = "tasklet",
+};
+
+static struct softirq_cpu softirq_cpus[NR_CPUS];
+
+/* Length of one run in TSC cycles, 0 while the TSC is not calibrated */
+static unsigned long long budget_cycles = 0;
+
+/* ============================================================================
+ * Running Softirqs
+ * ============================================================================
+ */
+
+/* Run the pending vectors (interrupts disabled; enabled while handlers run) */
+static void softirq_run(struct percpu* cpu) {
+    struct softirq_cpu* sc = &softirq_cpus[cpu->cpu];
+    unsigned long long start = rdtsc();
+    unsigned int restart = SOFTIRQ_MAX_RESTART;
+    unsigned int pending = cpu->softirq_pending;
+
+    cpu->softirq_active = 1;
+    cpu->preempt_count++;
+
+    for (;;) {
+        cpu->softirq_pending = 0;
+        __asm__ volatile ("sti" : : : "memory");
+
+        while (pending != 0) {
+            unsigned int nr = (unsigned int)__builtin_ctz(pending);
+            softirq_fn_t fn = softirq_vec[nr];
+
+            pending &= pending - 1;
+            if (fn != 0) {
+                unsigned long long t0 = rdtsc();
+                unsigned int cycles;
+
+                fn();
+                cycles = (unsigned int)(rdtsc() - t0);
+                sc->vec[nr].runs++;
+                sc->vec[nr].cycles += cycles;
+                if (cycles > sc->vec[nr].max_cycles) {
+                    sc->vec[nr].max_cycles = cycles;
+                }
+            }
+        }
+
+        __asm__ volatile ("cli" : : : "memory");
+        pending = cpu->softirq_pending;
+        if (pending == 0) {
+            break;
+        }
+        /* Raised again meanwhile: go on only while the budget lasts */
+        if (--restart == 0 || (budget_cycles != 0 && rdtsc() - start >= budget_cycles)) {
+            sc->deferred++;
+            break;
+        }
+        sc->restarts++;
+    }
+
+    cpu->preempt_count--;
+    cpu->softirq_active = 0;
+}
+
+/* Leaving the outermost interrupt handler (interrupts disabled) */
+int softirq_irq_exit(const struct trap_frame* frame) {
+    struct percpu* cpu = this_cpu();
+
+    /* Not on top of code that masked interrupts, holds preemption off or
+     * is itself a softirq run */
+    if (cpu->softirq_pending == 0 || cpu->softirq_active ||
+        cpu->preempt_count != 0 || !(frame->eflags & EFLAGS_IF)) {
+        return 0;
+    }
+    softirq_cpus[cpu->cpu].irq_exit_runs++;
+    softirq_run(cpu);
+    return 1;
+}
+
+/* Idle loop: finish work a budgeted run left behind */
+void softirq_idle(void) {
+    unsigned int flags = irq_save();
+    struct percpu* cpu = this_cpu();
+
+    if (cpu->softirq_pending != 0 && !cpu->softirq_active && cpu->preempt_count == 0) {
+        softirq_cpus[cpu->cpu].idle_runs++;
+        softirq_run(cpu);
+    }
+    irq_restore(flags);
+
+    /* A handler may have woken a thread */
+    if (sched_need_resched()) {
+        schedule();
+    }
+}
+
+/* Mark a vector pending on the calling CPU */
+void raise_softirq(unsigned int nr) {
+    unsigned int flags;
+    struct percpu* cpu;
+
+    if (nr >= NR_SOFTIRQS) {
+        return;
+    }
+    flags = irq_save();
+    cpu = this_cpu();
+    cpu->softirq_pending |= 1u << nr;
+    softirq_cpus[cpu->cpu].vec[nr].raised++;
+    irq_restore(flags);
+}
+
+/* Install the handler of a vector */
+void open_softirq(unsigned int nr, softirq_fn_t fn) {
+    if (nr < NR_SOFTIRQS) {
+        softirq_vec[nr] = fn;
+    }
+}
+
+/* Check whether vectors are pending on the calling CPU */
+int softirq_pending(void) {
+    return this_cpu()->softirq_pending != 0;
+}
+
+/* Check whether the calling CPU is running softirq handlers */
+int in_softirq(void) {
+    return this_cpu()->softirq_active != 0;
+}
+
+/* ============================================================================
+ * Tasklets
+ * ============================================================================
+ */
+
+/* Append to a list (interrupts disabled) */
+static void tasklet_append(struct tasklet_list* list, struct tasklet* t) {
+    t->next = 0;
+    if (list->head == 0) {
+        list->head = t;
+    } else {
+        list->tail->next = t;
+    }
+    list->tail = t;
+}
+
+/* Queue a tasklet on the calling CPU unless it is queued already */
+static void tasklet_queue(struct tasklet* t, unsigned int nr) {
+    unsigned int flags;
+    struct softirq_cpu* sc;
+
+    if (__atomic_fetch_or(&t->state, TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL) & TASKLET_STATE_SCHED) {
+        return;
+    }
+
+    flags = irq_save();
+    sc = &softirq_cpus[smp_processor_id()];
+    tasklet_append(nr == SOFTIRQ_HI ? &sc->hi : &sc->normal, t);
+    raise_softirq(nr);
+    irq_restore(flags);
+}
+
+/* Run every tasklet queued on one list so far */
+static void tasklet_run_list(struct tasklet_list* list, unsigned int nr) {
+    struct softirq_cpu* sc = &softirq_cpus[smp_processor_id()];
+    struct tasklet* t;
+    unsigned int flags = irq_save();
+
+    t = list->head;
+    list->head = 0;
+    list->tail = 0;
+    irq_restore(flags);
+
+    while (t != 0) {
+        struct tasklet* next = t->next;
+
+        if (__atomic_fetch_or(&t->state, TASKLET_STATE_RUN, __ATOMIC_ACQUIRE) & TASKLET_STATE_RUN) {
+            /* Still running on another CPU: try again on the next pass */
+            flags = irq_save();
+            tasklet_append(list, t);
+            raise_softirq(nr);
+            irq_restore(flags);
+        } else {
+            /* Clear SCHED first, so the function may schedule itself again */
+            __atomic_fetch_and(&t->state, ~TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL);
+            t->fn(t->data);
+            sc->tasklets++;
+            __atomic_fetch_and(&t->state, ~TASKLET_STATE_RUN, __ATOMIC_RELEASE);
+        }
+        t = next;
+    }
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run_list(&softirq_cpus[smp_processor_id()].hi, SOFTIRQ_HI);
+}
+
+static void tasklet_action(void) {
+    tasklet_run_list(&softirq_cpus[smp_processor_id()].normal, SOFTIRQ_TASKLET);
+}
+
+void tasklet_init(struct tasklet* t, void (*fn)(unsigned long data), unsigned long data) {
+    t->next = 0;
+    t->state = 0;
+    t->fn = fn;
+    t->data = data;
+}
+
+void tasklet_schedule(struct tasklet* t) {
+    tasklet_queue(t, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(struct tasklet* t) {
+    tasklet_queue(t, SOFTIRQ_HI);
+}
+
+/* Wait until a tasklet is neither queued nor running */
+void tasklet_kill(struct tasklet* t) {
+    while (t->state & (TASKLET_STATE_SCHED | TASKLET_STATE_RUN)) {
+        softirq_idle();
+        cpu_relax();
+    }
+}
+
+/* ============================================================================
+ * Statistics and Initialization
+ * ============================================================================
+ */
+
+/* Get a snapshot of the counters, summed over all CPUs */
+void softirq_get_stats(struct softirq_stats* out) {
+    unsigned int flags = irq_save();
+
+    *out = (struct softirq_stats){ 0 };
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        const struct softirq_cpu* sc = &softirq_cpus[cpu];
+
+        for (unsigned int nr = 0; nr < NR_SOFTIRQS; nr++) {
+            out->vec[nr].raised += sc->vec[nr].raised;
+            out->vec[nr].runs += sc->vec[nr].runs;
+            out->vec[nr].cycles += sc->vec[nr].cycles;
+            if (sc->vec[nr].max_cycles > out->vec[nr].max_cycles) {
+                out->vec[nr].max_cycles = sc->vec[nr].max_cycles;
+            }
+        }
+        out->irq_exit_runs += sc->irq_exit_runs;
+        out->idle_runs += sc->idle_runs;
+        out->restarts += sc->restarts;
+        out->deferred += sc->deferred;
+        out->tasklets += sc->tasklets;
+    }
+    irq_restore(flags);
+}
+
+/* Print the counters */
+void softirq_dump_stats(void) {
+    struct softirq_stats s;
+
+    softirq_get_stats(&s);
+    kprintf("Softirq: %u runs at irq exit, %u from idle, %u restarts, %u deferred, %u tasklets\n",
+            s.irq_exit_runs, s.idle_runs, s.restarts, s.deferred, s.tasklets);
+    kprintf("  vector    raised      runs  avg cycles  max cycles\n");
+    for (unsigned int nr = 0; nr < NR_SOFTIRQS; nr++) {
+        const struct softirq_vector_stats* v = &s.vec[nr];
+        unsigned int avg = v->runs ? (unsigned int)div_u64(v->cycles, v->runs) : 0;
+
+        kprintf("  %-7s %8u  %8u  %10u  %10u\n",
+                softirq_names[nr], v->raised, v->runs, avg, v->max_cycles);
+    }
+}
+
+/* Turn the time budget into TSC cycles */
+void softirq_init(void) {
+    budget_cycles = div_u64((unsigned long long)ktime_tsc_khz() * CONFIG_SOFTIRQ_BUDGET_US, 1000);
+
+    debug_logf(LOG_INFO, "softirq: %u vectors, budget %u us / %u passes",
+               NR_SOFTIRQS, CONFIG_SOFTIRQ_BUDGET_US, SOFTIRQ_MAX_RESTART);
+}
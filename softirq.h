@@ -0,0 +1,120 @@
+/*
+ * Softirq and Tasklet Header
+ *
+ * Interrupt handlers run behind interrupt gates, with every other IRQ
+ * masked until they return. Work that does not have to happen there - log
+ * output, protocol processing, waking consumers - is split off into a
+ * bottom half: the handler acknowledges the device, queues what it read
+ * and raises a softirq.
+ *
+ * Softirqs are a fixed set of vectors, each with one handler. Raising one
+ * sets its bit in the calling CPU's pending mask; the pending vectors run
+ * on that CPU, lowest number first, with interrupts enabled:
+ *
+ *   - on the way out of the outermost interrupt handler (interrupt_dispatch),
+ *     if the interrupted code had interrupts enabled and preemption on;
+ *   - from the idle loops, for whatever is left over.
+ *
+ * A run repeats while new bits come up, but at most SOFTIRQ_MAX_RESTART
+ * times and for at most CONFIG_SOFTIRQ_BUDGET_US microseconds; the rest
+ * stays pending for the next interrupt exit or idle pass, so an interrupt
+ * storm cannot keep a CPU in bottom halves forever. Handlers run with
+ * preemption disabled and never nest: an interrupt taken during a run
+ * leaves its softirqs to the running loop.
+ *
+ * Tasklets are deferred functions on top of two of the vectors
+ * (SOFTIRQ_HI and SOFTIRQ_TASKLET). A tasklet is queued on the CPU that
+ * schedules it, is queued at most once however often it is scheduled
+ * before it runs, and never runs on two CPUs at the same time.
+ */
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+/* Time a softirq run may take before it leaves the rest for later
+ * (make CONFIG_SOFTIRQ_BUDGET_US=...) */
+#ifndef CONFIG_SOFTIRQ_BUDGET_US
+#define CONFIG_SOFTIRQ_BUDGET_US 2000
+#endif
+
+/* Passes over the pending mask in one run */
+#define SOFTIRQ_MAX_RESTART  8
+
+/* Vectors, in the order they run */
+#define SOFTIRQ_HI           0   /* High-priority tasklets */
+#define SOFTIRQ_LOG          1   /* Log records queued by interrupt handlers */
+#define SOFTIRQ_TASKLET      2   /* Tasklets */
+#define NR_SOFTIRQS          3
+
+struct trap_frame;
+
+typedef void (*softirq_fn_t)(void);
+
+/* Per-vector counters, summed over all CPUs (cycles are TSC cycles) */
+struct softirq_vector_stats {
+    unsigned int raised;
+    unsigned int runs;
+    unsigned long long cycles;
+    unsigned int max_cycles;
+};
+
+struct softirq_stats {
+    struct softirq_vector_stats vec[NR_SOFTIRQS];
+    unsigned int irq_exit_runs;      /* Runs started at interrupt exit */
+    unsigned int idle_runs;          /* ... and from the idle loops */
+    unsigned int restarts;           /* Extra passes for bits raised during a run */
+    unsigned int deferred;           /* Runs that hit the budget with work left */
+    unsigned int tasklets;           /* Tasklet functions called */
+};
+
+/* Tasklet state bits */
+#define TASKLET_STATE_SCHED  0x1     /* Queued, not run yet */
+#define TASKLET_STATE_RUN    0x2     /* Running on some CPU */
+
+struct tasklet {
+    struct tasklet* next;
+    volatile unsigned int state;
+    void (*fn)(unsigned long data);
+    unsigned long data;
+};
+
+#define TASKLET_INIT(func, arg) { 0, 0, (func), (arg) }
+
+/* Turn the time budget into TSC cycles (after ktime_init; until then only
+ * SOFTIRQ_MAX_RESTART bounds a run) */
+void softirq_init(void);
+
+/* Install the handler of a vector */
+void open_softirq(unsigned int nr, softirq_fn_t fn);
+
+/* Mark a vector pending on the calling CPU; safe from any context */
+void raise_softirq(unsigned int nr);
+
+/* Interrupt exit (interrupts disabled): run the pending vectors if the
+ * interrupted code allows it. Returns 1 if any ran. */
+int softirq_irq_exit(const struct trap_frame* frame);
+
+/* Idle loop: run what is still pending, with interrupts enabled */
+void softirq_idle(void);
+
+/* Check whether vectors are pending on the calling CPU */
+int softirq_pending(void);
+
+/* Check whether the calling CPU is running softirq handlers */
+int in_softirq(void);
+
+/* Tasklets */
+void tasklet_init(struct tasklet* t, void (*fn)(unsigned long data), unsigned long data);
+void tasklet_schedule(struct tasklet* t);
+void tasklet_hi_schedule(struct tasklet* t);
+
+/* Wait until a tasklet is neither queued nor running (process context) */
+void tasklet_kill(struct tasklet* t);
+
+/* Get a snapshot of the counters */
+void softirq_get_stats(struct softirq_stats* stats);
+
+/* Print the counters */
+void softirq_dump_stats(void);
+
+#endif /* SOFTIRQ_H */
@@ -0,0 +1,582 @@
+/*
+ * Spinlock Library Implementation
+ *
+ * Acquisition takes preemption off first and release puts it back last,
+ * so a thread is never switched out while another thread of the same CPU
+ * could spin on its lock. The *_irqsave variants disable interrupts
+ * before that and restore them after the release, before preempt_enable()
+ * gets to run a switch that became due meanwhile.
+ */
+
+#include "spinlock.h"
+#include "sched.h"
+#include "smp.h"
+#include "bench.h"
+#include "serial.h"
+#include "kprintf.h"
+#include "cpu.h"
+#include "io.h"
+#include "debug.h"
+
+/* Adding this to spinlock.val hands out the next ticket */
+#define TICKET_ONE (1u << 16)
+
+/* ============================================================================
+ * Lock Statistics
+ * ============================================================================
+ */
+
+#if CONFIG_LOCKSTAT
+
+/* Every class that has been used, newest first */
+static struct lock_class* lockstat_classes = 0;
+
+/* Put a class on the list the first time it is counted */
+static void lockstat_register(struct lock_class* cls) {
+    if (__atomic_load_n(&cls->registered, __ATOMIC_ACQUIRE) ||
+        __atomic_exchange_n(&cls->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    cls->next = __atomic_load_n(&lockstat_classes, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&lockstat_classes, &cls->next, cls, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        /* cls->next was refreshed with the current head */
+    }
+}
+
+/* Count an acquisition on the calling CPU. `wait` is only meaningful
+ * when the lock was contended. */
+static void lockstat_acquired(struct lock_class* cls, int contended, unsigned long long wait) {
+    struct lockstat* s;
+    unsigned int flags;
+
+    if (cls == 0) {
+        return;
+    }
+    flags = irq_save();
+    lockstat_register(cls);
+    s = &cls->stats[smp_processor_id()];
+    s->acquisitions++;
+    if (contended) {
+        s->contended++;
+        s->wait_total += wait;
+        if (wait > s->wait_max) {
+            s->wait_max = wait;
+        }
+    }
+    irq_restore(flags);
+}
+
+static void lockstat_released(struct lock_class* cls, unsigned long long hold) {
+    struct lockstat* s;
+    unsigned int flags;
+
+    if (cls == 0) {
+        return;
+    }
+    flags = irq_save();
+    s = &cls->stats[smp_processor_id()];
+    s->hold_total += hold;
+    if (hold > s->hold_max) {
+        s->hold_max = hold;
+    }
+    irq_restore(flags);
+}
+
+#endif /* CONFIG_LOCKSTAT */
+
+/* Sum a class's counters over all CPUs */
+void lockstat_get(const struct lock_class* cls, struct lockstat* out) {
+    *out = (struct lockstat){ 0 };
+#if CONFIG_LOCKSTAT
+    for (unsigned int i = 0; i < NR_CPUS; i++) {
+        const struct lockstat* s = &cls->stats[i];
+        out->acquisitions += s->acquisitions;
+        out->contended += s->contended;
+        out->wait_total += s->wait_total;
+        out->hold_total += s->hold_total;
+        if (s->wait_max > out->wait_max) {
+            out->wait_max = s->wait_max;
+        }
+        if (s->hold_max > out->hold_max) {
+            out->hold_max = s->hold_max;
+        }
+    }
+#else
+    (void)cls;
+#endif
+}
+
+/* Zero the counters of every class. Counting goes on meanwhile, so a
+ * busy class may keep a few events from before the reset. */
+void lockstat_reset(void) {
+#if CONFIG_LOCKSTAT
+    for (struct lock_class* cls = __atomic_load_n(&lockstat_classes, __ATOMIC_ACQUIRE);
+         cls != 0; cls = cls->next) {
+        for (unsigned int i = 0; i < NR_CPUS; i++) {
+            cls->stats[i] = (struct lockstat){ 0 };
+        }
+    }
+#endif
+}
+
+/* Dump every class that has been used as a machine-readable table over
+ * serial
+ *
+ * Format (wait and hold times in TSC cycles):
+ *   # lockstat v1
+ *   lockstat <class> <acquisitions> <contended> <wait_total> <wait_max> <hold_total> <hold_max>
+ *   # end lockstat
+ */
+void lockstat_dump(void) {
+#if CONFIG_LOCKSTAT
+    char line[160];
+
+    serial_puts("# lockstat v1\n");
+    for (struct lock_class* cls = __atomic_load_n(&lockstat_classes, __ATOMIC_ACQUIRE);
+         cls != 0; cls = cls->next) {
+        struct lockstat s;
+
+        lockstat_get(cls, &s);
+        ksnprintf(line, sizeof(line), "lockstat %s %u %u %llu %llu %llu %llu\n",
+                  cls->name, s.acquisitions, s.contended, s.wait_total, s.wait_max,
+                  s.hold_total, s.hold_max);
+        serial_puts(line);
+    }
+    serial_puts("# end lockstat\n");
+#else
+    serial_puts("# lockstat disabled (built with CONFIG_LOCKSTAT=0)\n");
+#endif
+}
+
+/* ============================================================================
+ * Ticket Spinlocks
+ * ============================================================================
+ */
+
+void spin_lock_init(struct spinlock* lock, struct lock_class* cls) {
+    lock->val = 0;
+    lock->class = cls;
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = 0;
+#endif
+}
+
+/* Take a ticket and wait for it to be served (preemption already off) */
+static void spin_acquire(struct spinlock* lock) {
+#if CONFIG_LOCKSTAT
+    unsigned long long start = rdtsc();
+#endif
+    unsigned int old = __atomic_fetch_add(&lock->val, TICKET_ONE, __ATOMIC_ACQUIRE);
+    unsigned short ticket = (unsigned short)(old >> 16);
+    int contended = (unsigned short)old != ticket;
+
+    if (contended) {
+        while (__atomic_load_n(&lock->tickets.owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = rdtsc();
+    lockstat_acquired(lock->class, contended, lock->acquired_tsc - start);
+#endif
+}
+
+/* Serve the next ticket. Only the holder writes `owner`, so a plain
+ * increment with a release store is enough. */
+static void spin_release(struct spinlock* lock) {
+#if CONFIG_LOCKSTAT
+    lockstat_released(lock->class, rdtsc() - lock->acquired_tsc);
+#endif
+    __atomic_store_n(&lock->tickets.owner, (unsigned short)(lock->tickets.owner + 1),
+                     __ATOMIC_RELEASE);
+}
+
+void spin_lock(struct spinlock* lock) {
+    preempt_disable();
+    spin_acquire(lock);
+}
+
+void spin_unlock(struct spinlock* lock) {
+    spin_release(lock);
+    preempt_enable();
+}
+
+/* Take the lock if it is free */
+int spin_trylock(struct spinlock* lock) {
+    unsigned int old = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+
+    if ((old & 0xFFFF) != (old >> 16)) {
+        return 0;
+    }
+    preempt_disable();
+    if (!__atomic_compare_exchange_n(&lock->val, &old, old + TICKET_ONE, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        preempt_enable();
+        return 0;
+    }
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = rdtsc();
+    lockstat_acquired(lock->class, 0, 0);
+#endif
+    return 1;
+}
+
+/* Check whether the lock is held */
+int spin_is_locked(const struct spinlock* lock) {
+    unsigned int val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+
+    return (val & 0xFFFF) != (val >> 16);
+}
+
+unsigned int spin_lock_irqsave(struct spinlock* lock) {
+    unsigned int flags = irq_save();
+
+    preempt_disable();
+    spin_acquire(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(struct spinlock* lock, unsigned int flags) {
+    spin_release(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ============================================================================
+ * MCS Queue Locks
+ * ============================================================================
+ */
+
+void mcs_lock_init(struct mcs_lock* lock, struct lock_class* cls) {
+    lock->tail = 0;
+    lock->class = cls;
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = 0;
+#endif
+}
+
+/* Join the queue and wait for the predecessor's handoff */
+static void mcs_acquire(struct mcs_lock* lock, struct mcs_node* node) {
+#if CONFIG_LOCKSTAT
+    unsigned long long start = rdtsc();
+#endif
+    struct mcs_node* prev;
+
+    node->next = 0;
+    node->locked = 1;
+    prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != 0) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = rdtsc();
+    lockstat_acquired(lock->class, prev != 0, lock->acquired_tsc - start);
+#endif
+}
+
+/* Hand the lock to the next node, or mark it free if nobody waits */
+static void mcs_release(struct mcs_lock* lock, struct mcs_node* node) {
+    struct mcs_node* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+#if CONFIG_LOCKSTAT
+    lockstat_released(lock->class, rdtsc() - lock->acquired_tsc);
+#endif
+    if (next == 0) {
+        struct mcs_node* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, 0, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        /* A waiter swapped itself in but has not linked up yet */
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == 0) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+void mcs_lock(struct mcs_lock* lock, struct mcs_node* node) {
+    preempt_disable();
+    mcs_acquire(lock, node);
+}
+
+void mcs_unlock(struct mcs_lock* lock, struct mcs_node* node) {
+    mcs_release(lock, node);
+    preempt_enable();
+}
+
+unsigned int mcs_lock_irqsave(struct mcs_lock* lock, struct mcs_node* node) {
+    unsigned int flags = irq_save();
+
+    preempt_disable();
+    mcs_acquire(lock, node);
+    return flags;
+}
+
+void mcs_unlock_irqrestore(struct mcs_lock* lock, struct mcs_node* node, unsigned int flags) {
+    mcs_release(lock, node);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ============================================================================
+ * Reader-Writer Locks
+ * ============================================================================
+ */
+
+void rwlock_init(struct rwlock* lock, struct lock_class* cls) {
+    lock->count = 0;
+    lock->class = cls;
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = 0;
+#endif
+}
+
+/* Join the readers once no writer holds or waits for the lock */
+static void read_acquire(struct rwlock* lock) {
+#if CONFIG_LOCKSTAT
+    unsigned long long start = rdtsc();
+#endif
+    int contended = 0;
+
+    for (;;) {
+        unsigned int count = __atomic_load_n(&lock->count, __ATOMIC_RELAXED);
+        if (!(count & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+            __atomic_compare_exchange_n(&lock->count, &count, count + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        contended = 1;
+        cpu_relax();
+    }
+#if CONFIG_LOCKSTAT
+    lockstat_acquired(lock->class, contended, rdtsc() - start);
+#else
+    (void)contended;
+#endif
+}
+
+static void read_release(struct rwlock* lock) {
+    __atomic_fetch_sub(&lock->count, 1, __ATOMIC_RELEASE);
+}
+
+/* Take the lock once readers and other writers are gone. Meanwhile
+ * RWLOCK_WAITING stops new readers; the writer that gets the lock clears
+ * it, and any other waiting writer sets it again. */
+static void write_acquire(struct rwlock* lock) {
+#if CONFIG_LOCKSTAT
+    unsigned long long start = rdtsc();
+#endif
+    int contended = 0;
+
+    for (;;) {
+        unsigned int count = __atomic_load_n(&lock->count, __ATOMIC_RELAXED);
+        if ((count & ~RWLOCK_WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->count, &count, RWLOCK_WRITER, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (!(count & RWLOCK_WAITING)) {
+            __atomic_compare_exchange_n(&lock->count, &count, count | RWLOCK_WAITING, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        contended = 1;
+        cpu_relax();
+    }
+#if CONFIG_LOCKSTAT
+    lock->acquired_tsc = rdtsc();
+    lockstat_acquired(lock->class, contended, lock->acquired_tsc - start);
+#else
+    (void)contended;
+#endif
+}
+
+/* Drop the writer bit, keeping a WAITING flag another writer set */
+static void write_release(struct rwlock* lock) {
+#if CONFIG_LOCKSTAT
+    lockstat_released(lock->class, rdtsc() - lock->acquired_tsc);
+#endif
+    __atomic_fetch_and(&lock->count, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+void read_lock(struct rwlock* lock) {
+    preempt_disable();
+    read_acquire(lock);
+}
+
+void read_unlock(struct rwlock* lock) {
+    read_release(lock);
+    preempt_enable();
+}
+
+void write_lock(struct rwlock* lock) {
+    preempt_disable();
+    write_acquire(lock);
+}
+
+void write_unlock(struct rwlock* lock) {
+    write_release(lock);
+    preempt_enable();
+}
+
+unsigned int read_lock_irqsave(struct rwlock* lock) {
+    unsigned int flags = irq_save();
+
+    preempt_disable();
+    read_acquire(lock);
+    return flags;
+}
+
+void read_unlock_irqrestore(struct rwlock* lock, unsigned int flags) {
+    read_release(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+unsigned int write_lock_irqsave(struct rwlock* lock) {
+    unsigned int flags = irq_save();
+
+    preempt_disable();
+    write_acquire(lock);
+    return flags;
+}
+
+void write_unlock_irqrestore(struct rwlock* lock, unsigned int flags) {
+    write_release(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ============================================================================
+ * Self-Test
+ * ============================================================================
+ */
+
+#define LOCKTEST_ROUNDS 20000
+
+/* Every CPU bumps the counters under each kind of lock; a lost update
+ * means two CPUs were inside at once */
+static struct lock_class locktest_ticket_class = LOCK_CLASS_INIT("test-ticket");
+static struct lock_class locktest_mcs_class = LOCK_CLASS_INIT("test-mcs");
+static struct lock_class locktest_rw_class = LOCK_CLASS_INIT("test-rwlock");
+
+static struct spinlock locktest_ticket = SPINLOCK_INIT(&locktest_ticket_class);
+static struct mcs_lock locktest_mcs = MCS_LOCK_INIT(&locktest_mcs_class);
+static struct rwlock locktest_rw = RWLOCK_INIT(&locktest_rw_class);
+
+struct locktest {
+    unsigned int ticket_count;
+    unsigned int mcs_count;
+    unsigned int rw_count;
+    unsigned int rw_torn;             /* Readers that saw a half-done write */
+    unsigned int rw_shadow;
+};
+
+static struct locktest locktest;
+
+/* Runs on every CPU at once (smp_call_function_all) */
+static void locktest_fn(void* arg) {
+    struct locktest* t = arg;
+    struct mcs_node node;
+
+    for (unsigned int i = 0; i < LOCKTEST_ROUNDS; i++) {
+        spin_lock(&locktest_ticket);
+        t->ticket_count++;
+        spin_unlock(&locktest_ticket);
+
+        mcs_lock(&locktest_mcs, &node);
+        t->mcs_count++;
+        mcs_unlock(&locktest_mcs, &node);
+
+        /* One write in eight; readers check the writers' invariant */
+        if ((i & 7) == 0) {
+            write_lock(&locktest_rw);
+            t->rw_count++;
+            t->rw_shadow = t->rw_count;
+            write_unlock(&locktest_rw);
+        } else {
+            read_lock(&locktest_rw);
+            if (t->rw_shadow != t->rw_count) {
+                __atomic_fetch_add(&t->rw_torn, 1, __ATOMIC_RELAXED);
+            }
+            read_unlock(&locktest_rw);
+        }
+    }
+}
+
+static int spinlock_selftest(void) {
+    unsigned int cpus = smp_num_cpus();
+    unsigned int expected = cpus * LOCKTEST_ROUNDS;
+
+    locktest = (struct locktest){ 0 };
+    smp_call_function_all(locktest_fn, &locktest);
+
+    if (locktest.ticket_count != expected || locktest.mcs_count != expected ||
+        locktest.rw_count != expected / 8 || locktest.rw_torn != 0 ||
+        spin_is_locked(&locktest_ticket) || locktest_mcs.tail != 0 || locktest_rw.count != 0) {
+        debug_logf(LOG_ERROR, "spinlock: self-test FAILED on %u CPUs: ticket %u, mcs %u, rwlock %u (torn %u), expected %u",
+                   cpus, locktest.ticket_count, locktest.mcs_count, locktest.rw_count,
+                   locktest.rw_torn, expected);
+        return -1;
+    }
+    debug_logf(LOG_INFO, "spinlock: self-test ok, %u CPUs x %u rounds of ticket, mcs and rwlock",
+               cpus, LOCKTEST_ROUNDS);
+    return 0;
+}
+
+/* ============================================================================
+ * Benchmarks
+ * ============================================================================
+ */
+
+/* Uncontended acquire/release pairs */
+static struct spinlock bench_ticket;
+static struct mcs_lock bench_mcs;
+static struct rwlock bench_rw;
+
+static void bench_spin_lock(void) {
+    spin_lock(&bench_ticket);
+    spin_unlock(&bench_ticket);
+}
+
+static void bench_spin_lock_irqsave(void) {
+    unsigned int flags = spin_lock_irqsave(&bench_ticket);
+    spin_unlock_irqrestore(&bench_ticket, flags);
+}
+
+static void bench_mcs_lock(void) {
+    struct mcs_node node;
+
+    mcs_lock(&bench_mcs, &node);
+    mcs_unlock(&bench_mcs, &node);
+}
+
+static void bench_read_lock(void) {
+    read_lock(&bench_rw);
+    read_unlock(&bench_rw);
+}
+
+static void bench_write_lock(void) {
+    write_lock(&bench_rw);
+    write_unlock(&bench_rw);
+}
+
+static const struct bench spinlock_benches[] = {
+    { "spin_lock",         bench_spin_lock,         0, 0, 0, 0, 0 },
+    { "spin_lock_irqsave", bench_spin_lock_irqsave, 0, 0, 0, 0, 0 },
+    { "mcs_lock",          bench_mcs_lock,          0, 0, 0, 0, 0 },
+    { "read_lock",         bench_read_lock,         0, 0, 0, 0, 0 },
+    { "write_lock",        bench_write_lock,        0, 0, 0, 0, 0 },
+};
+
+/* Check the locks and register the lock benchmarks */
+int spinlock_init(void) {
+    if (bench_register(spinlock_benches, sizeof(spinlock_benches) / sizeof(spinlock_benches[0])) != 0) {
+        debug_warn("spinlock: benchmark table full");
+    }
+    return spinlock_selftest();
+}
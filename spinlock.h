@@ -0,0 +1,181 @@
+/*
+ * Spinlock Library Header
+ *
+ * Three kinds of busy-waiting locks, all of which disable preemption
+ * while held (sched.h) and so must never be held across a sleep:
+ *
+ *   struct spinlock  - ticket lock. Each CPU takes a ticket and waits for
+ *                      its number to be served, so waiters get the lock
+ *                      in arrival order. All waiters spin on the same
+ *                      cache line; fine for short, lightly contended
+ *                      sections.
+ *   struct mcs_lock  - MCS queue lock. Each waiter spins on its own queue
+ *                      node (usually on its stack) and the holder hands
+ *                      the lock to the next node directly, so a contended
+ *                      lock costs one cache-line transfer per handoff
+ *                      instead of one per waiter.
+ *   struct rwlock    - reader-writer lock. Readers share it; a waiting
+ *                      writer keeps new readers out so it cannot starve.
+ *
+ * Locks also taken from interrupt handlers must be taken with the
+ * *_irqsave variants everywhere else, or a handler can spin forever on a
+ * lock its own CPU holds.
+ *
+ * Lock statistics (make CONFIG_LOCKSTAT=1): every lock may name a lock
+ * class, and each class counts acquisitions, contended acquisitions, the
+ * cycles spent waiting and the cycles the lock was held. Locks of one
+ * class (every slab cache's lock, say) share the counters. A lock with
+ * no class (zero-initialized) is not counted. With CONFIG_LOCKSTAT=0 the
+ * counting code and the timestamp field are compiled out.
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "percpu.h"
+
+/* Disabled unless the build says otherwise (make CONFIG_LOCKSTAT=1) */
+#ifndef CONFIG_LOCKSTAT
+#define CONFIG_LOCKSTAT 0
+#endif
+
+/* Counters of one lock class on one CPU (cycles are TSC cycles) */
+struct lockstat {
+    unsigned int acquisitions;
+    unsigned int contended;           /* ... that found the lock taken */
+    unsigned long long wait_total;    /* Cycles spent spinning (contended only) */
+    unsigned long long wait_max;
+    unsigned long long hold_total;    /* Cycles from acquisition to release */
+    unsigned long long hold_max;
+};
+
+struct lock_class {
+    const char* name;
+#if CONFIG_LOCKSTAT
+    struct lock_class* next;          /* List of classes that have been used */
+    unsigned int registered;
+    struct lockstat stats[NR_CPUS];
+#endif
+};
+
+#define LOCK_CLASS_INIT(class_name) { .name = (class_name) }
+
+/* Every lock names its class; only lockstat needs the acquisition time */
+#if CONFIG_LOCKSTAT
+#define LOCKSTAT_FIELDS                                                      \
+    struct lock_class* class;                                                \
+    unsigned long long acquired_tsc;  /* When the holder got it */
+#define LOCKSTAT_INIT(cls) , (cls), 0
+#else
+#define LOCKSTAT_FIELDS                                                      \
+    struct lock_class* class;
+#define LOCKSTAT_INIT(cls) , (cls)
+#endif
+
+/* ============================================================================
+ * Ticket Spinlocks
+ * ============================================================================
+ */
+
+struct spinlock {
+    union {
+        unsigned int val;             /* Both halves, for spin_trylock() */
+        struct {
+            unsigned short owner;     /* Ticket being served */
+            unsigned short next;      /* Next ticket to hand out */
+        } tickets;
+    };
+    LOCKSTAT_FIELDS
+};
+
+/* Static initializer: struct spinlock lock = SPINLOCK_INIT(&lock_class); */
+#define SPINLOCK_INIT(cls) { { 0 } LOCKSTAT_INIT(cls) }
+
+void spin_lock_init(struct spinlock* lock, struct lock_class* cls);
+void spin_lock(struct spinlock* lock);
+void spin_unlock(struct spinlock* lock);
+
+/* Take the lock if it is free; returns 1 if it was taken */
+int spin_trylock(struct spinlock* lock);
+
+/* Check whether the lock is held (by anyone) */
+int spin_is_locked(const struct spinlock* lock);
+
+/* Disable interrupts, then take the lock; returns the saved EFLAGS */
+unsigned int spin_lock_irqsave(struct spinlock* lock);
+void spin_unlock_irqrestore(struct spinlock* lock, unsigned int flags);
+
+/* ============================================================================
+ * MCS Queue Locks
+ * ============================================================================
+ */
+
+/* One waiter's place in the queue, owned by the caller until unlock */
+struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile unsigned int locked;     /* Set while the owner must keep waiting */
+};
+
+struct mcs_lock {
+    struct mcs_node* tail;            /* Last waiter, or the holder, or 0 */
+    LOCKSTAT_FIELDS
+};
+
+#define MCS_LOCK_INIT(cls) { 0 LOCKSTAT_INIT(cls) }
+
+void mcs_lock_init(struct mcs_lock* lock, struct lock_class* cls);
+
+/* `node` must stay untouched until the matching unlock */
+void mcs_lock(struct mcs_lock* lock, struct mcs_node* node);
+void mcs_unlock(struct mcs_lock* lock, struct mcs_node* node);
+
+unsigned int mcs_lock_irqsave(struct mcs_lock* lock, struct mcs_node* node);
+void mcs_unlock_irqrestore(struct mcs_lock* lock, struct mcs_node* node, unsigned int flags);
+
+/* ============================================================================
+ * Reader-Writer Locks
+ * ============================================================================
+ */
+
+/* rwlock.count: number of readers, plus these flags */
+#define RWLOCK_WRITER   0x80000000u   /* A writer holds the lock */
+#define RWLOCK_WAITING  0x40000000u   /* A writer waits: no new readers */
+
+struct rwlock {
+    unsigned int count;
+    LOCKSTAT_FIELDS                   /* Hold times are the writers' only */
+};
+
+#define RWLOCK_INIT(cls) { 0 LOCKSTAT_INIT(cls) }
+
+void rwlock_init(struct rwlock* lock, struct lock_class* cls);
+void read_lock(struct rwlock* lock);
+void read_unlock(struct rwlock* lock);
+void write_lock(struct rwlock* lock);
+void write_unlock(struct rwlock* lock);
+
+unsigned int read_lock_irqsave(struct rwlock* lock);
+void read_unlock_irqrestore(struct rwlock* lock, unsigned int flags);
+unsigned int write_lock_irqsave(struct rwlock* lock);
+void write_unlock_irqrestore(struct rwlock* lock, unsigned int flags);
+
+/* ============================================================================
+ * Statistics and Self-Test
+ * ============================================================================
+ */
+
+/* Sum a class's counters over all CPUs (all zero without CONFIG_LOCKSTAT) */
+void lockstat_get(const struct lock_class* cls, struct lockstat* out);
+
+/* Zero the counters of every class */
+void lockstat_reset(void);
+
+/* Dump every class that has been used as a machine-readable table over
+ * serial */
+void lockstat_dump(void);
+
+/* Check every lock kind under contention from all online CPUs and
+ * register the lock benchmarks (after smp_init). Returns 0 on success. */
+int spinlock_init(void);
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,626 @@
+/*
+ * Kernel String Routines Implementation
+ *
+ * memcpy/memset/memmove are thin front ends: copies of up to
+ * STRING_SMALL_MAX bytes are done inline, everything larger goes through a
+ * function pointer bound once by string_init(). The implementations behind
+ * the pointers are kept separately callable so the self-test and the
+ * benchmarks can exercise every one of them, not just the chosen one.
+ *
+ * This file is compiled with -fno-tree-loop-distribute-patterns: otherwise
+ * GCC may turn the byte loops below back into calls to memcpy/memset.
+ */
+
+#include "string.h"
+#include "cpufeature.h"
+#include "fpu.h"
+#include "bench.h"
+#include "debug.h"
+
+typedef void* (*memcpy_fn)(void* dest, const void* src, unsigned int n);
+typedef void* (*memset_fn)(void* dest, int c, unsigned int n);
+
+/* Unaligned, aliasing accesses for the small-size paths */
+typedef unsigned int unaligned_u32 __attribute__((may_alias, aligned(1)));
+
+/* ============================================================================
+ * Small Sizes (0..STRING_SMALL_MAX)
+ * ============================================================================
+ */
+
+/* Copy with two to four possibly overlapping moves. All loads happen
+ * before the first store, so this is also a correct memmove. */
+static inline void copy_small(unsigned char* d, const unsigned char* s, unsigned int n) {
+    if (n >= 8) {
+        unsigned int a = *(const unaligned_u32*)s;
+        unsigned int b = *(const unaligned_u32*)(s + 4);
+        unsigned int c = *(const unaligned_u32*)(s + n - 8);
+        unsigned int e = *(const unaligned_u32*)(s + n - 4);
+        *(unaligned_u32*)d = a;
+        *(unaligned_u32*)(d + 4) = b;
+        *(unaligned_u32*)(d + n - 8) = c;
+        *(unaligned_u32*)(d + n - 4) = e;
+    } else if (n >= 4) {
+        unsigned int a = *(const unaligned_u32*)s;
+        unsigned int b = *(const unaligned_u32*)(s + n - 4);
+        *(unaligned_u32*)d = a;
+        *(unaligned_u32*)(d + n - 4) = b;
+    } else if (n != 0) {
+        /* 1..3 bytes: first, middle and last cover every case */
+        unsigned char a = s[0];
+        unsigned char b = s[n >> 1];
+        unsigned char c = s[n - 1];
+        d[0] = a;
+        d[n >> 1] = b;
+        d[n - 1] = c;
+    }
+}
+
+/* Fill the same way */
+static inline void set_small(unsigned char* d, unsigned int pattern, unsigned int n) {
+    if (n >= 8) {
+        *(unaligned_u32*)d = pattern;
+        *(unaligned_u32*)(d + 4) = pattern;
+        *(unaligned_u32*)(d + n - 8) = pattern;
+        *(unaligned_u32*)(d + n - 4) = pattern;
+    } else if (n >= 4) {
+        *(unaligned_u32*)d = pattern;
+        *(unaligned_u32*)(d + n - 4) = pattern;
+    } else if (n != 0) {
+        d[0] = (unsigned char)pattern;
+        d[n >> 1] = (unsigned char)pattern;
+        d[n - 1] = (unsigned char)pattern;
+    }
+}
+
+/* ============================================================================
+ * String Instructions
+ * ============================================================================
+ */
+
+/* A dword at a time, then the 0-3 byte tail. Copies upwards, so it is
+ * also safe when `dest` is below an overlapping `src`. */
+static void* memcpy_movsl(void* dest, const void* src, unsigned int n) {
+    void* ret = dest;
+    unsigned int words = n >> 2;
+    unsigned int bytes = n & 3;
+
+    __asm__ volatile ("rep movsl"
+                      : "+D"(dest), "+S"(src), "+c"(words)
+                      :
+                      : "memory");
+    __asm__ volatile ("rep movsb"
+                      : "+D"(dest), "+S"(src), "+c"(bytes)
+                      :
+                      : "memory");
+    return ret;
+}
+
+/* With ERMS the microcode moves whole cache lines for rep movsb, and it
+ * beats any loop we could write once past its start-up cost */
+static void* memcpy_erms(void* dest, const void* src, unsigned int n) {
+    void* ret = dest;
+
+    __asm__ volatile ("rep movsb"
+                      : "+D"(dest), "+S"(src), "+c"(n)
+                      :
+                      : "memory");
+    return ret;
+}
+
+static void* memset_stosl(void* dest, int c, unsigned int n) {
+    void* ret = dest;
+    unsigned int pattern = (unsigned char)c * 0x01010101u;
+    unsigned int words = n >> 2;
+    unsigned int bytes = n & 3;
+
+    __asm__ volatile ("rep stosl"
+                      : "+D"(dest), "+c"(words)
+                      : "a"(pattern)
+                      : "memory");
+    __asm__ volatile ("rep stosb"
+                      : "+D"(dest), "+c"(bytes)
+                      : "a"(pattern)
+                      : "memory");
+    return ret;
+}
+
+static void* memset_erms(void* dest, int c, unsigned int n) {
+    void* ret = dest;
+
+    __asm__ volatile ("rep stosb"
+                      : "+D"(dest), "+c"(n)
+                      : "a"(c)
+                      : "memory");
+    return ret;
+}
+
+/* Copy downwards, for a `dest` above an overlapping `src`: the 0-3 byte
+ * tail first, then dwords with the direction flag set. Interrupt entry
+ * clears DF (isr_common), so handlers never see it set. */
+static void* memmove_backward(void* dest, const void* src, unsigned int n) {
+    unsigned char* d = (unsigned char*)dest + n;
+    const unsigned char* s = (const unsigned char*)src + n;
+    unsigned int words = n >> 2;
+    unsigned int bytes = n & 3;
+
+    while (bytes--) {
+        *--d = *--s;
+    }
+    d -= 4;
+    s -= 4;
+    __asm__ volatile ("std\n\t"
+                      "rep movsl\n\t"
+                      "cld"
+                      : "+D"(d), "+S"(s), "+c"(words)
+                      :
+                      : "memory");
+    return dest;
+}
+
+/* ============================================================================
+ * SSE2
+ * ============================================================================
+ */
+
+/* SSE code runs inside kernel_fpu_begin/end (fpu.h). A caller that cannot
+ * have the registers (an interrupt or fault that arrived in the middle of
+ * another SSE copy, or no FPU yet) gets the integer version instead. The
+ * kernel is compiled without SSE code generation, so GCC neither uses the
+ * XMM registers nor lets the asm below name them as clobbers. */
+
+/* Align the destination to 16 bytes with dword moves, then copy 64 bytes
+ * per iteration: unaligned loads, aligned stores. Each block is loaded in
+ * full before it is stored, so a `dest` below `src` is fine here too. */
+static void* memcpy_sse2(void* dest, const void* src, unsigned int n) {
+    unsigned char* d = dest;
+    const unsigned char* s = src;
+    unsigned int head, blocks;
+
+    if (n < 64 || !kernel_fpu_usable()) {
+        return memcpy_movsl(dest, src, n);
+    }
+
+    head = (0u - (unsigned int)d) & 15;
+    memcpy_movsl(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    blocks = n >> 6;
+    kernel_fpu_begin();
+    if (blocks != 0) {
+        __asm__ volatile ("1:\n\t"
+                          "movdqu   (%1), %%xmm0\n\t"
+                          "movdqu 16(%1), %%xmm1\n\t"
+                          "movdqu 32(%1), %%xmm2\n\t"
+                          "movdqu 48(%1), %%xmm3\n\t"
+                          "movdqa %%xmm0,   (%0)\n\t"
+                          "movdqa %%xmm1, 16(%0)\n\t"
+                          "movdqa %%xmm2, 32(%0)\n\t"
+                          "movdqa %%xmm3, 48(%0)\n\t"
+                          "addl $64, %1\n\t"
+                          "addl $64, %0\n\t"
+                          "decl %2\n\t"
+                          "jnz 1b"
+                          : "+r"(d), "+r"(s), "+r"(blocks)
+                          :
+                          : "memory", "cc");
+    }
+    kernel_fpu_end();
+
+    memcpy_movsl(d, s, n & 63);
+    return dest;
+}
+
+/* Fill with non-temporal stores: the lines go straight to memory instead
+ * of displacing the cache, which is what a page clear wants. The sfence
+ * orders the weakly-ordered stores before anything that follows. */
+static void* memset_sse2(void* dest, int c, unsigned int n) {
+    unsigned char* d = dest;
+    unsigned int pattern = (unsigned char)c * 0x01010101u;
+    unsigned int head, blocks;
+
+    if (n < 64 || !kernel_fpu_usable()) {
+        return memset_stosl(dest, c, n);
+    }
+
+    head = (0u - (unsigned int)d) & 15;
+    memset_stosl(d, c, head);
+    d += head;
+    n -= head;
+
+    blocks = n >> 6;
+    kernel_fpu_begin();
+    if (blocks != 0) {
+        __asm__ volatile ("movd %2, %%xmm0\n\t"
+                          "pshufd $0, %%xmm0, %%xmm0\n\t"
+                          "1:\n\t"
+                          "movntdq %%xmm0,   (%0)\n\t"
+                          "movntdq %%xmm0, 16(%0)\n\t"
+                          "movntdq %%xmm0, 32(%0)\n\t"
+                          "movntdq %%xmm0, 48(%0)\n\t"
+                          "addl $64, %0\n\t"
+                          "decl %1\n\t"
+                          "jnz 1b\n\t"
+                          "sfence"
+                          : "+r"(d), "+r"(blocks)
+                          : "r"(pattern)
+                          : "memory", "cc");
+    }
+    kernel_fpu_end();
+
+    memset_stosl(d, c, n & 63);
+    return dest;
+}
+
+/* ============================================================================
+ * Dispatch
+ * ============================================================================
+ */
+
+/* Bound by string_init(); the defaults work on any CPU */
+static memcpy_fn memcpy_bulk = memcpy_movsl;   /* > STRING_SMALL_MAX */
+static memcpy_fn memcpy_wide = memcpy_movsl;   /* >= STRING_SSE_MIN */
+static memset_fn memset_bulk = memset_stosl;   /* > STRING_SMALL_MAX */
+static memset_fn memset_huge = memset_stosl;   /* >= STRING_NT_MIN */
+
+/* Copy `n` bytes; the areas must not overlap */
+void* memcpy(void* dest, const void* src, unsigned int n) {
+    if (n <= STRING_SMALL_MAX) {
+        copy_small(dest, src, n);
+        return dest;
+    }
+    if (n >= STRING_SSE_MIN) {
+        return memcpy_wide(dest, src, n);
+    }
+    return memcpy_bulk(dest, src, n);
+}
+
+/* Copy `n` bytes; the areas may overlap */
+void* memmove(void* dest, const void* src, unsigned int n) {
+    /* Unsigned distance: anything but a `dest` inside (src, src + n)
+     * can be copied upwards, and every memcpy variant copies upwards */
+    if ((unsigned int)dest - (unsigned int)src >= n) {
+        return memcpy(dest, src, n);
+    }
+    if (n <= STRING_SMALL_MAX) {
+        copy_small(dest, src, n);
+        return dest;
+    }
+    return memmove_backward(dest, src, n);
+}
+
+/* Fill `n` bytes with the byte `c` */
+void* memset(void* dest, int c, unsigned int n) {
+    if (n <= STRING_SMALL_MAX) {
+        set_small(dest, (unsigned char)c * 0x01010101u, n);
+        return dest;
+    }
+    if (n >= STRING_NT_MIN) {
+        return memset_huge(dest, c, n);
+    }
+    return memset_bulk(dest, c, n);
+}
+
+/* ============================================================================
+ * Variants
+ * ============================================================================
+ */
+
+/* Every implementation, with the feature it needs in order to run at all
+ * (-1 for none). rep movsb/stosb run everywhere; ERMS only makes them fast. */
+struct memcpy_variant {
+    const char* name;
+    int feature;
+    memcpy_fn fn;
+};
+
+struct memset_variant {
+    const char* name;
+    int feature;
+    memset_fn fn;
+};
+
+static const struct memcpy_variant memcpy_variants[] = {
+    { "movsl", -1,                memcpy_movsl },
+    { "erms",  -1,                memcpy_erms },
+    { "sse2",  X86_FEATURE_SSE2,  memcpy_sse2 },
+};
+
+static const struct memset_variant memset_variants[] = {
+    { "stosl", -1,                memset_stosl },
+    { "erms",  -1,                memset_erms },
+    { "sse2",  X86_FEATURE_SSE2,  memset_sse2 },
+};
+
+#define STRING_VARIANTS 3
+
+static int variant_usable(int feature) {
+    return feature < 0 || cpu_has((unsigned int)feature);
+}
+
+/* ============================================================================
+ * Benchmarks
+ * ============================================================================
+ */
+
+/* One benchmark per variant and size class. They are informational (no
+ * pass limit): the numbers are for comparing variants on a given CPU. */
+#define STRING_BENCH_MAX   (1u << 16)
+
+static unsigned char bench_src[STRING_BENCH_MAX + 64] __attribute__((aligned(4096)));
+static unsigned char bench_dst[STRING_BENCH_MAX + 64] __attribute__((aligned(4096)));
+
+#define STRING_BENCH(variant, size)                                       \
+    static void bench_memcpy_##variant##_##size(void) {                   \
+        memcpy_##variant(bench_dst, bench_src, size);                     \
+    }
+
+#define STRING_BENCH_SET(variant, size)                                   \
+    static void bench_memset_##variant##_##size(void) {                   \
+        memset_##variant(bench_dst, 0, size);                             \
+    }
+
+#define STRING_BENCH_SIZES(bench, variant)                                \
+    bench(variant, 64) bench(variant, 512) bench(variant, 4096) bench(variant, 65536)
+
+STRING_BENCH_SIZES(STRING_BENCH, movsl)
+STRING_BENCH_SIZES(STRING_BENCH, erms)
+STRING_BENCH_SIZES(STRING_BENCH, sse2)
+STRING_BENCH_SIZES(STRING_BENCH_SET, stosl)
+STRING_BENCH_SIZES(STRING_BENCH_SET, erms)
+STRING_BENCH_SIZES(STRING_BENCH_SET, sse2)
+
+/* The public memmove with overlap in both directions */
+static void bench_memmove_up_4096(void) {
+    memmove(bench_dst + 64, bench_dst, 4096);
+}
+
+static void bench_memmove_down_4096(void) {
+    memmove(bench_dst, bench_dst + 64, 4096);
+}
+
+/* 64 KB runs are long under emulation: fewer samples */
+#define STRING_BENCH_ENTRY(op, variant, size)                             \
+    { #op "_" #variant "_" #size, bench_##op##_##variant##_##size, 0,     \
+      size, (size) > 4096 ? 2 : 0, (size) > 4096 ? 32 : 0, 0 }
+
+#define STRING_BENCH_ROW(op, variant)                                     \
+    STRING_BENCH_ENTRY(op, variant, 64), STRING_BENCH_ENTRY(op, variant, 512), \
+    STRING_BENCH_ENTRY(op, variant, 4096), STRING_BENCH_ENTRY(op, variant, 65536)
+
+#define STRING_BENCH_CLASSES 4
+
+/* Rows in memcpy_variants/memset_variants order */
+static const struct bench memcpy_bench_rows[STRING_VARIANTS][STRING_BENCH_CLASSES] = {
+    { STRING_BENCH_ROW(memcpy, movsl) },
+    { STRING_BENCH_ROW(memcpy, erms) },
+    { STRING_BENCH_ROW(memcpy, sse2) },
+};
+
+static const struct bench memset_bench_rows[STRING_VARIANTS][STRING_BENCH_CLASSES] = {
+    { STRING_BENCH_ROW(memset, stosl) },
+    { STRING_BENCH_ROW(memset, erms) },
+    { STRING_BENCH_ROW(memset, sse2) },
+};
+
+static struct bench string_benches[2 * STRING_VARIANTS * STRING_BENCH_CLASSES + 2];
+
+/* Register the benchmarks of every variant this CPU can run */
+static void string_bench_register(void) {
+    unsigned int count = 0;
+
+    for (unsigned int v = 0; v < STRING_VARIANTS; v++) {
+        if (!variant_usable(memcpy_variants[v].feature)) {
+            continue;
+        }
+        for (unsigned int i = 0; i < STRING_BENCH_CLASSES; i++) {
+            string_benches[count++] = memcpy_bench_rows[v][i];
+        }
+    }
+    for (unsigned int v = 0; v < STRING_VARIANTS; v++) {
+        if (!variant_usable(memset_variants[v].feature)) {
+            continue;
+        }
+        for (unsigned int i = 0; i < STRING_BENCH_CLASSES; i++) {
+            string_benches[count++] = memset_bench_rows[v][i];
+        }
+    }
+    string_benches[count++] = (struct bench){ "memmove_up_4096", bench_memmove_up_4096,
+                                              0, 4096, 0, 0, 0 };
+    string_benches[count++] = (struct bench){ "memmove_down_4096", bench_memmove_down_4096,
+                                              0, 4096, 0, 0, 0 };
+
+    if (bench_register(string_benches, count) != 0) {
+        debug_warn("string: benchmark table full\n");
+    }
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================
+ */
+
+/* Bind the fastest implementations for this CPU */
+void string_init(void) {
+    if (cpu_has(X86_FEATURE_ERMS)) {
+        memcpy_bulk = memcpy_erms;
+        memcpy_wide = memcpy_erms;
+        memset_bulk = memset_erms;
+        memset_huge = memset_erms;
+    } else {
+        memcpy_bulk = memcpy_movsl;
+        memcpy_wide = memcpy_movsl;
+        memset_bulk = memset_stosl;
+        memset_huge = memset_stosl;
+        if (cpu_has(X86_FEATURE_SSE2)) {
+            memcpy_wide = memcpy_sse2;
+        }
+    }
+    /* Non-temporal stores win for page-sized clears even over ERMS */
+    if (cpu_has(X86_FEATURE_SSE2)) {
+        memset_huge = memset_sse2;
+    }
+
+    string_bench_register();
+
+    debug_logf(LOG_INFO, "string: memcpy %s/%s, memset %s/%s",
+               memcpy_bulk == memcpy_erms ? "erms" : "movsl",
+               memcpy_wide == memcpy_erms ? "erms" : memcpy_wide == memcpy_sse2 ? "sse2" : "movsl",
+               memset_bulk == memset_erms ? "erms" : "stosl",
+               memset_huge == memset_sse2 ? "sse2-nt" : memset_huge == memset_erms ? "erms" : "stosl");
+}
+
+/* ============================================================================
+ * Self-Test
+ * ============================================================================
+ */
+
+#define TEST_GUARD  32
+#define TEST_FILL   0xCC
+#define TEST_BUF    (2 * TEST_GUARD + 16 + 8192)
+
+static unsigned char test_src[TEST_BUF] __attribute__((aligned(16)));
+static unsigned char test_dst[TEST_BUF] __attribute__((aligned(16)));
+
+static const unsigned int test_sizes[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 12, 15, 16, 17, 24, 31, 32, 33,
+    47, 63, 64, 65, 100, 127, 128, 129, 255, 256, 257, 511, 1000,
+    4095, 4096, 4097, 5000, 8192,
+};
+
+static const unsigned int test_dst_aligns[] = { 0, 1, 2, 3, 4, 7, 8, 15 };
+static const unsigned int test_src_aligns[] = { 0, 1, 3 };
+static const int test_shifts[] = { -65, -33, -16, -5, -1, 1, 4, 7, 16, 33, 65 };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Reference pattern: differs between nearby offsets and across 256 */
+static unsigned char test_pattern(unsigned int x) {
+    return (unsigned char)(x * 7 + (x >> 8) * 13 + 3);
+}
+
+/* Check a result window: `n` bytes at `off` as expected, guards intact */
+static int test_check_copy(unsigned int off, unsigned int src_off, unsigned int n) {
+    for (unsigned int i = off - TEST_GUARD; i < off; i++) {
+        if (test_dst[i] != TEST_FILL) return 0;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        if (test_dst[off + i] != test_pattern(src_off + i)) return 0;
+    }
+    for (unsigned int i = off + n; i < off + n + TEST_GUARD; i++) {
+        if (test_dst[i] != TEST_FILL) return 0;
+    }
+    return 1;
+}
+
+static int test_check_set(unsigned int off, unsigned int n, unsigned char c) {
+    for (unsigned int i = off - TEST_GUARD; i < off + n + TEST_GUARD; i++) {
+        unsigned char want = (i >= off && i < off + n) ? c : TEST_FILL;
+        if (test_dst[i] != want) return 0;
+    }
+    return 1;
+}
+
+static void test_reset(unsigned int off, unsigned int n) {
+    for (unsigned int i = off - TEST_GUARD; i < off + n + TEST_GUARD; i++) {
+        test_dst[i] = TEST_FILL;
+    }
+}
+
+/* Overlapping memmove within test_dst: before the call every byte holds
+ * test_pattern(index); after it only [d, d + n) changed */
+static int test_memmove(unsigned int d, unsigned int s, unsigned int n) {
+    unsigned int lo = (d < s ? d : s) - TEST_GUARD;
+    unsigned int hi = (d > s ? d : s) + n + TEST_GUARD;
+
+    for (unsigned int i = lo; i < hi; i++) {
+        test_dst[i] = test_pattern(i);
+    }
+    if (memmove(test_dst + d, test_dst + s, n) != test_dst + d) {
+        return 0;
+    }
+    for (unsigned int i = lo; i < hi; i++) {
+        unsigned char want = (i >= d && i < d + n) ? test_pattern(i - d + s) : test_pattern(i);
+        if (test_dst[i] != want) return 0;
+    }
+    return 1;
+}
+
+/* Check every implementation against the byte-by-byte reference */
+unsigned int string_selftest(void) {
+    unsigned int cases = 0;
+    unsigned int failures = 0;
+
+    for (unsigned int i = 0; i < TEST_BUF; i++) {
+        test_src[i] = test_pattern(i);
+    }
+
+    for (unsigned int z = 0; z < ARRAY_SIZE(test_sizes); z++) {
+        unsigned int n = test_sizes[z];
+
+        for (unsigned int a = 0; a < ARRAY_SIZE(test_dst_aligns); a++) {
+            unsigned int off = TEST_GUARD + test_dst_aligns[a];
+
+            /* memcpy: each variant and the public entry point */
+            for (unsigned int b = 0; b < ARRAY_SIZE(test_src_aligns); b++) {
+                unsigned int src_off = TEST_GUARD + test_src_aligns[b];
+
+                for (unsigned int v = 0; v <= STRING_VARIANTS; v++) {
+                    memcpy_fn fn = v < STRING_VARIANTS ? memcpy_variants[v].fn : memcpy;
+                    const char* name = v < STRING_VARIANTS ? memcpy_variants[v].name : "memcpy";
+
+                    if (v < STRING_VARIANTS && !variant_usable(memcpy_variants[v].feature)) {
+                        continue;
+                    }
+                    test_reset(off, n);
+                    cases++;
+                    if (fn(test_dst + off, test_src + src_off, n) != test_dst + off ||
+                        !test_check_copy(off, src_off, n)) {
+                        failures++;
+                        debug_logf(LOG_ERROR, "string: memcpy %s failed: n=%u dst+%u src+%u",
+                                   name, n, test_dst_aligns[a], test_src_aligns[b]);
+                    }
+                }
+            }
+
+            /* memset */
+            for (unsigned int v = 0; v <= STRING_VARIANTS; v++) {
+                memset_fn fn = v < STRING_VARIANTS ? memset_variants[v].fn : memset;
+                const char* name = v < STRING_VARIANTS ? memset_variants[v].name : "memset";
+                unsigned char c = (unsigned char)(0x5A + v);
+
+                if (v < STRING_VARIANTS && !variant_usable(memset_variants[v].feature)) {
+                    continue;
+                }
+                test_reset(off, n);
+                cases++;
+                if (fn(test_dst + off, c, n) != test_dst + off || !test_check_set(off, n, c)) {
+                    failures++;
+                    debug_logf(LOG_ERROR, "string: memset %s failed: n=%u dst+%u",
+                               name, n, test_dst_aligns[a]);
+                }
+            }
+        }
+
+        /* memmove with the areas overlapping both ways */
+        if (n > TEST_BUF - 2 * TEST_GUARD - 2 * 65) {
+            continue;
+        }
+        for (unsigned int k = 0; k < ARRAY_SIZE(test_shifts); k++) {
+            unsigned int s = TEST_GUARD + 65 + 1;
+            unsigned int d = (unsigned int)((int)s + test_shifts[k]);
+
+            cases++;
+            if (!test_memmove(d, s, n)) {
+                failures++;
+                debug_logf(LOG_ERROR, "string: memmove failed: n=%u shift=%d", n, test_shifts[k]);
+            }
+        }
+    }
+
+    debug_logf(failures ? LOG_ERROR : LOG_INFO, "string: self-test %u cases, %u failed",
+               cases, failures);
+    return failures;
+}
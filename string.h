@@ -0,0 +1,48 @@
+/*
+ * Kernel String Routines Header
+ *
+ * The kernel is built freestanding (-ffreestanding -fno-builtin), so it
+ * supplies its own memory routines. GCC may also emit calls to memcpy and
+ * memset for structure copies and initializers, so these names must exist.
+ *
+ * Every routine has a few implementations, and string_init() binds the best
+ * ones for the CPU once at boot (after cpu_features_init):
+ *   - up to STRING_SMALL_MAX bytes: a few overlapping loads and stores,
+ *     with no loop and no string instruction start-up cost
+ *   - memcpy/memset: rep movsb/stosb when the CPU has ERMS, otherwise
+ *     rep movsl/stosl plus a byte tail
+ *   - memcpy of at least STRING_SSE_MIN bytes without ERMS: SSE2, 64 bytes
+ *     per iteration into a 16-byte aligned destination
+ *   - memset of at least STRING_NT_MIN bytes (page clears) with SSE2:
+ *     non-temporal stores, so the zeroes do not evict the cache
+ *   - memmove: forward through memcpy unless the destination overlaps the
+ *     end of the source, then backwards
+ * Until string_init() runs, the generic rep movsl/stosl versions are used.
+ */
+
+#ifndef STRING_H
+#define STRING_H
+
+/* Size-class boundaries */
+#define STRING_SMALL_MAX  16
+#define STRING_SSE_MIN    256
+#define STRING_NT_MIN     4096
+
+/* Copy `n` bytes; the areas must not overlap. Returns `dest`. */
+void* memcpy(void* dest, const void* src, unsigned int n);
+
+/* Copy `n` bytes; the areas may overlap. Returns `dest`. */
+void* memmove(void* dest, const void* src, unsigned int n);
+
+/* Fill `n` bytes with the byte `c`. Returns `dest`. */
+void* memset(void* dest, int c, unsigned int n);
+
+/* Bind the fastest implementations for this CPU and register their
+ * benchmarks (bench.h) */
+void string_init(void);
+
+/* Check every implementation against a byte-by-byte reference over many
+ * sizes and alignments. Returns the number of failed cases. */
+unsigned int string_selftest(void);
+
+#endif /* STRING_H */
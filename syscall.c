@@ -0,0 +1,238 @@
+/*
+ * System Call Implementation
+ *
+ * syscall_table[] maps call numbers to handlers taking up to three
+ * arguments. Pointers from user space are checked with user_access_ok()
+ * before the kernel touches them, so a bad pointer fails the call instead
+ * of faulting in ring 0.
+ *
+ * The null-call benchmarks time SYS_getpid from a user task, once through
+ * each entry path: "syscall_sysenter" and "syscall_int80".
+ */
+
+#include "syscall.h"
+#include "user.h"
+#include "sched.h"
+#include "smp.h"
+#include "idt.h"
+#include "percpu.h"
+#include "cpufeature.h"
+#include "cpu.h"
+#include "bench.h"
+#include "bench_thresholds.h"
+#include "string.h"
+#include "debug.h"
+
+static int sysenter_enabled = 0;
+static syscall_read_fn_t stdin_read = 0;
+static struct syscall_stats stats;
+
+/* ============================================================================
+ * Calls
+ * ============================================================================
+ */
+
+static int sys_exit(unsigned int code, unsigned int arg1, unsigned int arg2) {
+    (void)arg1;
+    (void)arg2;
+    user_task_exit((int)code);
+}
+
+/* fd 0 reads from the stdin source, if any */
+static int sys_read(unsigned int fd, unsigned int buf, unsigned int len) {
+    if (fd != 0 || !user_access_ok((void*)buf, len, 1)) {
+        return -1;
+    }
+    if (stdin_read == 0 || len == 0) {
+        return 0;
+    }
+    return (int)stdin_read((char*)buf, len);
+}
+
+/* fd 1 and 2 go to the console */
+static int sys_write(unsigned int fd, unsigned int buf, unsigned int len) {
+    const char* src = (const char*)buf;
+    char chunk[128];
+    unsigned int done = 0;
+
+    if ((fd != 1 && fd != 2) || !user_access_ok(src, len, 0)) {
+        return -1;
+    }
+    while (done < len) {
+        unsigned int n = len - done;
+        if (n > sizeof(chunk) - 1) {
+            n = sizeof(chunk) - 1;
+        }
+        memcpy(chunk, src + done, n);
+        chunk[n] = '\0';
+        debug_puts(chunk);
+        done += n;
+    }
+    return (int)len;
+}
+
+static int sys_getpid(unsigned int arg0, unsigned int arg1, unsigned int arg2) {
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    return (int)thread_current()->id;
+}
+
+static const syscall_fn_t syscall_table[SYSCALL_MAX] = {
+    [SYS_exit]   = sys_exit,
+    [SYS_read]   = sys_read,
+    [SYS_write]  = sys_write,
+    [SYS_getpid] = sys_getpid,
+};
+
+/* ============================================================================
+ * Dispatch
+ * ============================================================================
+ */
+
+/* Common C entry point, called by both entry stubs */
+void syscall_dispatch(struct syscall_frame* frame) {
+    unsigned int nr = frame->eax;
+
+    if (frame->eip == (unsigned int)user_sysenter_return) {
+        __atomic_fetch_add(&stats.sysenter, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&stats.int80, 1, __ATOMIC_RELAXED);
+    }
+
+    if (nr >= SYSCALL_MAX || syscall_table[nr] == 0) {
+        __atomic_fetch_add(&stats.bad, 1, __ATOMIC_RELAXED);
+        frame->eax = (unsigned int)-1;
+    } else {
+        frame->eax = (unsigned int)syscall_table[nr](frame->ebx, frame->ecx, frame->edx);
+    }
+
+    /* A wakeup during the call may be due */
+    if (sched_need_resched()) {
+        schedule();
+    }
+}
+
+/* Set the source of SYS_read data */
+void syscall_set_stdin(syscall_read_fn_t fn) {
+    stdin_read = fn;
+}
+
+/* Check whether SYSENTER is in use */
+int syscall_has_sysenter(void) {
+    return sysenter_enabled;
+}
+
+/* Get a snapshot of the counters */
+void syscall_get_stats(struct syscall_stats* out) {
+    unsigned int flags = irq_save();
+
+    *out = stats;
+    irq_restore(flags);
+}
+
+/* Print the counters */
+void syscall_dump_stats(void) {
+    struct syscall_stats s;
+
+    syscall_get_stats(&s);
+    debug_logf(LOG_INFO, "syscall: %u via sysenter, %u via int 0x80, %u bad",
+               s.sysenter, s.int80, s.bad);
+}
+
+/* ============================================================================
+ * Benchmarks
+ * ============================================================================
+ */
+
+/* Cycles of each timed call, written from ring 3 */
+static unsigned int bench_cycles[BENCH_MAX_SAMPLES] USER_BSS;
+
+static inline __attribute__((always_inline)) unsigned int user_rdtsc(void) {
+    unsigned int lo;
+    __asm__ volatile ("rdtsc" : "=a"(lo) : : "edx");
+    return lo;
+}
+
+/* Ring 3: time `count` getpid calls after a warmup */
+USER_TEXT static int bench_getpid_sysenter(unsigned int count) {
+    for (unsigned int i = 0; i < BENCH_WARMUP; i++) {
+        user_syscall_sysenter(SYS_getpid, 0, 0, 0);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int start = user_rdtsc();
+        user_syscall_sysenter(SYS_getpid, 0, 0, 0);
+        bench_cycles[i] = user_rdtsc() - start;
+    }
+    return 0;
+}
+
+USER_TEXT static int bench_getpid_int80(unsigned int count) {
+    for (unsigned int i = 0; i < BENCH_WARMUP; i++) {
+        user_syscall_int80(SYS_getpid, 0, 0, 0);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int start = user_rdtsc();
+        user_syscall_int80(SYS_getpid, 0, 0, 0);
+        bench_cycles[i] = user_rdtsc() - start;
+    }
+    return 0;
+}
+
+/* Run one of the above in a user task and hand its samples over */
+static unsigned int bench_sample_task(user_fn_t fn, unsigned int* samples, unsigned int count) {
+    int task = user_task_create("bench", fn, count);
+
+    if (task < 0 || user_task_wait(task) != 0) {
+        return 0;
+    }
+    memcpy(samples, bench_cycles, count * sizeof(samples[0]));
+    return count;
+}
+
+static unsigned int bench_sysenter(unsigned int* samples, unsigned int count) {
+    if (!sysenter_enabled) {
+        return 0;
+    }
+    return bench_sample_task(bench_getpid_sysenter, samples, count);
+}
+
+static unsigned int bench_int80(unsigned int* samples, unsigned int count) {
+    return bench_sample_task(bench_getpid_int80, samples, count);
+}
+
+static const struct bench_sampler syscall_benches[] = {
+    { "syscall_sysenter", bench_sysenter, 0, BENCH_MAX_SYSCALL_SYSENTER },
+    { "syscall_int80",    bench_int80,    0, BENCH_MAX_SYSCALL_INT80 },
+};
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================
+ */
+
+/* Program the SYSENTER MSRs of the calling CPU */
+static void syscall_init_cpu(void* arg) {
+    (void)arg;
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    wrmsr(MSR_SYSENTER_ESP, (unsigned int)&this_cpu()->tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (unsigned int)syscall_sysenter_entry);
+}
+
+/* Install the entry points and register the benchmarks */
+int syscall_init(void) {
+    idt_set_entry(SYSCALL_VECTOR, (unsigned int)syscall_int80_entry, KERNEL_CS,
+                  IDT_GATE_USER_INTERRUPT);
+
+    if (cpu_has(X86_FEATURE_SEP)) {
+        smp_call_function_all(syscall_init_cpu, 0);
+        sysenter_enabled = 1;
+    }
+    user_set_sysenter(sysenter_enabled);
+
+    bench_register_sampler(syscall_benches, sizeof(syscall_benches) / sizeof(syscall_benches[0]));
+
+    debug_logf(LOG_INFO, "syscall: entry through int 0x80%s",
+               sysenter_enabled ? " and sysenter" : " only (no SEP)");
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * System Call Header
+ *
+ * User tasks (user.h) enter the kernel in one of two ways, with the same
+ * register convention: EAX = call number, EBX, ECX, EDX = arguments, and
+ * the result comes back in EAX (-1 for an error or an unknown number).
+ *
+ *   SYSENTER  - the fast path, when the CPU has SEP. The CPU loads
+ *               CS/SS from MSR_SYSENTER_CS, EIP from MSR_SYSENTER_EIP and
+ *               ESP from MSR_SYSENTER_ESP without touching memory. ESP is
+ *               pointed at this CPU's tss.esp0 (gdt.h), from which the
+ *               entry stub loads the current thread's kernel stack. The
+ *               user stub passes its stack pointer in EBP and always
+ *               returns to one fixed address (user_sysenter_return), so
+ *               the kernel goes back with SYSEXIT.
+ *   int 0x80  - the fallback: a DPL 3 interrupt gate, returning with iret.
+ *
+ * Both stubs (syscall_asm.c) build the same struct syscall_frame and call
+ * syscall_dispatch(), which indexes syscall_table[]. The kernel runs the
+ * call with interrupts enabled on the thread's own kernel stack.
+ */
+
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+/* Call numbers (the Linux i386 ones) */
+#define SYS_exit      1
+#define SYS_read      3
+#define SYS_write     4
+#define SYS_getpid    20
+
+/* Size of the call table */
+#define SYSCALL_MAX   32
+
+/* Vector of the fallback gate */
+#define SYSCALL_VECTOR  0x80
+
+/* SYSENTER model-specific registers */
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+/* Registers saved on entry (lowest address first); syscall_asm.c builds
+ * it and the return path restores from it, so a call can change them */
+struct syscall_frame {
+    unsigned int ebx, ecx, edx, esi, edi, ebp, eax;
+    unsigned int ds, es, fs, gs;
+    unsigned int eip, cs, eflags;         /* Pushed by int 0x80; built by */
+    unsigned int user_esp, user_ss;       /* the SYSENTER stub */
+};
+
+typedef int (*syscall_fn_t)(unsigned int arg0, unsigned int arg1, unsigned int arg2);
+
+/* Source of SYS_read data for fd 0: copy at most `len` bytes into `buf`,
+ * return how many (0 = nothing available). Runs in thread context. */
+typedef unsigned int (*syscall_read_fn_t)(char* buf, unsigned int len);
+
+/* Counters */
+struct syscall_stats {
+    unsigned int sysenter;                /* Calls through SYSENTER */
+    unsigned int int80;                   /* Calls through int 0x80 */
+    unsigned int bad;                     /* Unknown call numbers */
+};
+
+/* Install the int 0x80 gate, program the SYSENTER MSRs on every online
+ * CPU and register the system call benchmarks (after smp_init and
+ * sched_init). Returns 0 on success. */
+int syscall_init(void);
+
+/* Check whether SYSENTER is in use (user_syscall() picks the path) */
+int syscall_has_sysenter(void);
+
+/* Common C entry point, called by both entry stubs */
+void syscall_dispatch(struct syscall_frame* frame);
+
+/* Set the source of SYS_read data (0 = reads return 0) */
+void syscall_set_stdin(syscall_read_fn_t fn);
+
+/* Get a snapshot of the counters */
+void syscall_get_stats(struct syscall_stats* stats);
+
+/* Print the counters */
+void syscall_dump_stats(void);
+
+/* Entry stubs (syscall_asm.c) */
+void syscall_int80_entry(void);
+void syscall_sysenter_entry(void);
+
+#endif /* SYSCALL_H */
@@ -0,0 +1,186 @@
+/*
+ * System Call Entry and Ring Transitions (Assembly)
+ *
+ * Kernel side:
+ *
+ *   syscall_int80_entry     - int 0x80 gate (DPL 3). The CPU has switched
+ *                             to the TSS stack and pushed the iret frame.
+ *   syscall_sysenter_entry  - MSR_SYSENTER_EIP. The CPU has loaded
+ *                             ESP = &tss.esp0 (MSR_SYSENTER_ESP) and
+ *                             cleared IF; the stub loads the thread's
+ *                             kernel stack from there and pushes an iret
+ *                             frame by hand: user ESP from EBP, return
+ *                             address user_sysenter_return.
+ *
+ * Both continue in syscall_common, which saves the registers as struct
+ * syscall_frame (syscall.h), loads the kernel data and per-CPU segments
+ * and calls syscall_dispatch() with interrupts enabled. On the way out,
+ * a frame returning to user_sysenter_return leaves with SYSEXIT (EDX =
+ * EIP, ECX = ESP; STI's one-instruction shadow keeps interrupts off until
+ * ring 3), anything else with iret.
+ *
+ *   user_enter(eip, esp)    - leave a kernel thread for ring 3 with an
+ *                             iret, user segments loaded and every
+ *                             general-purpose register cleared.
+ *
+ * Ring-3 side (in .text.user, see user.h):
+ *
+ *   user_syscall_int80      - int $0x80 with EAX, EBX, ECX, EDX loaded
+ *                             from the C arguments.
+ *   user_syscall_sysenter   - the same through SYSENTER: EBP carries the
+ *                             stack pointer, the kernel returns to
+ *                             user_sysenter_return right behind it.
+ *   user_exit_stub          - return address of a task's function: passes
+ *                             its result to SYS_exit.
+ */
+
+#include "syscall.h"
+#include "gdt.h"
+
+#define SYSCALL_STR_(x) #x
+#define SYSCALL_STR(x) SYSCALL_STR_(x)
+
+__asm__ (
+    ".text\n"
+
+    /* int 0x80 */
+    ".balign 16\n"
+    ".globl syscall_int80_entry\n"
+    ".type syscall_int80_entry, @function\n"
+    "syscall_int80_entry:\n"
+    "    jmp syscall_common\n"
+    ".size syscall_int80_entry, . - syscall_int80_entry\n"
+
+    /* SYSENTER */
+    ".balign 16\n"
+    ".globl syscall_sysenter_entry\n"
+    ".type syscall_sysenter_entry, @function\n"
+    "syscall_sysenter_entry:\n"
+    "    movl (%esp), %esp\n"            /* tss.esp0: this thread's stack */
+    "    pushl $" SYSCALL_STR(USER_DS) "\n"
+    "    pushl %ebp\n"                   /* User ESP */
+    "    pushfl\n"
+    "    orl $0x200, (%esp)\n"           /* SYSENTER cleared IF */
+    "    pushl $" SYSCALL_STR(USER_CS) "\n"
+    "    pushl $user_sysenter_return\n"
+    ".size syscall_sysenter_entry, . - syscall_sysenter_entry\n"
+
+    /* Common path (falls through from SYSENTER) */
+    "syscall_common:\n"
+    "    pushl %gs\n"
+    "    pushl %fs\n"
+    "    pushl %es\n"
+    "    pushl %ds\n"
+    "    pushl %eax\n"
+    "    pushl %ebp\n"
+    "    pushl %edi\n"
+    "    pushl %esi\n"
+    "    pushl %edx\n"
+    "    pushl %ecx\n"
+    "    pushl %ebx\n"
+    "    movw $" SYSCALL_STR(KERNEL_DS) ", %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw $" SYSCALL_STR(GDT_PERCPU_SEL) ", %ax\n"
+    "    movw %ax, %gs\n"
+    "    cld\n"
+    "    sti\n"
+    "    pushl %esp\n"                   /* Argument: struct syscall_frame* */
+    "    call syscall_dispatch\n"
+    "    cli\n"
+    "    addl $4, %esp\n"
+    "    popl %ebx\n"
+    "    popl %ecx\n"
+    "    popl %edx\n"
+    "    popl %esi\n"
+    "    popl %edi\n"
+    "    popl %ebp\n"
+    "    popl %eax\n"
+    "    popl %ds\n"
+    "    popl %es\n"
+    "    popl %fs\n"
+    "    popl %gs\n"
+    "    cmpl $user_sysenter_return, (%esp)\n"
+    "    jne 1f\n"
+    "    movl (%esp), %edx\n"            /* EIP */
+    "    movl 12(%esp), %ecx\n"          /* User ESP */
+    "    sti\n"
+    "    sysexit\n"
+    "1:  iret\n"
+
+    /* user_enter(eip, esp) */
+    ".balign 16\n"
+    ".globl user_enter\n"
+    ".type user_enter, @function\n"
+    "user_enter:\n"
+    "    cli\n"
+    "    movl 4(%esp), %ecx\n"           /* eip */
+    "    movl 8(%esp), %edx\n"           /* esp */
+    "    movw $" SYSCALL_STR(USER_DS) ", %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    pushl $" SYSCALL_STR(USER_DS) "\n"
+    "    pushl %edx\n"
+    "    pushl $0x202\n"                 /* EFLAGS: IF */
+    "    pushl $" SYSCALL_STR(USER_CS) "\n"
+    "    pushl %ecx\n"
+    "    xorl %eax, %eax\n"
+    "    xorl %ebx, %ebx\n"
+    "    xorl %ecx, %ecx\n"
+    "    xorl %edx, %edx\n"
+    "    xorl %esi, %esi\n"
+    "    xorl %edi, %edi\n"
+    "    xorl %ebp, %ebp\n"
+    "    iret\n"
+    ".size user_enter, . - user_enter\n"
+
+    /* Ring-3 stubs */
+    ".section .text.user, \"ax\", @progbits\n"
+
+    ".balign 16\n"
+    ".globl user_syscall_int80\n"
+    ".type user_syscall_int80, @function\n"
+    "user_syscall_int80:\n"
+    "    pushl %ebx\n"
+    "    movl 8(%esp), %eax\n"
+    "    movl 12(%esp), %ebx\n"
+    "    movl 16(%esp), %ecx\n"
+    "    movl 20(%esp), %edx\n"
+    "    int $" SYSCALL_STR(SYSCALL_VECTOR) "\n"
+    "    popl %ebx\n"
+    "    ret\n"
+    ".size user_syscall_int80, . - user_syscall_int80\n"
+
+    ".balign 16\n"
+    ".globl user_syscall_sysenter\n"
+    ".type user_syscall_sysenter, @function\n"
+    "user_syscall_sysenter:\n"
+    "    pushl %ebx\n"
+    "    pushl %ebp\n"
+    "    movl 12(%esp), %eax\n"
+    "    movl 16(%esp), %ebx\n"
+    "    movl 20(%esp), %ecx\n"
+    "    movl 24(%esp), %edx\n"
+    "    movl %esp, %ebp\n"
+    "    sysenter\n"
+    ".globl user_sysenter_return\n"
+    "user_sysenter_return:\n"
+    "    popl %ebp\n"
+    "    popl %ebx\n"
+    "    ret\n"
+    ".size user_syscall_sysenter, . - user_syscall_sysenter\n"
+
+    ".balign 16\n"
+    ".globl user_exit_stub\n"
+    ".type user_exit_stub, @function\n"
+    "user_exit_stub:\n"
+    "    movl %eax, %ebx\n"
+    "    movl $" SYSCALL_STR(SYS_exit) ", %eax\n"
+    "    int $" SYSCALL_STR(SYSCALL_VECTOR) "\n"
+    "1:  jmp 1b\n"
+    ".size user_exit_stub, . - user_exit_stub\n"
+
+    ".text\n"
+);
@@ -0,0 +1,471 @@
+/*
+ * Kernel Timer Implementation
+ *
+ * Wheel layout: level L slot S holds the timers whose deadline unit
+ * (expires >> TIMER_UNIT_SHIFT) is at least 64^L units away from the wheel
+ * clock and has S in bits [6L, 6L+6). Each level has a 64-bit occupancy
+ * bitmap, so finding the next non-empty slot is one rotate and one
+ * count-trailing-zeros instead of a walk over empty slots.
+ *
+ * wheel_clk is the next level-0 unit to run. When it reaches a multiple of
+ * 64^L, the matching level-L slot is cascaded (its timers are re-inserted
+ * relative to the new clock and land in finer slots). The clock does not
+ * step through empty units: after a wakeup it jumps straight to the next
+ * unit with work, so a long idle period costs nothing.
+ *
+ * Expired timers are first moved onto an "expired" list and then run one
+ * after the other; the device is reprogrammed once per batch.
+ */
+
+#include "timer.h"
+#include "ktime.h"
+#include "io.h"
+#include "math64.h"
+#include "debug.h"
+
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE   (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_BUCKETS       (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define TIMER_BUCKET_EXPIRED TIMER_BUCKETS  /* Timer is on the expired list */
+#define TIMER_NONE          (~0ull)
+
+static struct timer* wheel[TIMER_BUCKETS];
+static unsigned long long wheel_occupied[TIMER_WHEEL_LEVELS];
+static unsigned long long wheel_clk = 0;   /* Next unit to run; its cascades are done */
+static struct timer* expired_list = 0;     /* Current batch */
+
+static struct clockevent* clock_dev = 0;
+static unsigned long long programmed_ns = TIMER_NONE;  /* Deadline the device is armed for */
+static int in_timer_event = 0;
+
+static struct timer_stats stats;
+static unsigned long long window_start_ns = 0;
+static unsigned int window_wakeups = 0;
+
+/* ============================================================================
+ * Wheel Operations (interrupts disabled)
+ * ============================================================================
+ */
+
+/* Rotate a 64-bit bitmap right */
+static inline unsigned long long rotr64(unsigned long long value, unsigned int count) {
+    return count == 0 ? value : (value >> count) | (value << (64 - count));
+}
+
+/* Add a timer to the head of a list */
+static void timer_link(struct timer** head, struct timer* timer, unsigned int bucket) {
+    timer->bucket = bucket;
+    timer->next = *head;
+    if (timer->next != 0) {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+/* Remove a timer from whatever list it is on */
+static void timer_unlink(struct timer* timer) {
+    unsigned int bucket = timer->bucket;
+
+    *timer->pprev = timer->next;
+    if (timer->next != 0) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+
+    if (bucket != TIMER_BUCKET_EXPIRED && wheel[bucket] == 0) {
+        wheel_occupied[bucket / TIMER_WHEEL_SLOTS] &= ~(1ull << (bucket % TIMER_WHEEL_SLOTS));
+    }
+    stats.pending--;
+}
+
+/* Put a timer into the wheel slot for its deadline */
+static void wheel_insert(struct timer* timer) {
+    unsigned long long unit = timer->expires >> TIMER_UNIT_SHIFT;
+    unsigned long long delta;
+    unsigned int level = 0;
+    unsigned int bucket;
+
+    /* Already due: run it with the current unit */
+    if (unit < wheel_clk) {
+        unit = wheel_clk;
+    }
+
+    /* Beyond the wheel: park it in the last slot, it is re-inserted when
+     * that slot cascades */
+    delta = unit - wheel_clk;
+    if (delta >= TIMER_WHEEL_RANGE) {
+        delta = TIMER_WHEEL_RANGE - 1;
+        unit = wheel_clk + delta;
+    }
+
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    bucket = level * TIMER_WHEEL_SLOTS +
+             (unsigned int)((unit >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    timer_link(&wheel[bucket], timer, bucket);
+    wheel_occupied[level] |= 1ull << (bucket % TIMER_WHEEL_SLOTS);
+    stats.pending++;
+}
+
+/* Re-insert the timers of the current slot of `level` relative to wheel_clk */
+static void wheel_cascade(unsigned int level) {
+    unsigned int slot = (unsigned int)((wheel_clk >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    unsigned int bucket = level * TIMER_WHEEL_SLOTS + slot;
+    struct timer* timer = wheel[bucket];
+
+    wheel[bucket] = 0;
+    wheel_occupied[level] &= ~(1ull << slot);
+
+    while (timer != 0) {
+        struct timer* next = timer->next;
+        stats.pending--;
+        wheel_insert(timer);
+        stats.cascades++;
+        timer = next;
+    }
+}
+
+/* Move the wheel clock forward to `unit` and do the cascades due there.
+ * The caller guarantees that no non-empty slot lies in between. */
+static void wheel_set_clk(unsigned long long unit) {
+    wheel_clk = unit;
+
+    for (unsigned int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((unit & ((1ull << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        wheel_cascade(level);
+    }
+}
+
+/* Find the next unit with work: a level-0 slot to run or a slot to cascade.
+ * Stores the unit in `*unit_out` and returns the matching deadline in ns
+ * (the earliest timer for level-0 slots when `exact` is set, otherwise the
+ * start of the unit). Returns TIMER_NONE if the wheel is empty. */
+static unsigned long long wheel_next(unsigned long long* unit_out, int exact) {
+    unsigned long long best_unit = TIMER_NONE;
+    unsigned long long best_ns = TIMER_NONE;
+
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        unsigned long long map = wheel_occupied[level];
+        unsigned int shift = TIMER_WHEEL_BITS * level;
+        unsigned int index = (unsigned int)((wheel_clk >> shift) & TIMER_WHEEL_MASK);
+        unsigned long long unit;
+        unsigned long long ns;
+
+        if (map == 0) {
+            continue;
+        }
+
+        if (level == 0) {
+            /* Level-0 slots run at their own unit, including the current one */
+            unsigned int d = ctz_u64(rotr64(map, index));
+            unit = wheel_clk + d;
+            ns = unit << TIMER_UNIT_SHIFT;
+            if (exact) {
+                struct timer* timer = wheel[(index + d) & TIMER_WHEEL_MASK];
+                ns = TIMER_NONE;
+                for (; timer != 0; timer = timer->next) {
+                    if (timer->expires < ns) {
+                        ns = timer->expires;
+                    }
+                }
+            }
+        } else {
+            /* Higher slots cascade when the clock reaches their start; the
+             * current slot was cascaded already, so it is 64 periods away */
+            unsigned int d = ctz_u64(rotr64(map, (index + 1) & TIMER_WHEEL_MASK)) + 1;
+            unit = ((wheel_clk >> shift) + d) << shift;
+            ns = unit << TIMER_UNIT_SHIFT;
+        }
+
+        if (unit < best_unit) {
+            best_unit = unit;
+        }
+        if (ns < best_ns) {
+            best_ns = ns;
+        }
+    }
+
+    *unit_out = best_unit;
+    return best_ns;
+}
+
+/* Move every timer due at `now` onto the expired list */
+static unsigned int wheel_collect(unsigned long long now) {
+    unsigned long long now_unit = now >> TIMER_UNIT_SHIFT;
+    unsigned int count = 0;
+
+    for (;;) {
+        struct timer* timer = wheel[wheel_clk & TIMER_WHEEL_MASK];
+
+        while (timer != 0) {
+            struct timer* next = timer->next;
+            if (timer->expires <= now) {
+                timer_unlink(timer);
+                timer_link(&expired_list, timer, TIMER_BUCKET_EXPIRED);
+                stats.pending++;
+                count++;
+            }
+            timer = next;
+        }
+
+        /* The current unit may still hold timers due later in it */
+        if (wheel_clk >= now_unit) {
+            break;
+        }
+
+        unsigned long long unit;
+        wheel_next(&unit, 0);
+        wheel_set_clk(unit < now_unit ? unit : now_unit);
+    }
+
+    return count;
+}
+
+/* ============================================================================
+ * Clock Event Programming
+ * ============================================================================
+ */
+
+/* Arm the device for the next wheel event (interrupts disabled) */
+static void timer_program(void) {
+    unsigned long long unit, next, now, delta;
+
+    if (clock_dev == 0 || clock_dev->mode != CLOCKEVENT_MODE_ONESHOT) {
+        return;
+    }
+
+    next = wheel_next(&unit, 1);
+    if (next == TIMER_NONE) {
+        /* Nothing pending: no wakeups at all */
+        if (programmed_ns != TIMER_NONE) {
+            clock_dev->shutdown();
+            programmed_ns = TIMER_NONE;
+        }
+        return;
+    }
+
+    now = ktime_get_ns();
+    delta = next > now ? next - now : 0;
+    if (delta < clock_dev->min_delta_ns) {
+        delta = clock_dev->min_delta_ns;
+    } else if (delta > clock_dev->max_delta_ns) {
+        delta = clock_dev->max_delta_ns;  /* Wake up early and re-arm */
+    }
+
+    clock_dev->set_next_event((unsigned int)delta);
+    programmed_ns = now + delta;
+    stats.reprograms++;
+}
+
+/* Clock event interrupt: run the expired timers in one batch */
+static void timer_event(struct clockevent* dev) {
+    unsigned long long now = ktime_get_ns();
+    unsigned int batch;
+
+    (void)dev;
+
+    stats.wakeups++;
+    window_wakeups++;
+    if (now - window_start_ns >= NSEC_PER_SEC) {
+        unsigned int elapsed_ms = (unsigned int)div_u64(now - window_start_ns, NSEC_PER_MSEC);
+        stats.wakeups_per_sec = (unsigned int)div_u64((unsigned long long)window_wakeups * 1000,
+                                                      elapsed_ms);
+        window_start_ns = now;
+        window_wakeups = 0;
+    }
+
+    programmed_ns = TIMER_NONE;
+    in_timer_event = 1;
+
+    batch = wheel_collect(now);
+    while (expired_list != 0) {
+        struct timer* timer = expired_list;
+        timer_unlink(timer);
+        stats.expired++;
+        timer->function(timer, timer->data);
+    }
+
+    in_timer_event = 0;
+
+    if (batch != 0) {
+        stats.batches++;
+        if (batch > stats.max_batch) {
+            stats.max_batch = batch;
+        }
+    }
+
+    timer_program();
+}
+
+/* Offer a device to the timer core */
+void clockevent_register(struct clockevent* dev) {
+    unsigned int flags = irq_save();
+
+    if (clock_dev != 0 && clock_dev->rating >= dev->rating) {
+        dev->mode = CLOCKEVENT_MODE_SHUTDOWN;
+        irq_restore(flags);
+        return;
+    }
+
+    if (clock_dev != 0) {
+        clock_dev->shutdown();
+        clock_dev->mode = CLOCKEVENT_MODE_SHUTDOWN;
+        clock_dev->event_handler = 0;
+    }
+
+    clock_dev = dev;
+    dev->event_handler = timer_event;
+    programmed_ns = TIMER_NONE;
+
+    /* One-shot needs a clock that keeps running without the tick */
+    if ((dev->features & CLOCKEVENT_FEAT_ONESHOT) && ktime_tsc_khz() != 0) {
+        dev->mode = CLOCKEVENT_MODE_ONESHOT;
+        dev->set_oneshot();
+        timer_program();
+    } else {
+        dev->mode = CLOCKEVENT_MODE_PERIODIC;
+        dev->set_periodic();
+    }
+
+    irq_restore(flags);
+
+    debug_logf(LOG_INFO, "timer: using %s in %s mode", dev->name,
+               dev->mode == CLOCKEVENT_MODE_ONESHOT ? "one-shot" : "periodic");
+}
+
+/* Device currently driving the timer core */
+struct clockevent* clockevent_get_device(void) {
+    return clock_dev;
+}
+
+/* ============================================================================
+ * Timer API
+ * ============================================================================
+ */
+
+/* Initialize the timer core */
+void timer_init(void) {
+    unsigned long long now = ktime_get_ns();
+
+    for (unsigned int i = 0; i < TIMER_BUCKETS; i++) {
+        wheel[i] = 0;
+    }
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        wheel_occupied[level] = 0;
+    }
+    wheel_clk = now >> TIMER_UNIT_SHIFT;
+    window_start_ns = now;
+}
+
+/* Prepare a timer */
+void timer_setup(struct timer* timer, timer_fn_t function, void* data) {
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+    timer->bucket = 0;
+}
+
+/* Queue a timer and re-arm the device if it is now the earliest (interrupts disabled) */
+static void timer_enqueue(struct timer* timer, unsigned long long expires) {
+    /* An empty wheel can jump its clock to the present for free, so a new
+     * timer after a long idle period goes straight into a fine slot */
+    if (stats.pending == 0) {
+        unsigned long long now_unit = ktime_get_ns() >> TIMER_UNIT_SHIFT;
+        if (now_unit > wheel_clk) {
+            wheel_clk = now_unit;
+        }
+    }
+
+    timer->expires = expires;
+    wheel_insert(timer);
+
+    /* Inside timer_event the device is reprogrammed once after the batch */
+    if (!in_timer_event && expires < programmed_ns) {
+        timer_program();
+    }
+}
+
+/* Queue a timer that is not pending */
+void timer_add(struct timer* timer, unsigned long long expires) {
+    unsigned int flags = irq_save();
+
+    if (!timer_pending(timer)) {
+        timer_enqueue(timer, expires);
+    }
+
+    irq_restore(flags);
+}
+
+/* Change the deadline of a timer, queuing it if needed */
+int timer_mod(struct timer* timer, unsigned long long expires) {
+    unsigned int flags = irq_save();
+    int was_pending = timer_pending(timer);
+
+    if (was_pending) {
+        timer_unlink(timer);
+    }
+    timer_enqueue(timer, expires);
+
+    irq_restore(flags);
+    return was_pending;
+}
+
+/* Remove a pending timer */
+int timer_cancel(struct timer* timer) {
+    unsigned int flags = irq_save();
+    int was_pending = timer_pending(timer);
+
+    /* The device stays armed; an early wakeup simply finds nothing to do */
+    if (was_pending) {
+        timer_unlink(timer);
+    }
+
+    irq_restore(flags);
+    return was_pending;
+}
+
+/* Next time the timer core needs the CPU */
+unsigned long long timer_next_event(void) {
+    unsigned int flags = irq_save();
+    unsigned long long unit;
+    unsigned long long next = wheel_next(&unit, 1);
+    irq_restore(flags);
+    return next;
+}
+
+/* Get a snapshot of the timer statistics */
+void timer_get_stats(struct timer_stats* out) {
+    unsigned int flags = irq_save();
+
+    out->wakeups = stats.wakeups;
+    out->wakeups_per_sec = stats.wakeups_per_sec;
+    out->expired = stats.expired;
+    out->batches = stats.batches;
+    out->max_batch = stats.max_batch;
+    out->cascades = stats.cascades;
+    out->reprograms = stats.reprograms;
+    out->pending = stats.pending;
+
+    irq_restore(flags);
+}
+
+/* Print the timer statistics */
+void timer_dump_stats(void) {
+    struct timer_stats s;
+
+    timer_get_stats(&s);
+    kprintf("timer: device %s, %u wakeups (%u/s), %u expired in %u batches (max %u)\n",
+            clock_dev ? clock_dev->name : "none", s.wakeups, s.wakeups_per_sec,
+            s.expired, s.batches, s.max_batch);
+    kprintf("timer: %u pending, %u cascades, %u reprograms\n",
+            s.pending, s.cascades, s.reprograms);
+}
@@ -0,0 +1,88 @@
+/*
+ * Kernel Timer Header
+ *
+ * Timers run a callback once at an absolute ktime deadline (nanoseconds,
+ * see ktime.h). The caller owns the struct timer (usually embedded in a
+ * larger object); the timer core never allocates.
+ *
+ * Pending timers live in a hierarchical timing wheel: TIMER_WHEEL_LEVELS
+ * levels of TIMER_WHEEL_SLOTS slots, where a level-0 slot spans
+ * 2^TIMER_UNIT_SHIFT ns (about 1 ms) and each further level is 64 times
+ * coarser. Insert and cancel are O(1). A timer in a coarse slot is moved
+ * ("cascaded") to a finer level when its slot comes up, so callbacks still
+ * run at their exact deadline: the clock event device is programmed for
+ * the earliest expiry only.
+ *
+ * Callbacks run in interrupt context with interrupts disabled. They may
+ * add, modify or cancel timers (including their own).
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "clockevent.h"
+
+/* Wheel geometry */
+#define TIMER_UNIT_SHIFT    20   /* Level-0 slot width: 2^20 ns = 1.048576 ms */
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  4    /* Range: 2^24 units, about 4.9 hours */
+
+struct timer;
+
+/* Timer callback: receives the timer and the data given to timer_setup() */
+typedef void (*timer_fn_t)(struct timer* timer, void* data);
+
+struct timer {
+    struct timer* next;
+    struct timer** pprev;        /* 0 when the timer is not pending */
+    unsigned long long expires;  /* Deadline in ktime nanoseconds */
+    timer_fn_t function;
+    void* data;
+    unsigned int bucket;         /* level * TIMER_WHEEL_SLOTS + slot */
+};
+
+/* Timer statistics */
+struct timer_stats {
+    unsigned int wakeups;          /* Clock event interrupts */
+    unsigned int wakeups_per_sec;  /* Wakeup rate over the last window of at least 1 s */
+    unsigned int expired;          /* Callbacks run */
+    unsigned int batches;          /* Wakeups that ran at least one callback */
+    unsigned int max_batch;        /* Most callbacks run by one wakeup */
+    unsigned int cascades;         /* Timers moved to a finer wheel level */
+    unsigned int reprograms;       /* Clock event device armed */
+    unsigned int pending;          /* Timers currently queued */
+};
+
+/* Initialize the timer core (call after ktime_init, before any device registers) */
+void timer_init(void);
+
+/* Prepare a timer (it is not pending afterwards) */
+void timer_setup(struct timer* timer, timer_fn_t function, void* data);
+
+/* Queue a timer that is not pending to expire at `expires` ns */
+void timer_add(struct timer* timer, unsigned long long expires);
+
+/* Change the deadline of a timer, queuing it if needed.
+ * Returns 1 if the timer was pending, 0 otherwise. */
+int timer_mod(struct timer* timer, unsigned long long expires);
+
+/* Remove a pending timer. Returns 1 if it was pending, 0 otherwise. */
+int timer_cancel(struct timer* timer);
+
+/* Check whether a timer is queued */
+static inline int timer_pending(const struct timer* timer) {
+    return timer->pprev != 0;
+}
+
+/* Next time the timer core needs the CPU: the earliest level-0 deadline or
+ * the next cascade, whichever comes first (~0 if no timer is pending) */
+unsigned long long timer_next_event(void);
+
+/* Get a snapshot of the timer statistics */
+void timer_get_stats(struct timer_stats* stats);
+
+/* Print the timer statistics */
+void timer_dump_stats(void);
+
+#endif /* TIMER_H */
@@ -0,0 +1,196 @@
+/*
+ * User Tasks Implementation
+ *
+ * Each task owns a slot: its kernel thread, the exit status and a user
+ * stack in USER_BSS. The thread builds the task's first user stack
+ * frame - the argument and a return address into user_exit_stub - and
+ * leaves for ring 3 with an iret (user_enter, syscall_asm.c). It comes
+ * back only through SYS_exit or an exception, both of which end in
+ * user_task_exit().
+ *
+ * Slots are claimed and released with interrupts disabled, like the
+ * scheduler state they sit next to (user tasks are threads of the boot
+ * CPU).
+ */
+
+#include "user.h"
+#include "syscall.h"
+#include "sched.h"
+#include "paging.h"
+#include "io.h"
+#include "debug.h"
+
+/* linker.ld */
+extern char user_text_start[];
+extern char user_text_end[];
+extern char user_bss_start[];
+extern char user_bss_end[];
+
+/* syscall_asm.c */
+extern void user_enter(unsigned int eip, unsigned int esp) __attribute__((noreturn));
+extern void user_exit_stub(void);
+
+struct user_task {
+    int used;
+    struct thread* thread;
+    user_fn_t fn;
+    unsigned int arg;
+    volatile int done;
+    int exit_code;
+    struct wait_queue wait;
+};
+
+static struct user_task tasks[USER_TASKS_MAX];
+
+static unsigned char user_stacks[USER_TASKS_MAX][USER_STACK_SIZE]
+    USER_BSS __attribute__((aligned(PAGE_SIZE)));
+
+/* Path taken by user_syscall(); readable from ring 3 */
+static unsigned int user_use_sysenter USER_BSS;
+
+/* ============================================================================
+ * Tasks
+ * ============================================================================
+ */
+
+/* The task of the calling thread, or 0 for a plain kernel thread */
+static struct user_task* user_task_current(void) {
+    struct thread* self = thread_current();
+
+    for (unsigned int i = 0; i < USER_TASKS_MAX; i++) {
+        if (tasks[i].used && tasks[i].thread == self) {
+            return &tasks[i];
+        }
+    }
+    return 0;
+}
+
+/* Kernel side of a task: set up the user stack and drop to ring 3 */
+static void user_thread(void* arg) {
+    struct user_task* task = arg;
+    unsigned int* sp = (unsigned int*)user_stacks[task - tasks + 1];
+
+    task->thread = thread_current();
+    *--sp = task->arg;
+    *--sp = (unsigned int)user_exit_stub;
+    user_enter((unsigned int)task->fn, (unsigned int)sp);
+}
+
+/* Start a task running fn(arg) in ring 3 */
+int user_task_create(const char* name, user_fn_t fn, unsigned int arg) {
+    struct user_task* task = 0;
+    struct thread* thread;
+    unsigned int flags = irq_save();
+
+    for (unsigned int i = 0; i < USER_TASKS_MAX; i++) {
+        if (!tasks[i].used) {
+            task = &tasks[i];
+            task->used = 1;
+            break;
+        }
+    }
+    irq_restore(flags);
+    if (task == 0) {
+        return -1;
+    }
+
+    task->thread = 0;
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+    task->exit_code = 0;
+    wait_queue_init(&task->wait);
+
+    thread = thread_create(name, user_thread, task, SCHED_PRIO_DEFAULT);
+    if (thread == 0) {
+        task->used = 0;
+        return -1;
+    }
+    return (int)(task - tasks);
+}
+
+/* Block until the task ends */
+int user_task_wait(int id) {
+    struct user_task* task;
+    int code;
+
+    if (id < 0 || id >= USER_TASKS_MAX || !tasks[id].used) {
+        return USER_EXIT_FAULT;
+    }
+    task = &tasks[id];
+    wait_event(&task->wait, task->done);
+    code = task->exit_code;
+    task->used = 0;
+    return code;
+}
+
+/* End the calling user task */
+void user_task_exit(int code) {
+    struct user_task* task = user_task_current();
+
+    if (task != 0) {
+        unsigned int flags = irq_save();
+        task->exit_code = code;
+        task->done = 1;
+        wait_wake_all(&task->wait);
+        irq_restore(flags);
+    }
+    thread_exit();
+}
+
+/* Check whether [addr, addr + len) is user memory */
+int user_access_ok(const void* addr, unsigned int len, int write) {
+    unsigned int start = (unsigned int)addr;
+    unsigned int end = start + len;
+
+    if (end < start) {
+        return 0;
+    }
+    if (start >= (unsigned int)user_bss_start && end <= (unsigned int)user_bss_end) {
+        return 1;
+    }
+    return !write && start >= (unsigned int)user_text_start && end <= (unsigned int)user_text_end;
+}
+
+/* Where a killed task resumes, in ring 0 on its kernel stack */
+static void user_fault_exit(void) {
+    user_task_exit(USER_EXIT_FAULT);
+}
+
+/* Kill the task that raised an exception in ring 3 */
+int user_fault(struct trap_frame* frame) {
+    if ((frame->cs & 3) != 3 || user_task_current() == 0) {
+        return -1;
+    }
+
+    debug_logf(LOG_WARN, "user: task %s killed: %s at %08x",
+               thread_current()->name, exception_names[frame->vector], frame->eip);
+
+    /* Return to user_fault_exit instead: an iret within ring 0 */
+    frame->eip = (unsigned int)user_fault_exit;
+    frame->cs = KERNEL_CS;
+    frame->eflags = EFLAGS_IF | 0x2;
+    frame->ds = KERNEL_DS;
+    frame->es = KERNEL_DS;
+    frame->fs = 0;
+    frame->gs = GDT_PERCPU_SEL;
+    return 0;
+}
+
+/* Choose the entry path of user_syscall() */
+void user_set_sysenter(int enabled) {
+    user_use_sysenter = enabled ? 1 : 0;
+}
+
+/* ============================================================================
+ * Ring-3 Side
+ * ============================================================================
+ */
+
+/* Make a system call through the fastest available path */
+USER_TEXT int user_syscall(unsigned int nr, unsigned int arg0, unsigned int arg1, unsigned int arg2) {
+    if (user_use_sysenter) {
+        return user_syscall_sysenter(nr, arg0, arg1, arg2);
+    }
+    return user_syscall_int80(nr, arg0, arg1, arg2);
+}
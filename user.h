@@ -0,0 +1,79 @@
+/*
+ * User Tasks Header
+ *
+ * A user task is a kernel thread that drops to ring 3 (USER_CS/USER_DS,
+ * gdt.h) and runs one function there on a small user stack. It talks to
+ * the kernel only through system calls (syscall.h); interrupts and
+ * system calls switch to the thread's kernel stack through the TSS.
+ *
+ * There is one address space. User code and data are the parts of the
+ * kernel image placed in the user sections below, which paging_init()
+ * maps with PAGE_USER; everything else stays supervisor-only. A task that
+ * touches kernel memory, or raises any other exception, is killed with
+ * exit code USER_EXIT_FAULT instead of halting the kernel.
+ *
+ * Code that runs in ring 3 must therefore only call USER_TEXT functions
+ * (user_syscall() and the stubs included), keep its constants in
+ * USER_RODATA (a string literal would land in kernel .rodata) and its
+ * variables in USER_BSS.
+ */
+
+#ifndef USER_H
+#define USER_H
+
+#include "idt.h"
+
+/* Section attributes for code and data reachable from ring 3 */
+#define USER_TEXT    __attribute__((section(".text.user")))
+#define USER_RODATA  __attribute__((section(".rodata.user")))
+#define USER_BSS     __attribute__((section(".bss.user")))
+
+/* Tasks that can exist at once, and the user stack of each */
+#define USER_TASKS_MAX    4
+#define USER_STACK_SIZE   4096
+
+/* Exit code of a task killed by an exception */
+#define USER_EXIT_FAULT   (-1)
+
+/* Ring-3 function of a task; returning from it is SYS_exit(result) */
+typedef int (*user_fn_t)(unsigned int arg);
+
+/* Start a task running fn(arg) in ring 3. Returns the task number for
+ * user_task_wait(), or -1 if every slot is in use or out of memory.
+ * Every task must be waited for. */
+int user_task_create(const char* name, user_fn_t fn, unsigned int arg);
+
+/* Block until the task ends; returns its exit code and frees its slot */
+int user_task_wait(int task);
+
+/* End the calling user task (SYS_exit) */
+void user_task_exit(int code) __attribute__((noreturn));
+
+/* Check whether [addr, addr + len) is user memory; `write` asks for
+ * writable memory (USER_BSS) */
+int user_access_ok(const void* addr, unsigned int len, int write);
+
+/* Called by exception_handler for exceptions raised in ring 3: kills the
+ * task. Returns 0 if the frame now resumes in the kernel. */
+int user_fault(struct trap_frame* frame);
+
+/* Choose the entry path of user_syscall() (syscall_init) */
+void user_set_sysenter(int enabled);
+
+/* ============================================================================
+ * Ring-3 Side
+ * ============================================================================
+ */
+
+/* Make a system call through SYSENTER when the CPU has it, int 0x80
+ * otherwise */
+int user_syscall(unsigned int nr, unsigned int arg0, unsigned int arg1, unsigned int arg2) USER_TEXT;
+
+/* One path each (syscall_asm.c) */
+int user_syscall_int80(unsigned int nr, unsigned int arg0, unsigned int arg1, unsigned int arg2);
+int user_syscall_sysenter(unsigned int nr, unsigned int arg0, unsigned int arg1, unsigned int arg2);
+
+/* Where every SYSENTER returns to (syscall_asm.c) */
+extern char user_sysenter_return[];
+
+#endif /* USER_H */
@@ -1,26 +1,169 @@
-/* 
+/*
  * VGA Text Mode Implementation
- * 
+ *
  * This file implements VGA text mode output functions.
  * VGA text mode uses a memory-mapped buffer at address 0xB8000.
+ *
+ * Characters are written to a cached shadow copy of the screen instead of
+ * the (slow, uncached) VGA memory. Each screen row has a dirty bit, and
+ * vga_flush() copies only the dirty rows with 32-bit string moves, then
+ * updates the hardware cursor once.
+ *
+ * Scrolling does not move the screen contents. The 32 KB text window holds
+ * VGA_MEMORY_ROWS rows, so scrolling just advances the CRTC start address
+ * by one row and only the new bottom row has to be written. When the
+ * window reaches the end of VGA memory it wraps back to row 0 and the whole
+ * screen is rewritten from the shadow copy once.
+ *
+ * All of this state is shared by every CPU and by interrupt handlers that
+ * print, so each public function holds vga_lock (with interrupts
+ * disabled) for its whole update; the *_locked helpers expect it held.
  */
 
 #include "vga.h"
+#include "spinlock.h"
+#include "io.h"
+
+/* Build a character cell: [character][color] */
+#define VGA_CELL(c, color) ((unsigned short)(unsigned char)(c) | ((unsigned short)(color) << 8))
+
+/* Dirty mask with one bit per screen row */
+#define VGA_ALL_ROWS_DIRTY ((1u << VGA_HEIGHT) - 1)
 
 /* VGA text buffer - each entry is 2 bytes: [character][color] */
 static volatile unsigned short* vga_buffer = (volatile unsigned short*)VGA_MEMORY;
+
+/* Shadow copy of the visible screen, kept as a ring of rows:
+ * screen row r lives in vga_shadow[(vga_shadow_top + r) % VGA_HEIGHT] */
+static unsigned short vga_shadow[VGA_HEIGHT][VGA_WIDTH];
+static unsigned int vga_shadow_top = 0;
+
+static unsigned int vga_dirty = 0;           /* Screen rows that differ from VGA memory */
+static unsigned int vga_start_row = 0;       /* VGA memory row shown at the top of the screen */
+static unsigned int vga_hw_start_row = 0;    /* Start row last written to the CRTC */
+static unsigned int vga_hw_cursor = 0xFFFF;  /* Cursor offset last written to the CRTC */
+
 static unsigned int vga_row = 0;
 static unsigned int vga_col = 0;
 static unsigned char vga_color = VGA_COLOR(COLOR_LIGHT_GREY, COLOR_BLACK);
 
+static struct lock_class vga_lock_class = LOCK_CLASS_INIT("vga");
+static struct spinlock vga_lock = SPINLOCK_INIT(&vga_lock_class);
+
+/* Get the shadow row backing a screen row */
+static inline unsigned short* vga_shadow_row(unsigned int row) {
+    unsigned int index = vga_shadow_top + row;
+    if (index >= VGA_HEIGHT) {
+        index -= VGA_HEIGHT;
+    }
+    return vga_shadow[index];
+}
+
+/* Fill a shadow row with blanks in the current color */
+static void vga_blank_row(unsigned short* row) {
+    unsigned int blank = VGA_CELL(' ', vga_color);
+    unsigned int pair = blank | (blank << 16);
+    unsigned int count = VGA_WIDTH / 2;
+
+    __asm__ volatile ("rep stosl"
+                      : "+D"(row), "+c"(count)
+                      : "a"(pair)
+                      : "memory");
+}
+
+/* Copy one row (VGA_WIDTH cells) into VGA memory with 32-bit moves */
+static inline void vga_copy_row(volatile unsigned short* dst, const unsigned short* src) {
+    unsigned int count = VGA_WIDTH / 2;
+
+    __asm__ volatile ("rep movsl"
+                      : "+D"(dst), "+S"(src), "+c"(count)
+                      :
+                      : "memory");
+}
+
+/* Write a CRTC register pair (high byte at index, low byte at index + 1) */
+static void vga_crtc_write16(unsigned char index, unsigned int value) {
+    outb(VGA_CRTC_INDEX, index);
+    outb(VGA_CRTC_DATA, (unsigned char)((value >> 8) & 0xFF));
+    outb(VGA_CRTC_INDEX, index + 1);
+    outb(VGA_CRTC_DATA, (unsigned char)(value & 0xFF));
+}
+
+/* Scroll the screen up by one row */
+static void vga_scroll(void) {
+    /* The old top row becomes the new (blank) bottom row */
+    vga_shadow_top++;
+    if (vga_shadow_top >= VGA_HEIGHT) {
+        vga_shadow_top = 0;
+    }
+    vga_blank_row(vga_shadow_row(VGA_HEIGHT - 1));
+
+    vga_start_row++;
+    if (vga_start_row + VGA_HEIGHT > VGA_MEMORY_ROWS) {
+        /* Out of VGA memory: wrap the window and rewrite the whole screen */
+        vga_start_row = 0;
+        vga_dirty = VGA_ALL_ROWS_DIRTY;
+    } else {
+        /* Rows already in VGA memory stay where they are; only their
+         * screen position changes */
+        vga_dirty = (vga_dirty >> 1) | (1u << (VGA_HEIGHT - 1));
+    }
+}
+
+/* Move the cursor to the start of the next line, scrolling if needed */
+static void vga_newline(void) {
+    vga_col = 0;
+    if (vga_row + 1 < VGA_HEIGHT) {
+        vga_row++;
+    } else {
+        vga_scroll();
+    }
+}
+
+/* Copy dirty rows to VGA memory and update the CRTC start address and cursor */
+static void vga_flush_locked(void) {
+    unsigned int dirty = vga_dirty;
+
+    while (dirty != 0) {
+        unsigned int row = __builtin_ctz(dirty);
+        dirty &= dirty - 1;
+        vga_copy_row(&vga_buffer[(vga_start_row + row) * VGA_WIDTH], vga_shadow_row(row));
+    }
+    vga_dirty = 0;
+
+    if (vga_start_row != vga_hw_start_row) {
+        vga_crtc_write16(VGA_CRTC_START_ADDR_HIGH, vga_start_row * VGA_WIDTH);
+        vga_hw_start_row = vga_start_row;
+    }
+
+    unsigned int col = vga_col < VGA_WIDTH ? vga_col : VGA_WIDTH - 1;
+    unsigned int cursor = (vga_start_row + vga_row) * VGA_WIDTH + col;
+    if (cursor != vga_hw_cursor) {
+        vga_crtc_write16(VGA_CRTC_CURSOR_HIGH, cursor);
+        vga_hw_cursor = cursor;
+    }
+}
+
+/* Copy dirty rows to VGA memory */
+void vga_flush(void) {
+    unsigned int flags = spin_lock_irqsave(&vga_lock);
+
+    vga_flush_locked();
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
+
 /* Clear the VGA screen */
 void vga_clear(void) {
-    unsigned short blank = (unsigned short)' ' | (vga_color << 8);
-    for (unsigned int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = blank;
+    unsigned int flags = spin_lock_irqsave(&vga_lock);
+
+    for (unsigned int row = 0; row < VGA_HEIGHT; row++) {
+        vga_blank_row(vga_shadow[row]);
     }
+    vga_dirty = VGA_ALL_ROWS_DIRTY;
     vga_row = 0;
     vga_col = 0;
+    vga_flush_locked();
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 /* Set the VGA color scheme */
@@ -33,82 +176,80 @@ unsigned char vga_get_color(void) {
     return vga_color;
 }
 
-/* Write a single character to the VGA buffer */
-void vga_putchar(char c) {
+/* Write a single character to the shadow buffer */
+static void vga_putchar_locked(char c) {
     if (c == '\n') {
-        vga_col = 0;
-        vga_row++;
-        if (vga_row >= VGA_HEIGHT) {
-            vga_row = 0;  /* Simple wrap-around */
-        }
+        vga_newline();
         return;
     }
-    
+
     if (c == '\r') {
         vga_col = 0;
         return;
     }
-    
+
     if (vga_col >= VGA_WIDTH) {
-        vga_col = 0;
-        vga_row++;
-        if (vga_row >= VGA_HEIGHT) {
-            vga_row = 0;
-        }
+        vga_newline();
     }
-    
-    unsigned int index = vga_row * VGA_WIDTH + vga_col;
-    vga_buffer[index] = (unsigned short)c | (vga_color << 8);
+
+    vga_shadow_row(vga_row)[vga_col] = VGA_CELL(c, vga_color);
+    vga_dirty |= 1u << vga_row;
     vga_col++;
 }
 
+/* Write a single character to the shadow buffer (visible after vga_flush) */
+void vga_putchar(char c) {
+    unsigned int flags = spin_lock_irqsave(&vga_lock);
+
+    vga_putchar_locked(c);
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
+
 /* Write a null-terminated string to the VGA buffer */
 void vga_puts(const char* str) {
+    unsigned int flags = spin_lock_irqsave(&vga_lock);
+
     for (unsigned int i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+        vga_putchar_locked(str[i]);
     }
+    vga_flush_locked();
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 /* Print an unsigned integer as decimal */
 void vga_putuint(unsigned int num) {
-    if (num == 0) {
-        vga_putchar('0');
-        return;
-    }
-    
-    /* Convert number to string (reverse order) */
+    /* Convert number to string (filled from the end) */
     char buffer[12];  /* Enough for 32-bit unsigned int */
-    int i = 0;
-    
-    while (num > 0) {
-        buffer[i++] = '0' + (num % 10);
+    int i = 11;
+
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = '0' + (num % 10);
         num /= 10;
-    }
-    
-    /* Print in reverse order */
-    for (int j = i - 1; j >= 0; j--) {
-        vga_putchar(buffer[j]);
-    }
+    } while (num > 0);
+
+    vga_puts(&buffer[i]);
 }
 
 /* Print an unsigned integer as hexadecimal */
 void vga_puthex(unsigned int num) {
     char hex_chars[] = "0123456789ABCDEF";
-    vga_puts("0x");
-    
-    if (num == 0) {
-        vga_putchar('0');
-        return;
-    }
-    
+    char buffer[11];
+    int j = 0;
+
+    buffer[j++] = '0';
+    buffer[j++] = 'x';
+
     /* Skip leading zeros */
     int started = 0;
     for (int i = 7; i >= 0; i--) {
         unsigned char nibble = (num >> (i * 4)) & 0xF;
         if (nibble != 0 || started || i == 0) {
-            vga_putchar(hex_chars[nibble]);
+            buffer[j++] = hex_chars[nibble];
             started = 1;
         }
     }
-}
+    buffer[j] = '\0';
 
+    vga_puts(buffer);
+}
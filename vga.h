@@ -7,6 +7,9 @@
  * Each character on screen is represented by 2 bytes:
  * - Byte 0: ASCII character code
  * - Byte 1: Color attribute (foreground + background)
+ * 
+ * Output is buffered in a shadow copy of the screen; vga_puts() and
+ * vga_clear() flush it, vga_putchar() alone does not.
  */
 
 #ifndef VGA_H
@@ -17,6 +20,16 @@
 #define VGA_HEIGHT 25
 #define VGA_MEMORY 0xB8000
 
+/* The text-mode window at 0xB8000 is 32 KB: room for this many full rows */
+#define VGA_MEMORY_SIZE 0x8000
+#define VGA_MEMORY_ROWS (VGA_MEMORY_SIZE / (VGA_WIDTH * 2))
+
+/* CRT controller ports and registers */
+#define VGA_CRTC_INDEX            0x3D4
+#define VGA_CRTC_DATA             0x3D5
+#define VGA_CRTC_START_ADDR_HIGH  0x0C  /* Display start address (0x0D = low byte) */
+#define VGA_CRTC_CURSOR_HIGH      0x0E  /* Cursor location (0x0F = low byte) */
+
 /* Color attributes for VGA text mode */
 #define COLOR_BLACK         0
 #define COLOR_BLUE          1
@@ -49,12 +62,15 @@ void vga_set_color(unsigned char color);
 /* Get the current VGA color */
 unsigned char vga_get_color(void);
 
-/* Write a single character to the VGA buffer */
+/* Write a single character to the shadow buffer (visible after vga_flush) */
 void vga_putchar(char c);
 
-/* Write a null-terminated string to the VGA buffer */
+/* Write a null-terminated string to the VGA buffer (flushes) */
 void vga_puts(const char* str);
 
+/* Copy dirty rows to VGA memory and update the hardware cursor */
+void vga_flush(void);
+
 /* Print an unsigned integer as decimal */
 void vga_putuint(unsigned int num);
 